@@ -7,4 +7,12 @@ void *ag_std_new(const struct ag_std_vtable *vt);
 
 void ag_std_delete(void *obj);
 
+// The allocator behind them: size-class free lists, malloc above 256 bytes.
+void *ag_std_pool_alloc(size_t size);
+
+void ag_std_pool_free(void *ptr, size_t size);
+
+// Number of pooled blocks of this size that have not been freed.
+size_t ag_std_pool_live(size_t size);
+
 #endif
@@ -1,9 +1,24 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define DEBUG_MSG 0
 
@@ -16,20 +31,84 @@ struct ag_std_vtable;
 
 struct object {
   struct ag_std_vtable *vt;
+
+  // The references to the object, see ag_std_retain (0 if not counted).
+  size_t refs;
+};
+
+/* Methods are found by selector: every generic function (ag_std_print,
+ * ag_std_begin, ...) has a small integer id, and every class has a dense
+ * array of methods indexed by it. Calling a method is one indexed load out
+ * of the class, whatever the method is.
+ *
+ * The generic functions that come with the library have fixed ids. Code
+ * can add its own generic functions with ag_std_selector(), and classes
+ * override them the same way as the built in ones.
+ */
+enum ag_std_selector {
+  AG_STD_SEL_CTOR,
+  AG_STD_SEL_DTOR,
+  AG_STD_SEL_PRINT,
+  AG_STD_SEL_CMP,
+  AG_STD_SEL_HASH, // Objects that cmp equal must hash equal.
+
+  // Containers.
+  AG_STD_SEL_BEGIN,
+  AG_STD_SEL_END,
+  AG_STD_SEL_BEGIN_INTO,
+  AG_STD_SEL_END_INTO,
+  AG_STD_SEL_ITER_SIZE,
+
+  // Iterators.
+  AG_STD_SEL_INCREMENT,
+  AG_STD_SEL_DEREF,
+  AG_STD_SEL_NOT_EQUAL,
+  AG_STD_SEL_NEXT_BATCH,
+
+  // The first id ag_std_selector() hands out.
+  AG_STD_SEL_BUILTIN
 };
 
+#define AG_STD_SELECTORS 64
+
+/* Is-a tests take constant time with a display of ancestors (Cohen's
+ * encoding): a class at depth d (object is at depth 0) keeps its ancestors
+ * by depth, display[0] = object ... display[d] = the class itself. Then
+ * "is A a subclass of B" is just display[B's depth] == B. Classes deeper
+ * than AG_STD_CLASS_DEPTH still work, past that depth they walk up.
+ */
+#define AG_STD_CLASS_DEPTH 8
+
 // The vtable.
 struct ag_std_vtable {
   // struct object obj; // We need to fix this.
   char name[32];
   struct ag_std_vtable *super;
   size_t size;
-  void *(*ctor)(void *, va_list *);
-  void (*dtor)(void *);
-  void (*print)(void *);
-  int (*cmp)(void *, void *);
+
+  size_t depth;
+  const struct ag_std_vtable *display[AG_STD_CLASS_DEPTH];
+
+  // Indexed by selector, NULL where the class has no such method.
+  void *methods[AG_STD_SELECTORS];
 };
 
+// The types of the methods, to call them through.
+typedef void *(*ag_std_ctor_fn)(void *, va_list *);
+typedef void (*ag_std_void_fn)(void *);
+typedef int (*ag_std_cmp_fn)(void *, void *);
+typedef size_t (*ag_std_size_fn)(void *);
+typedef void *(*ag_std_get_fn)(void *);
+typedef void *(*ag_std_into_fn)(void *, void *);
+typedef size_t (*ag_std_batch_fn)(void *, void *, void **, size_t);
+
+// And of the predicates, for filters and remove_if.
+typedef int (*ag_std_pred_fn)(void *);
+
+// The method of class vt for selector sel, as a function of type T.
+#define AG_STD_METHOD(vt, sel, T) \
+  ((T)((const struct ag_std_vtable *)(vt))->methods[(sel)])
+
 // Object functions.
 void *object_ctor(void *obj, va_list *app) {
   // Nothing to init.
@@ -68,16 +147,37 @@ int object_cmp(void *obj_a, void *obj_b) {
   }
 }
 
+// Mix the bits of x so that every bit of the input affects every bit of
+// the output (the splitmix64 finalizer).
+size_t ag_std_hash_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return (size_t)x;
+}
+
+// Plain objects are only equal to themselves, so hash the address.
+size_t object_hash(void *obj) {
+  return ag_std_hash_mix((uint64_t)(uintptr_t)obj);
+}
+
 // The vtable of an object.
 struct ag_std_vtable object_vt = {
   // object struct.
   "object", // name
   NULL, // ptr to vtable of the super
   sizeof(struct object), // How come this doesn't work?
-  object_ctor,
-  object_dtor,
-  object_print,
-  object_cmp
+  0, // depth
+  { &object_vt },
+  {
+    [AG_STD_SEL_CTOR] = object_ctor,
+    [AG_STD_SEL_DTOR] = object_dtor,
+    [AG_STD_SEL_PRINT] = object_print,
+    [AG_STD_SEL_CMP] = object_cmp,
+    [AG_STD_SEL_HASH] = object_hash
+  }
 };
 
 // The ptr to a vtable of an object.
@@ -87,9 +187,124 @@ const struct ag_std_vtable *object = &object_vt;
 // An instance of object... do we need this?
 
 void *ag_std_new(const struct ag_std_vtable *vt, ...);
+void *ag_std_new_at(void *storage, const struct ag_std_vtable *vt, ...);
 void ag_std_delete(void *);
 void ag_std_print(void *);
 int ag_std_cmp(void *, void *);
+size_t ag_std_hash(void *);
+
+// The rest of the built in generic functions, for the selector table.
+void *ag_std_begin(void *obj);
+void *ag_std_end(void *obj);
+void *ag_std_begin_into(void *obj, void *storage);
+void *ag_std_end_into(void *obj, void *storage);
+size_t ag_std_iter_size(void *obj);
+void ag_std_iter_increment(void *obj);
+void *ag_std_iter_deref(void *obj);
+int ag_std_iter_not_equal(void *obj_a, void *obj_b);
+size_t ag_std_iter_next_batch(void *obj, void *end, void **out, size_t n);
+
+///////////////////////////////////////////////////////////////////////////////
+// selectors
+///////////////////////////////////////////////////////////////////////////////
+
+/* The generic functions, by id, and an index from a generic function back
+ * to its id: a small open addressing table keyed on the function's
+ * address, so making a class costs one probe per method it overrides.
+ *
+ * Selectors are meant to be added up front, before there are threads.
+ */
+#define AG_STD_SELECTOR_INDEX (2 * AG_STD_SELECTORS)
+
+struct ag_std_selector_entry {
+  void *generic;
+  int id;
+};
+
+void *ag_std_selector_generics[AG_STD_SELECTORS];
+int ag_std_selector_count = 0;
+struct ag_std_selector_entry ag_std_selector_index[AG_STD_SELECTOR_INDEX];
+pthread_once_t ag_std_selector_once = PTHREAD_ONCE_INIT;
+
+size_t ag_std_selector_slot(void *generic) {
+  uint64_t x = (uint64_t)(uintptr_t)generic;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (size_t)x & (AG_STD_SELECTOR_INDEX - 1);
+}
+
+// Internal function, give generic the id and index it.
+void ag_std_selector_add(void *generic, int id) {
+  size_t i = ag_std_selector_slot(generic);
+  while (ag_std_selector_index[i].generic != NULL) {
+    i = (i + 1) & (AG_STD_SELECTOR_INDEX - 1);
+  }
+
+  ag_std_selector_index[i].generic = generic;
+  ag_std_selector_index[i].id = id;
+  ag_std_selector_generics[id] = generic;
+}
+
+void ag_std_selector_init(void) {
+  ag_std_selector_add(ag_std_new, AG_STD_SEL_CTOR);
+  ag_std_selector_add(ag_std_delete, AG_STD_SEL_DTOR);
+  ag_std_selector_add(ag_std_print, AG_STD_SEL_PRINT);
+  ag_std_selector_add(ag_std_cmp, AG_STD_SEL_CMP);
+  ag_std_selector_add(ag_std_hash, AG_STD_SEL_HASH);
+  ag_std_selector_add(ag_std_begin, AG_STD_SEL_BEGIN);
+  ag_std_selector_add(ag_std_end, AG_STD_SEL_END);
+  ag_std_selector_add(ag_std_begin_into, AG_STD_SEL_BEGIN_INTO);
+  ag_std_selector_add(ag_std_end_into, AG_STD_SEL_END_INTO);
+  ag_std_selector_add(ag_std_iter_size, AG_STD_SEL_ITER_SIZE);
+  ag_std_selector_add(ag_std_iter_increment, AG_STD_SEL_INCREMENT);
+  ag_std_selector_add(ag_std_iter_deref, AG_STD_SEL_DEREF);
+  ag_std_selector_add(ag_std_iter_not_equal, AG_STD_SEL_NOT_EQUAL);
+  ag_std_selector_add(ag_std_iter_next_batch, AG_STD_SEL_NEXT_BATCH);
+  ag_std_selector_count = AG_STD_SEL_BUILTIN;
+}
+
+// The id of a generic function, or -1 if it isn't one.
+int ag_std_selector_find(void *generic) {
+  pthread_once(&ag_std_selector_once, ag_std_selector_init);
+
+  size_t i = ag_std_selector_slot(generic);
+  while (ag_std_selector_index[i].generic != NULL) {
+    if (ag_std_selector_index[i].generic == generic) {
+      return ag_std_selector_index[i].id;
+    }
+    i = (i + 1) & (AG_STD_SELECTOR_INDEX - 1);
+  }
+
+  return -1;
+}
+
+// Make generic a generic function that classes can override, and return
+// its id (the same id every time). Returns -1 once the table is full.
+int ag_std_selector(void *generic) {
+  int id = ag_std_selector_find(generic);
+  if (id >= 0) {
+    return id;
+  }
+
+  if (ag_std_selector_count == AG_STD_SELECTORS) {
+    return -1;
+  }
+
+  id = ag_std_selector_count++;
+  ag_std_selector_add(generic, id);
+  return id;
+}
+
+// The method obj has for selector sel, or NULL.
+void *ag_std_method(void *obj, int sel) {
+  struct ag_std_vtable *vt = ag_std_class_of(obj);
+  return vt->methods[sel];
+}
+
+int ag_std_responds_to(void *obj, int sel) {
+  return ag_std_method(obj, sel) != NULL;
+}
 
 // Vtable functions, which we may not need right now.
 void *vtable_ctor(void *obj, va_list *app) {
@@ -105,45 +320,33 @@ void *vtable_ctor(void *obj, va_list *app) {
   self->super = va_arg(*app, struct ag_std_vtable *);
   self->size = va_arg(*app, size_t);
 
-  // we want to copy over all of the functions.
-  // We can do this manually for now, and do the memcpy version later.
-  self->ctor = self->super->ctor;
-  self->dtor = self->super->dtor;
-  self->print = self->super->print;
-
-
-  // const size_t offset = offsetof(struct ag_std_vtable, ctor);
-
-  // TODO
-  // Need to implement the proper memcpy here...
-  /*
-  memcpy(
-      (char *)self + offset,
-      (char *)self->super + offset,
-      self->super->size - offset);
-  */
+  // The ancestors of the super class, and then this one.
+  self->depth = self->super->depth + 1;
+  memcpy(self->display, self->super->display, sizeof(self->display));
+  if (self->depth < AG_STD_CLASS_DEPTH) {
+    self->display[self->depth] = self;
+  }
 
-  // memcpy(self, self->super, sizeof(struct ag_std_vtable));
+  // Start with every method of the super class...
+  memcpy(self->methods, self->super->methods, sizeof(self->methods));
 
-  // Overwrite any of the functions that the new class wants to specialize.
-  va_list ap = *app;
+  // ...and overwrite the ones that the new class wants to specialize.
+  va_list ap;
+  va_copy(ap, *app);
 
   void *f = va_arg(ap, void *);
   while (f != NULL) {
     void *g = va_arg(ap, void *);
-    if (f == ag_std_new) {
-      self->ctor = g;
-    } else if (f == ag_std_delete) {
-      self->dtor = g;
-    } else if (f == ag_std_print) {
-      self->print = g;
-    } else if (f == ag_std_cmp) {
-      self->cmp = g;
+    int sel = ag_std_selector_find(f);
+    if (sel >= 0) {
+      self->methods[sel] = g;
     }
 
     f = va_arg(ap, void *);
   }
 
+  va_end(ap);
+
   return obj;
 }
 
@@ -162,1758 +365,13651 @@ int vtable_cmp(void *obj_a, void *obj_b) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// General functions - new, delete, print.
+// Memory pool - size-class free lists behind ag_std_new and ag_std_delete.
 ///////////////////////////////////////////////////////////////////////////////
-void *ag_std_new(const struct ag_std_vtable *vt, ...) {
 
-  // a vt has a size.
-  void *obj = malloc(vt->size);
+/* Every object knows its size through its vtable, so we don't need a header
+ * in front of each block: ag_std_delete reads vt->size before handing the
+ * block back. Sizes up to AG_STD_POOL_MAX_SIZE are rounded up to a multiple
+ * of AG_STD_POOL_ALIGN and served from a per size-class free list. The free
+ * lists are refilled a slab at a time, so most calls never touch libc.
+ * Anything bigger goes straight to malloc and free.
+ *
+ * Every thread has its own blocks, so new and delete take no lock and no
+ * atomic. They are kept in magazines, arrays of AG_STD_POOL_MAG blocks,
+ * two per size class: the loaded one, that new takes from and delete puts
+ * into, and the previous one. When the loaded magazine runs empty (or
+ * full) the two are swapped, and only if the previous one is no better
+ * does the thread go to the depot of that size class, which has a lock:
+ * it swaps an empty magazine for a full one (or a full for an empty). New
+ * slabs are carved up at the depot too. So the lock is taken at most once
+ * every AG_STD_POOL_MAG calls, and a thread going back and forth less than
+ * that doesn't take it at all.
+ *
+ * A block can be freed by any thread, not only the one that allocated it:
+ * the blocks of a size class are all alike, so it goes in the magazine of
+ * the thread that frees it, and gets back to the others through the depot.
+ * A thread that exits gives its magazines to the depot.
+ */
 
-  // TODO: Check for null.
+#define AG_STD_POOL_ALIGN 16
+#define AG_STD_POOL_MAX_SIZE 256
+#define AG_STD_POOL_CLASSES (AG_STD_POOL_MAX_SIZE / AG_STD_POOL_ALIGN)
+#define AG_STD_POOL_SLAB_SIZE (64 * 1024)
+#define AG_STD_POOL_MAG 64
 
-  // Zero out the obj.
-  memset(obj, 0, vt->size);
+struct ag_std_pool_block {
+  struct ag_std_pool_block *next;
+};
 
-  // Install the vtable (have to do away with the const).
-  *(struct ag_std_vtable **)obj = (struct ag_std_vtable *)vt;
+struct ag_std_pool_mag {
+  struct ag_std_pool_mag *next;
+  size_t n;
+  void *blocks[AG_STD_POOL_MAG];
+};
 
-  // call the ctor on the vtable on the object.
-  // TODO: Use varargs.
+// The depot of a size class.
+struct ag_std_pool {
+  pthread_mutex_t lock;
+  struct ag_std_pool_mag *full; // Not always quite full, but not empty.
+  struct ag_std_pool_mag *empty;
+  struct ag_std_pool_block *loose; // Blocks not in a magazine yet.
+
+  // Some numbers to see how the pool is doing.
+  size_t n_full;
+  size_t slabs;
+  size_t live; // What the threads that exited left allocated.
+};
 
-  va_list ap;
+// The magazines of a thread.
+struct ag_std_pool_cache {
+  struct ag_std_pool_mag *loaded[AG_STD_POOL_CLASSES];
+  struct ag_std_pool_mag *previous[AG_STD_POOL_CLASSES];
 
-  // We assume there is a ctor.
-  va_start(ap, vt);
-  vt->ctor(obj, &ap);
-  va_end(ap);
+  // Allocated less freed on this thread (it can wrap, the sum can't).
+  size_t live[AG_STD_POOL_CLASSES];
 
-  return obj;
-}
+  int registered;
+  struct ag_std_pool_cache *next;
+  struct ag_std_pool_cache *prev;
+};
 
-void ag_std_delete(void *obj) {
-  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
-  vt->dtor(obj);
-}
+struct ag_std_pool ag_std_pools[AG_STD_POOL_CLASSES];
+__thread struct ag_std_pool_cache ag_std_pool_cache;
 
-void ag_std_print(void *obj) {
-  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
-  vt->print(obj);
-}
+// The caches of the running threads, to add up the live counts.
+struct ag_std_pool_cache *ag_std_pool_caches;
+pthread_mutex_t ag_std_pool_caches_lock = PTHREAD_MUTEX_INITIALIZER;
 
-int ag_std_cmp(void *obj_a, void *obj_b) {
-  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj_a;
-  return vt->cmp(obj_a, obj_b);
-}
+pthread_key_t ag_std_pool_key;
+pthread_once_t ag_std_pool_once = PTHREAD_ONCE_INIT;
 
-// Return the vtable (class descriptor) of this object.
-void *ag_std_class_of(void *obj) {
-  // every possible object derives from object - so...
-  struct object *self = (struct object *)obj;
-  return self->vt;
+size_t ag_std_pool_class(size_t size) {
+  return (size + AG_STD_POOL_ALIGN - 1) / AG_STD_POOL_ALIGN - 1;
 }
 
-// Return the vtable (class descriptor) of the superclass of this object.
-// (Aka, return the parent class descriptor).
-void *ag_std_super(void *obj) {
-  struct object *self = (struct object *)obj;
-  return self->vt->super;
-}
+// Internal function, carve a new slab into loose blocks. The depot lock is
+// held for all of the ag_std_pool_depot functions.
+void ag_std_pool_refill(struct ag_std_pool *pool, size_t cls) {
+  // Slabs are never given back to libc, their blocks just get recycled.
+  char *slab = malloc(AG_STD_POOL_SLAB_SIZE);
+  if (slab == NULL) {
+    return;
+  }
 
-/*
-size_t ag_std_sizeof(void *obj) {
-  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
-  return vt->size;
-}
+  pool->slabs++;
 
-size_t ag_std_sizeof(struct ag_std_vtable *vt) {
-  return vt->size;
-}
-*/
+  // Linked from the top down, so that the lowest block is first.
+  size_t block_size = (cls + 1) * AG_STD_POOL_ALIGN;
+  size_t n = AG_STD_POOL_SLAB_SIZE / block_size;
 
-///////////////////////////////////////////////////////////////////////////////
-// Integer (derived from object)
-///////////////////////////////////////////////////////////////////////////////
-struct integer {
-  struct object obj;
-  int x;
-};
+  for (size_t i = n; i-- > 0; ) {
+    struct ag_std_pool_block *b = (struct ag_std_pool_block *)(slab + i * block_size);
+    b->next = pool->loose;
+    pool->loose = b;
+  }
+}
 
-void *integer_ctor(void *obj, va_list *app) {
+// Internal function, put a magazine on the full or the empty list.
+void ag_std_pool_depot_put(struct ag_std_pool *pool, struct ag_std_pool_mag *mag) {
+  if (mag == NULL) {
+    return;
+  }
 
-  // Run the parent ctor using super.
-  // We don't need to keep track of who the parent is.
-  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
-  if (super->ctor == NULL) {
-    printf("super ctor is null??\n");
+  if (mag->n > 0) {
+    mag->next = pool->full;
+    pool->full = mag;
+    pool->n_full++;
   } else {
-    super->ctor(obj, app);
+    mag->next = pool->empty;
+    pool->empty = mag;
   }
+}
 
-  // now we run our own construction.
-  struct integer *i = (struct integer *)obj;
-  i->x = va_arg(*app, int);
+// Internal function, an empty magazine, or NULL.
+struct ag_std_pool_mag *ag_std_pool_depot_empty(struct ag_std_pool *pool) {
+  struct ag_std_pool_mag *mag = pool->empty;
+  if (mag != NULL) {
+    pool->empty = mag->next;
+    return mag;
+  }
 
-  if (DEBUG_MSG) {
-    printf("[integer][ctor]\n");
+  mag = malloc(sizeof(struct ag_std_pool_mag));
+  if (mag != NULL) {
+    mag->n = 0;
   }
 
-  return obj;
+  return mag;
 }
 
-void integer_dtor(void *obj) {
-  (void)obj;
+// Internal function, a magazine with blocks in it, or NULL.
+struct ag_std_pool_mag *ag_std_pool_depot_full(struct ag_std_pool *pool, size_t cls) {
+  struct ag_std_pool_mag *mag = pool->full;
+  if (mag != NULL) {
+    pool->full = mag->next;
+    pool->n_full--;
+    return mag;
+  }
 
-  if (DEBUG_MSG) {
-    printf("[integer][dtor]\n");
+  // Fill one up from the loose blocks.
+  if (pool->loose == NULL) {
+    ag_std_pool_refill(pool, cls);
+    if (pool->loose == NULL) {
+      return NULL;
+    }
   }
 
-  // Run the parent dtor using super.
-  // We don't need to keep track of who the parent is.
-  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
-  super->dtor(obj);
-}
+  mag = ag_std_pool_depot_empty(pool);
+  if (mag == NULL) {
+    return NULL;
+  }
 
-void integer_print(void *obj) {
-  struct integer *i = (struct integer *)obj;
-  // struct ag_std_vtable *vt = ag_std_class_of(obj);
-  // vt->super->print(obj);
-  printf("%d", i->x);
-}
+  while (mag->n < AG_STD_POOL_MAG && pool->loose != NULL) {
+    mag->blocks[mag->n++] = pool->loose;
+    pool->loose = pool->loose->next;
+  }
 
-int integer_cmp(void *obj_a, void *obj_b) {
-  struct integer *a = (struct integer *)obj_a;
-  struct integer *b = (struct integer *)obj_b;
-  return a->x - b->x;
+  // New takes from the top, so turn it over: blocks carved from a slab are
+  // then handed out in address order, and what is made one after the other
+  // (the nodes of a list, say) is walked through one after the other.
+  for (size_t i = 0, j = mag->n - 1; i < j; ++i, --j) {
+    void *b = mag->blocks[i];
+    mag->blocks[i] = mag->blocks[j];
+    mag->blocks[j] = b;
+  }
+
+  return mag;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// Float (derived from object)
-///////////////////////////////////////////////////////////////////////////////
+// Internal function, the thread is exiting: its magazines go to the depot,
+// and what it left allocated stays counted.
+void ag_std_pool_cache_dtor(void *arg) {
+  struct ag_std_pool_cache *cache = arg;
 
-struct floating {
-  struct object obj;
-  float x;
-};
+  for (size_t cls = 0; cls < AG_STD_POOL_CLASSES; ++cls) {
+    struct ag_std_pool *pool = &ag_std_pools[cls];
 
-void *floating_ctor(void *obj, va_list *app) {
-  (void)app;
-  struct floating *i = (struct floating *)obj;
-  i->x = va_arg(*app, double);
+    pthread_mutex_lock(&pool->lock);
+    ag_std_pool_depot_put(pool, cache->loaded[cls]);
+    ag_std_pool_depot_put(pool, cache->previous[cls]);
+    pthread_mutex_unlock(&pool->lock);
 
-  if (DEBUG_MSG) {
-    printf("[floating][ctor]\n");
+    cache->loaded[cls] = NULL;
+    cache->previous[cls] = NULL;
   }
 
-  return obj;
-}
-
-void floating_dtor(void *obj) {
-  (void)obj;
+  pthread_mutex_lock(&ag_std_pool_caches_lock);
+  for (size_t cls = 0; cls < AG_STD_POOL_CLASSES; ++cls) {
+    ag_std_pools[cls].live += cache->live[cls];
+    cache->live[cls] = 0;
+  }
 
-  if (DEBUG_MSG) {
-    printf("[floating][dtor]\n");
+  if (cache->prev != NULL) {
+    cache->prev->next = cache->next;
+  } else {
+    ag_std_pool_caches = cache->next;
   }
+  if (cache->next != NULL) {
+    cache->next->prev = cache->prev;
+  }
+  pthread_mutex_unlock(&ag_std_pool_caches_lock);
+
+  cache->registered = 0;
 }
 
-void floating_print(void *obj) {
-  struct floating *i = (struct floating *)obj;
-  // struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
-  // printf("[%s][print][%f]\n", vt->name, i->x);
-  printf("%.2f", i->x);
+void ag_std_pool_init(void) {
+  for (size_t cls = 0; cls < AG_STD_POOL_CLASSES; ++cls) {
+    pthread_mutex_init(&ag_std_pools[cls].lock, NULL);
+  }
+
+  pthread_key_create(&ag_std_pool_key, ag_std_pool_cache_dtor);
 }
 
-int floating_cmp(void *obj_a, void *obj_b) {
-  struct floating *a = (struct floating *)obj_a;
-  struct floating *b = (struct floating *)obj_b;
+// Internal function, the first time a thread uses the pool.
+void ag_std_pool_cache_register(struct ag_std_pool_cache *cache) {
+  pthread_once(&ag_std_pool_once, ag_std_pool_init);
+
+  pthread_mutex_lock(&ag_std_pool_caches_lock);
+  cache->prev = NULL;
+  cache->next = ag_std_pool_caches;
+  if (cache->next != NULL) {
+    cache->next->prev = cache;
+  }
+  ag_std_pool_caches = cache;
+  pthread_mutex_unlock(&ag_std_pool_caches_lock);
 
-  return a->x - b->x;
+  // So that the magazines are given back when the thread exits.
+  pthread_setspecific(ag_std_pool_key, cache);
+  cache->registered = 1;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// String (derived from object)
-///////////////////////////////////////////////////////////////////////////////
+// Internal function, the loaded magazine is empty (or there is none).
+int ag_std_pool_cache_load(struct ag_std_pool_cache *cache, size_t cls) {
+  struct ag_std_pool_mag *loaded = cache->loaded[cls];
+  struct ag_std_pool_mag *previous = cache->previous[cls];
 
-struct string {
-  struct object obj;
-  char s[64];
-};
+  if (previous != NULL && previous->n > 0) {
+    cache->loaded[cls] = previous;
+    cache->previous[cls] = loaded;
+    return 0;
+  }
 
-void *string_ctor(void *obj, va_list *app) {
-  (void)app;
-  struct string *str_obj = (struct string *)obj;
-  char *arg = va_arg(*app, char *);
-  strcpy(str_obj->s, arg);
+  if (!cache->registered) {
+    ag_std_pool_cache_register(cache);
+  }
 
-  if (DEBUG_MSG) {
-    printf("[string][ctor]\n");
+  struct ag_std_pool *pool = &ag_std_pools[cls];
+
+  pthread_mutex_lock(&pool->lock);
+  struct ag_std_pool_mag *full = ag_std_pool_depot_full(pool, cls);
+  if (full != NULL) {
+    ag_std_pool_depot_put(pool, previous);
+    cache->previous[cls] = loaded;
+    cache->loaded[cls] = full;
   }
+  pthread_mutex_unlock(&pool->lock);
 
-  return obj;
+  return full != NULL ? 0 : -1;
 }
 
-void string_dtor(void *obj) {
-  (void)obj;
+// Internal function, the loaded magazine is full (or there is none), and
+// ptr has to go somewhere.
+void ag_std_pool_cache_unload(struct ag_std_pool_cache *cache, size_t cls, void *ptr) {
+  struct ag_std_pool_mag *loaded = cache->loaded[cls];
+  struct ag_std_pool_mag *previous = cache->previous[cls];
 
-  if (DEBUG_MSG) {
-    printf("[string][dtor]\n");
+  if (previous != NULL && previous->n == 0) {
+    cache->loaded[cls] = previous;
+    cache->previous[cls] = loaded;
+    previous->blocks[previous->n++] = ptr;
+    return;
   }
-}
 
-void string_print(void *obj) {
-  struct string *str_obj = (struct string *)obj;
-  // struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
-  // printf("[%s][print][%s]\n", vt->name, str_obj->s);
-  printf("\"%s\"", str_obj->s);
-}
+  if (!cache->registered) {
+    ag_std_pool_cache_register(cache);
+  }
 
-int string_cmp(void *obj_a, void *obj_b) {
-  struct string *a = (struct string *)obj_a;
-  struct string *b = (struct string *)obj_b;
+  struct ag_std_pool *pool = &ag_std_pools[cls];
 
-  (void)a;
-  (void)b;
-  // TODO
-  // Need to actually implement this but do it later.
-  return 0;
+  pthread_mutex_lock(&pool->lock);
+  struct ag_std_pool_mag *empty = ag_std_pool_depot_empty(pool);
+  if (empty != NULL) {
+    ag_std_pool_depot_put(pool, previous);
+    cache->previous[cls] = loaded;
+    cache->loaded[cls] = empty;
+    empty->blocks[empty->n++] = ptr;
+  } else {
+    // No memory for a magazine, the block can still be used.
+    struct ag_std_pool_block *b = ptr;
+    b->next = pool->loose;
+    pool->loose = b;
+  }
+  pthread_mutex_unlock(&pool->lock);
 }
 
+void *ag_std_pool_alloc(size_t size) {
+  if (size == 0 || size > AG_STD_POOL_MAX_SIZE) {
+    return malloc(size);
+  }
 
-///////////////////////////////////////////////////////////////////////////////
-// Pair (derived from object)
-///////////////////////////////////////////////////////////////////////////////
+  size_t cls = ag_std_pool_class(size);
+  struct ag_std_pool_cache *cache = &ag_std_pool_cache;
+  struct ag_std_pool_mag *mag = cache->loaded[cls];
+  if (mag == NULL || mag->n == 0) {
+    if (ag_std_pool_cache_load(cache, cls) != 0) {
+      return NULL;
+    }
+    mag = cache->loaded[cls];
+  }
 
-struct ag_std_pair {
-  struct object obj; // base
+  // Other threads read the count, in ag_std_pool_live.
+  __atomic_store_n(&cache->live[cls], cache->live[cls] + 1, __ATOMIC_RELAXED);
 
-  void *first;
-  void *second;
-};
+  return mag->blocks[--mag->n];
+}
 
-void *ag_std_pair_ctor(void *obj, va_list *app) {
-  struct ag_std_pair *p = (struct ag_std_pair *)obj;
-  p->first = va_arg(*app, void *);
-  p->second = va_arg(*app, void *);
+void ag_std_pool_free(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
 
-  return obj;
+  if (size == 0 || size > AG_STD_POOL_MAX_SIZE) {
+    free(ptr);
+    return;
+  }
+
+  size_t cls = ag_std_pool_class(size);
+  struct ag_std_pool_cache *cache = &ag_std_pool_cache;
+  struct ag_std_pool_mag *mag = cache->loaded[cls];
+  if (mag == NULL || mag->n == AG_STD_POOL_MAG) {
+    ag_std_pool_cache_unload(cache, cls, ptr);
+  } else {
+    mag->blocks[mag->n++] = ptr;
+  }
+
+  __atomic_store_n(&cache->live[cls], cache->live[cls] - 1, __ATOMIC_RELAXED);
 }
 
-void ag_std_pair_dtor(void *obj) {
-  (void)obj;
+// Number of pooled objects of this size that have not been deleted, over
+// all the threads.
+size_t ag_std_pool_live(size_t size) {
+  size_t cls = ag_std_pool_class(size);
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_pair][dtor]\n");
+  pthread_mutex_lock(&ag_std_pool_caches_lock);
+  size_t live = ag_std_pools[cls].live;
+  for (struct ag_std_pool_cache *c = ag_std_pool_caches; c != NULL; c = c->next) {
+    live += __atomic_load_n(&c->live[cls], __ATOMIC_RELAXED);
   }
-}
-
-void ag_std_pair_print(void *obj) {
-  struct ag_std_pair *p = obj;
-  // struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
-  // printf("[%s][print][%s]\n", vt->name, str_obj->s);
-  printf("(");
-  ag_std_print(p->first);
-  printf(", ");
-  ag_std_print(p->second);
-  printf(")");
-}
-
-int ag_std_pair_cmp(void *obj_a, void *obj_b) {
-  struct ag_std_pair *a = obj_a;
-  struct ag_std_pair *b = obj_b;
-
-  (void)a;
-  (void)b;
-  // TODO
-  // Need to actually implement this but do it later.
-  return 0;
-}
-
-// Specialized functions - first and second.
-void *ag_std_pair_first(void *obj) {
-  struct ag_std_pair *p = obj;
-  return p->first;
-}
-
-void *ag_std_pair_second(void *obj) {
-  struct ag_std_pair *p = obj;
-  return p->second;
+  pthread_mutex_unlock(&ag_std_pool_caches_lock);
+
+  return live;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_list (derived from object)
+// Arena - scoped bump allocation for short lived objects.
 ///////////////////////////////////////////////////////////////////////////////
 
-/* Our ag_std_list will (at the moment) allow for any kind of object to be
- * inserted into it, not just objects of a specific type, (though we can
- * technically enforce this by providing the allowed type during
- * the lists construction, ie: void *lst = ag_std_new(ag_std_list, integer),
- * at which point every insert will do a check to ensure that the object
- * being inserted is in fact of type integer.
+/* Between ag_std_arena_begin() and ag_std_arena_end(), ag_std_new bumps a
+ * pointer through big chunks instead of going to the pool. Ending the scope
+ * drops every object made inside it at once. Scopes nest: the innermost one
+ * is the one that gets the allocations.
+ *
+ * Objects whose class overrides the dtor are remembered, so that
+ * ag_std_arena_end(1) can run their dtors (newest first) before the memory
+ * goes away. ag_std_arena_end(0) skips that and just resets.
  */
 
-struct ag_std_list_node {
-  void *obj; // not a pointer to the base object, just a pointer to
-             // the newly inserted object.
-  struct ag_std_list_node *next;
-  struct ag_std_list_node *prev;
+#define AG_STD_ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ag_std_arena_chunk {
+  struct ag_std_arena_chunk *next;
+  size_t size; // usable bytes after the header.
+  size_t used;
 };
 
-// Internal function, nobody except ag_std_list functions will call this.
-struct ag_std_list_node *ag_std_list_node_ctor(void *obj) {
-  struct ag_std_list_node *node = malloc(sizeof(struct ag_std_list_node));
-  node->next = NULL;
-  node->prev = NULL;
-  node->obj = obj;
-  return node;
-}
+struct ag_std_arena {
+  struct ag_std_arena *outer; // the enclosing scope, if any.
+  struct ag_std_arena_chunk *chunks;
 
-void ag_std_list_node_link
-(struct ag_std_list_node *a, struct ag_std_list_node *b) {
+  // Objects that will need their dtor run at the end of the scope.
+  void **dtors;
+  size_t n_dtors;
+  size_t cap_dtors;
+};
 
-  a->next = b;
-  b->prev = a;
-}
+// The innermost open scope. Scopes belong to a thread, like the pool's
+// magazines, so that other threads' ag_std_new go on to the pool.
+__thread struct ag_std_arena *ag_std_arena_top = NULL;
 
-void ag_std_list_node_insert(
-    struct ag_std_list_node *a,
-    struct ag_std_list_node *b,
-    struct ag_std_list_node *c)
-{
-  a->next = b;
-  b->next = c;
+// Chunks from closed scopes, kept around for the next scope to use.
+__thread struct ag_std_arena_chunk *ag_std_arena_spare = NULL;
 
-  b->prev = a;
-  c->prev = b;
+size_t ag_std_arena_header(void) {
+  size_t h = sizeof(struct ag_std_arena_chunk);
+  return (h + AG_STD_POOL_ALIGN - 1) & ~(size_t)(AG_STD_POOL_ALIGN - 1);
 }
 
-struct ag_std_list {
-  struct object obj; // base
+char *ag_std_arena_data(struct ag_std_arena_chunk *c) {
+  return (char *)c + ag_std_arena_header();
+}
 
-  struct ag_std_list_node *front;
-  struct ag_std_list_node *back;
-  size_t size;
-};
+void ag_std_arena_begin(void) {
+  struct ag_std_arena *a = malloc(sizeof(struct ag_std_arena));
+  if (a == NULL) {
+    return;
+  }
 
-void *ag_std_list_ctor(void *obj, va_list *app) {
-  // does nothing.
-  (void)app;
+  a->outer = ag_std_arena_top;
+  a->chunks = NULL;
+  a->dtors = NULL;
+  a->n_dtors = 0;
+  a->cap_dtors = 0;
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_list][ctor]\n");
+  ag_std_arena_top = a;
+}
+
+void ag_std_arena_end(int run_dtors) {
+  struct ag_std_arena *a = ag_std_arena_top;
+  if (a == NULL) {
+    return;
   }
 
-  struct ag_std_list *lst = obj;
+  // Pop the scope first, so the dtors don't allocate into it.
+  ag_std_arena_top = a->outer;
 
-  struct ag_std_list_node *a = ag_std_list_node_ctor(NULL);
-  struct ag_std_list_node *b = ag_std_list_node_ctor(NULL);
+  if (run_dtors) {
+    for (size_t i = a->n_dtors; i > 0; --i) {
+      struct ag_std_vtable *vt = *(struct ag_std_vtable **)a->dtors[i - 1];
 
-  ag_std_list_node_link(a, b);
-  lst->front = a;
-  lst->back = b;
+      // Objects that were already deleted have their vtable cleared.
+      if (vt != NULL) {
+        AG_STD_METHOD(vt, AG_STD_SEL_DTOR, ag_std_void_fn)(a->dtors[i - 1]);
+      }
+    }
+  }
 
-  lst->size = 0;
+  // Standard sized chunks go back on the spare list, big ones to libc.
+  struct ag_std_arena_chunk *c = a->chunks;
+  while (c != NULL) {
+    struct ag_std_arena_chunk *next = c->next;
+    if (c->size + ag_std_arena_header() == AG_STD_ARENA_CHUNK_SIZE) {
+      c->next = ag_std_arena_spare;
+      ag_std_arena_spare = c;
+    } else {
+      free(c);
+    }
+    c = next;
+  }
 
-  return obj;
+  free(a->dtors);
+  free(a);
 }
 
-void ag_std_list_dtor(void *obj) {
-  (void)obj;
+// Internal function, get a chunk with room for at least size bytes.
+struct ag_std_arena_chunk *ag_std_arena_chunk_ctor(size_t size) {
+  struct ag_std_arena_chunk *c = NULL;
+  size_t total = ag_std_arena_header() + size;
 
-  // TODO: Delete stuff.
+  if (total <= AG_STD_ARENA_CHUNK_SIZE) {
+    total = AG_STD_ARENA_CHUNK_SIZE;
+    if (ag_std_arena_spare != NULL) {
+      c = ag_std_arena_spare;
+      ag_std_arena_spare = c->next;
+    }
+  }
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_list][dtor]\n");
+  if (c == NULL) {
+    c = malloc(total);
+    if (c == NULL) {
+      return NULL;
+    }
   }
-}
 
-void ag_std_list_print(void *obj) {
-  struct ag_std_list *lst = obj;
+  c->next = NULL;
+  c->size = total - ag_std_arena_header();
+  c->used = 0;
 
-  if (lst->size == 0) {
-    printf("[]");
-    return;
-  } else {
+  return c;
+}
 
-    printf("[");
-    struct ag_std_list_node *c = lst->front->next;
-    while (c->next->obj != NULL) {
-      ag_std_print(c->obj);
-      printf(", ");
-      c = c->next;
+void *ag_std_arena_alloc(struct ag_std_arena *a, size_t size) {
+  size = (size + AG_STD_POOL_ALIGN - 1) & ~(size_t)(AG_STD_POOL_ALIGN - 1);
+
+  struct ag_std_arena_chunk *c = a->chunks;
+  if (c == NULL || c->size - c->used < size) {
+    c = ag_std_arena_chunk_ctor(size);
+    if (c == NULL) {
+      return NULL;
     }
 
-    ag_std_print(c->obj);
-    printf("]");
+    c->next = a->chunks;
+    a->chunks = c;
   }
+
+  void *ptr = ag_std_arena_data(c) + c->used;
+  c->used += size;
+
+  return ptr;
 }
 
-int ag_std_list_cmp(void *obj_a, void *obj_b) {
-  struct ag_std_list *a = (struct ag_std_list *)obj_a;
-  struct ag_std_list *b = (struct ag_std_list *)obj_b;
+// Internal function, remember an object whose dtor runs at the scope end.
+void ag_std_arena_add_dtor(struct ag_std_arena *a, void *obj) {
+  if (a->n_dtors == a->cap_dtors) {
+    size_t cap = a->cap_dtors == 0 ? 64 : a->cap_dtors * 2;
+    void **dtors = realloc(a->dtors, sizeof(void *) * cap);
+    if (dtors == NULL) {
+      return;
+    }
 
-  (void)a;
-  (void)b;
+    a->dtors = dtors;
+    a->cap_dtors = cap;
+  }
 
-  // TODO
-  // Need to actually implement this but do it later.
-  return 0;
+  a->dtors[a->n_dtors++] = obj;
 }
 
-// TODO: Remove this from the global namespace... somehow.
-// Had to put this here so ag_std_list_begin and end would know the type of
-// object to create.
-void *ag_std_list_iter;
+// Does a scope own the memory of this object? Arena objects are marked in
+// their header (see AG_STD_REF_ARENA), so this is one load, on any thread.
+int ag_std_arena_owns(void *obj);
 
-void *ag_std_list_begin(void *obj) {
-  (void)obj;
+///////////////////////////////////////////////////////////////////////////////
+// Immediates - integers and floats kept in the pointer itself.
+///////////////////////////////////////////////////////////////////////////////
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_list][begin]\n");
-  }
+/* Objects are at least 8 byte aligned, so the low bits of a real object
+ * pointer are always 0. An immediate sets one of them and keeps its value
+ * in the rest of the pointer:
+ *
+ *   ...value... 01   an integer, ag_std_int(x)
+ *   ...value... 10   a floating, ag_std_float(x) (in the top 32 bits)
+ *
+ * Immediates are integers and floatings as far as ag_std_class_of, print,
+ * cmp and hash can tell, but they take no memory: ag_std_delete does
+ * nothing to them, and there is no field to write to. Code that reads the
+ * number out of an integer or a floating should use ag_std_int_value and
+ * ag_std_float_value, which work for both kinds.
+ */
+#define AG_STD_TAG_MASK ((uintptr_t)3)
+#define AG_STD_TAG_INT ((uintptr_t)1)
+#define AG_STD_TAG_FLOAT ((uintptr_t)2)
 
-  struct ag_std_list *lst = obj;
-  struct ag_std_list_node *c = lst->front->next;
+// With 64 bit pointers every int and every float fits next to the tag.
+// With 32 bit ones, floats and the biggest ints are boxed instead.
+#define AG_STD_WIDE_POINTERS (UINTPTR_MAX > 0xffffffffu)
 
-  return ag_std_new(ag_std_list_iter, c);
+// The classes the immediates belong to (made in main).
+void *integer;
+void *floating;
+
+int ag_std_is_immediate(const void *obj) {
+  return ((uintptr_t)obj & AG_STD_TAG_MASK) != 0;
 }
 
-void *ag_std_list_end(void *obj) {
-  (void)obj;
+// Forward declare this, for the boxed fallback.
+void *ag_std_new(const struct ag_std_vtable *vt, ...);
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_list][end]\n");
+void *ag_std_int(int x) {
+#if !AG_STD_WIDE_POINTERS
+  if (x < -(1 << 29) || x >= (1 << 29)) {
+    return ag_std_new(integer, x);
   }
-  struct ag_std_list *lst = obj;
-  struct ag_std_list_node *c = lst->back;
-
-  return ag_std_new(ag_std_list_iter, c);
+#endif
+  return (void *)(((uintptr_t)(intptr_t)x << 2) | AG_STD_TAG_INT);
 }
 
-void ag_std_list_push_front(void *lst_arg, void *obj) {
-  struct ag_std_list *lst = lst_arg;
-  struct ag_std_list_node *new_node = ag_std_list_node_ctor(obj);
+void *ag_std_float(float x) {
+#if AG_STD_WIDE_POINTERS
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return (void *)(((uintptr_t)bits << 32) | AG_STD_TAG_FLOAT);
+#else
+  return ag_std_new(floating, (double)x);
+#endif
+}
 
-  struct ag_std_list_node *a = lst->front;
-  struct ag_std_list_node *c = a->next;
-  ag_std_list_node_insert(a, new_node, c);
+///////////////////////////////////////////////////////////////////////////////
+// Reference counting - retain and release.
+///////////////////////////////////////////////////////////////////////////////
 
-  lst->size++;
-}
+/* Objects from the pool are reference counted. ag_std_new hands back the
+ * first reference, ag_std_retain adds one and ag_std_release drops one, and
+ * the last release runs the dtor and frees the object. ag_std_delete is a
+ * release for these objects. Containers retain what goes into them, and
+ * release it when it comes out or the container goes.
+ *
+ * The count is in the object header, two per reference. The low bit is set
+ * once the object is handed to other threads (ag_std_share), and only then
+ * is the count updated with atomics; before that one thread owns it, and a
+ * plain add does. Immediates, objects placed with ag_std_new_at and objects
+ * in an arena scope aren't counted (refs is 0, or AG_STD_REF_ARENA): they
+ * live as long as their storage does, and retain and release leave them
+ * alone.
+ */
+#define AG_STD_REF ((size_t)2)
+#define AG_STD_REF_SHARED ((size_t)1)
 
-void ag_std_list_push_back(void *lst_arg, void *obj) {
-  struct ag_std_list *lst = lst_arg;
-  struct ag_std_list_node *new_node = ag_std_list_node_ctor(obj);
+// An arena object isn't counted either, but has this in refs instead of 0,
+// so that ag_std_delete can tell its memory isn't the pool's. A counted
+// object never gets here: its count would have to be all of memory.
+#define AG_STD_REF_ARENA (~(size_t)0)
 
-  struct ag_std_list_node *c = lst->back;
-  struct ag_std_list_node *a = c->prev;
-  ag_std_list_node_insert(a, new_node, c);
+// Internal function, are these refs those of a counted object?
+int ag_std_refs_counted(size_t refs) {
+  return refs != 0 && refs != AG_STD_REF_ARENA;
+}
 
-  lst->size++;
+int ag_std_arena_owns(void *obj) {
+  return !ag_std_is_immediate(obj)
+    && ((struct object *)obj)->refs == AG_STD_REF_ARENA;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_vector (derived from object)
+// General functions - new, delete, print.
 ///////////////////////////////////////////////////////////////////////////////
+// Internal function, turn raw storage into an object of class vt, which
+// starts out with refs (see ag_std_retain).
+void *ag_std_construct(void *obj, const struct ag_std_vtable *vt, size_t refs,
+    va_list *app) {
 
-/* Our vector will (at the moment) allow for any kind of object to be
- * inserted into it, not just objects of a specific type, (though we can
- * technically enforce this by providing the allowed type during
- * the construction, ie: void *v = ag_std_new(vector, integer),
- * at which point every insert will do a check to ensure that the object
- * being inserted is in fact of type integer.
- */
-struct ag_std_vector {
-  struct object obj;
+  // Zero out the obj.
+  memset(obj, 0, vt->size);
 
-  void **arr;
-  size_t size;
-  size_t capacity;
-};
+  // Install the vtable (have to do away with the const).
+  *(struct ag_std_vtable **)obj = (struct ag_std_vtable *)vt;
+  ((struct object *)obj)->refs = refs;
 
-void *ag_std_vector_ctor(void *obj, va_list *app) {
-  // does nothing.
-  (void)app;
+  // call the ctor on the vtable on the object.
+  // We assume there is a ctor.
+  return AG_STD_METHOD(vt, AG_STD_SEL_CTOR, ag_std_ctor_fn)(obj, app);
+}
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector][ctor]\n");
+void *ag_std_new(const struct ag_std_vtable *vt, ...) {
+
+  // a vt has a size, and the open arena scope (or else the pool) hands out
+  // a block of that size. Only pool objects are counted, arena ones go
+  // with their scope.
+  void *obj = NULL;
+  size_t refs = 0;
+  if (ag_std_arena_top != NULL) {
+    obj = ag_std_arena_alloc(ag_std_arena_top, vt->size);
+    refs = AG_STD_REF_ARENA;
+  } else {
+    obj = ag_std_pool_alloc(vt->size);
+    refs = AG_STD_REF;
   }
 
-  struct ag_std_vector *v = obj;
+  if (obj == NULL) {
+    return NULL;
+  }
 
-  v->arr = malloc(sizeof(void *) * 8);
-  v->size = 0;
-  v->capacity = 8;
+  va_list ap;
+  va_start(ap, vt);
+  void *made = ag_std_construct(obj, vt, refs, &ap);
+  va_end(ap);
+
+  // A ctor that fails returns NULL, having given back what it took. (Arena
+  // memory just stays with the scope.)
+  if (made == NULL) {
+    if (refs == AG_STD_REF) {
+      ag_std_pool_free(obj, vt->size);
+    }
+    return NULL;
+  }
+
+  // Only classes with their own dtor need to be visited at the scope end.
+  if (ag_std_arena_top != NULL && vt->methods[AG_STD_SEL_DTOR] != (void *)object_dtor) {
+    ag_std_arena_add_dtor(ag_std_arena_top, obj);
+  }
 
   return obj;
 }
 
-void ag_std_vector_dtor(void *obj) {
-  (void)obj;
+// Construct an object in storage owned by the caller (the stack, or inside
+// another object), at least vt->size bytes. Objects made this way must not
+// be passed to ag_std_delete, and aren't counted.
+void *ag_std_new_at(void *storage, const struct ag_std_vtable *vt, ...) {
+  va_list ap;
+  va_start(ap, vt);
+  void *obj = ag_std_construct(storage, vt, 0, &ap);
+  va_end(ap);
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector][dtor]\n");
+  return obj;
+}
+
+// Internal function, run the dtor and give the memory back.
+void ag_std_destroy(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  AG_STD_METHOD(vt, AG_STD_SEL_DTOR, ag_std_void_fn)(obj);
+
+  // Arena memory goes away with its scope. Clear the vtable so the scope
+  // end knows the dtor already ran.
+  if (ag_std_arena_owns(obj)) {
+    *(struct ag_std_vtable **)obj = NULL;
+    return;
   }
 
-  // TODO: Free the data.
+  // The dtor is done with the object, give the memory back.
+  ag_std_pool_free(obj, vt->size);
 }
 
-void ag_std_vector_print(void *obj) {
-  (void)obj;
+// Internal function, retain obj, and say if it is counted at all.
+int ag_std_retain_counted(void *obj) {
+  if (obj == NULL || ag_std_is_immediate(obj)) {
+    return 0;
+  }
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector][print]\n");
+  struct object *o = obj;
+  size_t refs = __atomic_load_n(&o->refs, __ATOMIC_RELAXED);
+  if (!ag_std_refs_counted(refs)) {
+    return 0;
   }
 
-  struct ag_std_vector *v = obj;
+  if (refs & AG_STD_REF_SHARED) {
+    __atomic_fetch_add(&o->refs, AG_STD_REF, __ATOMIC_RELAXED);
+  } else {
+    o->refs = refs + AG_STD_REF;
+  }
 
-  if (v->size == 0) {
-    printf("ag_std_vector([])");
+  return 1;
+}
+
+void *ag_std_retain(void *obj) {
+  ag_std_retain_counted(obj);
+  return obj;
+}
+
+void ag_std_release(void *obj) {
+  if (obj == NULL || ag_std_is_immediate(obj)) {
     return;
   }
 
-  printf("ag_std_vector([");
-  for (size_t i = 0; i < v->size - 1; ++i) {
-    ag_std_print(v->arr[i]);
-    printf(", ");
+  struct object *o = obj;
+  size_t refs = __atomic_load_n(&o->refs, __ATOMIC_RELAXED);
+  if (!ag_std_refs_counted(refs)) {
+    return;
   }
 
-  ag_std_print(v->arr[v->size - 1]);
-  printf("])");
+  if (refs & AG_STD_REF_SHARED) {
+    // The last thread out has to see every write the others made.
+    if (__atomic_sub_fetch(&o->refs, AG_STD_REF, __ATOMIC_ACQ_REL)
+        != AG_STD_REF_SHARED) {
+      return;
+    }
+  } else if (refs > AG_STD_REF) {
+    o->refs = refs - AG_STD_REF;
+    return;
+  }
+
+  ag_std_destroy(obj);
 }
 
-// TODO: Remove this from the global namespace... somehow.
-// Had to put this here so vec_begin and vec_end would know the type of
-// object to create.
-void *ag_std_vector_iter;
+// Make the count atomic from now on. Call it before another thread can see
+// the object, it doesn't reach the objects inside a container.
+void ag_std_share(void *obj) {
+  if (obj == NULL || ag_std_is_immediate(obj)) {
+    return;
+  }
 
-void *ag_std_vector_begin(void *obj) {
+  struct object *o = obj;
+  if (ag_std_refs_counted(o->refs)) {
+    __atomic_fetch_or(&o->refs, AG_STD_REF_SHARED, __ATOMIC_RELAXED);
+  }
+}
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector][begin]\n");
+// How many references there are to obj, 0 if it isn't counted.
+size_t ag_std_refs(void *obj) {
+  if (obj == NULL || ag_std_is_immediate(obj)) {
+    return 0;
   }
 
-  struct ag_std_vector *v = obj;
-  return ag_std_new(ag_std_vector_iter, v->arr, 0);
+  struct object *o = obj;
+  size_t refs = __atomic_load_n(&o->refs, __ATOMIC_RELAXED);
+  return ag_std_refs_counted(refs) ? refs / AG_STD_REF : 0;
 }
 
-void *ag_std_vector_end(void *obj) {
-  (void)obj;
+// Counted objects go with their last reference, the rest right away.
+void ag_std_delete(void *obj) {
+  // Nothing to free.
+  if (ag_std_is_immediate(obj)) {
+    return;
+  }
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector][end]\n");
+  if (ag_std_refs_counted(((struct object *)obj)->refs)) {
+    ag_std_release(obj);
+    return;
   }
 
-  struct ag_std_vector *v = obj;
-  return ag_std_new(ag_std_vector_iter, v->arr, v->size);
+  ag_std_destroy(obj);
 }
 
-void ag_std_vector_push_back(void *vec_arg, void *obj) {
-  struct ag_std_vector *v = vec_arg;
+void ag_std_print(void *obj) {
+  struct ag_std_vtable *vt = ag_std_class_of(obj);
+  AG_STD_METHOD(vt, AG_STD_SEL_PRINT, ag_std_void_fn)(obj);
+}
 
-  v->arr[v->size] = obj;
-  v->size++;
+int ag_std_cmp(void *obj_a, void *obj_b) {
+  struct ag_std_vtable *vt = ag_std_class_of(obj_a);
+  return AG_STD_METHOD(vt, AG_STD_SEL_CMP, ag_std_cmp_fn)(obj_a, obj_b);
 }
 
-void ag_std_vector_pop_back(void *vec_arg) {
-  struct ag_std_vector *v = vec_arg;
-  if (v->size > 0) {
-    // Should we call the dtor on the popped object?
-    // TODO Decide what to do with popped object.
-    v->size--;
+size_t ag_std_hash(void *obj) {
+  struct ag_std_vtable *vt = ag_std_class_of(obj);
+  return AG_STD_METHOD(vt, AG_STD_SEL_HASH, ag_std_size_fn)(obj);
+}
+
+// Return the vtable (class descriptor) of this object.
+void *ag_std_class_of(void *obj) {
+  // An immediate's class is in its tag, not behind the pointer.
+  uintptr_t tag = (uintptr_t)obj & AG_STD_TAG_MASK;
+  if (tag != 0) {
+    return tag == AG_STD_TAG_INT ? integer : floating;
+  }
+
+  // every possible object derives from object - so...
+  struct object *self = (struct object *)obj;
+  return self->vt;
+}
+
+// Return the vtable (class descriptor) of the superclass of this object.
+// (Aka, return the parent class descriptor).
+void *ag_std_super(void *obj) {
+  struct ag_std_vtable *vt = ag_std_class_of(obj);
+  return vt->super;
+}
+
+// Is class sub the class cls, or derived from it?
+int ag_std_is_subclass(const void *sub_arg, const void *cls_arg) {
+  const struct ag_std_vtable *sub = sub_arg;
+  const struct ag_std_vtable *cls = cls_arg;
+
+  if (cls->depth > sub->depth) {
+    return 0;
+  }
+
+  if (cls->depth < AG_STD_CLASS_DEPTH) {
+    return sub->display[cls->depth] == cls;
   }
+
+  // Too deep for the display, go up to cls's depth the slow way.
+  while (sub->depth > cls->depth) {
+    sub = sub->super;
+  }
+  return sub == cls;
+}
+
+// Is obj an instance of cls, or of a class derived from it?
+int ag_std_is_a(void *obj, const void *cls) {
+  return ag_std_is_subclass(ag_std_class_of(obj), cls);
+}
+
+// A checked cast: obj if it is a cls, NULL if not.
+void *ag_std_cast(void *obj, const void *cls) {
+  return ag_std_is_a(obj, cls) ? obj : NULL;
+}
+
+/*
+size_t ag_std_sizeof(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return vt->size;
+}
+
+size_t ag_std_sizeof(struct ag_std_vtable *vt) {
+  return vt->size;
 }
+*/
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_map (derived from object)
+// Deferred release - spread out the releases of a big container.
 ///////////////////////////////////////////////////////////////////////////////
 
-/* Our map will (at the moment) allow for any kind of object to be
- * inserted into it, not just objects of a specific type, (though we can
- * technically enforce this by providing the allowed type during
- * the construction, ie: void *v = ag_std_new(ag_std_map, integer, string),
- * at which point every insert will do a check to ensure that the key and
- * value being inserted are the correct types.
+/* Deleting a container releases everything in it, and with a million
+ * elements in it that's a million dtors in one go. Containers with more than
+ * AG_STD_RELEASE_INLINE elements hand them to a queue instead (a vector
+ * hands over its whole array, so deleting it takes the same time at any
+ * size). The queue is paid off AG_STD_RELEASE_STEP objects every time
+ * something is added to it, and by ag_std_release_drain, for a loop that
+ * wants to set its own budget, and ag_std_release_flush, which empties it.
+ * It never holds more than AG_STD_RELEASE_MAX objects, past that they are
+ * released right away, so a thread that never drains can't keep much
+ * memory from being freed.
+ *
+ * Every thread has its own queue, so there are no locks, and a thread that
+ * deletes big containers should flush before it exits.
  */
-struct ag_std_map {
-  struct object obj;
+#define AG_STD_RELEASE_INLINE 1024
+#define AG_STD_RELEASE_STEP 1024
+#define AG_STD_RELEASE_MAX ((size_t)1 << 22)
+
+struct ag_std_release_batch {
+  void **items;
+  size_t n;
+  size_t mapped; // The bytes to munmap items with, 0 if it came from malloc.
+};
 
-  void **arr;
-  size_t size;
+struct ag_std_release_queue {
+  struct ag_std_release_batch *batches;
+  size_t n;
   size_t capacity;
+
+  size_t pending; // Objects still to release, over all the batches.
 };
 
-void *ag_std_map_ctor(void *obj, va_list *app) {
-  // does nothing.
-  (void)app;
+__thread struct ag_std_release_queue ag_std_release_queue;
+
+// Release up to budget queued objects, and return how many are left.
+size_t ag_std_release_drain(size_t budget) {
+  struct ag_std_release_queue *q = &ag_std_release_queue;
+
+  // A release can queue more (a container inside a container), so look
+  // the batch up again every time.
+  while (budget > 0 && q->n > 0) {
+    struct ag_std_release_batch *b = &q->batches[q->n - 1];
+    void *obj = b->items[--b->n];
+    q->pending--;
+    budget--;
+
+    if (b->n == 0) {
+      if (b->mapped != 0) {
+        munmap(b->items, b->mapped);
+      } else {
+        free(b->items);
+      }
+      q->n--;
+    }
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_map][ctor]\n");
+    ag_std_release(obj);
   }
 
-  struct ag_std_map *m = obj;
-
-  m->arr = malloc(sizeof(void *) * 8);
-  m->size = 0;
-  m->capacity = 8;
+  if (q->n == 0) {
+    free(q->batches);
+    q->batches = NULL;
+    q->capacity = 0;
+  }
 
-  return obj;
+  return q->pending;
 }
 
-void ag_std_map_dtor(void *obj) {
-  (void)obj;
-
-  if (DEBUG_MSG) {
-    printf("[ag_std_map][dtor]\n");
+void ag_std_release_flush(void) {
+  while (ag_std_release_drain(SIZE_MAX) > 0) {
   }
-
-  // TODO: Free the data.
 }
 
-void ag_std_map_print(void *obj) {
-  (void)obj;
+size_t ag_std_release_pending(void) {
+  return ag_std_release_queue.pending;
+}
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_map][print]\n");
-  }
+/* Release the n objects in items, now or a step at a time. The queue takes
+ * items over, and frees it (or munmaps mapped bytes of it) when it's done.
+ */
+void ag_std_release_later(void **items, size_t n, size_t mapped) {
+  struct ag_std_release_queue *q = &ag_std_release_queue;
+
+  if (n > AG_STD_RELEASE_INLINE) {
+    // Pay off the ones before, so the queue can't only grow, and what
+    // doesn't fit now.
+    ag_std_release_drain(AG_STD_RELEASE_STEP);
+    while (n > 0 && q->pending + n > AG_STD_RELEASE_MAX) {
+      ag_std_release(items[--n]);
+    }
 
-  struct ag_std_map *m = obj;
+    if (q->n == q->capacity) {
+      size_t capacity = q->capacity == 0 ? 16 : q->capacity * 2;
+      struct ag_std_release_batch *batches =
+        realloc(q->batches, sizeof(*batches) * capacity);
+      if (batches != NULL) {
+        q->batches = batches;
+        q->capacity = capacity;
+      }
+    }
 
-  if (m->size == 0) {
-    printf("ag_std_map([])");
-    return;
+    if (n > 0 && q->n < q->capacity) {
+      struct ag_std_release_batch b = { items, n, mapped };
+      q->batches[q->n++] = b;
+      q->pending += n;
+      return;
+    }
   }
 
-  printf("ag_std_map([");
-  for (size_t i = 0; i < m->size - 1; ++i) {
-    ag_std_print(m->arr[i]);
-    printf(", ");
+  // Small ones (or no room in the queue), release right here.
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_release(items[i]);
   }
 
-  ag_std_print(m->arr[m->size - 1]);
-  printf("])");
+  if (mapped != 0) {
+    munmap(items, mapped);
+  } else {
+    free(items);
+  }
 }
 
-// TODO: Remove this from the global namespace... somehow.
-// Had to put this here so ag_std_map_begin and ag_std_map_end
-// would know the type of object to create.
-void *ag_std_map_iter;
+///////////////////////////////////////////////////////////////////////////////
+// Number (derived from object)
+///////////////////////////////////////////////////////////////////////////////
 
-void *ag_std_map_begin(void *obj) {
+/* The class that integer, floating, integer64 and floating64 derive from,
+ * so that ag_std_is_a(obj, number) can tell numbers from everything else
+ * in one step. It adds nothing to object.
+ */
+void *number;
+
+///////////////////////////////////////////////////////////////////////////////
+// Integer (derived from number)
+///////////////////////////////////////////////////////////////////////////////
+struct integer {
+  struct object obj;
+  int x;
+};
+
+void *integer_ctor(void *obj, va_list *app) {
+
+  // Run the parent ctor using super.
+  // We don't need to keep track of who the parent is.
+  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
+  if (super->methods[AG_STD_SEL_CTOR] == NULL) {
+    printf("super ctor is null??\n");
+  } else {
+    AG_STD_METHOD(super, AG_STD_SEL_CTOR, ag_std_ctor_fn)(obj, app);
+  }
+
+  // now we run our own construction.
+  struct integer *i = (struct integer *)obj;
+  i->x = va_arg(*app, int);
 
   if (DEBUG_MSG) {
-    printf("[ag_std_map][begin]\n");
+    printf("[integer][ctor]\n");
   }
 
-  struct ag_std_map *m = obj;
-  return ag_std_new(ag_std_map_iter, m->arr, 0);
+  return obj;
 }
 
-void *ag_std_map_end(void *obj) {
+void integer_dtor(void *obj) {
+  (void)obj;
 
   if (DEBUG_MSG) {
-    printf("[ag_std_map][end]\n");
+    printf("[integer][dtor]\n");
   }
 
-  struct ag_std_map *m = obj;
-  return ag_std_new(ag_std_map_iter, m->arr, m->size);
+  // Run the parent dtor using super.
+  // We don't need to keep track of who the parent is.
+  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
+  AG_STD_METHOD(super, AG_STD_SEL_DTOR, ag_std_void_fn)(obj);
 }
 
-// We are inserting a pair: (key, value)
-void ag_std_map_insert(void *map_arg, void *obj) {
-  struct ag_std_map *m = map_arg;
+// The value of an integer, boxed or immediate.
+int ag_std_int_value(void *obj) {
+  if (((uintptr_t)obj & AG_STD_TAG_MASK) == AG_STD_TAG_INT) {
+    return (int)((intptr_t)obj >> 2);
+  }
 
-  m->arr[m->size] = obj;
-  m->size++;
+  return ((struct integer *)obj)->x;
 }
 
-void *ag_std_map_at(void *map_arg, void *key) {
-  struct ag_std_map *m = map_arg;
+void integer_print(void *obj) {
+  // struct ag_std_vtable *vt = ag_std_class_of(obj);
+  // vt->super->print(obj);
+  printf("%d", ag_std_int_value(obj));
+}
 
-  for (size_t i = 0; i < m->size; ++i) {
-    void *p = m->arr[i];
-    void *first = ag_std_pair_first(p);
-    if (ag_std_cmp(first, key) == 0) {
-      return ag_std_pair_second(p);
-    }
-  }
+int integer_cmp(void *obj_a, void *obj_b) {
+  int a = ag_std_int_value(obj_a);
+  int b = ag_std_int_value(obj_b);
+  return (a > b) - (a < b);
+}
 
-  return NULL;
+size_t integer_hash(void *obj) {
+  return ag_std_hash_mix((uint64_t)(int64_t)ag_std_int_value(obj));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// iota_view
+// Float (derived from number)
 ///////////////////////////////////////////////////////////////////////////////
 
-struct ag_std_iota_view {
+struct floating {
   struct object obj;
-  int size;
+  float x;
 };
 
-void *ag_std_iota_view_ctor(void *obj, va_list *app) {
-  // does nothing.
+void *floating_ctor(void *obj, va_list *app) {
   (void)app;
+  struct floating *i = (struct floating *)obj;
+  i->x = va_arg(*app, double);
 
   if (DEBUG_MSG) {
-    printf("[ag_std_iota_view][ctor]\n");
+    printf("[floating][ctor]\n");
   }
 
-  struct ag_std_iota_view *v = obj;
-
-  // TODO: Should this be... an integer object?
-  // For now, we can do this, but later it might be better
-  // to instead use the integer object.
-
-  // TODO: Call the parent ctor.
-  v->size = va_arg(*app, int);
-
   return obj;
 }
 
-void ag_std_iota_view_dtor(void *obj) {
+void floating_dtor(void *obj) {
   (void)obj;
 
   if (DEBUG_MSG) {
-    printf("[ag_std_iota_view][dtor]\n");
+    printf("[floating][dtor]\n");
   }
-
-  // TODO: Free the data.
 }
 
-void ag_std_iota_view_print(void *obj) {
-
-  if (DEBUG_MSG) {
-    printf("[ag_std_iota_view][print]\n");
+// The value of a floating, boxed or immediate.
+float ag_std_float_value(void *obj) {
+  if (((uintptr_t)obj & AG_STD_TAG_MASK) == AG_STD_TAG_FLOAT) {
+    uint32_t bits = (uint32_t)((uint64_t)(uintptr_t)obj >> 32);
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
   }
 
-  struct ag_std_iota_view *iv = obj;
-  printf("ag_std_iota_view(%d)", iv->size);
+  return ((struct floating *)obj)->x;
 }
 
-// TODO: Remove this from the global namespace... somehow.
-// Had to put this here so vec_begin and vec_end would know the type of
-// object to create.
-void *ag_std_iota_view_iter;
-
-void *ag_std_iota_view_begin(void *obj) {
-  (void)obj;
+void floating_print(void *obj) {
+  // struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  // printf("[%s][print][%f]\n", vt->name, i->x);
+  printf("%.2f", ag_std_float_value(obj));
+}
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_iota_view][begin]\n");
-  }
+int floating_cmp(void *obj_a, void *obj_b) {
+  float a = ag_std_float_value(obj_a);
+  float b = ag_std_float_value(obj_b);
 
-  // We don't even need to reference the obj.
-  return ag_std_new(ag_std_iota_view_iter, 0);
+  return (a > b) - (a < b);
 }
 
-void *ag_std_iota_view_end(void *obj) {
+size_t floating_hash(void *obj) {
+  float x = ag_std_float_value(obj);
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_iota_view][end]\n");
-  }
+  // 0.0 and -0.0 compare equal, so they have to hash the same.
+  x = x == 0.0f ? 0.0f : x;
 
-  struct ag_std_iota_view *iv = obj;
-  return ag_std_new(ag_std_iota_view_iter, iv->size);
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return ag_std_hash_mix(bits);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_zip_view
+// Integer64 and Floating64 (derived from number)
 ///////////////////////////////////////////////////////////////////////////////
 
-
-struct ag_std_zip_view {
+/* The 64 bit versions of integer and floating. Mostly they show up as the
+ * elements of the int64 and double typed vectors.
+ */
+struct integer64 {
   struct object obj;
-
-  // The first and second range.
-  void *rng_a;
-  void *rng_b;
+  int64_t x;
 };
 
-void *ag_std_zip_view_ctor(void *obj, va_list *app) {
+void *integer64_ctor(void *obj, va_list *app) {
+  struct integer64 *i = (struct integer64 *)obj;
+  i->x = va_arg(*app, int64_t);
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_zip_view][ctor]\n");
-  }
+  return obj;
+}
 
-  struct ag_std_zip_view *v = obj;
+void integer64_print(void *obj) {
+  struct integer64 *i = (struct integer64 *)obj;
+  printf("%lld", (long long)i->x);
+}
 
-  // TODO: Call the parent ctor.
-  v->rng_a = va_arg(*app, void *);
-  v->rng_b = va_arg(*app, void *);
+int integer64_cmp(void *obj_a, void *obj_b) {
+  struct integer64 *a = (struct integer64 *)obj_a;
+  struct integer64 *b = (struct integer64 *)obj_b;
 
-  return obj;
+  return (a->x > b->x) - (a->x < b->x);
 }
 
-void ag_std_zip_view_dtor(void *obj) {
-  (void)obj;
+size_t integer64_hash(void *obj) {
+  struct integer64 *i = (struct integer64 *)obj;
+  return ag_std_hash_mix((uint64_t)i->x);
+}
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_zip_view][dtor]\n");
-  }
+struct floating64 {
+  struct object obj;
+  double x;
+};
 
-  // TODO: Free the data.
+void *floating64_ctor(void *obj, va_list *app) {
+  struct floating64 *f = (struct floating64 *)obj;
+  f->x = va_arg(*app, double);
+
+  return obj;
 }
 
-void ag_std_zip_view_print(void *obj) {
-  (void)obj;
+void floating64_print(void *obj) {
+  struct floating64 *f = (struct floating64 *)obj;
+  printf("%.2f", f->x);
+}
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_zip_view][print]\n");
-  }
+int floating64_cmp(void *obj_a, void *obj_b) {
+  struct floating64 *a = (struct floating64 *)obj_a;
+  struct floating64 *b = (struct floating64 *)obj_b;
 
-  // TODO: Some actual printing?
-  // struct ag_std_zip_view *iv = obj;
+  return (a->x > b->x) - (a->x < b->x);
 }
 
-// TODO: Remove this from the global namespace... somehow.
-// Had to put this here so vec_begin and vec_end would know the type of
-// object to create.
-void *ag_std_zip_view_iter;
-void *ag_std_pair;
-
-// Forward declare these so that the zip_view_begin has them.
-void *ag_std_begin(void *obj);
-void *ag_std_end(void *obj);
-
-void *ag_std_zip_view_begin(void *obj) {
-
-  if (DEBUG_MSG) {
-    printf("[ag_std_zip_view][begin]\n");
-  }
-
-  struct ag_std_zip_view *v = obj;
-  void *it_a = ag_std_begin(v->rng_a);
-  void *it_b = ag_std_begin(v->rng_b);
+size_t floating64_hash(void *obj) {
+  struct floating64 *f = (struct floating64 *)obj;
 
-  void *p = ag_std_new(ag_std_pair, it_a, it_b);
+  // 0.0 and -0.0 compare equal, so they have to hash the same.
+  double x = f->x == 0.0 ? 0.0 : f->x;
 
-  return ag_std_new(ag_std_zip_view_iter, p);
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return ag_std_hash_mix(bits);
 }
 
-void *ag_std_zip_view_end(void *obj) {
+// These are out here so that the typed vectors can box their elements.
+void *integer64;
+void *floating64;
 
-  if (DEBUG_MSG) {
-    printf("[ag_std_zip_view][end]\n");
-  }
+///////////////////////////////////////////////////////////////////////////////
+// String (derived from object)
+///////////////////////////////////////////////////////////////////////////////
 
-  struct ag_std_zip_view *v = obj;
-  void *it_a = ag_std_end(v->rng_a);
-  void *it_b = ag_std_end(v->rng_b);
+/* Short strings (up to AG_STD_STRING_INLINE - 1 characters) are stored in
+ * the object itself, longer ones get a buffer of their own on the heap.
+ * The length and the hash are worked out once, in the ctor, since strings
+ * don't change after they are made.
+ */
+#define AG_STD_STRING_INLINE 24
+
+struct string {
+  struct object obj;
+  size_t len;
+  size_t hash;
 
-  void *p = ag_std_new(ag_std_pair, it_a, it_b);
+  union {
+    char *heap;
+    char buf[AG_STD_STRING_INLINE];
+  } data;
+};
 
-  return ag_std_new(ag_std_zip_view_iter, p);
+int string_is_inline(struct string *str_obj) {
+  return str_obj->len < AG_STD_STRING_INLINE;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// container_vtable (derived from vtable)
-///////////////////////////////////////////////////////////////////////////////
-struct container_vtable {
-  struct ag_std_vtable vt;
-  void *(*begin)(void *);
-  void *(*end)(void *);
-};
+const char *ag_std_string_cstr(void *obj) {
+  struct string *str_obj = (struct string *)obj;
+  if (string_is_inline(str_obj)) {
+    return str_obj->data.buf;
+  }
 
-// Forward declare these so that the container_vtable_ctor has them.
-void *ag_std_begin(void *obj);
-void *ag_std_end(void *obj);
+  return str_obj->data.heap;
+}
 
-void *container_vtable_ctor(void *obj, va_list *app) {
+size_t ag_std_string_len(void *obj) {
+  struct string *str_obj = (struct string *)obj;
+  return str_obj->len;
+}
 
-  // Run the parent ctor using super.
-  // We don't need to keep track of who the parent is.
-  struct container_vtable *container_vt = NULL;
-  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
-  if (super->ctor == NULL) {
-    printf("super ctor is null??\n");
-  } else {
-    container_vt = super->ctor(obj, app);
+// FNV-1a over the characters.
+size_t ag_std_string_hash_chars(const char *c, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)c[i];
+    h *= 0x100000001b3ULL;
   }
 
-  if (DEBUG_MSG) {
-    printf("[container_vtable][ctor]\n");
-  }
+  return ag_std_hash_mix(h);
+}
 
-  // Assign the container begin and end functions.
-  va_list ap = *app;
+void *string_ctor(void *obj, va_list *app) {
+  struct string *str_obj = (struct string *)obj;
+  const char *arg = va_arg(*app, char *);
 
-  void *f = va_arg(ap, void *);
+  str_obj->len = strlen(arg);
 
-  while (f != NULL) {
-    void *g = va_arg(ap, void *);
-    if (f == ag_std_begin) {
-      container_vt->begin = g;
-    } else if (f == ag_std_end) {
-      container_vt->end = g;
+  char *dst = str_obj->data.buf;
+  if (!string_is_inline(str_obj)) {
+    dst = malloc(str_obj->len + 1);
+    if (dst == NULL) {
+      return NULL;
     }
+    str_obj->data.heap = dst;
+  }
 
-    f = va_arg(ap, void *);
+  memcpy(dst, arg, str_obj->len + 1);
+  str_obj->hash = ag_std_string_hash_chars(dst, str_obj->len);
+
+  if (DEBUG_MSG) {
+    printf("[string][ctor]\n");
   }
 
   return obj;
 }
 
-void container_vtable_dtor(void *obj) {
-  (void)obj;
+void string_dtor(void *obj) {
+  struct string *str_obj = (struct string *)obj;
+  if (!string_is_inline(str_obj)) {
+    free(str_obj->data.heap);
+  }
 
   if (DEBUG_MSG) {
-    printf("[container_vtable][dtor]\n");
+    printf("[string][dtor]\n");
   }
 }
 
-void *ag_std_begin(void *obj) {
-  struct container_vtable *cvt = *(struct container_vtable **)obj;
-  return cvt->begin(obj);
+void string_print(void *obj) {
+  // struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  // printf("[%s][print][%s]\n", vt->name, str_obj->s);
+  printf("\"%s\"", ag_std_string_cstr(obj));
 }
 
-void *ag_std_end(void *obj) {
-  struct container_vtable *cvt = *(struct container_vtable **)obj;
-  return cvt->end(obj);
+// Byte by byte, and a string that runs out first is the smaller one.
+int string_cmp(void *obj_a, void *obj_b) {
+  struct string *a = (struct string *)obj_a;
+  struct string *b = (struct string *)obj_b;
+
+  if (a == b) {
+    return 0;
+  }
+
+  size_t len = a->len < b->len ? a->len : b->len;
+  int res = memcmp(ag_std_string_cstr(a), ag_std_string_cstr(b), len);
+  if (res != 0) {
+    return res;
+  }
+
+  return (a->len > b->len) - (a->len < b->len);
+}
+
+size_t string_hash(void *obj) {
+  struct string *str_obj = (struct string *)obj;
+  return str_obj->hash;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// iterator_vtable (derived from vtable)
+// String interning
 ///////////////////////////////////////////////////////////////////////////////
-struct iterator_vtable {
-  struct ag_std_vtable vt;
 
-  void (*increment)(void *);
-  void *(*deref)(void *);
-  int (*not_equal)(void *, void *);
+/* ag_std_intern(chars) hands back the one string object for that content,
+ * making it the first time it is asked for. Two interned strings are equal
+ * exactly when they are the same pointer (string_cmp checks that first),
+ * and their hash was worked out once when they were made.
+ *
+ * Interned strings belong to the table: they live for the whole program
+ * and must never be passed to ag_std_delete. They are malloc'd rather than
+ * taken from an arena scope or the pool, so they outlive both.
+ *
+ * The table is split into shards by hash, each behind a read/write lock,
+ * so lookups of strings that are already interned (the common case) only
+ * take a shared lock and different shards never contend at all.
+ */
+#define AG_STD_INTERN_SHARDS 16
+
+struct ag_std_intern_shard {
+  pthread_rwlock_t lock;
+  void **slots;
+  size_t capacity; // a power of two, or 0 before the first insert.
+  size_t count;
 };
 
-// Forward declare these so that the iterator_vtable_ctor has them.
-void ag_std_iter_increment(void *obj);
-void *ag_std_iter_deref(void *obj);
-int ag_std_iter_not_equal(void *obj_a, void *obj_b);
+struct ag_std_intern_stats {
+  size_t lookups;
+  size_t hits;
+  size_t strings;
+  size_t bytes_saved; // memory the hits didn't spend on their own copy.
+};
 
-void *iterator_vtable_ctor(void *obj, va_list *app) {
+struct ag_std_intern_shard ag_std_intern_shards[AG_STD_INTERN_SHARDS];
+struct ag_std_intern_stats ag_std_intern_counts;
+pthread_once_t ag_std_intern_once = PTHREAD_ONCE_INIT;
 
-  // Run the parent ctor using super.
-  // We don't need to keep track of who the parent is.
-  struct iterator_vtable *iter_vt = NULL;
-  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
-  if (super->ctor == NULL) {
-    printf("super ctor is null??\n");
-  } else {
-    iter_vt = super->ctor(obj, app);
+// The class of the objects the table makes.
+void *string;
+
+void ag_std_intern_init(void) {
+  for (size_t i = 0; i < AG_STD_INTERN_SHARDS; ++i) {
+    pthread_rwlock_init(&ag_std_intern_shards[i].lock, NULL);
   }
+}
 
-  if (DEBUG_MSG) {
-    printf("[iterator_vtable][ctor]\n");
+// Internal function, the interned string with these chars, or NULL.
+// The caller holds the shard lock.
+void *ag_std_intern_find(
+    struct ag_std_intern_shard *shard,
+    const char *chars,
+    size_t len,
+    size_t h)
+{
+  if (shard->capacity == 0) {
+    return NULL;
   }
 
-  // Assign the container begin and end functions.
-  va_list ap = *app;
+  size_t mask = shard->capacity - 1;
+  for (size_t i = (h >> 4) & mask; shard->slots[i] != NULL; i = (i + 1) & mask) {
+    struct string *str_obj = shard->slots[i];
+    if (str_obj->hash == h
+        && str_obj->len == len
+        && memcmp(ag_std_string_cstr(str_obj), chars, len) == 0) {
+      return str_obj;
+    }
+  }
 
-  void *f = va_arg(ap, void *);
+  return NULL;
+}
 
-  while (f != NULL) {
-    void *g = va_arg(ap, void *);
-    if (f == ag_std_iter_increment) {
-      iter_vt->increment = g;
-    } else if (f == ag_std_iter_deref) {
-      iter_vt->deref = g;
-    } else if (f == ag_std_iter_not_equal) {
-      iter_vt->not_equal = g;
+// Internal function, add a string to the shard, growing it when half full.
+// The caller holds the shard lock for writing.
+int ag_std_intern_add(struct ag_std_intern_shard *shard, void *obj) {
+  if ((shard->count + 1) * 2 > shard->capacity) {
+    size_t capacity = shard->capacity == 0 ? 64 : shard->capacity * 2;
+    void **slots = calloc(capacity, sizeof(void *));
+    if (slots == NULL) {
+      return -1;
     }
 
-    f = va_arg(ap, void *);
+    for (size_t i = 0; i < shard->capacity; ++i) {
+      struct string *str_obj = shard->slots[i];
+      if (str_obj != NULL) {
+        size_t j = (str_obj->hash >> 4) & (capacity - 1);
+        while (slots[j] != NULL) {
+          j = (j + 1) & (capacity - 1);
+        }
+        slots[j] = str_obj;
+      }
+    }
+
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
   }
 
-  return obj;
+  struct string *str_obj = obj;
+  size_t mask = shard->capacity - 1;
+  size_t i = (str_obj->hash >> 4) & mask;
+  while (shard->slots[i] != NULL) {
+    i = (i + 1) & mask;
+  }
+
+  shard->slots[i] = obj;
+  shard->count++;
+
+  return 0;
 }
 
-void iterator_vtable_dtor(void *obj) {
-  (void)obj;
+void *ag_std_intern(const char *chars) {
+  pthread_once(&ag_std_intern_once, ag_std_intern_init);
+
+  size_t len = strlen(chars);
+  size_t h = ag_std_string_hash_chars(chars, len);
+  struct ag_std_intern_shard *shard =
+    &ag_std_intern_shards[h % AG_STD_INTERN_SHARDS];
+
+  __atomic_fetch_add(&ag_std_intern_counts.lookups, 1, __ATOMIC_RELAXED);
+
+  pthread_rwlock_rdlock(&shard->lock);
+  void *obj = ag_std_intern_find(shard, chars, len, h);
+  pthread_rwlock_unlock(&shard->lock);
+
+  if (obj == NULL) {
+    pthread_rwlock_wrlock(&shard->lock);
+
+    // Someone may have added it between the two locks.
+    obj = ag_std_intern_find(shard, chars, len, h);
+    if (obj == NULL) {
+      void *mem = malloc(((struct ag_std_vtable *)string)->size);
+      if (mem != NULL) {
+        obj = ag_std_new_at(mem, string, chars);
+        if (ag_std_intern_add(shard, obj) != 0) {
+          string_dtor(obj);
+          free(mem);
+          obj = NULL;
+        } else {
+          __atomic_fetch_add(&ag_std_intern_counts.strings, 1, __ATOMIC_RELAXED);
+          pthread_rwlock_unlock(&shard->lock);
+          return obj;
+        }
+      }
+    }
 
-  if (DEBUG_MSG) {
-    printf("[iterator_vtable][dtor]\n");
+    pthread_rwlock_unlock(&shard->lock);
+    if (obj == NULL) {
+      return NULL;
+    }
   }
-}
 
-void ag_std_iter_increment(void *obj) {
-  struct iterator_vtable *ivt = *(struct iterator_vtable **)obj;
-  return ivt->increment(obj);
+  // A hit: this caller didn't need a string object (or a buffer) of its own.
+  size_t saved = sizeof(struct string);
+  if (len >= AG_STD_STRING_INLINE) {
+    saved += len + 1;
+  }
+
+  __atomic_fetch_add(&ag_std_intern_counts.hits, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ag_std_intern_counts.bytes_saved, saved, __ATOMIC_RELAXED);
+
+  return obj;
 }
 
-void *ag_std_iter_deref(void *obj) {
-  struct iterator_vtable *ivt = *(struct iterator_vtable **)obj;
-  return ivt->deref(obj);
+void ag_std_intern_stats(struct ag_std_intern_stats *stats) {
+  stats->lookups = __atomic_load_n(&ag_std_intern_counts.lookups, __ATOMIC_RELAXED);
+  stats->hits = __atomic_load_n(&ag_std_intern_counts.hits, __ATOMIC_RELAXED);
+  stats->strings = __atomic_load_n(&ag_std_intern_counts.strings, __ATOMIC_RELAXED);
+  stats->bytes_saved =
+    __atomic_load_n(&ag_std_intern_counts.bytes_saved, __ATOMIC_RELAXED);
 }
 
-int ag_std_iter_not_equal(void *obj_a, void *obj_b) {
-  struct iterator_vtable *ivt = *(struct iterator_vtable **)obj_a;
-  return ivt->not_equal(obj_a, obj_b);
+void ag_std_intern_print_stats(void) {
+  struct ag_std_intern_stats stats;
+  ag_std_intern_stats(&stats);
+
+  double rate = stats.lookups == 0 ? 0.0 : (double)stats.hits / (double)stats.lookups;
+  printf("intern: %zu strings, %zu lookups, %.1f%% hits, %zu bytes saved\n",
+      stats.strings, stats.lookups, rate * 100.0, stats.bytes_saved);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_list_iter (derived from object)
+// Pair (derived from object)
 ///////////////////////////////////////////////////////////////////////////////
 
-struct ag_std_list_iter {
-  struct object obj;
-  struct ag_std_list_node *c;
-};
-
-void *ag_std_list_iter_ctor(void *obj, va_list *app) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_list_iter_ctor]\n");
-  }
+struct ag_std_pair {
+  struct object obj; // base
 
-  // TODO
-  // Need to call the super ctor.
+  void *first;
+  void *second;
+};
 
-  struct ag_std_list_iter *li = obj;
-  li->c = va_arg(*app, struct ag_std_list_node *);
+void *ag_std_pair_ctor(void *obj, va_list *app) {
+  struct ag_std_pair *p = (struct ag_std_pair *)obj;
+  p->first = ag_std_retain(va_arg(*app, void *));
+  p->second = ag_std_retain(va_arg(*app, void *));
 
   return obj;
 }
 
-void ag_std_list_iter_dtor(void *obj) {
-  // TODO
-  (void)obj;
-}
+void ag_std_pair_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_pair][dtor]\n");
+  }
 
-void ag_std_list_iter_print(void *obj) {
-  (void)obj;
-  printf("[ag_std_list_iter][print]");
+  struct ag_std_pair *p = obj;
+  ag_std_release(p->first);
+  ag_std_release(p->second);
 }
 
-void ag_std_list_iter_increment(void *obj) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_list_iter_inc]\n");
-  }
-  struct ag_std_list_iter *li = obj;
-  li->c = li->c->next;
+void ag_std_pair_print(void *obj) {
+  struct ag_std_pair *p = obj;
+  // struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  // printf("[%s][print][%s]\n", vt->name, str_obj->s);
+  printf("(");
+  ag_std_print(p->first);
+  printf(", ");
+  ag_std_print(p->second);
+  printf(")");
 }
 
-void *ag_std_list_iter_deref(void *obj) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_list_iter_deref]\n");
+// Pairs compare by first, then by second.
+int ag_std_pair_cmp(void *obj_a, void *obj_b) {
+  struct ag_std_pair *a = obj_a;
+  struct ag_std_pair *b = obj_b;
+
+  int res = ag_std_cmp(a->first, b->first);
+  if (res != 0) {
+    return res;
   }
 
-  struct ag_std_list_iter *li = obj;
-  return li->c->obj;
+  return ag_std_cmp(a->second, b->second);
 }
 
-int ag_std_list_iter_not_equal(void *obj_a, void *obj_b) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_list_iter_neq]\n");
-  }
+size_t ag_std_pair_hash(void *obj) {
+  struct ag_std_pair *p = obj;
 
-  struct ag_std_list_iter *a = obj_a;
-  struct ag_std_list_iter *b = obj_b;
+  size_t h = ag_std_hash(p->first);
+  return ag_std_hash_mix(h ^ (ag_std_hash(p->second) + 0x9e3779b97f4a7c15ULL));
+}
+
+// Specialized functions - first and second.
+void *ag_std_pair_first(void *obj) {
+  struct ag_std_pair *p = obj;
+  return p->first;
+}
 
-  return a->c != b->c;
+void *ag_std_pair_second(void *obj) {
+  struct ag_std_pair *p = obj;
+  return p->second;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_vector_iter (derived from object)
+// Tuple (derived from object)
 ///////////////////////////////////////////////////////////////////////////////
 
-struct ag_std_vector_iter {
-  struct object obj;
+/* A pair of any length, up to AG_STD_TUPLE_MAX. The items are kept in the
+ * tuple itself, so every tuple is the same size.
+ */
+#define AG_STD_TUPLE_MAX 8
 
-  void **arr;
-  size_t i;
+struct ag_std_tuple {
+  struct object obj; // base
+
+  size_t n;
+  void *items[AG_STD_TUPLE_MAX];
 };
 
-void *ag_std_vector_iter_ctor(void *obj, va_list *app) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_ctor]\n");
-  }
+// ag_std_new(ag_std_tuple, n, items). With items NULL, they all start out
+// NULL.
+void *ag_std_tuple_ctor(void *obj, va_list *app) {
+  struct ag_std_tuple *t = obj;
+  int n = va_arg(*app, int);
+  void **items = va_arg(*app, void **);
 
-  // TODO
-  // Need to call the super ctor.
+  t->n = n < 0 ? 0 : (size_t)n;
+  if (t->n > AG_STD_TUPLE_MAX) {
+    t->n = AG_STD_TUPLE_MAX;
+  }
 
-  struct ag_std_vector_iter *vi = obj;
-  vi->arr = va_arg(*app, void **);
-  vi->i = va_arg(*app, size_t);
+  for (size_t i = 0; i < t->n; ++i) {
+    t->items[i] = items == NULL ? NULL : ag_std_retain(items[i]);
+  }
 
   return obj;
 }
 
-void ag_std_vector_iter_dtor(void *obj) {
-  // TODO
-  (void)obj;
-}
+void ag_std_tuple_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_tuple][dtor]\n");
+  }
 
-void ag_std_vector_iter_print(void *obj) {
-  (void)obj;
-  printf("[ag_std_vector_iter][print]");
+  struct ag_std_tuple *t = obj;
+  for (size_t i = 0; i < t->n; ++i) {
+    ag_std_release(t->items[i]);
+  }
 }
 
-void ag_std_vector_iter_increment(void *obj) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_inc]\n");
+void ag_std_tuple_print(void *obj) {
+  struct ag_std_tuple *t = obj;
+
+  printf("(");
+  for (size_t i = 0; i < t->n; ++i) {
+    if (i > 0) {
+      printf(", ");
+    }
+    ag_std_print(t->items[i]);
   }
-  struct ag_std_vector_iter *vi = obj;
-  vi->i++;
+  printf(")");
 }
 
-void *ag_std_vector_iter_deref(void *obj) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_deref]\n");
+// Tuples compare item by item, and a shorter one comes first.
+int ag_std_tuple_cmp(void *obj_a, void *obj_b) {
+  struct ag_std_tuple *a = obj_a;
+  struct ag_std_tuple *b = obj_b;
+
+  for (size_t i = 0; i < a->n && i < b->n; ++i) {
+    int res = ag_std_cmp(a->items[i], b->items[i]);
+    if (res != 0) {
+      return res;
+    }
   }
 
-  struct ag_std_vector_iter *vi = obj;
-  return vi->arr[vi->i];
+  return (a->n > b->n) - (a->n < b->n);
 }
 
-int ag_std_vector_iter_not_equal(void *obj_a, void *obj_b) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_neq]\n");
+size_t ag_std_tuple_hash(void *obj) {
+  struct ag_std_tuple *t = obj;
+
+  size_t h = t->n;
+  for (size_t i = 0; i < t->n; ++i) {
+    h = ag_std_hash_mix(h ^ (ag_std_hash(t->items[i]) + 0x9e3779b97f4a7c15ULL));
   }
 
-  struct ag_std_vector_iter *a = obj_a;
-  struct ag_std_vector_iter *b = obj_b;
+  return h;
+}
 
-  return a->i != b->i;
+// Specialized functions - size and at.
+size_t ag_std_tuple_size(void *obj) {
+  struct ag_std_tuple *t = obj;
+  return t->n;
+}
+
+void *ag_std_tuple_at(void *obj, size_t i) {
+  struct ag_std_tuple *t = obj;
+  return t->items[i];
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ag_std_iota_view_iter (derived from object)
+// Iterator storage
 ///////////////////////////////////////////////////////////////////////////////
 
-struct ag_std_iota_view_iter {
-  struct object obj;
-  int i;
+/* Storage for iterators on the stack. Algorithms size it with
+ * AG_STD_ITER_SLOTS(rng), so that a traversal needs no heap memory:
+ *
+ *   union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+ *   void *it = ag_std_begin_into(rng, it_buf);
+ */
+union ag_std_iter_slot {
+  void *p;
+  size_t n;
+  double d;
 };
 
-void *ag_std_iota_view_iter_ctor(void *obj, va_list *app) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_ctor]\n");
-  }
+#define AG_STD_ITER_SLOTS(rng) \
+  (ag_std_iter_round(ag_std_iter_size(rng)) / sizeof(union ag_std_iter_slot))
 
-  // TODO
-  // Need to call the super ctor.
+size_t ag_std_iter_round(size_t size) {
+  const size_t slot = sizeof(union ag_std_iter_slot);
+  return (size + slot - 1) / slot * slot;
+}
 
-  struct ag_std_iota_view_iter *vi = obj;
-  vi->i = va_arg(*app, int);
+// How many elements the algorithms ask ag_std_iter_next_batch for at once.
+#define AG_STD_ITER_BATCH 64
 
-  return obj;
-}
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_list (derived from object)
+///////////////////////////////////////////////////////////////////////////////
 
-void ag_std_iota_view_iter_dtor(void *obj) {
-  // TODO
-  (void)obj;
-}
+/* Our ag_std_list will (at the moment) allow for any kind of object to be
+ * inserted into it, not just objects of a specific type, (though we can
+ * technically enforce this by providing the allowed type during
+ * the lists construction, ie: void *lst = ag_std_new(ag_std_list, integer),
+ * at which point every insert will do a check to ensure that the object
+ * being inserted is in fact of type integer.
+ *
+ * The nodes come from the memory pool, like objects do, and are linked in
+ * a ring through a sentinel node that is part of the list itself, so an
+ * empty list allocates nothing. A node holds up to cap elements: one, for
+ * ag_std_list, or AG_STD_LIST_UNROLL for ag_std_unrolled_list, which keeps
+ * runs of elements next to each other so that long walks touch far fewer
+ * cache lines. Everything else is the same for both, and nodes of both
+ * kinds can be in the same list (after a splice, say).
+ */
+#define AG_STD_LIST_UNROLL 13 // A node of 128 bytes.
 
-void ag_std_iota_view_iter_print(void *obj) {
-  (void)obj;
-  printf("[ag_std_iota_view_iter][print]");
+struct ag_std_list_node {
+  struct ag_std_list_node *next;
+  struct ag_std_list_node *prev;
+  uint32_t n; // How many of objs are in use.
+  uint32_t cap;
+  void *objs[]; // not pointers to the base object, just pointers to
+                // the newly inserted objects.
+};
+
+size_t ag_std_list_node_size(uint32_t cap) {
+  return sizeof(struct ag_std_list_node) + cap * sizeof(void *);
 }
 
-void ag_std_iota_view_iter_increment(void *obj) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_inc]\n");
+// Internal function, nobody except ag_std_list functions will call this.
+// NULL if there is no memory.
+struct ag_std_list_node *ag_std_list_node_ctor(uint32_t cap) {
+  struct ag_std_list_node *node = ag_std_pool_alloc(ag_std_list_node_size(cap));
+  if (node == NULL) {
+    return NULL;
   }
-  struct ag_std_iota_view_iter *vi = obj;
-  vi->i++;
+
+  node->next = NULL;
+  node->prev = NULL;
+  node->n = 0;
+  node->cap = cap;
+  return node;
 }
 
-// TODO: Get rid of this when we can.
-// This needs to be forward declared
-void *integer;
+void ag_std_list_node_dtor(struct ag_std_list_node *node) {
+  ag_std_pool_free(node, ag_std_list_node_size(node->cap));
+}
 
-void *ag_std_iota_view_iter_deref(void *obj) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_deref]\n");
-  }
+void ag_std_list_node_link
+(struct ag_std_list_node *a, struct ag_std_list_node *b) {
 
-  struct ag_std_iota_view_iter *vi = obj;
-  return ag_std_new(integer, vi->i);
+  a->next = b;
+  b->prev = a;
 }
 
-int ag_std_iota_view_iter_not_equal(void *obj_a, void *obj_b) {
+void ag_std_list_node_insert(
+    struct ag_std_list_node *a,
+    struct ag_std_list_node *b,
+    struct ag_std_list_node *c)
+{
+  a->next = b;
+  b->next = c;
+
+  b->prev = a;
+  c->prev = b;
+}
+
+struct ag_std_list {
+  struct object obj; // base
+
+  size_t size;
+  uint32_t unroll; // The cap of the nodes it makes.
+
+  // next is the first node and prev the last; it has no elements.
+  struct ag_std_list_node head;
+};
+
+void *ag_std_list_ctor(void *obj, va_list *app) {
+  // does nothing.
+  (void)app;
+
   if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_neq]\n");
+    printf("[ag_std_list][ctor]\n");
   }
 
-  struct ag_std_iota_view_iter *a = obj_a;
-  struct ag_std_iota_view_iter *b = obj_b;
+  struct ag_std_list *lst = obj;
 
-  return a->i != b->i;
+  ag_std_list_node_link(&lst->head, &lst->head);
+  lst->head.n = 0;
+  lst->head.cap = 0;
+
+  lst->size = 0;
+  lst->unroll = 1;
+
+  return obj;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// ag_std_zip_view_iter (derived from object)
-///////////////////////////////////////////////////////////////////////////////
+void *ag_std_unrolled_list_ctor(void *obj, va_list *app) {
+  ag_std_list_ctor(obj, app);
 
-struct ag_std_zip_view_iter {
-  struct object obj;
+  struct ag_std_list *lst = obj;
+  lst->unroll = AG_STD_LIST_UNROLL;
 
-  // A pair of iters zipped together.
-  struct ag_std_pair *p;
-};
+  return obj;
+}
 
-void *ag_std_zip_view_iter_ctor(void *obj, va_list *app) {
+void ag_std_list_dtor(void *obj) {
   if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_ctor]\n");
+    printf("[ag_std_list][dtor]\n");
   }
 
-  // TODO
-  // Need to call the super ctor.
+  // The list has a reference to each element. A long list hands them all
+  // to the release queue, a short one releases them as it goes.
+  struct ag_std_list *lst = obj;
+  void **items = NULL;
+  if (lst->size > AG_STD_RELEASE_INLINE) {
+    items = malloc(sizeof(void *) * lst->size);
+  }
+
+  size_t n = 0;
+  struct ag_std_list_node *node = lst->head.next;
+  while (node != &lst->head) {
+    struct ag_std_list_node *next = node->next;
+    for (uint32_t i = 0; i < node->n; ++i) {
+      if (items != NULL && ag_std_refs(node->objs[i]) != 0) {
+        items[n++] = node->objs[i];
+      } else {
+        ag_std_release(node->objs[i]);
+      }
+    }
+    ag_std_list_node_dtor(node);
+    node = next;
+  }
 
-  struct ag_std_zip_view_iter *vi = obj;
-  vi->p = va_arg(*app, struct ag_std_pair *);
+  if (items != NULL) {
+    ag_std_release_later(items, n, 0);
+  }
 
-  return obj;
+  ag_std_list_node_link(&lst->head, &lst->head);
+  lst->size = 0;
 }
 
-void ag_std_zip_view_iter_dtor(void *obj) {
-  // TODO actual implementation.
-  (void)obj;
+void ag_std_list_print(void *obj) {
+  struct ag_std_list *lst = obj;
+
+  printf("[");
+  size_t k = 0;
+  for (struct ag_std_list_node *c = lst->head.next; c != &lst->head; c = c->next) {
+    for (uint32_t i = 0; i < c->n; ++i) {
+      if (k++ > 0) {
+        printf(", ");
+      }
+      ag_std_print(c->objs[i]);
+    }
+  }
+  printf("]");
 }
 
-void ag_std_zip_view_iter_print(void *obj) {
-  (void)obj;
-  printf("[ag_std_zip_view_iter][print]");
+int ag_std_list_cmp(void *obj_a, void *obj_b) {
+  struct ag_std_list *a = (struct ag_std_list *)obj_a;
+  struct ag_std_list *b = (struct ag_std_list *)obj_b;
+
+  (void)a;
+  (void)b;
+
+  // TODO
+  // Need to actually implement this but do it later.
+  return 0;
 }
 
-void ag_std_zip_view_iter_increment(void *obj) {
+// TODO: Remove this from the global namespace... somehow.
+// Had to put this here so ag_std_list_begin and end would know the type of
+// object to create.
+void *ag_std_list_iter;
+
+// The list class is out here too, so that the benchmarks can make one.
+void *ag_std_list;
+void *ag_std_unrolled_list;
+
+void *ag_std_list_begin(void *obj) {
+  (void)obj;
+
   if (DEBUG_MSG) {
-    printf("[zip_iter_inc]\n");
+    printf("[ag_std_list][begin]\n");
   }
 
-  struct ag_std_zip_view_iter *zv = obj;
-  void *a = ag_std_pair_first(zv->p);
-  void *b = ag_std_pair_second(zv->p);
+  struct ag_std_list *lst = obj;
+  struct ag_std_list_node *c = lst->head.next;
 
-  ag_std_iter_increment(a);
-  ag_std_iter_increment(b);
+  return ag_std_new(ag_std_list_iter, c);
 }
 
-void *ag_std_zip_view_iter_deref(void *obj) {
+void *ag_std_list_end(void *obj) {
+  (void)obj;
+
   if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_deref]\n");
+    printf("[ag_std_list][end]\n");
   }
+  struct ag_std_list *lst = obj;
+  struct ag_std_list_node *c = &lst->head;
 
-  struct ag_std_zip_view_iter *zv = obj;
+  return ag_std_new(ag_std_list_iter, c);
+}
 
-  void *a = ag_std_pair_first(zv->p);
-  void *b = ag_std_pair_second(zv->p);
+size_t ag_std_list_size(void *obj) {
+  struct ag_std_list *lst = obj;
+  return lst->size;
+}
 
-  void *value_a = ag_std_iter_deref(a);
-  void *value_b = ag_std_iter_deref(b);
+size_t ag_std_list_iter_size(void *obj) {
+  (void)obj;
+  return ((struct ag_std_vtable *)ag_std_list_iter)->size;
+}
 
-  void *new_pair = ag_std_new(ag_std_pair, value_a, value_b);
-  return new_pair;
+void *ag_std_list_begin_into(void *obj, void *storage) {
+  struct ag_std_list *lst = obj;
+  return ag_std_new_at(storage, ag_std_list_iter, lst->head.next);
 }
 
-int ag_std_zip_view_iter_not_equal(void *obj_a, void *obj_b) {
-  if (DEBUG_MSG) {
-    printf("[ag_std_vector_iter_neq]\n");
-  }
+void *ag_std_list_end_into(void *obj, void *storage) {
+  struct ag_std_list *lst = obj;
+  return ag_std_new_at(storage, ag_std_list_iter, &lst->head);
+}
 
-  struct ag_std_zip_view_iter *zv_a = obj_a;
-  struct ag_std_zip_view_iter *zv_b = obj_b;
+void ag_std_list_push_front(void *lst_arg, void *obj) {
+  struct ag_std_list *lst = lst_arg;
+  struct ag_std_list_node *a = &lst->head;
+  struct ag_std_list_node *c = a->next;
 
-  void *pa_01 = ag_std_pair_first(zv_a->p);
-  void *pa_02 = ag_std_pair_second(zv_a->p);
+  if (c != a && c->n < c->cap) {
+    memmove(c->objs + 1, c->objs, c->n * sizeof(void *));
+    c->objs[0] = ag_std_retain(obj);
+    c->n++;
+  } else {
+    struct ag_std_list_node *new_node = ag_std_list_node_ctor(lst->unroll);
+    if (new_node == NULL) {
+      return;
+    }
+    new_node->objs[new_node->n++] = ag_std_retain(obj);
+    ag_std_list_node_insert(a, new_node, c);
+  }
 
-  void *pb_01 = ag_std_pair_first(zv_b->p);
-  void *pb_02 = ag_std_pair_second(zv_b->p);
+  lst->size++;
+}
 
-  int res_01 = ag_std_iter_not_equal(pa_01, pb_01);
-  int res_02 = ag_std_iter_not_equal(pa_02, pb_02);
+void ag_std_list_push_back(void *lst_arg, void *obj) {
+  struct ag_std_list *lst = lst_arg;
+  struct ag_std_list_node *c = &lst->head;
+  struct ag_std_list_node *a = c->prev;
 
-  if (res_01 == 0 || res_02 == 0) {
-    return 0;
+  if (a != c && a->n < a->cap) {
+    a->objs[a->n++] = ag_std_retain(obj);
   } else {
-    return 1;
+    struct ag_std_list_node *new_node = ag_std_list_node_ctor(lst->unroll);
+    if (new_node == NULL) {
+      return;
+    }
+    new_node->objs[new_node->n++] = ag_std_retain(obj);
+    ag_std_list_node_insert(a, new_node, c);
   }
+
+  lst->size++;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// range functions
-///////////////////////////////////////////////////////////////////////////////
-void ag_std_range_print(void *rng) {
+// Here, for ag_std_list_splice. The element it is at is c->objs[i].
+struct ag_std_list_iter {
+  struct object obj;
+  struct ag_std_list_node *c;
+  size_t i;
+};
 
-  void *it = ag_std_begin(rng);
-  void *end = ag_std_end(rng);
+// Internal function, split node after its first i elements, so that
+// element i starts a node. Returns that node (NULL, with node as it was, if
+// there is no memory).
+struct ag_std_list_node *ag_std_list_node_split(struct ag_std_list_node *node, uint32_t i) {
+  if (i == 0) {
+    return node;
+  }
 
-  printf("range_print( ");
+  struct ag_std_list_node *rest = ag_std_list_node_ctor(node->cap);
+  if (rest == NULL) {
+    return NULL;
+  }
+  rest->n = node->n - i;
+  memcpy(rest->objs, node->objs + i, rest->n * sizeof(void *));
+  node->n = i;
+  ag_std_list_node_insert(node, rest, node->next);
 
-  while (ag_std_iter_not_equal(it, end)) {
-    void *val = ag_std_iter_deref(it);
-    ag_std_print(val);
-    printf(" ");
-    ag_std_iter_increment(it);
+  return rest;
+}
+
+/* Move everything in other into lst, before the element that the list
+ * iterator pos is at (NULL for the end), and leave other empty. The
+ * nodes are relinked, not copied, so it takes the same time however long
+ * other is (in an unrolled list it may split the node at pos in two; pos
+ * then moves to the new node, and stays at the same element).
+ */
+void ag_std_list_splice(void *lst_arg, void *pos, void *other_arg) {
+  struct ag_std_list *lst = lst_arg;
+  struct ag_std_list *other = other_arg;
+  if (other == lst || other->size == 0) {
+    return;
   }
 
-  printf(")\n");
+  struct ag_std_list_node *c = &lst->head;
+  if (pos != NULL) {
+    struct ag_std_list_iter *li = pos;
+    c = ag_std_list_node_split(li->c, (uint32_t)li->i);
+    if (c == NULL) {
+      return;
+    }
+    li->c = c;
+    li->i = 0;
+  }
+
+  struct ag_std_list_node *first = other->head.next;
+  struct ag_std_list_node *last = other->head.prev;
+  ag_std_list_node_link(c->prev, first);
+  ag_std_list_node_link(last, c);
+  lst->size += other->size;
+
+  ag_std_list_node_link(&other->head, &other->head);
+  other->size = 0;
 }
 
-int ag_std_range_find(void *rng, void *val) {
+// Internal function, a chain of nodes linked through next (and ended by
+// NULL), for merging and sorting. The prevs are put right at the end.
+struct ag_std_list_run {
+  struct ag_std_list_node *first;
+  struct ag_std_list_node *last;
+};
 
-  void *it = ag_std_begin(rng);
-  void *end = ag_std_end(rng);
+// Internal function, where a merge reads one of its runs.
+struct ag_std_list_cursor {
+  struct ag_std_list_node *c;
+  uint32_t i;
+};
 
-  while (ag_std_iter_not_equal(it, end)) {
-    void *obj = ag_std_iter_deref(it);
+/* Internal function, merge the runs a and b, both sorted by ag_std_cmp and
+ * not empty, taking from a first when they are equal. The elements move
+ * from node to node; a node that is emptied goes on *spare, and the result
+ * takes its nodes from there (a new one is only made when it is empty). So
+ * with one element a node this only relinks the nodes, and with more it
+ * never holds more than two nodes more than it started with.
+ *
+ * If a node can't be made, the merge stops there and what is left of a and
+ * then of b goes on the end as it is, and *failed is set: every element is
+ * still in the run, but not in order.
+ */
+struct ag_std_list_run ag_std_list_merge_runs(struct ag_std_list_run a,
+    struct ag_std_list_run b, struct ag_std_list_node **spare, uint32_t cap,
+    int *failed) {
+  // Already in order (a sorted list, say): just join them.
+  if (ag_std_cmp(b.first->objs[0], a.last->objs[a.last->n - 1]) >= 0) {
+    a.last->next = b.first;
+    a.last = b.last;
+    return a;
+  }
 
-    if (ag_std_cmp(obj, val) == 0) {
-      return 1;
+  struct ag_std_list_cursor x = { a.first, 0 };
+  struct ag_std_list_cursor y = { b.first, 0 };
+  struct ag_std_list_run out = { NULL, NULL };
+
+  while (x.c != NULL && y.c != NULL) {
+    struct ag_std_list_cursor *from =
+      ag_std_cmp(y.c->objs[y.i], x.c->objs[x.i]) < 0 ? &y : &x;
+    void *obj = from->c->objs[from->i++];
+
+    if (from->i == from->c->n) {
+      struct ag_std_list_node *done = from->c;
+      from->c = done->next;
+      from->i = 0;
+      done->next = *spare;
+      *spare = done;
     }
 
-    ag_std_iter_increment(it);
+    if (out.last == NULL || out.last->n == out.last->cap) {
+      struct ag_std_list_node *node = *spare;
+      if (node != NULL) {
+        *spare = node->next;
+      } else {
+        node = ag_std_list_node_ctor(cap);
+      }
+      if (node == NULL) {
+        // Nothing went on *spare, so obj's node still has it.
+        from->i--;
+        *failed = 1;
+        break;
+      }
+      node->n = 0;
+      node->next = NULL;
+      if (out.last == NULL) {
+        out.first = node;
+      } else {
+        out.last->next = node;
+      }
+      out.last = node;
+    }
+    out.last->objs[out.last->n++] = obj;
   }
 
-  return 0;
-}
+  // What is left goes on the end as it is, but for the part of a node
+  // already taken from.
+  struct ag_std_list_cursor *rests[2] = { &x, &y };
+  struct ag_std_list_node *rest_lasts[2] = { a.last, b.last };
+  for (int k = 0; k < 2; ++k) {
+    struct ag_std_list_cursor *rest = rests[k];
+    if (rest->c == NULL) {
+      continue;
+    }
+    if (rest->i > 0) {
+      struct ag_std_list_node *node = rest->c;
+      node->n -= rest->i;
+      memmove(node->objs, node->objs + rest->i, node->n * sizeof(void *));
+    }
 
-///////////////////////////////////////////////////////////////////////////////
-// main
-///////////////////////////////////////////////////////////////////////////////
+    if (out.last == NULL) {
+      out.first = rest->c;
+    } else {
+      out.last->next = rest->c;
+    }
+    out.last = rest_lasts[k];
+  }
 
-int main(void) {
+  return out;
+}
 
-  struct ag_std_vtable vtable_vt = {
+// Internal function, take the nodes out of lst, as a run.
+struct ag_std_list_run ag_std_list_take_run(struct ag_std_list *lst) {
+  struct ag_std_list_run run = { lst->head.next, lst->head.prev };
+  run.last->next = NULL;
+  ag_std_list_node_link(&lst->head, &lst->head);
+  return run;
+}
+
+// Internal function, put a run into lst (which has no nodes), setting the
+// prevs, and give back the spare nodes.
+void ag_std_list_put_run(struct ag_std_list *lst, struct ag_std_list_run run,
+    struct ag_std_list_node *spare) {
+  struct ag_std_list_node *a = &lst->head;
+  for (struct ag_std_list_node *node = run.first; node != NULL; node = node->next) {
+    node->prev = a;
+    a = node;
+  }
+  ag_std_list_node_link(a, &lst->head);
+  if (run.first != NULL) {
+    lst->head.next = run.first;
+  }
+
+  while (spare != NULL) {
+    struct ag_std_list_node *next = spare->next;
+    ag_std_list_node_dtor(spare);
+    spare = next;
+  }
+}
+
+/* Merge other into lst, both sorted by ag_std_cmp, and leave other empty.
+ * It is stable: of equal elements, those of lst come first. Nothing is
+ * retained or released, and emptied nodes are used again for the result,
+ * so a plain list is only relinked. Unrolled nodes also come out full.
+ * Returns -1 if it ran out of memory: everything is still moved into lst,
+ * but not in order.
+ */
+int ag_std_list_merge(void *lst_arg, void *other_arg) {
+  struct ag_std_list *lst = lst_arg;
+  struct ag_std_list *other = other_arg;
+  if (other == lst || other->size == 0) {
+    return 0;
+  }
+
+  if (lst->size == 0) {
+    ag_std_list_splice(lst, NULL, other);
+    return 0;
+  }
+
+  struct ag_std_list_node *spare = NULL;
+  int failed = 0;
+  struct ag_std_list_run run = ag_std_list_merge_runs(ag_std_list_take_run(lst),
+      ag_std_list_take_run(other), &spare, lst->unroll, &failed);
+  ag_std_list_put_run(lst, run, spare);
+
+  lst->size += other->size;
+  other->size = 0;
+
+  return failed ? -1 : 0;
+}
+
+// Internal function, sort the elements of one node, by insertion.
+void ag_std_list_node_sort(struct ag_std_list_node *node) {
+  for (uint32_t i = 1; i < node->n; ++i) {
+    void *obj = node->objs[i];
+    uint32_t j = i;
+    while (j > 0 && ag_std_cmp(obj, node->objs[j - 1]) < 0) {
+      node->objs[j] = node->objs[j - 1];
+      --j;
+    }
+    node->objs[j] = obj;
+  }
+}
+
+/* Sort lst by ag_std_cmp, stably, in place: a bottom-up merge sort over
+ * runs of nodes. Each node is taken off in turn and merged into a stack of
+ * runs of 1, 2, 4, ... nodes, like carrying in a binary counter, and what
+ * is on the stack at the end is merged together. Nodes are only relinked,
+ * so a plain list is sorted with no memory at all (and an unrolled one
+ * with at most two nodes more, for a moment). Returns -1 if that node
+ * could not be had: the elements are all still there, but not in order.
+ */
+int ag_std_list_sort(void *lst_arg) {
+  struct ag_std_list *lst = lst_arg;
+  if (lst->size < 2) {
+    return 0;
+  }
+
+  struct ag_std_list_run pending[64];
+  size_t n_pending = 0;
+  struct ag_std_list_node *spare = NULL;
+  int failed = 0;
+
+  struct ag_std_list_run rest = ag_std_list_take_run(lst);
+  struct ag_std_list_node *node = rest.first;
+  while (node != NULL) {
+    struct ag_std_list_run carry = { node, node };
+    node = node->next;
+    carry.last->next = NULL;
+    ag_std_list_node_sort(carry.first);
+
+    // pending[k] is empty or has 2^k nodes' worth, and comes before carry.
+    size_t k = 0;
+    while (k < n_pending && pending[k].first != NULL) {
+      carry = ag_std_list_merge_runs(pending[k], carry, &spare, lst->unroll, &failed);
+      pending[k].first = NULL;
+      ++k;
+    }
+    if (k == n_pending) {
+      ++n_pending;
+    }
+    pending[k] = carry;
+  }
+
+  struct ag_std_list_run run = { NULL, NULL };
+  for (size_t k = 0; k < n_pending; ++k) {
+    if (pending[k].first == NULL) {
+      continue;
+    }
+    run = run.first == NULL
+      ? pending[k]
+      : ag_std_list_merge_runs(pending[k], run, &spare, lst->unroll, &failed);
+  }
+
+  ag_std_list_put_run(lst, run, spare);
+
+  return failed ? -1 : 0;
+}
+
+// Internal function, node has no elements left: take it out.
+void ag_std_list_node_remove(struct ag_std_list_node *node) {
+  ag_std_list_node_link(node->prev, node->next);
+  ag_std_list_node_dtor(node);
+}
+
+/* Take the element that the list iterator it is at out of lst (and
+ * release it). it moves on to the next one.
+ */
+void ag_std_list_erase(void *lst_arg, void *it) {
+  struct ag_std_list *lst = lst_arg;
+  struct ag_std_list_iter *li = it;
+  struct ag_std_list_node *c = li->c;
+
+  ag_std_release(c->objs[li->i]);
+  c->n--;
+  memmove(c->objs + li->i, c->objs + li->i + 1, (c->n - li->i) * sizeof(void *));
+  lst->size--;
+
+  if (li->i == c->n) {
+    li->c = c->next;
+    li->i = 0;
+  }
+  if (c->n == 0) {
+    ag_std_list_node_remove(c);
+  }
+}
+
+/* Put obj into lst before the element that the list iterator it is at
+ * (at the end, for the end iterator). it stays at the same element.
+ */
+void ag_std_list_insert(void *lst_arg, void *it, void *obj) {
+  struct ag_std_list *lst = lst_arg;
+  struct ag_std_list_iter *li = it;
+  struct ag_std_list_node *c = li->c;
+  struct ag_std_list_node *a = c->prev;
+
+  if (li->i > 0 && c->n == c->cap) {
+    // Make room: what it is at goes to a node of its own.
+    struct ag_std_list_node *rest = ag_std_list_node_split(c, (uint32_t)li->i);
+    if (rest == NULL) {
+      return;
+    }
+    li->c = rest;
+    li->i = 0;
+    c->objs[c->n++] = ag_std_retain(obj);
+  } else if (li->i > 0 || (c != &lst->head && c->n < c->cap)) {
+    memmove(c->objs + li->i + 1, c->objs + li->i, (c->n - li->i) * sizeof(void *));
+    c->objs[li->i++] = ag_std_retain(obj);
+    c->n++;
+  } else if (a != &lst->head && a->n < a->cap) {
+    a->objs[a->n++] = ag_std_retain(obj);
+  } else {
+    struct ag_std_list_node *new_node = ag_std_list_node_ctor(lst->unroll);
+    if (new_node == NULL) {
+      return;
+    }
+    new_node->objs[new_node->n++] = ag_std_retain(obj);
+    ag_std_list_node_insert(a, new_node, c);
+  }
+
+  lst->size++;
+}
+
+/* Internal function, for unique and remove_if: go through the elements,
+ * releasing and taking out those that drop says to, and closing up the
+ * gaps in each node. last is the element kept before obj, or NULL.
+ */
+size_t ag_std_list_drop(struct ag_std_list *lst,
+    int (*drop)(void *ctx, void *last, void *obj), void *ctx) {
+  size_t dropped = 0;
+  void *last = NULL;
+
+  struct ag_std_list_node *c = lst->head.next;
+  while (c != &lst->head) {
+    struct ag_std_list_node *next = c->next;
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < c->n; ++i) {
+      void *obj = c->objs[i];
+      if (drop(ctx, last, obj)) {
+        ag_std_release(obj);
+        ++dropped;
+      } else {
+        c->objs[n++] = obj;
+        last = obj;
+      }
+    }
+
+    c->n = n;
+    if (n == 0) {
+      ag_std_list_node_remove(c);
+    }
+    c = next;
+  }
+
+  lst->size -= dropped;
+  return dropped;
+}
+
+int ag_std_list_drop_repeat(void *ctx, void *last, void *obj) {
+  (void)ctx;
+  return last != NULL && ag_std_cmp(last, obj) == 0;
+}
+
+int ag_std_list_drop_if(void *ctx, void *last, void *obj) {
+  (void)last;
+  return (*(ag_std_pred_fn *)ctx)(obj);
+}
+
+// Take out each element equal to the one before it, and say how many.
+size_t ag_std_list_unique(void *lst_arg) {
+  return ag_std_list_drop(lst_arg, ag_std_list_drop_repeat, NULL);
+}
+
+// Take out each element that pred is true for, and say how many.
+size_t ag_std_list_remove_if(void *lst_arg, ag_std_pred_fn pred) {
+  return ag_std_list_drop(lst_arg, ag_std_list_drop_if, &pred);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_vector (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* Our vector will (at the moment) allow for any kind of object to be
+ * inserted into it, not just objects of a specific type, (though we can
+ * technically enforce this by providing the allowed type during
+ * the construction, ie: void *v = ag_std_new(vector, integer),
+ * at which point every insert will do a check to ensure that the object
+ * being inserted is in fact of type integer.
+ */
+struct ag_std_vector {
+  struct object obj;
+
+  void **arr;
+  size_t size;
+  size_t capacity;
+
+  // Has a counted object been put in? If not, there is nothing to release.
+  int counted;
+};
+
+/* The array grows geometrically, so push_back is amortized O(1). Once the
+ * array is AG_STD_VECTOR_MMAP_BYTES or bigger it is mapped directly, and
+ * growing it is an mremap: the kernel moves the pages instead of us
+ * copying them. Whether arr is mapped follows from the capacity alone.
+ */
+#define AG_STD_VECTOR_MIN_CAPACITY 8
+#define AG_STD_VECTOR_MMAP_BYTES (1024 * 1024)
+
+int ag_std_vector_is_mapped(size_t capacity) {
+  return capacity * sizeof(void *) >= AG_STD_VECTOR_MMAP_BYTES;
+}
+
+// Internal function, round a mapped capacity up to whole pages.
+size_t ag_std_vector_page_capacity(size_t capacity) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t bytes = (capacity * sizeof(void *) + page - 1) / page * page;
+  return bytes / sizeof(void *);
+}
+
+// Internal function, move arr to a buffer of exactly this capacity.
+// Returns 0 on success and -1 if there was no memory (arr is untouched).
+int ag_std_vector_realloc(struct ag_std_vector *v, size_t capacity) {
+  if (ag_std_vector_is_mapped(capacity)) {
+    capacity = ag_std_vector_page_capacity(capacity);
+  }
+
+  size_t old_bytes = v->capacity * sizeof(void *);
+  size_t new_bytes = capacity * sizeof(void *);
+  int old_mapped = ag_std_vector_is_mapped(v->capacity);
+  int new_mapped = ag_std_vector_is_mapped(capacity);
+  void **arr = NULL;
+
+  if (old_mapped && new_mapped) {
+    arr = mremap(v->arr, old_bytes, new_bytes, MREMAP_MAYMOVE);
+    if (arr == MAP_FAILED) {
+      return -1;
+    }
+  } else if (!old_mapped && !new_mapped) {
+    arr = realloc(v->arr, new_bytes);
+    if (arr == NULL) {
+      return -1;
+    }
+  } else {
+    // Crossing the line, one copy to get from the heap to a mapping or back.
+    if (new_mapped) {
+      arr = mmap(NULL, new_bytes, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (arr == MAP_FAILED) {
+        return -1;
+      }
+    } else {
+      arr = malloc(new_bytes);
+      if (arr == NULL) {
+        return -1;
+      }
+    }
+
+    memcpy(arr, v->arr, v->size * sizeof(void *));
+
+    if (old_mapped) {
+      munmap(v->arr, old_bytes);
+    } else {
+      free(v->arr);
+    }
+  }
+
+  v->arr = arr;
+  v->capacity = capacity;
+
+  return 0;
+}
+
+void *ag_std_vector_ctor(void *obj, va_list *app) {
+  // does nothing.
+  (void)app;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector][ctor]\n");
+  }
+
+  struct ag_std_vector *v = obj;
+
+  // Without memory it starts with no room, and the first push tries again.
+  v->arr = malloc(sizeof(void *) * AG_STD_VECTOR_MIN_CAPACITY);
+  v->size = 0;
+  v->capacity = v->arr != NULL ? AG_STD_VECTOR_MIN_CAPACITY : 0;
+
+  return obj;
+}
+
+void ag_std_vector_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector][dtor]\n");
+  }
+
+  // The vector has a reference to each element, and the array goes with
+  // them (a big one to the release queue, in one piece).
+  struct ag_std_vector *v = obj;
+  size_t mapped = 0;
+  if (ag_std_vector_is_mapped(v->capacity)) {
+    mapped = v->capacity * sizeof(void *);
+  }
+
+  if (v->counted) {
+    ag_std_release_later(v->arr, v->size, mapped);
+  } else if (mapped != 0) {
+    munmap(v->arr, mapped);
+  } else {
+    free(v->arr);
+  }
+
+  v->arr = NULL;
+  v->size = 0;
+  v->capacity = 0;
+}
+
+void ag_std_vector_print(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector][print]\n");
+  }
+
+  struct ag_std_vector *v = obj;
+
+  if (v->size == 0) {
+    printf("ag_std_vector([])");
+    return;
+  }
+
+  printf("ag_std_vector([");
+  for (size_t i = 0; i < v->size - 1; ++i) {
+    ag_std_print(v->arr[i]);
+    printf(", ");
+  }
+
+  ag_std_print(v->arr[v->size - 1]);
+  printf("])");
+}
+
+// TODO: Remove this from the global namespace... somehow.
+// Had to put this here so vec_begin and vec_end would know the type of
+// object to create.
+void *ag_std_vector_iter;
+
+// The vector class is out here too, so that the benchmarks can make one.
+void *vector;
+
+void *ag_std_vector_begin(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector][begin]\n");
+  }
+
+  struct ag_std_vector *v = obj;
+  return ag_std_new(ag_std_vector_iter, v->arr, (size_t)0);
+}
+
+void *ag_std_vector_end(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector][end]\n");
+  }
+
+  struct ag_std_vector *v = obj;
+  return ag_std_new(ag_std_vector_iter, v->arr, v->size);
+}
+
+size_t ag_std_vector_size(void *obj) {
+  struct ag_std_vector *v = obj;
+  return v->size;
+}
+
+size_t ag_std_vector_iter_size(void *obj) {
+  (void)obj;
+  return ((struct ag_std_vtable *)ag_std_vector_iter)->size;
+}
+
+void *ag_std_vector_begin_into(void *obj, void *storage) {
+  struct ag_std_vector *v = obj;
+  return ag_std_new_at(storage, ag_std_vector_iter, v->arr, (size_t)0);
+}
+
+void *ag_std_vector_end_into(void *obj, void *storage) {
+  struct ag_std_vector *v = obj;
+  return ag_std_new_at(storage, ag_std_vector_iter, v->arr, v->size);
+}
+
+// Make room for at least n elements.
+void ag_std_vector_reserve(void *vec_arg, size_t n) {
+  struct ag_std_vector *v = vec_arg;
+  if (n > v->capacity) {
+    ag_std_vector_realloc(v, n);
+  }
+}
+
+// Give back the room that isn't used.
+void ag_std_vector_shrink_to_fit(void *vec_arg) {
+  struct ag_std_vector *v = vec_arg;
+
+  size_t capacity = v->size;
+  if (capacity < AG_STD_VECTOR_MIN_CAPACITY) {
+    capacity = AG_STD_VECTOR_MIN_CAPACITY;
+  }
+
+  if (capacity < v->capacity) {
+    ag_std_vector_realloc(v, capacity);
+  }
+}
+
+// Internal function, grow (geometrically) so n more elements fit.
+int ag_std_vector_grow(struct ag_std_vector *v, size_t n) {
+  if (v->size + n <= v->capacity) {
+    return 0;
+  }
+
+  size_t capacity = v->capacity * 2;
+  if (capacity < v->size + n) {
+    capacity = v->size + n;
+  }
+
+  return ag_std_vector_realloc(v, capacity);
+}
+
+void ag_std_vector_push_back(void *vec_arg, void *obj) {
+  struct ag_std_vector *v = vec_arg;
+
+  if (v->size == v->capacity && ag_std_vector_grow(v, 1) != 0) {
+    return;
+  }
+
+  v->counted |= ag_std_retain_counted(obj);
+  v->arr[v->size] = obj;
+  v->size++;
+}
+
+// Push n objects at once, growing at most once.
+void ag_std_vector_append_n(void *vec_arg, void **objs, size_t n) {
+  struct ag_std_vector *v = vec_arg;
+
+  if (ag_std_vector_grow(v, n) != 0) {
+    return;
+  }
+
+  memcpy(v->arr + v->size, objs, n * sizeof(void *));
+  for (size_t i = 0; i < n; ++i) {
+    v->counted |= ag_std_retain_counted(objs[i]);
+  }
+  v->size += n;
+}
+
+// Forward declare these so that extend_from_range has them.
+int ag_std_iter_batches(void *obj);
+void ag_std_vector_pop_back(void *vec_arg);
+
+/* Internal function, what a vector can hold for obj. An iterator that
+ * doesn't batch may hand out an object of its own that it fills in again
+ * (a typed vector's box): if that is a number, it is boxed anew, and the
+ * caller releases the box once it is in. Anything else of that kind can't
+ * be held, and gives NULL (as does no memory for the box).
+ */
+void *ag_std_vector_keep(void *obj) {
+  if (obj == NULL || ag_std_is_immediate(obj) || ((struct object *)obj)->refs != 0) {
+    return obj;
+  }
+
+  void *cls = ag_std_class_of(obj);
+  if (cls == integer) {
+    return ag_std_int(((struct integer *)obj)->x);
+  }
+  if (cls == floating) {
+    return ag_std_float(((struct floating *)obj)->x);
+  }
+  if (cls == integer64) {
+    return ag_std_new(integer64, ((struct integer64 *)obj)->x);
+  }
+  if (cls == floating64) {
+    return ag_std_new(floating64, ((struct floating64 *)obj)->x);
+  }
+
+  return NULL;
+}
+
+/* Push every element of a range. Another vector is copied straight out of
+ * its array, anything else is appended a batch at a time (or one at a
+ * time, through ag_std_vector_keep, if the iterator doesn't batch).
+ * Returns -1, with the vector as it was, if there was no memory or an
+ * element can't be held (the tuples of a zip or an enumerate).
+ */
+int ag_std_vector_extend_from_range(void *vec_arg, void *rng) {
+  struct ag_std_vector *v = vec_arg;
+  if (ag_std_class_of(rng) == vector) {
+    // Grow first: rng may be this vector, and its array moves.
+    struct ag_std_vector *other = rng;
+    if (ag_std_vector_grow(v, other->size) != 0) {
+      return -1;
+    }
+    ag_std_vector_append_n(v, other->arr, other->size);
+    return 0;
+  }
+
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+
+  void *it = ag_std_begin_into(rng, it_buf);
+  void *end = ag_std_end_into(rng, end_buf);
+  int batches = ag_std_iter_batches(it);
+  size_t size = v->size;
+
+  void *batch[AG_STD_ITER_BATCH];
+  size_t k;
+  while ((k = ag_std_iter_next_batch(it, end, batch, batches ? AG_STD_ITER_BATCH : 1)) > 0) {
+    void *kept = batches ? NULL : ag_std_vector_keep(batch[0]);
+    int failed = (!batches && kept == NULL) || ag_std_vector_grow(v, k) != 0;
+    if (!failed) {
+      ag_std_vector_append_n(v, batches ? batch : &kept, k);
+    }
+    if (kept != batch[0]) {
+      ag_std_release(kept);
+    }
+
+    if (failed) {
+      while (v->size > size) {
+        ag_std_vector_pop_back(v);
+      }
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void ag_std_vector_pop_back(void *vec_arg) {
+  struct ag_std_vector *v = vec_arg;
+  if (v->size > 0) {
+    // The popped object goes if the vector had the last reference.
+    v->size--;
+    ag_std_release(v->arr[v->size]);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_typed_vector (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* Vectors of plain numbers: int32_t, int64_t, float or double, stored one
+ * after the other with no object around each one. There is one class per
+ * element type (ag_std_int32_vector and friends) and they all share this
+ * struct and these functions.
+ *
+ * For tight loops, ag_std_typed_vector_data gives the array itself. The
+ * iterators still hand out objects (an integer, integer64, floating or
+ * floating64), so the typed vectors work with every range algorithm. To
+ * do that without allocating, each iterator owns one box object and
+ * refills it on every deref: the object is only good until the iterator
+ * moves or is dereferenced again.
+ */
+enum ag_std_num_kind {
+  AG_STD_INT32,
+  AG_STD_INT64,
+  AG_STD_FLOAT,
+  AG_STD_DOUBLE
+};
+
+struct ag_std_typed_vector {
+  struct object obj;
+
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+  size_t elem_size;
+  enum ag_std_num_kind kind;
+};
+
+// Internal function, the common part of the four ctors.
+void *ag_std_typed_vector_init(void *obj, enum ag_std_num_kind kind, size_t elem_size) {
+  struct ag_std_typed_vector *v = obj;
+
+  v->kind = kind;
+  v->elem_size = elem_size;
+  v->size = 0;
+
+  // As with the vector: without memory, the first push tries again.
+  v->data = malloc(elem_size * AG_STD_VECTOR_MIN_CAPACITY);
+  v->capacity = v->data != NULL ? AG_STD_VECTOR_MIN_CAPACITY : 0;
+
+  return obj;
+}
+
+void *ag_std_int32_vector_ctor(void *obj, va_list *app) {
+  (void)app;
+  return ag_std_typed_vector_init(obj, AG_STD_INT32, sizeof(int32_t));
+}
+
+void *ag_std_int64_vector_ctor(void *obj, va_list *app) {
+  (void)app;
+  return ag_std_typed_vector_init(obj, AG_STD_INT64, sizeof(int64_t));
+}
+
+void *ag_std_float_vector_ctor(void *obj, va_list *app) {
+  (void)app;
+  return ag_std_typed_vector_init(obj, AG_STD_FLOAT, sizeof(float));
+}
+
+void *ag_std_double_vector_ctor(void *obj, va_list *app) {
+  (void)app;
+  return ag_std_typed_vector_init(obj, AG_STD_DOUBLE, sizeof(double));
+}
+
+void ag_std_typed_vector_dtor(void *obj) {
+  struct ag_std_typed_vector *v = obj;
+  free(v->data);
+  v->data = NULL;
+}
+
+void ag_std_typed_vector_print_elem(struct ag_std_typed_vector *v, size_t i) {
+  const unsigned char *p = v->data + i * v->elem_size;
+
+  switch (v->kind) {
+    case AG_STD_INT32:
+      printf("%d", (int)*(const int32_t *)p);
+      break;
+    case AG_STD_INT64:
+      printf("%lld", (long long)*(const int64_t *)p);
+      break;
+    case AG_STD_FLOAT:
+      printf("%.2f", *(const float *)p);
+      break;
+    case AG_STD_DOUBLE:
+      printf("%.2f", *(const double *)p);
+      break;
+  }
+}
+
+void ag_std_typed_vector_print(void *obj) {
+  struct ag_std_typed_vector *v = obj;
+  struct ag_std_vtable *vt = ag_std_class_of(obj);
+
+  printf("%s([", vt->name);
+  for (size_t i = 0; i < v->size; ++i) {
+    if (i > 0) {
+      printf(", ");
+    }
+    ag_std_typed_vector_print_elem(v, i);
+  }
+  printf("])");
+}
+
+// The array itself, for loops that want to skip the iterators.
+void *ag_std_typed_vector_data(void *obj) {
+  struct ag_std_typed_vector *v = obj;
+  return v->data;
+}
+
+size_t ag_std_typed_vector_size(void *obj) {
+  struct ag_std_typed_vector *v = obj;
+  return v->size;
+}
+
+void ag_std_typed_vector_reserve(void *obj, size_t n) {
+  struct ag_std_typed_vector *v = obj;
+  if (n <= v->capacity) {
+    return;
+  }
+
+  unsigned char *data = realloc(v->data, n * v->elem_size);
+  if (data == NULL) {
+    return;
+  }
+
+  v->data = data;
+  v->capacity = n;
+}
+
+// Copy n values (of the vector's element type) onto the end.
+void ag_std_typed_vector_append_n(void *obj, const void *vals, size_t n) {
+  struct ag_std_typed_vector *v = obj;
+
+  if (v->size + n > v->capacity) {
+    size_t capacity = v->capacity * 2;
+    if (capacity < v->size + n) {
+      capacity = v->size + n;
+    }
+    ag_std_typed_vector_reserve(obj, capacity);
+    if (v->size + n > v->capacity) {
+      return;
+    }
+  }
+
+  memcpy(v->data + v->size * v->elem_size, vals, n * v->elem_size);
+  v->size += n;
+}
+
+void ag_std_int32_vector_push_back(void *obj, int32_t x) {
+  ag_std_typed_vector_append_n(obj, &x, 1);
+}
+
+void ag_std_int64_vector_push_back(void *obj, int64_t x) {
+  ag_std_typed_vector_append_n(obj, &x, 1);
+}
+
+void ag_std_float_vector_push_back(void *obj, float x) {
+  ag_std_typed_vector_append_n(obj, &x, 1);
+}
+
+void ag_std_double_vector_push_back(void *obj, double x) {
+  ag_std_typed_vector_append_n(obj, &x, 1);
+}
+
+// The class is out here too, so that the typed vector functions can make one.
+void *ag_std_typed_vector_iter;
+
+// The typed vector classes, out here so the benchmarks can make them.
+void *ag_std_int32_vector;
+void *ag_std_int64_vector;
+void *ag_std_float_vector;
+void *ag_std_double_vector;
+
+size_t ag_std_typed_vector_iter_size(void *obj) {
+  (void)obj;
+  return ((struct ag_std_vtable *)ag_std_typed_vector_iter)->size;
+}
+
+void *ag_std_typed_vector_begin(void *obj) {
+  return ag_std_new(ag_std_typed_vector_iter, obj, (size_t)0);
+}
+
+void *ag_std_typed_vector_end(void *obj) {
+  struct ag_std_typed_vector *v = obj;
+  return ag_std_new(ag_std_typed_vector_iter, obj, v->size);
+}
+
+void *ag_std_typed_vector_begin_into(void *obj, void *storage) {
+  return ag_std_new_at(storage, ag_std_typed_vector_iter, obj, (size_t)0);
+}
+
+void *ag_std_typed_vector_end_into(void *obj, void *storage) {
+  struct ag_std_typed_vector *v = obj;
+  return ag_std_new_at(storage, ag_std_typed_vector_iter, obj, v->size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_map (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* Our map will (at the moment) allow for any kind of object to be
+ * inserted into it, not just objects of a specific type, (though we can
+ * technically enforce this by providing the allowed type during
+ * the construction, ie: void *v = ag_std_new(ag_std_map, integer, string),
+ * at which point every insert will do a check to ensure that the key and
+ * value being inserted are the correct types.
+ */
+
+/* The pairs are kept in arr in the order they were inserted (so printing
+ * and iterating work just like a vector), together with the hash of each
+ * key. Lookups go through a separate open addressing index, laid out like
+ * a SwissTable: slots come in groups of 16, and every slot has a control
+ * byte that is either AG_STD_MAP_EMPTY or the low 7 bits of the hash of
+ * the key it points at. A probe loads a whole group of control bytes and
+ * compares all 16 against those 7 bits at once (with SSE2 when we have
+ * it), so cmp is only called on the few slots that are likely to match.
+ * A group with an empty slot in it ends the probe.
+ */
+#define AG_STD_MAP_GROUP 16
+#define AG_STD_MAP_EMPTY 0x80
+
+struct ag_std_map {
+  struct object obj;
+
+  void **arr;
+  size_t *hashes;
+  size_t size;
+  size_t capacity;
+
+  // The index. n_slots is a power of two, and at least one group.
+  unsigned char *ctrl;
+  size_t *slots;
+  size_t n_slots;
+};
+
+void *ag_std_map_ctor(void *obj, va_list *app) {
+  // does nothing.
+  (void)app;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_map][ctor]\n");
+  }
+
+  struct ag_std_map *m = obj;
+
+  m->arr = malloc(sizeof(void *) * 8);
+  m->hashes = malloc(sizeof(size_t) * 8);
+  m->size = 0;
+  m->capacity = 8;
+
+  m->n_slots = AG_STD_MAP_GROUP;
+  m->ctrl = malloc(m->n_slots);
+  m->slots = malloc(sizeof(size_t) * m->n_slots);
+  if (m->arr == NULL || m->hashes == NULL || m->ctrl == NULL || m->slots == NULL) {
+    free(m->arr);
+    free(m->hashes);
+    free(m->ctrl);
+    free(m->slots);
+    return NULL;
+  }
+  memset(m->ctrl, AG_STD_MAP_EMPTY, m->n_slots);
+
+  return obj;
+}
+
+void ag_std_map_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_map][dtor]\n");
+  }
+
+  // Like the vector, the map has a reference to each pair.
+  struct ag_std_map *m = obj;
+  ag_std_release_later(m->arr, m->size, 0);
+  free(m->hashes);
+  free(m->ctrl);
+  free(m->slots);
+}
+
+// Bit i of the result is set when byte i of the group is b.
+unsigned ag_std_map_group_match(const unsigned char *group, unsigned char b) {
+#if defined(__SSE2__)
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b));
+  return (unsigned)_mm_movemask_epi8(eq);
+#else
+  unsigned match = 0;
+  for (unsigned i = 0; i < AG_STD_MAP_GROUP; ++i) {
+    if (group[i] == b) {
+      match |= 1u << i;
+    }
+  }
+  return match;
+#endif
+}
+
+// The top bits of the hash pick the group, the low 7 go in the ctrl byte.
+size_t ag_std_map_h1(size_t h) {
+  return h >> 7;
+}
+
+unsigned char ag_std_map_h2(size_t h) {
+  return (unsigned char)(h & 0x7f);
+}
+
+// Internal function, the index in arr of the pair with this key, or size.
+size_t ag_std_map_find(struct ag_std_map *m, void *key, size_t h) {
+  const size_t n_groups = m->n_slots / AG_STD_MAP_GROUP;
+  const unsigned char h2 = ag_std_map_h2(h);
+  void *key_class = ag_std_class_of(key);
+
+  size_t g = ag_std_map_h1(h) & (n_groups - 1);
+  for (size_t step = 1; step <= n_groups; ++step) {
+    const unsigned char *group = m->ctrl + g * AG_STD_MAP_GROUP;
+
+    unsigned match = ag_std_map_group_match(group, h2);
+    while (match != 0) {
+      size_t slot = g * AG_STD_MAP_GROUP + (size_t)__builtin_ctz(match);
+      size_t i = m->slots[slot];
+      void *first = ag_std_pair_first(m->arr[i]);
+
+      if (m->hashes[i] == h
+          && ag_std_class_of(first) == key_class
+          && ag_std_cmp(first, key) == 0) {
+        return i;
+      }
+
+      match &= match - 1;
+    }
+
+    if (ag_std_map_group_match(group, AG_STD_MAP_EMPTY) != 0) {
+      break;
+    }
+
+    // Triangular steps visit every group once, since n_groups is 2^k.
+    g = (g + step) & (n_groups - 1);
+  }
+
+  return m->size;
+}
+
+// Internal function, point a free slot of the index at arr[i].
+void ag_std_map_place(struct ag_std_map *m, size_t i) {
+  const size_t n_groups = m->n_slots / AG_STD_MAP_GROUP;
+  size_t h = m->hashes[i];
+
+  size_t g = ag_std_map_h1(h) & (n_groups - 1);
+  for (size_t step = 1; ; ++step) {
+    unsigned char *group = m->ctrl + g * AG_STD_MAP_GROUP;
+
+    unsigned empty = ag_std_map_group_match(group, AG_STD_MAP_EMPTY);
+    if (empty != 0) {
+      size_t slot = g * AG_STD_MAP_GROUP + (size_t)__builtin_ctz(empty);
+      m->ctrl[slot] = ag_std_map_h2(h);
+      m->slots[slot] = i;
+      return;
+    }
+
+    g = (g + step) & (n_groups - 1);
+  }
+}
+
+// Internal function, rebuild the index with n_slots slots.
+int ag_std_map_rehash(struct ag_std_map *m, size_t n_slots) {
+  unsigned char *ctrl = malloc(n_slots);
+  size_t *slots = malloc(sizeof(size_t) * n_slots);
+  if (ctrl == NULL || slots == NULL) {
+    free(ctrl);
+    free(slots);
+    return -1;
+  }
+
+  free(m->ctrl);
+  free(m->slots);
+
+  m->ctrl = ctrl;
+  m->slots = slots;
+  m->n_slots = n_slots;
+  memset(m->ctrl, AG_STD_MAP_EMPTY, n_slots);
+
+  // The hashes are saved, so this doesn't call back into the keys.
+  for (size_t i = 0; i < m->size; ++i) {
+    ag_std_map_place(m, i);
+  }
+
+  return 0;
+}
+
+void ag_std_map_print(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_map][print]\n");
+  }
+
+  struct ag_std_map *m = obj;
+
+  if (m->size == 0) {
+    printf("ag_std_map([])");
+    return;
+  }
+
+  printf("ag_std_map([");
+  for (size_t i = 0; i < m->size - 1; ++i) {
+    ag_std_print(m->arr[i]);
+    printf(", ");
+  }
+
+  ag_std_print(m->arr[m->size - 1]);
+  printf("])");
+}
+
+// TODO: Remove this from the global namespace... somehow.
+// Had to put this here so ag_std_map_begin and ag_std_map_end
+// would know the type of object to create.
+void *ag_std_map_iter;
+
+// The map class is out here too, so that the benchmarks can make one.
+void *ag_std_map;
+
+void *ag_std_map_begin(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_map][begin]\n");
+  }
+
+  struct ag_std_map *m = obj;
+  return ag_std_new(ag_std_map_iter, m->arr, (size_t)0);
+}
+
+void *ag_std_map_end(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_map][end]\n");
+  }
+
+  struct ag_std_map *m = obj;
+  return ag_std_new(ag_std_map_iter, m->arr, m->size);
+}
+
+size_t ag_std_map_size(void *obj) {
+  struct ag_std_map *m = obj;
+  return m->size;
+}
+
+size_t ag_std_map_iter_size(void *obj) {
+  (void)obj;
+  return ((struct ag_std_vtable *)ag_std_map_iter)->size;
+}
+
+void *ag_std_map_begin_into(void *obj, void *storage) {
+  struct ag_std_map *m = obj;
+  return ag_std_new_at(storage, ag_std_map_iter, m->arr, (size_t)0);
+}
+
+void *ag_std_map_end_into(void *obj, void *storage) {
+  struct ag_std_map *m = obj;
+  return ag_std_new_at(storage, ag_std_map_iter, m->arr, m->size);
+}
+
+// We are inserting a pair: (key, value)
+// If the key is already in the map, the map is left as it is.
+void ag_std_map_insert(void *map_arg, void *obj) {
+  struct ag_std_map *m = map_arg;
+
+  void *key = ag_std_pair_first(obj);
+  size_t h = ag_std_hash(key);
+  if (ag_std_map_find(m, key, h) != m->size) {
+    return;
+  }
+
+  if (m->size == m->capacity) {
+    size_t capacity = m->capacity * 2;
+    void **arr = realloc(m->arr, sizeof(void *) * capacity);
+    if (arr == NULL) {
+      return;
+    }
+    m->arr = arr;
+
+    size_t *hashes = realloc(m->hashes, sizeof(size_t) * capacity);
+    if (hashes == NULL) {
+      return;
+    }
+    m->hashes = hashes;
+    m->capacity = capacity;
+  }
+
+  // Keep the index at most 7/8 full, so probes stay short.
+  if ((m->size + 1) * 8 > m->n_slots * 7
+      && ag_std_map_rehash(m, m->n_slots * 2) != 0) {
+    return;
+  }
+
+  m->arr[m->size] = ag_std_retain(obj);
+  m->hashes[m->size] = h;
+  ag_std_map_place(m, m->size);
+  m->size++;
+}
+
+void *ag_std_map_at(void *map_arg, void *key) {
+  struct ag_std_map *m = map_arg;
+
+  size_t i = ag_std_map_find(m, key, ag_std_hash(key));
+  if (i == m->size) {
+    return NULL;
+  }
+
+  return ag_std_pair_second(m->arr[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_btree (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* An ordered map of (key, value) pairs, kept sorted by the cmp of the keys
+ * (so all the keys should be of one class). It is a B+ tree: the pairs all
+ * live in the leaves, which are linked left to right, and the inner nodes
+ * only hold separator keys. That makes an in order walk, and any range
+ * of keys, a walk along the leaves.
+ *
+ * A node is four cache lines, with the key pointers packed together so a
+ * search within a node touches as little memory as possible.
+ */
+#define AG_STD_BTREE_CACHE_LINE 64
+#define AG_STD_BTREE_KEYS 14
+
+struct ag_std_btree_node {
+  size_t n;
+  struct ag_std_btree_node *next; // Leaves only, the leaf to the right.
+  void *keys[AG_STD_BTREE_KEYS];
+
+  // Children of an inner node (n + 1 of them), or pairs of a leaf (n).
+  void *ptrs[AG_STD_BTREE_KEYS + 1];
+};
+
+struct ag_std_btree {
+  struct object obj;
+
+  struct ag_std_btree_node *root;
+  size_t height; // 0 when the root is a leaf.
+  size_t size;
+};
+
+// Internal function, an empty node on its own cache lines.
+struct ag_std_btree_node *ag_std_btree_node_ctor(void) {
+  void *mem = NULL;
+  if (posix_memalign(&mem, AG_STD_BTREE_CACHE_LINE,
+        sizeof(struct ag_std_btree_node)) != 0) {
+    return NULL;
+  }
+
+  struct ag_std_btree_node *node = mem;
+  node->n = 0;
+  node->next = NULL;
+
+  return node;
+}
+
+// Internal function, take a node made ahead of a split off spares.
+struct ag_std_btree_node *ag_std_btree_spare(struct ag_std_btree_node **spares) {
+  struct ag_std_btree_node *node = *spares;
+  *spares = node->next;
+  node->next = NULL;
+
+  return node;
+}
+
+// Internal function, free a node and everything under it. The pairs in
+// the leaves go into items, or are released if there is no items.
+void ag_std_btree_node_dtor(struct ag_std_btree_node *node, size_t height,
+    void **items, size_t *n) {
+  if (height > 0) {
+    for (size_t i = 0; i <= node->n; ++i) {
+      ag_std_btree_node_dtor(node->ptrs[i], height - 1, items, n);
+    }
+  } else {
+    for (size_t i = 0; i < node->n; ++i) {
+      if (items != NULL) {
+        items[(*n)++] = node->ptrs[i];
+      } else {
+        ag_std_release(node->ptrs[i]);
+      }
+    }
+  }
+
+  free(node);
+}
+
+void *ag_std_btree_ctor(void *obj, va_list *app) {
+  (void)app;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_btree][ctor]\n");
+  }
+
+  struct ag_std_btree *t = obj;
+  t->root = ag_std_btree_node_ctor();
+  if (t->root == NULL) {
+    return NULL;
+  }
+  t->height = 0;
+  t->size = 0;
+
+  return obj;
+}
+
+void ag_std_btree_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_btree][dtor]\n");
+  }
+
+  // Like the map, the tree has a reference to each pair.
+  struct ag_std_btree *t = obj;
+  void **items = NULL;
+  if (t->size > AG_STD_RELEASE_INLINE) {
+    items = malloc(sizeof(void *) * t->size);
+  }
+
+  size_t n = 0;
+  ag_std_btree_node_dtor(t->root, t->height, items, &n);
+  if (items != NULL) {
+    ag_std_release_later(items, n, 0);
+  }
+
+  t->root = NULL;
+  t->size = 0;
+}
+
+// Internal function, the first leaf.
+struct ag_std_btree_node *ag_std_btree_first_leaf(struct ag_std_btree *t) {
+  struct ag_std_btree_node *node = t->root;
+  for (size_t h = t->height; h > 0; --h) {
+    node = node->ptrs[0];
+  }
+
+  return node;
+}
+
+void ag_std_btree_print(void *obj) {
+  struct ag_std_btree *t = obj;
+
+  printf("ag_std_btree([");
+  const char *sep = "";
+  for (struct ag_std_btree_node *leaf = ag_std_btree_first_leaf(t);
+      leaf != NULL;
+      leaf = leaf->next)
+  {
+    for (size_t i = 0; i < leaf->n; ++i) {
+      printf("%s", sep);
+      ag_std_print(leaf->ptrs[i]);
+      sep = ", ";
+    }
+  }
+  printf("])");
+}
+
+// Internal function, the first key in the node that is >= key (or > key
+// when strict is set). Binary search, keeping the cmp calls down.
+size_t ag_std_btree_search(struct ag_std_btree_node *node, void *key, int strict) {
+  size_t lo = 0;
+  size_t hi = node->n;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int res = ag_std_cmp(node->keys[mid], key);
+    if (res < 0 || (strict && res == 0)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Internal function, find the leaf position of the first key >= key (or
+// > key when strict is set). *leaf is NULL when there is no such key.
+void ag_std_btree_bound(
+    struct ag_std_btree *t,
+    void *key,
+    int strict,
+    struct ag_std_btree_node **leaf,
+    size_t *i)
+{
+  struct ag_std_btree_node *node = t->root;
+
+  // A separator is the smallest key of the subtree on its right, so a key
+  // equal to it lives on the right.
+  for (size_t h = t->height; h > 0; --h) {
+    node = node->ptrs[ag_std_btree_search(node, key, 1)];
+  }
+
+  size_t pos = ag_std_btree_search(node, key, strict);
+  if (pos == node->n) {
+    node = node->next;
+    pos = 0;
+  }
+
+  *leaf = node;
+  *i = pos;
+}
+
+void *ag_std_btree_at(void *tree_arg, void *key) {
+  struct ag_std_btree_node *leaf = NULL;
+  size_t i = 0;
+
+  ag_std_btree_bound(tree_arg, key, 0, &leaf, &i);
+  if (leaf != NULL && ag_std_cmp(leaf->keys[i], key) == 0) {
+    return ag_std_pair_second(leaf->ptrs[i]);
+  }
+
+  return NULL;
+}
+
+/* Internal function, insert into the subtree at node. Returns 1 if the
+ * node had to split, with the new right node and its separator filled in.
+ *
+ * above is how many nodes it takes above node if node splits: the full
+ * ones over it, and a new root if they go all the way up. A full leaf
+ * makes all the nodes the splits will take before it changes anything,
+ * and hands them up in spares; without the memory for them it returns -1,
+ * and the tree is as it was.
+ */
+int ag_std_btree_insert_rec(
+    struct ag_std_btree *t,
+    struct ag_std_btree_node *node,
+    size_t height,
+    size_t above,
+    void *key,
+    void *pair,
+    void **sep,
+    struct ag_std_btree_node **right,
+    struct ag_std_btree_node **spares)
+{
+  // Room for one key (and pointer) more than a node can hold.
+  void *keys[AG_STD_BTREE_KEYS + 1];
+  void *ptrs[AG_STD_BTREE_KEYS + 2];
+  size_t n = node->n;
+
+  if (height == 0) {
+    size_t pos = ag_std_btree_search(node, key, 0);
+    if (pos < n && ag_std_cmp(node->keys[pos], key) == 0) {
+      return 0;
+    }
+
+    if (n == AG_STD_BTREE_KEYS) {
+      for (size_t k = 0; k <= above; ++k) {
+        struct ag_std_btree_node *spare = ag_std_btree_node_ctor();
+        if (spare == NULL) {
+          while (*spares != NULL) {
+            struct ag_std_btree_node *next = (*spares)->next;
+            free(*spares);
+            *spares = next;
+          }
+          return -1;
+        }
+        spare->next = *spares;
+        *spares = spare;
+      }
+    }
+
+    t->size++;
+
+    if (n < AG_STD_BTREE_KEYS) {
+      memmove(&node->keys[pos + 1], &node->keys[pos], (n - pos) * sizeof(void *));
+      memmove(&node->ptrs[pos + 1], &node->ptrs[pos], (n - pos) * sizeof(void *));
+      node->keys[pos] = key;
+      node->ptrs[pos] = pair;
+      node->n++;
+      return 0;
+    }
+
+    // Full leaf: lay out all n + 1 pairs, then split them in two.
+    memcpy(keys, node->keys, pos * sizeof(void *));
+    memcpy(ptrs, node->ptrs, pos * sizeof(void *));
+    keys[pos] = key;
+    ptrs[pos] = pair;
+    memcpy(&keys[pos + 1], &node->keys[pos], (n - pos) * sizeof(void *));
+    memcpy(&ptrs[pos + 1], &node->ptrs[pos], (n - pos) * sizeof(void *));
+
+    struct ag_std_btree_node *r = ag_std_btree_spare(spares);
+    size_t left_n = (n + 1) / 2;
+
+    node->n = left_n;
+    memcpy(node->keys, keys, left_n * sizeof(void *));
+    memcpy(node->ptrs, ptrs, left_n * sizeof(void *));
+
+    r->n = n + 1 - left_n;
+    memcpy(r->keys, &keys[left_n], r->n * sizeof(void *));
+    memcpy(r->ptrs, &ptrs[left_n], r->n * sizeof(void *));
+
+    r->next = node->next;
+    node->next = r;
+
+    *sep = r->keys[0];
+    *right = r;
+    return 1;
+  }
+
+  size_t pos = ag_std_btree_search(node, key, 1);
+  void *child_sep = NULL;
+  struct ag_std_btree_node *child_right = NULL;
+
+  int res = ag_std_btree_insert_rec(t, node->ptrs[pos], height - 1,
+      n == AG_STD_BTREE_KEYS ? above + 1 : 0, key, pair, &child_sep, &child_right, spares);
+  if (res != 1) {
+    return res;
+  }
+
+  // The child split, so its separator and new right half go in here.
+  if (n < AG_STD_BTREE_KEYS) {
+    memmove(&node->keys[pos + 1], &node->keys[pos], (n - pos) * sizeof(void *));
+    memmove(&node->ptrs[pos + 2], &node->ptrs[pos + 1], (n - pos) * sizeof(void *));
+    node->keys[pos] = child_sep;
+    node->ptrs[pos + 1] = child_right;
+    node->n++;
+    return 0;
+  }
+
+  memcpy(keys, node->keys, pos * sizeof(void *));
+  keys[pos] = child_sep;
+  memcpy(&keys[pos + 1], &node->keys[pos], (n - pos) * sizeof(void *));
+
+  memcpy(ptrs, node->ptrs, (pos + 1) * sizeof(void *));
+  ptrs[pos + 1] = child_right;
+  memcpy(&ptrs[pos + 2], &node->ptrs[pos + 1], (n - pos) * sizeof(void *));
+
+  // The middle key moves up, the ones either side of it stay down here.
+  struct ag_std_btree_node *r = ag_std_btree_spare(spares);
+  size_t mid = (n + 1) / 2;
+
+  node->n = mid;
+  memcpy(node->keys, keys, mid * sizeof(void *));
+  memcpy(node->ptrs, ptrs, (mid + 1) * sizeof(void *));
+
+  r->n = n - mid;
+  memcpy(r->keys, &keys[mid + 1], r->n * sizeof(void *));
+  memcpy(r->ptrs, &ptrs[mid + 1], (r->n + 1) * sizeof(void *));
+
+  *sep = keys[mid];
+  *right = r;
+  return 1;
+}
+
+// We are inserting a pair: (key, value)
+// If the key is already in the tree, the tree is left as it is. Returns -1
+// (the tree again left as it is) if there was no memory for the pair.
+int ag_std_btree_insert(void *tree_arg, void *obj) {
+  struct ag_std_btree *t = tree_arg;
+
+  void *sep = NULL;
+  struct ag_std_btree_node *right = NULL;
+  struct ag_std_btree_node *spares = NULL;
+  size_t size = t->size;
+
+  int res = ag_std_btree_insert_rec(t, t->root, t->height, 1,
+      ag_std_pair_first(obj), obj, &sep, &right, &spares);
+  if (res < 0) {
+    return -1;
+  }
+  if (res == 1) {
+    // The root split, so the tree gets taller.
+    struct ag_std_btree_node *root = ag_std_btree_spare(&spares);
+    root->n = 1;
+    root->keys[0] = sep;
+    root->ptrs[0] = t->root;
+    root->ptrs[1] = right;
+
+    t->root = root;
+    t->height++;
+  }
+
+  // A new pair, not a key that was already there.
+  if (t->size != size) {
+    ag_std_retain(obj);
+  }
+
+  return 0;
+}
+
+// The class is out here too, so that the btree functions can make one.
+void *ag_std_btree_iter;
+
+// The classes are out here too, so that the benchmarks can make them.
+void *ag_std_btree;
+void *ag_std_btree_range;
+
+size_t ag_std_btree_iter_size(void *obj) {
+  (void)obj;
+  return ((struct ag_std_vtable *)ag_std_btree_iter)->size;
+}
+
+size_t ag_std_btree_size(void *obj) {
+  struct ag_std_btree *t = obj;
+  return t->size;
+}
+
+// Internal function, the leaf of the first pair (NULL if there is none).
+struct ag_std_btree_node *ag_std_btree_begin_leaf(void *obj) {
+  struct ag_std_btree_node *leaf = ag_std_btree_first_leaf(obj);
+  return leaf->n == 0 ? NULL : leaf;
+}
+
+void *ag_std_btree_begin(void *obj) {
+  return ag_std_new(ag_std_btree_iter, ag_std_btree_begin_leaf(obj), (size_t)0);
+}
+
+// One past the last pair is "no leaf".
+void *ag_std_btree_end(void *obj) {
+  (void)obj;
+  return ag_std_new(ag_std_btree_iter, NULL, (size_t)0);
+}
+
+void *ag_std_btree_begin_into(void *obj, void *storage) {
+  return ag_std_new_at(storage, ag_std_btree_iter,
+      ag_std_btree_begin_leaf(obj), (size_t)0);
+}
+
+void *ag_std_btree_end_into(void *obj, void *storage) {
+  (void)obj;
+  return ag_std_new_at(storage, ag_std_btree_iter, NULL, (size_t)0);
+}
+
+// Iterator at the first pair whose key is >= key.
+void *ag_std_btree_lower_bound_into(void *tree_arg, void *key, void *storage) {
+  struct ag_std_btree_node *leaf = NULL;
+  size_t i = 0;
+
+  ag_std_btree_bound(tree_arg, key, 0, &leaf, &i);
+  return ag_std_new_at(storage, ag_std_btree_iter, leaf, i);
+}
+
+// Iterator at the first pair whose key is > key.
+void *ag_std_btree_upper_bound_into(void *tree_arg, void *key, void *storage) {
+  struct ag_std_btree_node *leaf = NULL;
+  size_t i = 0;
+
+  ag_std_btree_bound(tree_arg, key, 1, &leaf, &i);
+  return ag_std_new_at(storage, ag_std_btree_iter, leaf, i);
+}
+
+void *ag_std_btree_lower_bound(void *tree_arg, void *key) {
+  struct ag_std_btree_node *leaf = NULL;
+  size_t i = 0;
+
+  ag_std_btree_bound(tree_arg, key, 0, &leaf, &i);
+  return ag_std_new(ag_std_btree_iter, leaf, i);
+}
+
+void *ag_std_btree_upper_bound(void *tree_arg, void *key) {
+  struct ag_std_btree_node *leaf = NULL;
+  size_t i = 0;
+
+  ag_std_btree_bound(tree_arg, key, 1, &leaf, &i);
+  return ag_std_new(ag_std_btree_iter, leaf, i);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_btree_range (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* A view of the pairs of a tree with lo <= key <= hi, in order:
+ *
+ *   void *rng = ag_std_new(ag_std_btree_range, tree, lo, hi);
+ *   ag_std_range_print(rng);
+ *
+ * Either bound can be NULL, meaning the range is open on that side.
+ */
+struct ag_std_btree_range {
+  struct object obj;
+
+  void *tree;
+  void *lo;
+  void *hi;
+};
+
+void *ag_std_btree_range_ctor(void *obj, va_list *app) {
+  struct ag_std_btree_range *r = obj;
+  r->tree = va_arg(*app, void *);
+  r->lo = va_arg(*app, void *);
+  r->hi = va_arg(*app, void *);
+
+  return obj;
+}
+
+void ag_std_btree_range_print(void *obj) {
+  struct ag_std_btree_range *r = obj;
+
+  printf("ag_std_btree_range(");
+  if (r->lo != NULL) {
+    ag_std_print(r->lo);
+  }
+  printf(", ");
+  if (r->hi != NULL) {
+    ag_std_print(r->hi);
+  }
+  printf(")");
+}
+
+// Internal function, is lo > hi? Then the range is empty, and begin is
+// made the same as end: lower_bound(lo) would be past upper_bound(hi), and
+// never meet it.
+int ag_std_btree_range_inverted(struct ag_std_btree_range *r) {
+  return r->lo != NULL && r->hi != NULL && ag_std_cmp(r->lo, r->hi) > 0;
+}
+
+void *ag_std_btree_range_end_into(void *obj, void *storage);
+void *ag_std_btree_range_end(void *obj);
+
+void *ag_std_btree_range_begin_into(void *obj, void *storage) {
+  struct ag_std_btree_range *r = obj;
+  if (ag_std_btree_range_inverted(r)) {
+    return ag_std_btree_range_end_into(obj, storage);
+  }
+  if (r->lo == NULL) {
+    return ag_std_btree_begin_into(r->tree, storage);
+  }
+
+  return ag_std_btree_lower_bound_into(r->tree, r->lo, storage);
+}
+
+void *ag_std_btree_range_end_into(void *obj, void *storage) {
+  struct ag_std_btree_range *r = obj;
+  if (r->hi == NULL) {
+    return ag_std_btree_end_into(r->tree, storage);
+  }
+
+  return ag_std_btree_upper_bound_into(r->tree, r->hi, storage);
+}
+
+void *ag_std_btree_range_begin(void *obj) {
+  struct ag_std_btree_range *r = obj;
+  if (ag_std_btree_range_inverted(r)) {
+    return ag_std_btree_range_end(obj);
+  }
+  if (r->lo == NULL) {
+    return ag_std_btree_begin(r->tree);
+  }
+
+  return ag_std_btree_lower_bound(r->tree, r->lo);
+}
+
+void *ag_std_btree_range_end(void *obj) {
+  struct ag_std_btree_range *r = obj;
+  if (r->hi == NULL) {
+    return ag_std_btree_end(r->tree);
+  }
+
+  return ag_std_btree_upper_bound(r->tree, r->hi);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// iota_view
+///////////////////////////////////////////////////////////////////////////////
+
+struct ag_std_iota_view {
+  struct object obj;
+  int size;
+};
+
+void *ag_std_iota_view_ctor(void *obj, va_list *app) {
+  // does nothing.
+  (void)app;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_iota_view][ctor]\n");
+  }
+
+  struct ag_std_iota_view *v = obj;
+
+  // TODO: Should this be... an integer object?
+  // For now, we can do this, but later it might be better
+  // to instead use the integer object.
+
+  // TODO: Call the parent ctor.
+  v->size = va_arg(*app, int);
+
+  return obj;
+}
+
+void ag_std_iota_view_dtor(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_iota_view][dtor]\n");
+  }
+
+  // TODO: Free the data.
+}
+
+void ag_std_iota_view_print(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_iota_view][print]\n");
+  }
+
+  struct ag_std_iota_view *iv = obj;
+  printf("ag_std_iota_view(%d)", iv->size);
+}
+
+size_t ag_std_iota_view_size(void *obj) {
+  struct ag_std_iota_view *iv = obj;
+  return (size_t)iv->size;
+}
+
+// TODO: Remove this from the global namespace... somehow.
+// Had to put this here so vec_begin and vec_end would know the type of
+// object to create.
+void *ag_std_iota_view_iter;
+
+// The view class is out here too, so that the benchmarks can make one.
+void *ag_std_iota_view;
+
+void *ag_std_iota_view_begin(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_iota_view][begin]\n");
+  }
+
+  // We don't even need to reference the obj.
+  return ag_std_new(ag_std_iota_view_iter, 0);
+}
+
+void *ag_std_iota_view_end(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_iota_view][end]\n");
+  }
+
+  struct ag_std_iota_view *iv = obj;
+  return ag_std_new(ag_std_iota_view_iter, iv->size);
+}
+
+size_t ag_std_iota_view_iter_size(void *obj) {
+  (void)obj;
+  return ((struct ag_std_vtable *)ag_std_iota_view_iter)->size;
+}
+
+void *ag_std_iota_view_begin_into(void *obj, void *storage) {
+  (void)obj;
+  return ag_std_new_at(storage, ag_std_iota_view_iter, 0);
+}
+
+void *ag_std_iota_view_end_into(void *obj, void *storage) {
+  struct ag_std_iota_view *iv = obj;
+  return ag_std_new_at(storage, ag_std_iota_view_iter, iv->size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_zip_view
+///////////////////////////////////////////////////////////////////////////////
+
+/* Walks up to AG_STD_ZIP_MAX ranges side by side and stops at the end of
+ * the shortest one. A zip of two hands out pairs, like it always has:
+ *
+ *   void *zv = ag_std_new(ag_std_zip_view, rng_a, rng_b);
+ *
+ * and ag_std_zip_n_view zips any number of them, handing out tuples:
+ *
+ *   void *rngs[3] = { a, b, c };
+ *   void *zv = ag_std_new(ag_std_zip_n_view, 3, rngs);
+ */
+#define AG_STD_ZIP_MAX AG_STD_TUPLE_MAX
+
+struct ag_std_zip_view {
+  struct object obj;
+
+  // The ranges, in the order they show up in each pair or tuple.
+  size_t n;
+  void *rngs[AG_STD_ZIP_MAX];
+};
+
+void *ag_std_zip_view_ctor(void *obj, va_list *app) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view][ctor]\n");
+  }
+
+  struct ag_std_zip_view *v = obj;
+
+  // TODO: Call the parent ctor.
+  v->n = 2;
+  v->rngs[0] = va_arg(*app, void *);
+  v->rngs[1] = va_arg(*app, void *);
+
+  return obj;
+}
+
+// ag_std_new(ag_std_zip_n_view, n, rngs). More than AG_STD_ZIP_MAX ranges
+// (or fewer than none) gives NULL.
+void *ag_std_zip_n_view_ctor(void *obj, va_list *app) {
+  struct ag_std_zip_view *v = obj;
+
+  int n = va_arg(*app, int);
+  void **rngs = va_arg(*app, void **);
+  if (n < 0 || n > AG_STD_ZIP_MAX) {
+    return NULL;
+  }
+
+  v->n = (size_t)n;
+
+  for (size_t i = 0; i < v->n; ++i) {
+    v->rngs[i] = rngs[i];
+  }
+
+  return obj;
+}
+
+void ag_std_zip_view_dtor(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view][dtor]\n");
+  }
+
+  // TODO: Free the data.
+}
+
+void ag_std_zip_view_print(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view][print]\n");
+  }
+
+  // TODO: Some actual printing?
+  // struct ag_std_zip_view *iv = obj;
+}
+
+// TODO: Remove this from the global namespace... somehow.
+// Had to put this here so vec_begin and vec_end would know the type of
+// object to create.
+void *ag_std_zip_view_iter;
+void *ag_std_pair;
+void *ag_std_tuple;
+
+// The view classes are out here too, so that the benchmarks can make them.
+void *ag_std_zip_view;
+void *ag_std_zip_n_view;
+
+// Forward declare these so that the zip_view_begin has them.
+void *ag_std_begin(void *obj);
+void *ag_std_end(void *obj);
+extern int ag_std_size_sel;
+size_t ag_std_size(void *obj);
+
+/* If every range knows its size, how many elements the zip has: the
+ * iterators can then count instead of comparing every sub-iterator with
+ * its end. Returns 0 if some range doesn't know.
+ */
+int ag_std_zip_view_len(struct ag_std_zip_view *v, size_t *len) {
+  size_t min = SIZE_MAX;
+  for (size_t i = 0; i < v->n; ++i) {
+    if (!ag_std_responds_to(v->rngs[i], ag_std_size_sel)) {
+      return 0;
+    }
+
+    size_t len_i = ag_std_size(v->rngs[i]);
+    if (len_i < min) {
+      min = len_i;
+    }
+  }
+
+  *len = v->n == 0 ? 0 : min;
+  return 1;
+}
+
+// The room a zip iterator needs past its own struct. See the zip iterator.
+size_t ag_std_zip_view_rest_size(struct ag_std_zip_view *v) {
+  void *slot_vt = v->n == 2 ? ag_std_pair : ag_std_tuple;
+
+  size_t size = AG_STD_ITER_BATCH
+    * ag_std_iter_round(((struct ag_std_vtable *)slot_vt)->size);
+  for (size_t i = 0; i < v->n; ++i) {
+    size += ag_std_iter_round(ag_std_iter_size(v->rngs[i]));
+  }
+
+  return size;
+}
+
+// A heap iterator keeps the rest in a block of its own, which its dtor
+// frees. NULL if there is no memory for either.
+void *ag_std_zip_view_heap_iter(struct ag_std_zip_view *v, int at_end) {
+  size_t size = ag_std_zip_view_rest_size(v);
+  void *rest = malloc(size);
+  if (rest == NULL && size > 0) {
+    return NULL;
+  }
+
+  void *it = ag_std_new(ag_std_zip_view_iter, v, rest, at_end, 1);
+  if (it == NULL) {
+    free(rest);
+  }
+
+  return it;
+}
+
+void *ag_std_zip_view_begin(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view][begin]\n");
+  }
+
+  return ag_std_zip_view_heap_iter(obj, 0);
+}
+
+void *ag_std_zip_view_end(void *obj) {
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view][end]\n");
+  }
+
+  return ag_std_zip_view_heap_iter(obj, 1);
+}
+
+size_t ag_std_zip_view_iter_size(void *obj) {
+  return ag_std_iter_round(((struct ag_std_vtable *)ag_std_zip_view_iter)->size)
+    + ag_std_zip_view_rest_size(obj);
+}
+
+// Internal function, lay out a zip iterator in storage, the rest right
+// after the iterator.
+void *ag_std_zip_view_into(void *obj, void *storage, int at_end) {
+  char *rest = (char *)storage
+    + ag_std_iter_round(((struct ag_std_vtable *)ag_std_zip_view_iter)->size);
+
+  return ag_std_new_at(storage, ag_std_zip_view_iter, obj, rest, at_end, 0);
+}
+
+void *ag_std_zip_view_begin_into(void *obj, void *storage) {
+  return ag_std_zip_view_into(obj, storage, 0);
+}
+
+void *ag_std_zip_view_end_into(void *obj, void *storage) {
+  return ag_std_zip_view_into(obj, storage, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Views - filter, transform, take, drop, enumerate
+///////////////////////////////////////////////////////////////////////////////
+
+/* Lazy views over another range. Nothing is worked out up front: each
+ * view's iterator wraps the iterator of the range under it, so a stack of
+ * them
+ *
+ *   void *evens = ag_std_new(ag_std_filter_view, v, is_even);
+ *   void *squares = ag_std_new(ag_std_transform_view, evens, square);
+ *   void *first = ag_std_new(ag_std_take_view, squares, 10);
+ *
+ * is walked in one pass, with all of the iterators in the one block the
+ * outermost was built in (begin_into), and nothing made per stage or per
+ * element. next_batch goes down the stack the same way, so a batch costs
+ * one call per view and not one per element.
+ *
+ * The classes share this struct, and all but drop share the iterator
+ * struct too. A drop view's iterators are the range's own, moved along.
+ */
+
+struct ag_std_view {
+  struct object obj;
+
+  // The range under this one.
+  void *rng;
+
+  // Which of these is set depends on the class.
+  ag_std_pred_fn pred;
+  ag_std_get_fn fn;
+  size_t n;
+
+  // The class of its iterators.
+  void *iter_vt;
+};
+
+// The iterators of all of them but drop. See ag_std_view_iter.
+struct ag_std_view_iter {
+  struct object obj;
+
+  struct ag_std_view *v;
+
+  // The iterator of the range under it.
+  void *base;
+
+  // A filter needs the end of that range, to know when to stop looking.
+  void *base_end;
+
+  // How many elements it has gone past (take and enumerate).
+  size_t i;
+
+  char *slots;
+  size_t slot_size;
+
+  // The rest, if this iterator has to free it.
+  void *heap;
+};
+
+// The view classes, and the classes of their iterators.
+void *ag_std_filter_view;
+void *ag_std_transform_view;
+void *ag_std_take_view;
+void *ag_std_drop_view;
+void *ag_std_enumerate_view;
+
+void *ag_std_filter_view_iter;
+void *ag_std_transform_view_iter;
+void *ag_std_take_view_iter;
+void *ag_std_enumerate_view_iter;
+
+// Internal function, the part every ctor does.
+struct ag_std_view *ag_std_view_init(void *obj, va_list *app, void *iter_vt) {
+  struct ag_std_view *v = obj;
+
+  v->rng = va_arg(*app, void *);
+  v->pred = NULL;
+  v->fn = NULL;
+  v->n = 0;
+  v->iter_vt = iter_vt;
+
+  return v;
+}
+
+// ag_std_new(ag_std_filter_view, rng, pred): the elements pred is true for.
+void *ag_std_filter_view_ctor(void *obj, va_list *app) {
+  struct ag_std_view *v = ag_std_view_init(obj, app, ag_std_filter_view_iter);
+  v->pred = va_arg(*app, ag_std_pred_fn);
+  return obj;
+}
+
+// ag_std_new(ag_std_transform_view, rng, fn): fn of each element. What fn
+// returns has to stay good as long as its argument does (an immediate, a
+// new object or a part of the argument all do).
+void *ag_std_transform_view_ctor(void *obj, va_list *app) {
+  struct ag_std_view *v = ag_std_view_init(obj, app, ag_std_transform_view_iter);
+  v->fn = va_arg(*app, ag_std_get_fn);
+  return obj;
+}
+
+// ag_std_new(ag_std_take_view, rng, n): the first n elements, or all of
+// them if there are fewer.
+void *ag_std_take_view_ctor(void *obj, va_list *app) {
+  struct ag_std_view *v = ag_std_view_init(obj, app, ag_std_take_view_iter);
+  int n = va_arg(*app, int);
+  v->n = n < 0 ? 0 : (size_t)n;
+  return obj;
+}
+
+// ag_std_new(ag_std_drop_view, rng, n): all but the first n elements.
+void *ag_std_drop_view_ctor(void *obj, va_list *app) {
+  struct ag_std_view *v = ag_std_view_init(obj, app, NULL);
+  int n = va_arg(*app, int);
+  v->n = n < 0 ? 0 : (size_t)n;
+  return obj;
+}
+
+// ag_std_new(ag_std_enumerate_view, rng): (index, element) pairs. The
+// index is an immediate integer, so counting makes no objects.
+void *ag_std_enumerate_view_ctor(void *obj, va_list *app) {
+  ag_std_view_init(obj, app, ag_std_enumerate_view_iter);
+  return obj;
+}
+
+void ag_std_view_print(void *obj) {
+  struct ag_std_view *v = obj;
+  struct ag_std_vtable *vt = ag_std_class_of(obj);
+
+  printf("%s(", vt->name);
+  ag_std_print(v->rng);
+  if (v->iter_vt == ag_std_take_view_iter || v->iter_vt == NULL) {
+    printf(", %zu", v->n);
+  }
+  printf(")");
+}
+
+/* The room a view iterator needs past its own struct:
+ *
+ *   [ view_iter ][ pairs (enumerate) ][ iter of rng ][ end of rng (filter) ]
+ */
+size_t ag_std_view_rest_size(struct ag_std_view *v) {
+  size_t size = ag_std_iter_round(ag_std_iter_size(v->rng));
+
+  if (v->iter_vt == ag_std_filter_view_iter) {
+    size *= 2;
+  } else if (v->iter_vt == ag_std_enumerate_view_iter) {
+    size += AG_STD_ITER_BATCH
+      * ag_std_iter_round(((struct ag_std_vtable *)ag_std_pair)->size);
+  }
+
+  return size;
+}
+
+// A heap iterator keeps the rest in a block of its own, which its dtor
+// frees. NULL if there is no memory for either.
+void *ag_std_view_heap_iter(struct ag_std_view *v, int at_end) {
+  void *rest = malloc(ag_std_view_rest_size(v));
+  if (rest == NULL) {
+    return NULL;
+  }
+
+  void *it = ag_std_new(v->iter_vt, v, rest, at_end, 1);
+  if (it == NULL) {
+    free(rest);
+  }
+
+  return it;
+}
+
+void *ag_std_view_begin(void *obj) {
+  return ag_std_view_heap_iter(obj, 0);
+}
+
+void *ag_std_view_end(void *obj) {
+  return ag_std_view_heap_iter(obj, 1);
+}
+
+size_t ag_std_view_iter_size(void *obj) {
+  struct ag_std_view *v = obj;
+  return ag_std_iter_round(((struct ag_std_vtable *)v->iter_vt)->size)
+    + ag_std_view_rest_size(v);
+}
+
+void *ag_std_view_begin_into(void *obj, void *storage) {
+  struct ag_std_view *v = obj;
+  char *rest = (char *)storage
+    + ag_std_iter_round(((struct ag_std_vtable *)v->iter_vt)->size);
+
+  return ag_std_new_at(storage, v->iter_vt, v, rest, 0, 0);
+}
+
+void *ag_std_view_end_into(void *obj, void *storage) {
+  struct ag_std_view *v = obj;
+  char *rest = (char *)storage
+    + ag_std_iter_round(((struct ag_std_vtable *)v->iter_vt)->size);
+
+  return ag_std_new_at(storage, v->iter_vt, v, rest, 1, 0);
+}
+
+// Internal function, move it past n elements (or to end, if sooner).
+void ag_std_drop_view_skip(void *it, void *end, size_t n) {
+  void *skipped[AG_STD_ITER_BATCH];
+  while (n > 0) {
+    size_t k = ag_std_iter_next_batch(
+        it, end, skipped, n < AG_STD_ITER_BATCH ? n : AG_STD_ITER_BATCH);
+    if (k == 0) {
+      break;
+    }
+    n -= k;
+  }
+}
+
+void *ag_std_drop_view_begin(void *obj) {
+  struct ag_std_view *v = obj;
+
+  void *it = ag_std_begin(v->rng);
+  void *end = ag_std_end(v->rng);
+  ag_std_drop_view_skip(it, end, v->n);
+  ag_std_delete(end);
+
+  return it;
+}
+
+void *ag_std_drop_view_end(void *obj) {
+  struct ag_std_view *v = obj;
+  return ag_std_end(v->rng);
+}
+
+size_t ag_std_drop_view_iter_size(void *obj) {
+  struct ag_std_view *v = obj;
+  return ag_std_iter_size(v->rng);
+}
+
+void *ag_std_drop_view_begin_into(void *obj, void *storage) {
+  struct ag_std_view *v = obj;
+
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(v->rng)];
+  void *end = ag_std_end_into(v->rng, end_buf);
+
+  void *it = ag_std_begin_into(v->rng, storage);
+  ag_std_drop_view_skip(it, end, v->n);
+
+  return it;
+}
+
+void *ag_std_drop_view_end_into(void *obj, void *storage) {
+  struct ag_std_view *v = obj;
+  return ag_std_end_into(v->rng, storage);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// container_vtable (derived from vtable)
+///////////////////////////////////////////////////////////////////////////////
+/* A container class overrides begin, end, begin_into, end_into and
+ * iter_size. Those are selectors like any other, so vtable_ctor fills them
+ * in, and the container vtable needs nothing more than the vtable.
+ *
+ * begin_into and end_into build iterators in storage the caller provides,
+ * instead of the heap. iter_size says how many bytes that storage needs
+ * for this container.
+ */
+struct container_vtable {
+  struct ag_std_vtable vt;
+};
+
+void *container_vtable_ctor(void *obj, va_list *app) {
+
+  // Run the parent ctor using super.
+  // We don't need to keep track of who the parent is.
+  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
+  if (super->methods[AG_STD_SEL_CTOR] == NULL) {
+    printf("super ctor is null??\n");
+  } else {
+    AG_STD_METHOD(super, AG_STD_SEL_CTOR, ag_std_ctor_fn)(obj, app);
+  }
+
+  if (DEBUG_MSG) {
+    printf("[container_vtable][ctor]\n");
+  }
+
+  return obj;
+}
+
+void container_vtable_dtor(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[container_vtable][dtor]\n");
+  }
+}
+
+void *ag_std_begin(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, AG_STD_SEL_BEGIN, ag_std_get_fn)(obj);
+}
+
+void *ag_std_end(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, AG_STD_SEL_END, ag_std_get_fn)(obj);
+}
+
+void *ag_std_begin_into(void *obj, void *storage) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, AG_STD_SEL_BEGIN_INTO, ag_std_into_fn)(obj, storage);
+}
+
+void *ag_std_end_into(void *obj, void *storage) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, AG_STD_SEL_END_INTO, ag_std_into_fn)(obj, storage);
+}
+
+size_t ag_std_iter_size(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, AG_STD_SEL_ITER_SIZE, ag_std_size_fn)(obj);
+}
+
+/* How many elements a container holds. This one is not built in: main
+ * adds it with ag_std_selector() before making the classes, the same way
+ * code outside the library would add a generic function of its own.
+ */
+int ag_std_size_sel = -1;
+
+size_t ag_std_size(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, ag_std_size_sel, ag_std_size_fn)(obj);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// iterator_vtable (derived from vtable)
+///////////////////////////////////////////////////////////////////////////////
+/* An iterator class overrides increment, deref, not_equal and (if it can)
+ * next_batch. Like the container methods, those are filled in by
+ * vtable_ctor.
+ */
+struct iterator_vtable {
+  struct ag_std_vtable vt;
+};
+
+void *iterator_vtable_ctor(void *obj, va_list *app) {
+
+  // Run the parent ctor using super.
+  // We don't need to keep track of who the parent is.
+  struct ag_std_vtable *super = (struct ag_std_vtable *)ag_std_super(obj);
+  if (super->methods[AG_STD_SEL_CTOR] == NULL) {
+    printf("super ctor is null??\n");
+  } else {
+    AG_STD_METHOD(super, AG_STD_SEL_CTOR, ag_std_ctor_fn)(obj, app);
+  }
+
+  if (DEBUG_MSG) {
+    printf("[iterator_vtable][ctor]\n");
+  }
+
+  return obj;
+}
+
+void iterator_vtable_dtor(void *obj) {
+  (void)obj;
+
+  if (DEBUG_MSG) {
+    printf("[iterator_vtable][dtor]\n");
+  }
+}
+
+void ag_std_iter_increment(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  AG_STD_METHOD(vt, AG_STD_SEL_INCREMENT, ag_std_void_fn)(obj);
+}
+
+void *ag_std_iter_deref(void *obj) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  return AG_STD_METHOD(vt, AG_STD_SEL_DEREF, ag_std_get_fn)(obj);
+}
+
+int ag_std_iter_not_equal(void *obj_a, void *obj_b) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj_a;
+  return AG_STD_METHOD(vt, AG_STD_SEL_NOT_EQUAL, ag_std_cmp_fn)(obj_a, obj_b);
+}
+
+/* Batches: ag_std_iter_next_batch puts the next (up to) n elements between
+ * obj and end into out, moves obj past them, and returns how many it put
+ * there. It only returns 0 once obj has reached end.
+ *
+ * That is one indirect call per batch instead of three per element. An
+ * iterator class that hands out pointers that stay good (list, vector, map,
+ * btree...) registers a next_batch, and fills the whole batch. The rest
+ * (like the typed vector iterator, whose deref refills one box) get a
+ * batch of one at a time, built out of increment / deref / not_equal, so
+ * the callers can always use batches.
+ */
+size_t ag_std_iter_next_batch(void *obj, void *end, void **out, size_t n) {
+  struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
+  if (vt->methods[AG_STD_SEL_NEXT_BATCH] != NULL) {
+    return AG_STD_METHOD(vt, AG_STD_SEL_NEXT_BATCH, ag_std_batch_fn)(obj, end, out, n);
+  }
+
+  if (n == 0 || !AG_STD_METHOD(vt, AG_STD_SEL_NOT_EQUAL, ag_std_cmp_fn)(obj, end)) {
+    return 0;
+  }
+
+  out[0] = AG_STD_METHOD(vt, AG_STD_SEL_DEREF, ag_std_get_fn)(obj);
+  AG_STD_METHOD(vt, AG_STD_SEL_INCREMENT, ag_std_void_fn)(obj);
+  return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_list_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+void *ag_std_list_iter_ctor(void *obj, va_list *app) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_list_iter_ctor]\n");
+  }
+
+  // TODO
+  // Need to call the super ctor.
+
+  struct ag_std_list_iter *li = obj;
+  li->c = va_arg(*app, struct ag_std_list_node *);
+  li->i = 0;
+
+  return obj;
+}
+
+void ag_std_list_iter_dtor(void *obj) {
+  // TODO
+  (void)obj;
+}
+
+void ag_std_list_iter_print(void *obj) {
+  (void)obj;
+  printf("[ag_std_list_iter][print]");
+}
+
+void ag_std_list_iter_increment(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_list_iter_inc]\n");
+  }
+  struct ag_std_list_iter *li = obj;
+  if (++li->i >= li->c->n) {
+    li->c = li->c->next;
+    li->i = 0;
+  }
+}
+
+void *ag_std_list_iter_deref(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_list_iter_deref]\n");
+  }
+
+  struct ag_std_list_iter *li = obj;
+  return li->c->objs[li->i];
+}
+
+int ag_std_list_iter_not_equal(void *obj_a, void *obj_b) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_list_iter_neq]\n");
+  }
+
+  struct ag_std_list_iter *a = obj_a;
+  struct ag_std_list_iter *b = obj_b;
+
+  return a->c != b->c || a->i != b->i;
+}
+
+size_t ag_std_list_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_list_iter *li = obj;
+  struct ag_std_list_iter *end = end_arg;
+  struct ag_std_list_node *c = li->c;
+  size_t i = li->i;
+
+  // A node's elements at a time.
+  size_t k = 0;
+  while (k < n && (c != end->c || i < end->i)) {
+    size_t stop = c == end->c ? end->i : c->n;
+    size_t m = stop - i < n - k ? stop - i : n - k;
+    memcpy(out + k, c->objs + i, m * sizeof(void *));
+    k += m;
+    i += m;
+
+    if (i == c->n && c != end->c) {
+      c = c->next;
+      i = 0;
+    }
+  }
+
+  li->c = c;
+  li->i = i;
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_vector_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+struct ag_std_vector_iter {
+  struct object obj;
+
+  void **arr;
+  size_t i;
+};
+
+void *ag_std_vector_iter_ctor(void *obj, va_list *app) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_ctor]\n");
+  }
+
+  // TODO
+  // Need to call the super ctor.
+
+  struct ag_std_vector_iter *vi = obj;
+  vi->arr = va_arg(*app, void **);
+  vi->i = va_arg(*app, size_t);
+
+  return obj;
+}
+
+void ag_std_vector_iter_dtor(void *obj) {
+  // TODO
+  (void)obj;
+}
+
+void ag_std_vector_iter_print(void *obj) {
+  (void)obj;
+  printf("[ag_std_vector_iter][print]");
+}
+
+void ag_std_vector_iter_increment(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_inc]\n");
+  }
+  struct ag_std_vector_iter *vi = obj;
+  vi->i++;
+}
+
+void *ag_std_vector_iter_deref(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_deref]\n");
+  }
+
+  struct ag_std_vector_iter *vi = obj;
+  return vi->arr[vi->i];
+}
+
+int ag_std_vector_iter_not_equal(void *obj_a, void *obj_b) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_neq]\n");
+  }
+
+  struct ag_std_vector_iter *a = obj_a;
+  struct ag_std_vector_iter *b = obj_b;
+
+  return a->i != b->i;
+}
+
+// The elements are already in an array, a batch is one memcpy.
+size_t ag_std_vector_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_vector_iter *vi = obj;
+  struct ag_std_vector_iter *end = end_arg;
+
+  size_t k = end->i - vi->i;
+  if (k > n) {
+    k = n;
+  }
+
+  memcpy(out, vi->arr + vi->i, k * sizeof(void *));
+  vi->i += k;
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_iota_view_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+struct ag_std_iota_view_iter {
+  struct object obj;
+  int i;
+};
+
+void *ag_std_iota_view_iter_ctor(void *obj, va_list *app) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_ctor]\n");
+  }
+
+  // TODO
+  // Need to call the super ctor.
+
+  struct ag_std_iota_view_iter *vi = obj;
+  vi->i = va_arg(*app, int);
+
+  return obj;
+}
+
+void ag_std_iota_view_iter_dtor(void *obj) {
+  // TODO
+  (void)obj;
+}
+
+void ag_std_iota_view_iter_print(void *obj) {
+  (void)obj;
+  printf("[ag_std_iota_view_iter][print]");
+}
+
+void ag_std_iota_view_iter_increment(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_inc]\n");
+  }
+  struct ag_std_iota_view_iter *vi = obj;
+  vi->i++;
+}
+
+void *ag_std_iota_view_iter_deref(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_deref]\n");
+  }
+
+  struct ag_std_iota_view_iter *vi = obj;
+  return ag_std_int(vi->i);
+}
+
+int ag_std_iota_view_iter_not_equal(void *obj_a, void *obj_b) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_vector_iter_neq]\n");
+  }
+
+  struct ag_std_iota_view_iter *a = obj_a;
+  struct ag_std_iota_view_iter *b = obj_b;
+
+  return a->i != b->i;
+}
+
+size_t ag_std_iota_view_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_iota_view_iter *vi = obj;
+  struct ag_std_iota_view_iter *end = end_arg;
+
+  size_t k = 0;
+  while (k < n && vi->i != end->i) {
+    out[k++] = ag_std_int(vi->i);
+    vi->i++;
+  }
+
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_zip_view_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* A zip iterator is made with the view, where to put the rest, whether it
+ * is the end iterator, and whether it owns the rest (the heap iterators do):
+ *
+ *   ag_std_new_at(storage, ag_std_zip_view_iter, v, rest, at_end, owns_rest)
+ *
+ * The rest is the tuples it hands out, then the iterators of the ranges:
+ *
+ *   [ zip_view_iter ][ AG_STD_ITER_BATCH tuples ][ iter 0 ][ iter 1 ]...
+ *
+ * So nothing is allocated per element: deref fills in the first tuple and
+ * next_batch as many as it hands out, and a tuple is only good until the
+ * iterator is dereferenced or moved again. With two ranges the tuples are
+ * pairs.
+ */
+struct ag_std_zip_view_iter {
+  struct object obj;
+
+  // The iterators zipped together.
+  size_t n;
+  void *its[AG_STD_ZIP_MAX];
+
+  // When every range knows its size, the zip counts: i is how far along it
+  // is, and the end iterator starts at the length of the shortest range.
+  int sized;
+  size_t i;
+
+  char *slots;
+  size_t slot_size;
+
+  // The rest, if this iterator has to free it.
+  void *heap;
+};
+
+void *ag_std_zip_view_iter_ctor(void *obj, va_list *app) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view_iter_ctor]\n");
+  }
+
+  // TODO
+  // Need to call the super ctor.
+
+  struct ag_std_zip_view_iter *zv = obj;
+  struct ag_std_zip_view *v = va_arg(*app, struct ag_std_zip_view *);
+  char *rest = va_arg(*app, char *);
+  int at_end = va_arg(*app, int);
+  int owns_rest = va_arg(*app, int);
+
+  void *slot_vt = v->n == 2 ? ag_std_pair : ag_std_tuple;
+
+  zv->n = v->n;
+  zv->slots = rest;
+  zv->slot_size = ag_std_iter_round(((struct ag_std_vtable *)slot_vt)->size);
+  zv->heap = owns_rest ? rest : NULL;
+
+  for (size_t k = 0; k < AG_STD_ITER_BATCH; ++k) {
+    if (v->n == 2) {
+      ag_std_new_at(zv->slots + k * zv->slot_size, ag_std_pair, NULL, NULL);
+    } else {
+      ag_std_new_at(zv->slots + k * zv->slot_size, ag_std_tuple, (int)v->n, NULL);
+    }
+  }
+
+  char *at = rest + AG_STD_ITER_BATCH * zv->slot_size;
+  for (size_t k = 0; k < v->n; ++k) {
+    zv->its[k] = at_end
+      ? ag_std_end_into(v->rngs[k], at)
+      : ag_std_begin_into(v->rngs[k], at);
+    at += ag_std_iter_round(ag_std_iter_size(v->rngs[k]));
+  }
+
+  size_t len = 0;
+  zv->sized = ag_std_zip_view_len(v, &len);
+  zv->i = at_end ? len : 0;
+
+  return obj;
+}
+
+void ag_std_zip_view_iter_dtor(void *obj) {
+  struct ag_std_zip_view_iter *zv = obj;
+  free(zv->heap);
+}
+
+void ag_std_zip_view_iter_print(void *obj) {
+  (void)obj;
+  printf("[ag_std_zip_view_iter][print]");
+}
+
+void ag_std_zip_view_iter_increment(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[zip_iter_inc]\n");
+  }
+
+  struct ag_std_zip_view_iter *zv = obj;
+  for (size_t k = 0; k < zv->n; ++k) {
+    ag_std_iter_increment(zv->its[k]);
+  }
+  zv->i++;
+}
+
+// Internal function, put the values into tuple number slot.
+void *ag_std_zip_view_iter_fill(
+    struct ag_std_zip_view_iter *zv,
+    size_t slot,
+    void **vals,
+    size_t stride)
+{
+  void *t = zv->slots + slot * zv->slot_size;
+
+  if (zv->n == 2) {
+    struct ag_std_pair *p = t;
+    p->first = vals[0];
+    p->second = vals[stride];
+  } else {
+    struct ag_std_tuple *tp = t;
+    for (size_t k = 0; k < zv->n; ++k) {
+      tp->items[k] = vals[k * stride];
+    }
+  }
+
+  return t;
+}
+
+void *ag_std_zip_view_iter_deref(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view_iter_deref]\n");
+  }
+
+  struct ag_std_zip_view_iter *zv = obj;
+
+  void *vals[AG_STD_ZIP_MAX];
+  for (size_t k = 0; k < zv->n; ++k) {
+    vals[k] = ag_std_iter_deref(zv->its[k]);
+  }
+
+  return ag_std_zip_view_iter_fill(zv, 0, vals, 1);
+}
+
+int ag_std_zip_view_iter_not_equal(void *obj_a, void *obj_b) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_zip_view_iter_neq]\n");
+  }
+
+  struct ag_std_zip_view_iter *zv_a = obj_a;
+  struct ag_std_zip_view_iter *zv_b = obj_b;
+
+  if (zv_a->sized) {
+    return zv_a->i != zv_b->i;
+  }
+
+  // Done as soon as any of them is.
+  for (size_t k = 0; k < zv_a->n; ++k) {
+    if (!ag_std_iter_not_equal(zv_a->its[k], zv_b->its[k])) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Does this iterator fill whole batches of pointers that stay good? A zip
+// or an enumerate doesn't, its tuples are filled in again on the next call.
+// The other views do if the range under them does.
+int ag_std_iter_batches(void *obj) {
+  if (!ag_std_responds_to(obj, AG_STD_SEL_NEXT_BATCH)) {
+    return 0;
+  }
+
+  void *vt = ag_std_class_of(obj);
+  if (vt == ag_std_zip_view_iter || vt == ag_std_enumerate_view_iter) {
+    return 0;
+  }
+
+  if (vt == ag_std_filter_view_iter
+      || vt == ag_std_transform_view_iter
+      || vt == ag_std_take_view_iter) {
+    return ag_std_iter_batches(((struct ag_std_view_iter *)obj)->base);
+  }
+
+  return 1;
+}
+
+// Take a batch from each range and zip them into the tuples. The others
+// are asked for as many as the first gave; if one has fewer, it hit its end
+// and so did the zip. A batch is good until the next call.
+size_t ag_std_zip_view_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_zip_view_iter *zv = obj;
+  struct ag_std_zip_view_iter *end = end_arg;
+
+  if (n == 0 || zv->n == 0) {
+    return 0;
+  }
+
+  // One tuple at a time, since the values may be gone by the next deref.
+  for (size_t k = 0; k < zv->n; ++k) {
+    if (!ag_std_iter_batches(zv->its[k])) {
+      if (!ag_std_zip_view_iter_not_equal(obj, end_arg)) {
+        return 0;
+      }
+
+      out[0] = ag_std_zip_view_iter_deref(obj);
+      ag_std_zip_view_iter_increment(obj);
+      return 1;
+    }
+  }
+
+  if (n > AG_STD_ITER_BATCH) {
+    n = AG_STD_ITER_BATCH;
+  }
+  if (zv->sized && n > end->i - zv->i) {
+    n = end->i - zv->i;
+  }
+
+  // The values of range k go in row k.
+  void *vals[AG_STD_ZIP_MAX][AG_STD_ITER_BATCH];
+
+  size_t got = ag_std_iter_next_batch(zv->its[0], end->its[0], vals[0], n);
+  for (size_t k = 1; k < zv->n; ++k) {
+    size_t got_k = 0;
+    while (got_k < got) {
+      size_t m = ag_std_iter_next_batch(
+          zv->its[k], end->its[k], vals[k] + got_k, got - got_k);
+      if (m == 0) {
+        break;
+      }
+      got_k += m;
+    }
+    got = got_k;
+  }
+
+  for (size_t i = 0; i < got; ++i) {
+    out[i] = ag_std_zip_view_iter_fill(zv, i, &vals[0][i], AG_STD_ITER_BATCH);
+  }
+  zv->i += got;
+
+  return got;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_view_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+/* The iterators of the filter, transform, take and enumerate views. Like
+ * the zip iterator, one is made with the view, where to put the rest,
+ * whether it is the end iterator, and whether it owns the rest:
+ *
+ *   ag_std_new_at(storage, v->iter_vt, v, rest, at_end, owns_rest)
+ *
+ * An enumerate iterator fills in pairs of its own, which are good until
+ * it is dereferenced or moved again. (struct ag_std_view_iter is up with
+ * the views, so that ag_std_iter_batches can look inside.)
+ */
+
+// Internal function, move a filter iterator up to the next element its
+// predicate is true for.
+void ag_std_filter_view_iter_settle(struct ag_std_view_iter *vi) {
+  while (ag_std_iter_not_equal(vi->base, vi->base_end)
+      && !vi->v->pred(ag_std_iter_deref(vi->base))) {
+    ag_std_iter_increment(vi->base);
+  }
+}
+
+void *ag_std_view_iter_ctor(void *obj, va_list *app) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_view_iter_ctor]\n");
+  }
+
+  struct ag_std_view_iter *vi = obj;
+  struct ag_std_view *v = va_arg(*app, struct ag_std_view *);
+  char *rest = va_arg(*app, char *);
+  int at_end = va_arg(*app, int);
+  int owns_rest = va_arg(*app, int);
+
+  vi->v = v;
+  vi->base_end = NULL;
+  vi->i = 0;
+  vi->slots = NULL;
+  vi->slot_size = 0;
+  vi->heap = owns_rest ? rest : NULL;
+
+  if (v->iter_vt == ag_std_enumerate_view_iter) {
+    vi->slots = rest;
+    vi->slot_size = ag_std_iter_round(((struct ag_std_vtable *)ag_std_pair)->size);
+    for (size_t k = 0; k < AG_STD_ITER_BATCH; ++k) {
+      ag_std_new_at(vi->slots + k * vi->slot_size, ag_std_pair, NULL, NULL);
+    }
+    rest += AG_STD_ITER_BATCH * vi->slot_size;
+  }
+
+  vi->base = at_end
+    ? ag_std_end_into(v->rng, rest)
+    : ag_std_begin_into(v->rng, rest);
+
+  if (v->iter_vt == ag_std_filter_view_iter) {
+    rest += ag_std_iter_round(ag_std_iter_size(v->rng));
+    vi->base_end = ag_std_end_into(v->rng, rest);
+    if (!at_end) {
+      ag_std_filter_view_iter_settle(vi);
+    }
+  }
+
+  // A take ends after n, unless the range ends first.
+  if (v->iter_vt == ag_std_take_view_iter && at_end) {
+    vi->i = v->n;
+  }
+
+  return obj;
+}
+
+void ag_std_view_iter_dtor(void *obj) {
+  struct ag_std_view_iter *vi = obj;
+  free(vi->heap);
+}
+
+void ag_std_view_iter_increment(void *obj) {
+  struct ag_std_view_iter *vi = obj;
+  ag_std_iter_increment(vi->base);
+  vi->i++;
+}
+
+void *ag_std_view_iter_deref(void *obj) {
+  struct ag_std_view_iter *vi = obj;
+  return ag_std_iter_deref(vi->base);
+}
+
+int ag_std_view_iter_not_equal(void *obj_a, void *obj_b) {
+  struct ag_std_view_iter *a = obj_a;
+  struct ag_std_view_iter *b = obj_b;
+  return ag_std_iter_not_equal(a->base, b->base);
+}
+
+void ag_std_filter_view_iter_increment(void *obj) {
+  struct ag_std_view_iter *vi = obj;
+  ag_std_iter_increment(vi->base);
+  ag_std_filter_view_iter_settle(vi);
+}
+
+// Keep the ones the predicate is true for, and go again if that was none
+// of them, so that 0 still means the end.
+size_t ag_std_filter_view_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_view_iter *vi = obj;
+  struct ag_std_view_iter *end = end_arg;
+
+  for (;;) {
+    size_t k = ag_std_iter_next_batch(vi->base, end->base, out, n);
+    if (k == 0) {
+      return 0;
+    }
+
+    size_t got = 0;
+    for (size_t i = 0; i < k; ++i) {
+      if (vi->v->pred(out[i])) {
+        out[got++] = out[i];
+      }
+    }
+
+    if (got > 0) {
+      return got;
+    }
+  }
+}
+
+void *ag_std_transform_view_iter_deref(void *obj) {
+  struct ag_std_view_iter *vi = obj;
+  return vi->v->fn(ag_std_iter_deref(vi->base));
+}
+
+size_t ag_std_transform_view_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_view_iter *vi = obj;
+  struct ag_std_view_iter *end = end_arg;
+
+  size_t k = ag_std_iter_next_batch(vi->base, end->base, out, n);
+  for (size_t i = 0; i < k; ++i) {
+    out[i] = vi->v->fn(out[i]);
+  }
+
+  return k;
+}
+
+int ag_std_take_view_iter_not_equal(void *obj_a, void *obj_b) {
+  struct ag_std_view_iter *a = obj_a;
+  struct ag_std_view_iter *b = obj_b;
+  return a->i != b->i && ag_std_iter_not_equal(a->base, b->base);
+}
+
+size_t ag_std_take_view_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_view_iter *vi = obj;
+  struct ag_std_view_iter *end = end_arg;
+
+  if (vi->i >= end->i) {
+    return 0;
+  }
+  if (n > end->i - vi->i) {
+    n = end->i - vi->i;
+  }
+
+  size_t k = ag_std_iter_next_batch(vi->base, end->base, out, n);
+  vi->i += k;
+
+  return k;
+}
+
+void *ag_std_enumerate_view_iter_deref(void *obj) {
+  struct ag_std_view_iter *vi = obj;
+
+  struct ag_std_pair *p = (struct ag_std_pair *)vi->slots;
+  p->first = ag_std_int((int)vi->i);
+  p->second = ag_std_iter_deref(vi->base);
+
+  return p;
+}
+
+size_t ag_std_enumerate_view_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_view_iter *vi = obj;
+  struct ag_std_view_iter *end = end_arg;
+
+  if (n > AG_STD_ITER_BATCH) {
+    n = AG_STD_ITER_BATCH;
+  }
+
+  size_t k = ag_std_iter_next_batch(vi->base, end->base, out, n);
+  for (size_t j = 0; j < k; ++j) {
+    struct ag_std_pair *p = (struct ag_std_pair *)(vi->slots + j * vi->slot_size);
+    p->first = ag_std_int((int)(vi->i + j));
+    p->second = out[j];
+    out[j] = p;
+  }
+  vi->i += k;
+
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_btree_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+struct ag_std_btree_iter {
+  struct object obj;
+
+  struct ag_std_btree_node *leaf;
+  size_t i;
+};
+
+void *ag_std_btree_iter_ctor(void *obj, va_list *app) {
+  struct ag_std_btree_iter *bi = obj;
+  bi->leaf = va_arg(*app, struct ag_std_btree_node *);
+  bi->i = va_arg(*app, size_t);
+
+  return obj;
+}
+
+// At the end of a leaf, hop along to the next one.
+void ag_std_btree_iter_increment(void *obj) {
+  struct ag_std_btree_iter *bi = obj;
+  bi->i++;
+  if (bi->i == bi->leaf->n) {
+    bi->leaf = bi->leaf->next;
+    bi->i = 0;
+  }
+}
+
+void *ag_std_btree_iter_deref(void *obj) {
+  struct ag_std_btree_iter *bi = obj;
+  return bi->leaf->ptrs[bi->i];
+}
+
+int ag_std_btree_iter_not_equal(void *obj_a, void *obj_b) {
+  struct ag_std_btree_iter *a = obj_a;
+  struct ag_std_btree_iter *b = obj_b;
+
+  return a->leaf != b->leaf || a->i != b->i;
+}
+
+// Copy out the rest of the current leaf (or up to end, if it is in this
+// leaf), then move on to the next leaf.
+size_t ag_std_btree_iter_next_batch(void *obj, void *end_arg, void **out, size_t n) {
+  struct ag_std_btree_iter *bi = obj;
+  struct ag_std_btree_iter *end = end_arg;
+
+  size_t k = 0;
+  while (k < n && (bi->leaf != end->leaf || bi->i != end->i)) {
+    size_t stop = bi->leaf == end->leaf ? end->i : bi->leaf->n;
+    size_t m = stop - bi->i;
+    if (m > n - k) {
+      m = n - k;
+    }
+
+    memcpy(out + k, bi->leaf->ptrs + bi->i, m * sizeof(void *));
+    k += m;
+    bi->i += m;
+
+    if (bi->i == bi->leaf->n) {
+      bi->leaf = bi->leaf->next;
+      bi->i = 0;
+    }
+  }
+
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_typed_vector_iter (derived from object)
+///////////////////////////////////////////////////////////////////////////////
+
+struct ag_std_typed_vector_iter {
+  struct object obj;
+
+  struct ag_std_typed_vector *v;
+  size_t i;
+
+  // The object deref hands out, refilled every time.
+  union {
+    struct integer i32;
+    struct integer64 i64;
+    struct floating f32;
+    struct floating64 f64;
+  } box;
+};
+
+void *ag_std_typed_vector_iter_ctor(void *obj, va_list *app) {
+  struct ag_std_typed_vector_iter *ti = obj;
+  ti->v = va_arg(*app, struct ag_std_typed_vector *);
+  ti->i = va_arg(*app, size_t);
+
+  // Give the box its class once, deref only has to fill in the value.
+  switch (ti->v->kind) {
+    case AG_STD_INT32:
+      ag_std_new_at(&ti->box, integer, 0);
+      break;
+    case AG_STD_INT64:
+      ag_std_new_at(&ti->box, integer64, (int64_t)0);
+      break;
+    case AG_STD_FLOAT:
+      ag_std_new_at(&ti->box, floating, 0.0);
+      break;
+    case AG_STD_DOUBLE:
+      ag_std_new_at(&ti->box, floating64, 0.0);
+      break;
+  }
+
+  return obj;
+}
+
+void ag_std_typed_vector_iter_increment(void *obj) {
+  struct ag_std_typed_vector_iter *ti = obj;
+  ti->i++;
+}
+
+void *ag_std_typed_vector_iter_deref(void *obj) {
+  struct ag_std_typed_vector_iter *ti = obj;
+  const unsigned char *p = ti->v->data + ti->i * ti->v->elem_size;
+
+  switch (ti->v->kind) {
+    case AG_STD_INT32:
+      ti->box.i32.x = *(const int32_t *)p;
+      break;
+    case AG_STD_INT64:
+      ti->box.i64.x = *(const int64_t *)p;
+      break;
+    case AG_STD_FLOAT:
+      ti->box.f32.x = *(const float *)p;
+      break;
+    case AG_STD_DOUBLE:
+      ti->box.f64.x = *(const double *)p;
+      break;
+  }
+
+  return &ti->box;
+}
+
+int ag_std_typed_vector_iter_not_equal(void *obj_a, void *obj_b) {
+  struct ag_std_typed_vector_iter *a = obj_a;
+  struct ag_std_typed_vector_iter *b = obj_b;
+
+  return a->i != b->i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMD kernels for numeric spans
+///////////////////////////////////////////////////////////////////////////////
+
+/* find, count, min, max, sum and equal over a plain array of int32_t,
+ * int64_t, float or double. Every kernel has a scalar version; on x86 there
+ * are SSE2 and AVX2 versions of the ones that pay off, and the best level
+ * the CPU supports (asked through CPUID) is picked the first time a kernel
+ * is needed. ag_std_simd_use() can force a lower level, for testing.
+ *
+ * sum writes an int64_t for the integer kinds and a double for the floating
+ * ones. min and max need at least one element.
+ */
+enum ag_std_simd_level {
+  AG_STD_SIMD_SCALAR,
+  AG_STD_SIMD_SSE2,
+  AG_STD_SIMD_AVX2
+};
+
+struct ag_std_simd_kernels {
+  size_t (*find)(const void *, size_t, const void *);
+  size_t (*count)(const void *, size_t, const void *);
+  void (*min)(const void *, size_t, void *);
+  void (*max)(const void *, size_t, void *);
+  void (*sum)(const void *, size_t, void *);
+  int (*equal)(const void *, const void *, size_t);
+};
+
+#define AG_STD_SCALAR_KERNELS(NAME, T, SUM_T) \
+  size_t ag_std_scalar_find_##NAME(const void *data, size_t n, const void *val) { \
+    const T *p = data; \
+    const T v = *(const T *)val; \
+    for (size_t i = 0; i < n; ++i) { \
+      if (p[i] == v) { \
+        return i; \
+      } \
+    } \
+    return n; \
+  } \
+  \
+  size_t ag_std_scalar_count_##NAME(const void *data, size_t n, const void *val) { \
+    const T *p = data; \
+    const T v = *(const T *)val; \
+    size_t c = 0; \
+    for (size_t i = 0; i < n; ++i) { \
+      c += p[i] == v; \
+    } \
+    return c; \
+  } \
+  \
+  void ag_std_scalar_min_##NAME(const void *data, size_t n, void *out) { \
+    const T *p = data; \
+    T m = p[0]; \
+    for (size_t i = 1; i < n; ++i) { \
+      m = p[i] < m ? p[i] : m; \
+    } \
+    *(T *)out = m; \
+  } \
+  \
+  void ag_std_scalar_max_##NAME(const void *data, size_t n, void *out) { \
+    const T *p = data; \
+    T m = p[0]; \
+    for (size_t i = 1; i < n; ++i) { \
+      m = p[i] > m ? p[i] : m; \
+    } \
+    *(T *)out = m; \
+  } \
+  \
+  void ag_std_scalar_sum_##NAME(const void *data, size_t n, void *out) { \
+    const T *p = data; \
+    SUM_T s = 0; \
+    for (size_t i = 0; i < n; ++i) { \
+      s += p[i]; \
+    } \
+    *(SUM_T *)out = s; \
+  } \
+  \
+  int ag_std_scalar_equal_##NAME(const void *a, const void *b, size_t n) { \
+    const T *p = a; \
+    const T *q = b; \
+    for (size_t i = 0; i < n; ++i) { \
+      if (p[i] != q[i]) { \
+        return 0; \
+      } \
+    } \
+    return 1; \
+  }
+
+AG_STD_SCALAR_KERNELS(i32, int32_t, int64_t)
+AG_STD_SCALAR_KERNELS(i64, int64_t, int64_t)
+AG_STD_SCALAR_KERNELS(f32, float, double)
+AG_STD_SCALAR_KERNELS(f64, double, double)
+
+// For integers, equal is equal bytes, and libc already has a fast memcmp.
+int ag_std_memcmp_equal(const void *a, const void *b, size_t n, size_t elem_size) {
+  return memcmp(a, b, n * elem_size) == 0;
+}
+
+int ag_std_memcmp_equal_i32(const void *a, const void *b, size_t n) {
+  return ag_std_memcmp_equal(a, b, n, sizeof(int32_t));
+}
+
+int ag_std_memcmp_equal_i64(const void *a, const void *b, size_t n) {
+  return ag_std_memcmp_equal(a, b, n, sizeof(int64_t));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AG_STD_SIMD_X86 1
+#include <immintrin.h>
+#define AG_STD_SSE2 __attribute__((target("sse2")))
+#define AG_STD_AVX2 __attribute__((target("avx2")))
+#else
+#define AG_STD_SIMD_X86 0
+#endif
+
+#if AG_STD_SIMD_X86
+
+// SSE2: the equality scans, plus min/max/sum where SSE2 has the instructions.
+
+AG_STD_SSE2 size_t ag_std_sse2_find_i32(const void *data, size_t n, const void *val) {
+  const int32_t *p = data;
+  const __m128i v = _mm_set1_epi32(*(const int32_t *)val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, v)));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_i32(p + i, n - i, val);
+}
+
+AG_STD_SSE2 size_t ag_std_sse2_count_i32(const void *data, size_t n, const void *val) {
+  const int32_t *p = data;
+  const __m128i v = _mm_set1_epi32(*(const int32_t *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    c += (size_t)__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, v))));
+  }
+  return c + ag_std_scalar_count_i32(p + i, n - i, val);
+}
+
+AG_STD_SSE2 size_t ag_std_sse2_find_f32(const void *data, size_t n, const void *val) {
+  const float *p = data;
+  const __m128 v = _mm_set1_ps(*(const float *)val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(p + i), v));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_f32(p + i, n - i, val);
+}
+
+AG_STD_SSE2 size_t ag_std_sse2_count_f32(const void *data, size_t n, const void *val) {
+  const float *p = data;
+  const __m128 v = _mm_set1_ps(*(const float *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    c += (size_t)__builtin_popcount(_mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(p + i), v)));
+  }
+  return c + ag_std_scalar_count_f32(p + i, n - i, val);
+}
+
+AG_STD_SSE2 void ag_std_sse2_min_f32(const void *data, size_t n, void *out) {
+  const float *p = data;
+  float lanes[4];
+  size_t i = 0;
+  if (n >= 4) {
+    __m128 m = _mm_loadu_ps(p);
+    for (i = 4; i + 4 <= n; i += 4) {
+      m = _mm_min_ps(m, _mm_loadu_ps(p + i));
+    }
+    _mm_storeu_ps(lanes, m);
+  } else {
+    lanes[0] = lanes[1] = lanes[2] = lanes[3] = p[0];
+  }
+  float r = lanes[0];
+  for (int k = 1; k < 4; ++k) {
+    r = lanes[k] < r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] < r ? p[i] : r;
+  }
+  *(float *)out = r;
+}
+
+AG_STD_SSE2 void ag_std_sse2_max_f32(const void *data, size_t n, void *out) {
+  const float *p = data;
+  float lanes[4];
+  size_t i = 0;
+  if (n >= 4) {
+    __m128 m = _mm_loadu_ps(p);
+    for (i = 4; i + 4 <= n; i += 4) {
+      m = _mm_max_ps(m, _mm_loadu_ps(p + i));
+    }
+    _mm_storeu_ps(lanes, m);
+  } else {
+    lanes[0] = lanes[1] = lanes[2] = lanes[3] = p[0];
+  }
+  float r = lanes[0];
+  for (int k = 1; k < 4; ++k) {
+    r = lanes[k] > r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] > r ? p[i] : r;
+  }
+  *(float *)out = r;
+}
+
+AG_STD_SSE2 void ag_std_sse2_sum_f32(const void *data, size_t n, void *out) {
+  const float *p = data;
+  __m128d acc = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(p + i);
+    acc = _mm_add_pd(acc, _mm_cvtps_pd(x));
+    acc = _mm_add_pd(acc, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double tail = 0.0;
+  ag_std_scalar_sum_f32(p + i, n - i, &tail);
+  *(double *)out = lanes[0] + lanes[1] + tail;
+}
+
+AG_STD_SSE2 size_t ag_std_sse2_find_f64(const void *data, size_t n, const void *val) {
+  const double *p = data;
+  const __m128d v = _mm_set1_pd(*(const double *)val);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    int mask = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(p + i), v));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_f64(p + i, n - i, val);
+}
+
+AG_STD_SSE2 size_t ag_std_sse2_count_f64(const void *data, size_t n, const void *val) {
+  const double *p = data;
+  const __m128d v = _mm_set1_pd(*(const double *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    c += (size_t)__builtin_popcount(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(p + i), v)));
+  }
+  return c + ag_std_scalar_count_f64(p + i, n - i, val);
+}
+
+// AVX2: 8 ints or floats (4 int64s or doubles) at a time.
+
+AG_STD_AVX2 size_t ag_std_avx2_find_i32(const void *data, size_t n, const void *val) {
+  const int32_t *p = data;
+  const __m256i v = _mm256_set1_epi32(*(const int32_t *)val);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, v)));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_i32(p + i, n - i, val);
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_count_i32(const void *data, size_t n, const void *val) {
+  const int32_t *p = data;
+  const __m256i v = _mm256_set1_epi32(*(const int32_t *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    c += (size_t)__builtin_popcount(
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, v))));
+  }
+  return c + ag_std_scalar_count_i32(p + i, n - i, val);
+}
+
+AG_STD_AVX2 void ag_std_avx2_min_i32(const void *data, size_t n, void *out) {
+  const int32_t *p = data;
+  if (n < 8) {
+    ag_std_scalar_min_i32(data, n, out);
+    return;
+  }
+  __m256i m = _mm256_loadu_si256((const __m256i *)p);
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i *)(p + i)));
+  }
+  int32_t lanes[8];
+  _mm256_storeu_si256((__m256i *)lanes, m);
+  int32_t r = lanes[0];
+  for (int k = 1; k < 8; ++k) {
+    r = lanes[k] < r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] < r ? p[i] : r;
+  }
+  *(int32_t *)out = r;
+}
+
+AG_STD_AVX2 void ag_std_avx2_max_i32(const void *data, size_t n, void *out) {
+  const int32_t *p = data;
+  if (n < 8) {
+    ag_std_scalar_max_i32(data, n, out);
+    return;
+  }
+  __m256i m = _mm256_loadu_si256((const __m256i *)p);
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    m = _mm256_max_epi32(m, _mm256_loadu_si256((const __m256i *)(p + i)));
+  }
+  int32_t lanes[8];
+  _mm256_storeu_si256((__m256i *)lanes, m);
+  int32_t r = lanes[0];
+  for (int k = 1; k < 8; ++k) {
+    r = lanes[k] > r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] > r ? p[i] : r;
+  }
+  *(int32_t *)out = r;
+}
+
+// Widen to 64 bits before adding, so the sum can't overflow.
+AG_STD_AVX2 void ag_std_avx2_sum_i32(const void *data, size_t n, void *out) {
+  const int32_t *p = data;
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  int64_t tail = 0;
+  ag_std_scalar_sum_i32(p + i, n - i, &tail);
+  *(int64_t *)out = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail;
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_find_i64(const void *data, size_t n, const void *val) {
+  const int64_t *p = data;
+  const __m256i v = _mm256_set1_epi64x(*(const int64_t *)val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, v)));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_i64(p + i, n - i, val);
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_count_i64(const void *data, size_t n, const void *val) {
+  const int64_t *p = data;
+  const __m256i v = _mm256_set1_epi64x(*(const int64_t *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    c += (size_t)__builtin_popcount(
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, v))));
+  }
+  return c + ag_std_scalar_count_i64(p + i, n - i, val);
+}
+
+AG_STD_AVX2 void ag_std_avx2_sum_i64(const void *data, size_t n, void *out) {
+  const int64_t *p = data;
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  int64_t tail = 0;
+  ag_std_scalar_sum_i64(p + i, n - i, &tail);
+  *(int64_t *)out = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail;
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_find_f32(const void *data, size_t n, const void *val) {
+  const float *p = data;
+  const __m256 v = _mm256_set1_ps(*(const float *)val);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p + i), v, _CMP_EQ_OQ));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_f32(p + i, n - i, val);
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_count_f32(const void *data, size_t n, const void *val) {
+  const float *p = data;
+  const __m256 v = _mm256_set1_ps(*(const float *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    c += (size_t)__builtin_popcount(
+        _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p + i), v, _CMP_EQ_OQ)));
+  }
+  return c + ag_std_scalar_count_f32(p + i, n - i, val);
+}
+
+AG_STD_AVX2 void ag_std_avx2_min_f32(const void *data, size_t n, void *out) {
+  const float *p = data;
+  if (n < 8) {
+    ag_std_scalar_min_f32(data, n, out);
+    return;
+  }
+  __m256 m = _mm256_loadu_ps(p);
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    m = _mm256_min_ps(m, _mm256_loadu_ps(p + i));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, m);
+  float r = lanes[0];
+  for (int k = 1; k < 8; ++k) {
+    r = lanes[k] < r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] < r ? p[i] : r;
+  }
+  *(float *)out = r;
+}
+
+AG_STD_AVX2 void ag_std_avx2_max_f32(const void *data, size_t n, void *out) {
+  const float *p = data;
+  if (n < 8) {
+    ag_std_scalar_max_f32(data, n, out);
+    return;
+  }
+  __m256 m = _mm256_loadu_ps(p);
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    m = _mm256_max_ps(m, _mm256_loadu_ps(p + i));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, m);
+  float r = lanes[0];
+  for (int k = 1; k < 8; ++k) {
+    r = lanes[k] > r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] > r ? p[i] : r;
+  }
+  *(float *)out = r;
+}
+
+// Floats are summed as doubles, like the scalar version does.
+AG_STD_AVX2 void ag_std_avx2_sum_f32(const void *data, size_t n, void *out) {
+  const float *p = data;
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(p + i);
+    acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+    acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double tail = 0.0;
+  ag_std_scalar_sum_f32(p + i, n - i, &tail);
+  *(double *)out = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail;
+}
+
+AG_STD_AVX2 int ag_std_avx2_equal_f32(const void *a, const void *b, size_t n) {
+  const float *p = a;
+  const float *q = b;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 eq = _mm256_cmp_ps(_mm256_loadu_ps(p + i), _mm256_loadu_ps(q + i), _CMP_EQ_OQ);
+    if (_mm256_movemask_ps(eq) != 0xff) {
+      return 0;
+    }
+  }
+  return ag_std_scalar_equal_f32(p + i, q + i, n - i);
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_find_f64(const void *data, size_t n, const void *val) {
+  const double *p = data;
+  const __m256d v = _mm256_set1_pd(*(const double *)val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p + i), v, _CMP_EQ_OQ));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  return i + ag_std_scalar_find_f64(p + i, n - i, val);
+}
+
+AG_STD_AVX2 size_t ag_std_avx2_count_f64(const void *data, size_t n, const void *val) {
+  const double *p = data;
+  const __m256d v = _mm256_set1_pd(*(const double *)val);
+  size_t c = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    c += (size_t)__builtin_popcount(
+        _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p + i), v, _CMP_EQ_OQ)));
+  }
+  return c + ag_std_scalar_count_f64(p + i, n - i, val);
+}
+
+AG_STD_AVX2 void ag_std_avx2_min_f64(const void *data, size_t n, void *out) {
+  const double *p = data;
+  if (n < 4) {
+    ag_std_scalar_min_f64(data, n, out);
+    return;
+  }
+  __m256d m = _mm256_loadu_pd(p);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_min_pd(m, _mm256_loadu_pd(p + i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double r = lanes[0];
+  for (int k = 1; k < 4; ++k) {
+    r = lanes[k] < r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] < r ? p[i] : r;
+  }
+  *(double *)out = r;
+}
+
+AG_STD_AVX2 void ag_std_avx2_max_f64(const void *data, size_t n, void *out) {
+  const double *p = data;
+  if (n < 4) {
+    ag_std_scalar_max_f64(data, n, out);
+    return;
+  }
+  __m256d m = _mm256_loadu_pd(p);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_max_pd(m, _mm256_loadu_pd(p + i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double r = lanes[0];
+  for (int k = 1; k < 4; ++k) {
+    r = lanes[k] > r ? lanes[k] : r;
+  }
+  for (; i < n; ++i) {
+    r = p[i] > r ? p[i] : r;
+  }
+  *(double *)out = r;
+}
+
+AG_STD_AVX2 void ag_std_avx2_sum_f64(const void *data, size_t n, void *out) {
+  const double *p = data;
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(acc, _mm256_loadu_pd(p + i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double tail = 0.0;
+  ag_std_scalar_sum_f64(p + i, n - i, &tail);
+  *(double *)out = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail;
+}
+
+AG_STD_AVX2 int ag_std_avx2_equal_f64(const void *a, const void *b, size_t n) {
+  const double *p = a;
+  const double *q = b;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d eq = _mm256_cmp_pd(_mm256_loadu_pd(p + i), _mm256_loadu_pd(q + i), _CMP_EQ_OQ);
+    if (_mm256_movemask_pd(eq) != 0xf) {
+      return 0;
+    }
+  }
+  return ag_std_scalar_equal_f64(p + i, q + i, n - i);
+}
+
+#endif
+
+// One set of kernels per enum ag_std_num_kind.
+struct ag_std_simd_kernels ag_std_simd[4];
+enum ag_std_simd_level ag_std_simd_current = AG_STD_SIMD_SCALAR;
+pthread_once_t ag_std_simd_once = PTHREAD_ONCE_INIT;
+
+// The best level this CPU can run.
+enum ag_std_simd_level ag_std_simd_supported(void) {
+#if AG_STD_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return AG_STD_SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return AG_STD_SIMD_SSE2;
+  }
+#endif
+  return AG_STD_SIMD_SCALAR;
+}
+
+// Internal function, fill the kernel table for a level.
+void ag_std_simd_fill(enum ag_std_simd_level level) {
+  struct ag_std_simd_kernels *k = ag_std_simd;
+
+  k[AG_STD_INT32] = (struct ag_std_simd_kernels) {
+    ag_std_scalar_find_i32, ag_std_scalar_count_i32, ag_std_scalar_min_i32,
+    ag_std_scalar_max_i32, ag_std_scalar_sum_i32, ag_std_memcmp_equal_i32
+  };
+  k[AG_STD_INT64] = (struct ag_std_simd_kernels) {
+    ag_std_scalar_find_i64, ag_std_scalar_count_i64, ag_std_scalar_min_i64,
+    ag_std_scalar_max_i64, ag_std_scalar_sum_i64, ag_std_memcmp_equal_i64
+  };
+  k[AG_STD_FLOAT] = (struct ag_std_simd_kernels) {
+    ag_std_scalar_find_f32, ag_std_scalar_count_f32, ag_std_scalar_min_f32,
+    ag_std_scalar_max_f32, ag_std_scalar_sum_f32, ag_std_scalar_equal_f32
+  };
+  k[AG_STD_DOUBLE] = (struct ag_std_simd_kernels) {
+    ag_std_scalar_find_f64, ag_std_scalar_count_f64, ag_std_scalar_min_f64,
+    ag_std_scalar_max_f64, ag_std_scalar_sum_f64, ag_std_scalar_equal_f64
+  };
+
+#if AG_STD_SIMD_X86
+  if (level >= AG_STD_SIMD_SSE2) {
+    k[AG_STD_INT32].find = ag_std_sse2_find_i32;
+    k[AG_STD_INT32].count = ag_std_sse2_count_i32;
+
+    k[AG_STD_FLOAT].find = ag_std_sse2_find_f32;
+    k[AG_STD_FLOAT].count = ag_std_sse2_count_f32;
+    k[AG_STD_FLOAT].min = ag_std_sse2_min_f32;
+    k[AG_STD_FLOAT].max = ag_std_sse2_max_f32;
+    k[AG_STD_FLOAT].sum = ag_std_sse2_sum_f32;
+
+    k[AG_STD_DOUBLE].find = ag_std_sse2_find_f64;
+    k[AG_STD_DOUBLE].count = ag_std_sse2_count_f64;
+  }
+
+  if (level >= AG_STD_SIMD_AVX2) {
+    k[AG_STD_INT32].find = ag_std_avx2_find_i32;
+    k[AG_STD_INT32].count = ag_std_avx2_count_i32;
+    k[AG_STD_INT32].min = ag_std_avx2_min_i32;
+    k[AG_STD_INT32].max = ag_std_avx2_max_i32;
+    k[AG_STD_INT32].sum = ag_std_avx2_sum_i32;
+
+    k[AG_STD_INT64].find = ag_std_avx2_find_i64;
+    k[AG_STD_INT64].count = ag_std_avx2_count_i64;
+    k[AG_STD_INT64].sum = ag_std_avx2_sum_i64;
+
+    k[AG_STD_FLOAT].find = ag_std_avx2_find_f32;
+    k[AG_STD_FLOAT].count = ag_std_avx2_count_f32;
+    k[AG_STD_FLOAT].min = ag_std_avx2_min_f32;
+    k[AG_STD_FLOAT].max = ag_std_avx2_max_f32;
+    k[AG_STD_FLOAT].sum = ag_std_avx2_sum_f32;
+    k[AG_STD_FLOAT].equal = ag_std_avx2_equal_f32;
+
+    k[AG_STD_DOUBLE].find = ag_std_avx2_find_f64;
+    k[AG_STD_DOUBLE].count = ag_std_avx2_count_f64;
+    k[AG_STD_DOUBLE].min = ag_std_avx2_min_f64;
+    k[AG_STD_DOUBLE].max = ag_std_avx2_max_f64;
+    k[AG_STD_DOUBLE].sum = ag_std_avx2_sum_f64;
+    k[AG_STD_DOUBLE].equal = ag_std_avx2_equal_f64;
+  }
+#endif
+
+  ag_std_simd_current = level;
+}
+
+void ag_std_simd_init(void) {
+  ag_std_simd_fill(ag_std_simd_supported());
+}
+
+/* Use the kernels of a level (no higher than the CPU supports), from now
+ * on. Returns the level that is now in use. The table is written with no
+ * lock, so this must not run while any thread may be running a kernel:
+ * call it at startup, or between tests.
+ */
+enum ag_std_simd_level ag_std_simd_use(enum ag_std_simd_level level) {
+  if (level > ag_std_simd_supported()) {
+    level = ag_std_simd_supported();
+  }
+
+  // Set up the table first, or the first ag_std_simd_get would put the
+  // best level back.
+  pthread_once(&ag_std_simd_once, ag_std_simd_init);
+  ag_std_simd_fill(level);
+
+  return level;
+}
+
+// The kernels for one kind of number, set up on first use.
+struct ag_std_simd_kernels *ag_std_simd_get(enum ag_std_num_kind kind) {
+  pthread_once(&ag_std_simd_once, ag_std_simd_init);
+  return &ag_std_simd[kind];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Numbers in ranges
+///////////////////////////////////////////////////////////////////////////////
+
+/* The numeric range algorithms (ag_std_range_count, _sum, _min, _max and
+ * _equal, and ag_std_range_find) look at what kind of range they got:
+ *
+ *  - a typed vector is already a plain array, so it goes to the kernels.
+ *  - a vector of objects is read straight out of its array, looking at the
+ *    fields of integer / floating (and the 64 bit ones) without going
+ *    through the vtable.
+ *  - anything else is walked with iterators, like before.
+ *
+ * Results come back as a struct ag_std_num: an int64_t if every element
+ * was an integer, otherwise a double.
+ */
+struct ag_std_num {
+  int is_float;
+  int64_t i;
+  double d;
+};
+
+// Read the number out of an integer, integer64, floating or floating64.
+// Returns -1 if obj is none of those.
+int ag_std_num_of(void *obj, struct ag_std_num *num) {
+  if (!ag_std_is_a(obj, number)) {
+    return -1;
+  }
+
+  void *cls = ag_std_class_of(obj);
+  if (cls == integer) {
+    num->is_float = 0;
+    num->i = ag_std_int_value(obj);
+  } else if (cls == integer64) {
+    num->is_float = 0;
+    num->i = ((struct integer64 *)obj)->x;
+  } else if (cls == floating) {
+    num->is_float = 1;
+    num->d = ag_std_float_value(obj);
+  } else if (cls == floating64) {
+    num->is_float = 1;
+    num->d = ((struct floating64 *)obj)->x;
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+double ag_std_num_as_double(const struct ag_std_num *num) {
+  return num->is_float ? num->d : (double)num->i;
+}
+
+int ag_std_num_less(const struct ag_std_num *a, const struct ag_std_num *b) {
+  if (!a->is_float && !b->is_float) {
+    return a->i < b->i;
+  }
+
+  return ag_std_num_as_double(a) < ag_std_num_as_double(b);
+}
+
+// Internal function, is this range a typed vector (a plain array)?
+struct ag_std_typed_vector *ag_std_typed_vector_of(void *rng) {
+  void *cls = ag_std_class_of(rng);
+  if (cls == ag_std_int32_vector || cls == ag_std_int64_vector
+      || cls == ag_std_float_vector || cls == ag_std_double_vector) {
+    return rng;
+  }
+
+  return NULL;
+}
+
+// Internal function, val as a raw number of the kind the vector holds, as
+// long as val is of the class the vector's elements come out as.
+int ag_std_typed_vector_raw(struct ag_std_typed_vector *v, void *val, void *raw) {
+  void *cls = ag_std_class_of(val);
+
+  switch (v->kind) {
+    case AG_STD_INT32:
+      if (cls != integer) {
+        return -1;
+      }
+      *(int32_t *)raw = ag_std_int_value(val);
+      return 0;
+    case AG_STD_INT64:
+      if (cls != integer64) {
+        return -1;
+      }
+      *(int64_t *)raw = ((struct integer64 *)val)->x;
+      return 0;
+    case AG_STD_FLOAT:
+      if (cls != floating) {
+        return -1;
+      }
+      *(float *)raw = ag_std_float_value(val);
+      return 0;
+    case AG_STD_DOUBLE:
+      if (cls != floating64) {
+        return -1;
+      }
+      *(double *)raw = ((struct floating64 *)val)->x;
+      return 0;
+  }
+
+  return -1;
+}
+
+// Internal function, one raw element of a typed vector as an ag_std_num.
+void ag_std_typed_vector_num(
+    struct ag_std_typed_vector *v,
+    const void *raw,
+    struct ag_std_num *num)
+{
+  switch (v->kind) {
+    case AG_STD_INT32:
+      num->is_float = 0;
+      num->i = *(const int32_t *)raw;
+      break;
+    case AG_STD_INT64:
+      num->is_float = 0;
+      num->i = *(const int64_t *)raw;
+      break;
+    case AG_STD_FLOAT:
+      num->is_float = 1;
+      num->d = *(const float *)raw;
+      break;
+    case AG_STD_DOUBLE:
+      num->is_float = 1;
+      num->d = *(const double *)raw;
+      break;
+  }
+}
+
+// Internal function, is this element equal to val? Numbers of the same
+// class are compared by their field, anything else goes through cmp.
+int ag_std_num_equal(void *obj, void *val, void *val_class) {
+  void *cls = ag_std_class_of(obj);
+  if (cls != val_class) {
+    return ag_std_cmp(obj, val) == 0;
+  }
+
+  if (cls == integer) {
+    return ag_std_int_value(obj) == ag_std_int_value(val);
+  } else if (cls == floating) {
+    return ag_std_float_value(obj) == ag_std_float_value(val);
+  } else if (cls == integer64) {
+    return ((struct integer64 *)obj)->x == ((struct integer64 *)val)->x;
+  } else if (cls == floating64) {
+    return ((struct floating64 *)obj)->x == ((struct floating64 *)val)->x;
+  }
+
+  return ag_std_cmp(obj, val) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// range functions
+///////////////////////////////////////////////////////////////////////////////
+void ag_std_range_print(void *rng) {
+
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+
+  void *it = ag_std_begin_into(rng, it_buf);
+  void *end = ag_std_end_into(rng, end_buf);
+
+  printf("range_print( ");
+
+  void *batch[AG_STD_ITER_BATCH];
+  size_t k;
+  while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+    for (size_t i = 0; i < k; ++i) {
+      ag_std_print(batch[i]);
+      printf(" ");
+    }
+  }
+
+  printf(")\n");
+}
+
+int ag_std_range_find(void *rng, void *val) {
+  struct ag_std_typed_vector *tv = ag_std_typed_vector_of(rng);
+  union ag_std_iter_slot raw;
+  if (tv != NULL && ag_std_typed_vector_raw(tv, val, &raw) == 0) {
+    return ag_std_simd_get(tv->kind)->find(tv->data, tv->size, &raw) != tv->size;
+  }
+
+  if (ag_std_class_of(rng) == vector) {
+    struct ag_std_vector *v = rng;
+    void *val_class = ag_std_class_of(val);
+    for (size_t i = 0; i < v->size; ++i) {
+      if (ag_std_num_equal(v->arr[i], val, val_class)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+
+  void *it = ag_std_begin_into(rng, it_buf);
+  void *end = ag_std_end_into(rng, end_buf);
+
+  void *batch[AG_STD_ITER_BATCH];
+  size_t k;
+  while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+    for (size_t i = 0; i < k; ++i) {
+      if (ag_std_cmp(batch[i], val) == 0) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// How many elements of the range compare equal to val.
+size_t ag_std_range_count(void *rng, void *val) {
+  struct ag_std_typed_vector *tv = ag_std_typed_vector_of(rng);
+  union ag_std_iter_slot raw;
+  if (tv != NULL && ag_std_typed_vector_raw(tv, val, &raw) == 0) {
+    return ag_std_simd_get(tv->kind)->count(tv->data, tv->size, &raw);
+  }
+
+  size_t c = 0;
+
+  if (ag_std_class_of(rng) == vector) {
+    struct ag_std_vector *v = rng;
+    void *val_class = ag_std_class_of(val);
+    for (size_t i = 0; i < v->size; ++i) {
+      c += ag_std_num_equal(v->arr[i], val, val_class);
+    }
+    return c;
+  }
+
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+
+  void *it = ag_std_begin_into(rng, it_buf);
+  void *end = ag_std_end_into(rng, end_buf);
+
+  void *batch[AG_STD_ITER_BATCH];
+  size_t k;
+  while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+    for (size_t i = 0; i < k; ++i) {
+      c += ag_std_cmp(batch[i], val) == 0;
+    }
+  }
+
+  return c;
+}
+
+enum ag_std_num_op {
+  AG_STD_NUM_SUM,
+  AG_STD_NUM_MIN,
+  AG_STD_NUM_MAX
+};
+
+// Internal function, fold one more number into acc.
+void ag_std_num_fold(
+    struct ag_std_num *acc,
+    const struct ag_std_num *x,
+    enum ag_std_num_op op)
+{
+  switch (op) {
+    case AG_STD_NUM_SUM:
+      if (acc->is_float || x->is_float) {
+        acc->d = ag_std_num_as_double(acc) + ag_std_num_as_double(x);
+        acc->is_float = 1;
+      } else {
+        acc->i += x->i;
+      }
+      break;
+    case AG_STD_NUM_MIN:
+      if (ag_std_num_less(x, acc)) {
+        *acc = *x;
+      }
+      break;
+    case AG_STD_NUM_MAX:
+      if (ag_std_num_less(acc, x)) {
+        *acc = *x;
+      }
+      break;
+  }
+}
+
+// Internal function, the part of sum / min / max that is the same. Returns
+// -1 if an element isn't a number, or if min / max got an empty range.
+int ag_std_range_fold(void *rng, enum ag_std_num_op op, struct ag_std_num *out) {
+  struct ag_std_num x;
+  size_t n = 0;
+
+  out->is_float = 0;
+  out->i = 0;
+  out->d = 0.0;
+
+  struct ag_std_typed_vector *tv = ag_std_typed_vector_of(rng);
+  if (tv != NULL) {
+    if (tv->size == 0) {
+      return op == AG_STD_NUM_SUM ? 0 : -1;
+    }
+
+    struct ag_std_simd_kernels *k = ag_std_simd_get(tv->kind);
+    union ag_std_iter_slot raw;
+
+    if (op == AG_STD_NUM_SUM) {
+      out->is_float = tv->kind == AG_STD_FLOAT || tv->kind == AG_STD_DOUBLE;
+      k->sum(tv->data, tv->size, out->is_float ? (void *)&out->d : (void *)&out->i);
+      return 0;
+    }
+
+    if (op == AG_STD_NUM_MIN) {
+      k->min(tv->data, tv->size, &raw);
+    } else {
+      k->max(tv->data, tv->size, &raw);
+    }
+    ag_std_typed_vector_num(tv, &raw, out);
+    return 0;
+  }
+
+  if (ag_std_class_of(rng) == vector) {
+    struct ag_std_vector *v = rng;
+    for (size_t i = 0; i < v->size; ++i) {
+      if (ag_std_num_of(v->arr[i], &x) != 0) {
+        return -1;
+      }
+
+      if (n++ == 0 && op != AG_STD_NUM_SUM) {
+        *out = x;
+      } else {
+        ag_std_num_fold(out, &x, op);
+      }
+    }
+
+    return n == 0 && op != AG_STD_NUM_SUM ? -1 : 0;
+  }
+
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+
+  void *it = ag_std_begin_into(rng, it_buf);
+  void *end = ag_std_end_into(rng, end_buf);
+
+  void *batch[AG_STD_ITER_BATCH];
+  size_t k;
+  while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+    for (size_t i = 0; i < k; ++i) {
+      if (ag_std_num_of(batch[i], &x) != 0) {
+        return -1;
+      }
+
+      if (n++ == 0 && op != AG_STD_NUM_SUM) {
+        *out = x;
+      } else {
+        ag_std_num_fold(out, &x, op);
+      }
+    }
+  }
+
+  return n == 0 && op != AG_STD_NUM_SUM ? -1 : 0;
+}
+
+// Add up a range of numbers. The sum of an empty range is the integer 0.
+int ag_std_range_sum(void *rng, struct ag_std_num *out) {
+  return ag_std_range_fold(rng, AG_STD_NUM_SUM, out);
+}
+
+int ag_std_range_min(void *rng, struct ag_std_num *out) {
+  return ag_std_range_fold(rng, AG_STD_NUM_MIN, out);
+}
+
+int ag_std_range_max(void *rng, struct ag_std_num *out) {
+  return ag_std_range_fold(rng, AG_STD_NUM_MAX, out);
+}
+
+// Do two ranges have the same length and equal elements, in order?
+int ag_std_range_equal(void *rng_a, void *rng_b) {
+  struct ag_std_typed_vector *ta = ag_std_typed_vector_of(rng_a);
+  struct ag_std_typed_vector *tb = ag_std_typed_vector_of(rng_b);
+  if (ta != NULL && tb != NULL && ta->kind == tb->kind) {
+    return ta->size == tb->size
+      && ag_std_simd_get(ta->kind)->equal(ta->data, tb->data, ta->size);
+  }
+
+  if (ag_std_class_of(rng_a) == vector && ag_std_class_of(rng_b) == vector) {
+    struct ag_std_vector *a = rng_a;
+    struct ag_std_vector *b = rng_b;
+    if (a->size != b->size) {
+      return 0;
+    }
+
+    for (size_t i = 0; i < a->size; ++i) {
+      if (!ag_std_num_equal(a->arr[i], b->arr[i], ag_std_class_of(b->arr[i]))) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  union ag_std_iter_slot a_buf[AG_STD_ITER_SLOTS(rng_a)];
+  union ag_std_iter_slot a_end_buf[AG_STD_ITER_SLOTS(rng_a)];
+  union ag_std_iter_slot b_buf[AG_STD_ITER_SLOTS(rng_b)];
+  union ag_std_iter_slot b_end_buf[AG_STD_ITER_SLOTS(rng_b)];
+
+  void *a = ag_std_begin_into(rng_a, a_buf);
+  void *a_end = ag_std_end_into(rng_a, a_end_buf);
+  void *b = ag_std_begin_into(rng_b, b_buf);
+  void *b_end = ag_std_end_into(rng_b, b_end_buf);
+
+  // Both sides a batch at a time, if the values from b can be held on to.
+  if (ag_std_iter_batches(b)) {
+    void *batch_a[AG_STD_ITER_BATCH];
+    void *batch_b[AG_STD_ITER_BATCH];
+    size_t k;
+    while ((k = ag_std_iter_next_batch(a, a_end, batch_a, AG_STD_ITER_BATCH)) > 0) {
+      size_t got = 0;
+      while (got < k) {
+        size_t m = ag_std_iter_next_batch(b, b_end, batch_b + got, k - got);
+        if (m == 0) {
+          return 0;
+        }
+        got += m;
+      }
+
+      for (size_t i = 0; i < k; ++i) {
+        if (ag_std_cmp(batch_a[i], batch_b[i]) != 0) {
+          return 0;
+        }
+      }
+    }
+
+    return !ag_std_iter_not_equal(b, b_end);
+  }
+
+  while (ag_std_iter_not_equal(a, a_end) && ag_std_iter_not_equal(b, b_end)) {
+    if (ag_std_cmp(ag_std_iter_deref(a), ag_std_iter_deref(b)) != 0) {
+      return 0;
+    }
+
+    ag_std_iter_increment(a);
+    ag_std_iter_increment(b);
+  }
+
+  return !ag_std_iter_not_equal(a, a_end) && !ag_std_iter_not_equal(b, b_end);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parallel range functions
+///////////////////////////////////////////////////////////////////////////////
+
+/* ag_std_par_for_each, _reduce, _find_any, _count_if and _transform do
+ * what their names say, on a pool of threads that are started once and
+ * then wait for work.
+ *
+ * A vector, a typed vector or an iota_view is cut into chunks of
+ * AG_STD_PAR_CHUNK elements, and the threads (the caller too) take chunks
+ * until there are none left. The chunks depend only on the length of the
+ * range, never on the number of threads, and the results of the chunks
+ * are put together in order, so reduce gives the same answer (to the
+ * last bit, for doubles) on any number of threads. Other ranges are walked
+ * on the calling thread.
+ *
+ * The functions are called on each element from several threads at once,
+ * so they must not touch shared state unless it is made for that, and
+ * that includes the pools behind ag_std_new. An element of a typed vector
+ * is a box that is refilled for the next one.
+ */
+#define AG_STD_PAR_CHUNK 16384
+
+typedef void (*ag_std_par_job_fn)(void *job, size_t chunk);
+
+struct ag_std_par_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+
+  // The workers; the caller of ag_std_par_run makes one more.
+  pthread_t *workers;
+  size_t n_workers;
+
+  // The job they are on. A worker takes the next chunk with an atomic add,
+  // so handing out chunks doesn't take the lock.
+  ag_std_par_job_fn fn;
+  void *job;
+  size_t chunks;
+  size_t next;
+  unsigned long generation;
+
+  // Workers still on a job. A new one isn't posted until this is 0.
+  size_t busy;
+  int stop;
+
+  // Has ag_std_par_set_threads been called? (With 1 thread there are no
+  // workers, so that can't tell.)
+  int configured;
+};
+
+struct ag_std_par_pool ag_std_par_pool = {
+  PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+  NULL, 0, NULL, NULL, 0, 0, 0, 0, 0, 0
+};
+
+// One job at a time, from whichever thread.
+pthread_mutex_t ag_std_par_run_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t ag_std_par_once = PTHREAD_ONCE_INIT;
+
+// A job run from inside a job goes on the thread it is on.
+__thread int ag_std_par_nested = 0;
+
+// Internal function, take chunks of the job until there are none left.
+void ag_std_par_take_chunks(ag_std_par_job_fn fn, void *job, size_t chunks) {
+  struct ag_std_par_pool *pool = &ag_std_par_pool;
+
+  size_t c;
+  while ((c = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < chunks) {
+    fn(job, c);
+  }
+}
+
+void *ag_std_par_worker(void *arg) {
+  struct ag_std_par_pool *pool = arg;
+  unsigned long seen = 0;
+
+  ag_std_par_nested = 1;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->generation == seen) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+
+    seen = pool->generation;
+    ag_std_par_job_fn fn = pool->fn;
+    void *job = pool->job;
+    size_t chunks = pool->chunks;
+    pool->busy++;
+    pthread_mutex_unlock(&pool->lock);
+
+    ag_std_par_take_chunks(fn, job, chunks);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0) {
+      pthread_cond_broadcast(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+// Internal function, stop and join the workers.
+void ag_std_par_stop(void) {
+  struct ag_std_par_pool *pool = &ag_std_par_pool;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->n_workers; ++i) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  free(pool->workers);
+  pool->workers = NULL;
+  pool->n_workers = 0;
+  pool->stop = 0;
+}
+
+/* Use n threads, counting the one that calls the parallel functions. 1
+ * means everything runs on the caller. Not to be called while a parallel
+ * function is running.
+ */
+void ag_std_par_set_threads(size_t n) {
+  struct ag_std_par_pool *pool = &ag_std_par_pool;
+
+  pthread_mutex_lock(&ag_std_par_run_lock);
+  ag_std_par_stop();
+  pool->configured = 1;
+
+  if (n > 1) {
+    pool->workers = malloc((n - 1) * sizeof(pthread_t));
+    while (pool->workers != NULL && pool->n_workers < n - 1
+        && pthread_create(&pool->workers[pool->n_workers], NULL,
+          ag_std_par_worker, pool) == 0) {
+      pool->n_workers++;
+    }
+  }
+  pthread_mutex_unlock(&ag_std_par_run_lock);
+}
+
+// Internal function, one thread per CPU, unless ag_std_par_set_threads
+// said otherwise first.
+void ag_std_par_init(void) {
+  if (!ag_std_par_pool.configured) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ag_std_par_set_threads(cpus > 1 ? (size_t)cpus : 1);
+  }
+}
+
+size_t ag_std_par_threads(void) {
+  pthread_once(&ag_std_par_once, ag_std_par_init);
+  return ag_std_par_pool.n_workers + 1;
+}
+
+// Run fn(job, c) for every chunk c, on the pool, and wait for all of them.
+void ag_std_par_run(ag_std_par_job_fn fn, void *job, size_t chunks) {
+  struct ag_std_par_pool *pool = &ag_std_par_pool;
+
+  pthread_once(&ag_std_par_once, ag_std_par_init);
+
+  if (chunks <= 1 || ag_std_par_nested || pool->n_workers == 0) {
+    for (size_t c = 0; c < chunks; ++c) {
+      fn(job, c);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&ag_std_par_run_lock);
+
+  // A worker that woke up late for the last job may still be on it.
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pool->fn = fn;
+  pool->job = job;
+  pool->chunks = chunks;
+  pool->next = 0;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  ag_std_par_nested = 1;
+  ag_std_par_take_chunks(fn, job, chunks);
+  ag_std_par_nested = 0;
+
+  // Every chunk is taken; wait for the ones still running.
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_unlock(&ag_std_par_run_lock);
+}
+
+/* What the parallel functions need to know about a range: where its
+ * elements are if it can be cut up, and how many there are.
+ */
+struct ag_std_par_range {
+  void *rng;
+  struct ag_std_vector *vec;
+  struct ag_std_typed_vector *tv;
+  int iota;
+
+  // Whether it can be cut up; size is only known if so.
+  int split;
+  size_t size;
+  size_t chunks;
+};
+
+// Internal function. A range that can't be cut up is one chunk.
+void ag_std_par_range_of(void *rng, struct ag_std_par_range *pr) {
+  pr->rng = rng;
+  pr->vec = NULL;
+  pr->tv = ag_std_typed_vector_of(rng);
+  pr->iota = 0;
+  pr->split = 0;
+  pr->size = 0;
+  pr->chunks = 1;
+
+  if (pr->tv != NULL) {
+    pr->size = pr->tv->size;
+  } else if (ag_std_class_of(rng) == vector) {
+    pr->vec = rng;
+    pr->size = pr->vec->size;
+  } else if (ag_std_class_of(rng) == ag_std_iota_view) {
+    pr->iota = 1;
+    pr->size = ag_std_iota_view_size(rng);
+  } else {
+    return;
+  }
+
+  pr->split = 1;
+  pr->chunks = (pr->size + AG_STD_PAR_CHUNK - 1) / AG_STD_PAR_CHUNK;
+}
+
+/* Call visit(job, i, element) on the elements of chunk c, in order, until
+ * visit returns non zero. i is the element's index in the range.
+ */
+typedef int (*ag_std_par_visit_fn)(void *job, size_t i, void *elem);
+
+void ag_std_par_walk(
+    struct ag_std_par_range *pr,
+    size_t c,
+    ag_std_par_visit_fn visit,
+    void *job)
+{
+  size_t lo = c * AG_STD_PAR_CHUNK;
+  size_t hi = lo + AG_STD_PAR_CHUNK < pr->size ? lo + AG_STD_PAR_CHUNK : pr->size;
+
+  if (pr->vec != NULL) {
+    for (size_t i = lo; i < hi; ++i) {
+      if (visit(job, i, pr->vec->arr[i])) {
+        return;
+      }
+    }
+    return;
+  }
+
+  if (pr->iota) {
+    for (size_t i = lo; i < hi; ++i) {
+      if (visit(job, i, ag_std_int((int)i))) {
+        return;
+      }
+    }
+    return;
+  }
+
+  if (pr->tv != NULL) {
+    union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(pr->rng)];
+    void *it = ag_std_new_at(it_buf, ag_std_typed_vector_iter, pr->tv, lo);
+    for (size_t i = lo; i < hi; ++i) {
+      if (visit(job, i, ag_std_typed_vector_iter_deref(it))) {
+        return;
+      }
+      ag_std_typed_vector_iter_increment(it);
+    }
+    return;
+  }
+
+  // Anything else, on this thread with its iterators.
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(pr->rng)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(pr->rng)];
+  void *it = ag_std_begin_into(pr->rng, it_buf);
+  void *end = ag_std_end_into(pr->rng, end_buf);
+
+  void *batch[AG_STD_ITER_BATCH];
+  size_t i = 0;
+  size_t k;
+  while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+    for (size_t j = 0; j < k; ++j, ++i) {
+      if (visit(job, i, batch[j])) {
+        return;
+      }
+    }
+  }
+}
+
+// for_each
+
+struct ag_std_par_for_each_job {
+  struct ag_std_par_range pr;
+  ag_std_void_fn fn;
+};
+
+int ag_std_par_for_each_visit(void *job_arg, size_t i, void *elem) {
+  (void)i;
+  struct ag_std_par_for_each_job *job = job_arg;
+  job->fn(elem);
+  return 0;
+}
+
+void ag_std_par_for_each_chunk(void *job_arg, size_t c) {
+  struct ag_std_par_for_each_job *job = job_arg;
+  ag_std_par_walk(&job->pr, c, ag_std_par_for_each_visit, job);
+}
+
+// Call fn on every element, in no particular order.
+void ag_std_par_for_each(void *rng, ag_std_void_fn fn) {
+  struct ag_std_par_for_each_job job;
+  ag_std_par_range_of(rng, &job.pr);
+  job.fn = fn;
+
+  ag_std_par_run(ag_std_par_for_each_chunk, &job, job.pr.chunks);
+}
+
+// count_if
+
+struct ag_std_par_count_job {
+  struct ag_std_par_range pr;
+  ag_std_pred_fn pred;
+  size_t *counts;
+};
+
+struct ag_std_par_count_chunk {
+  struct ag_std_par_count_job *job;
+  size_t count;
+};
+
+int ag_std_par_count_visit(void *arg, size_t i, void *elem) {
+  (void)i;
+  struct ag_std_par_count_chunk *cc = arg;
+  cc->count += cc->job->pred(elem) != 0;
+  return 0;
+}
+
+void ag_std_par_count_if_chunk(void *job_arg, size_t c) {
+  struct ag_std_par_count_chunk cc = { job_arg, 0 };
+  ag_std_par_walk(&cc.job->pr, c, ag_std_par_count_visit, &cc);
+  cc.job->counts[c] = cc.count;
+}
+
+// How many elements pred is true for.
+size_t ag_std_par_count_if(void *rng, ag_std_pred_fn pred) {
+  struct ag_std_par_count_job job;
+  ag_std_par_range_of(rng, &job.pr);
+  job.pred = pred;
+  job.counts = malloc((job.pr.chunks + 1) * sizeof(size_t));
+  if (job.counts == NULL) {
+    return 0;
+  }
+
+  ag_std_par_run(ag_std_par_count_if_chunk, &job, job.pr.chunks);
+
+  size_t count = 0;
+  for (size_t c = 0; c < job.pr.chunks; ++c) {
+    count += job.counts[c];
+  }
+  free(job.counts);
+
+  return count;
+}
+
+// find_any
+
+struct ag_std_par_find_job {
+  struct ag_std_par_range pr;
+  ag_std_pred_fn pred;
+
+  // The lowest index found so far, SIZE_MAX for none. Chunks past it
+  // don't bother looking.
+  size_t found;
+};
+
+int ag_std_par_find_visit(void *job_arg, size_t i, void *elem) {
+  struct ag_std_par_find_job *job = job_arg;
+
+  if (!job->pred(elem)) {
+    return 0;
+  }
+
+  size_t found = __atomic_load_n(&job->found, __ATOMIC_RELAXED);
+  while (i < found && !__atomic_compare_exchange_n(
+        &job->found, &found, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  return 1;
+}
+
+void ag_std_par_find_any_chunk(void *job_arg, size_t c) {
+  struct ag_std_par_find_job *job = job_arg;
+
+  if (c * AG_STD_PAR_CHUNK > __atomic_load_n(&job->found, __ATOMIC_RELAXED)) {
+    return;
+  }
+  ag_std_par_walk(&job->pr, c, ag_std_par_find_visit, job);
+}
+
+/* Is pred true for any element? If so, and at isn't NULL, *at is the index
+ * of one. The chunks stop once an earlier one has found something, and
+ * of the ones found the lowest index wins, so that is usually (not always)
+ * the first match.
+ */
+int ag_std_par_find_any(void *rng, ag_std_pred_fn pred, size_t *at) {
+  struct ag_std_par_find_job job;
+  ag_std_par_range_of(rng, &job.pr);
+  job.pred = pred;
+  job.found = SIZE_MAX;
+
+  ag_std_par_run(ag_std_par_find_any_chunk, &job, job.pr.chunks);
+
+  if (job.found == SIZE_MAX) {
+    return 0;
+  }
+  if (at != NULL) {
+    *at = job.found;
+  }
+  return 1;
+}
+
+// transform
+
+struct ag_std_par_transform_job {
+  struct ag_std_par_range pr;
+  ag_std_get_fn fn;
+  void **out;
+};
+
+int ag_std_par_transform_visit(void *job_arg, size_t i, void *elem) {
+  struct ag_std_par_transform_job *job = job_arg;
+  job->out[i] = job->fn(elem);
+  return 0;
+}
+
+void ag_std_par_transform_chunk(void *job_arg, size_t c) {
+  struct ag_std_par_transform_job *job = job_arg;
+  ag_std_par_walk(&job->pr, c, ag_std_par_transform_visit, job);
+}
+
+/* Push fn of every element onto the vector out, in order. As with the
+ * transform view, what fn returns has to outlive its argument.
+ */
+void ag_std_par_transform(void *rng, void *out, ag_std_get_fn fn) {
+  struct ag_std_par_transform_job job;
+  ag_std_par_range_of(rng, &job.pr);
+  job.fn = fn;
+
+  // A range that can't be cut up doesn't know its size.
+  if (!job.pr.split) {
+    void *tv = ag_std_new(ag_std_transform_view, rng, fn);
+    ag_std_vector_extend_from_range(out, tv);
+    ag_std_delete(tv);
+    return;
+  }
+
+  struct ag_std_vector *v = out;
+  if (ag_std_vector_grow(v, job.pr.size) != 0) {
+    return;
+  }
+  job.out = v->arr + v->size;
+
+  ag_std_par_run(ag_std_par_transform_chunk, &job, job.pr.chunks);
+
+  // Retained here, since the counts of the results may not be atomic.
+  for (size_t i = 0; i < job.pr.size; ++i) {
+    v->counted |= ag_std_retain_counted(job.out[i]);
+  }
+  v->size += job.pr.size;
+}
+
+// reduce
+
+struct ag_std_par_reduce_job {
+  struct ag_std_par_range pr;
+  enum ag_std_num_op op;
+  struct ag_std_num *accs;
+  size_t *counts;
+  int *failed;
+};
+
+struct ag_std_par_reduce_chunk {
+  struct ag_std_par_reduce_job *job;
+  size_t c;
+};
+
+int ag_std_par_reduce_visit(void *arg, size_t i, void *elem) {
+  (void)i;
+  struct ag_std_par_reduce_chunk *rc = arg;
+  struct ag_std_par_reduce_job *job = rc->job;
+  struct ag_std_num x;
+
+  if (ag_std_num_of(elem, &x) != 0) {
+    job->failed[rc->c] = 1;
+    return 1;
+  }
+
+  if (job->counts[rc->c]++ == 0 && job->op != AG_STD_NUM_SUM) {
+    job->accs[rc->c] = x;
+  } else {
+    ag_std_num_fold(&job->accs[rc->c], &x, job->op);
+  }
+  return 0;
+}
+
+void ag_std_par_reduce_chunk(void *job_arg, size_t c) {
+  struct ag_std_par_reduce_job *job = job_arg;
+  struct ag_std_num *acc = &job->accs[c];
+
+  acc->is_float = 0;
+  acc->i = 0;
+  acc->d = 0.0;
+  job->counts[c] = 0;
+  job->failed[c] = 0;
+
+  // A chunk of a typed vector is a plain array, for the kernels.
+  struct ag_std_typed_vector *tv = job->pr.tv;
+  if (tv != NULL) {
+    size_t lo = c * AG_STD_PAR_CHUNK;
+    size_t n = tv->size - lo < AG_STD_PAR_CHUNK ? tv->size - lo : AG_STD_PAR_CHUNK;
+    const unsigned char *data = tv->data + lo * tv->elem_size;
+    struct ag_std_simd_kernels *k = ag_std_simd_get(tv->kind);
+    union ag_std_iter_slot raw;
+
+    job->counts[c] = n;
+    if (job->op == AG_STD_NUM_SUM) {
+      acc->is_float = tv->kind == AG_STD_FLOAT || tv->kind == AG_STD_DOUBLE;
+      k->sum(data, n, acc->is_float ? (void *)&acc->d : (void *)&acc->i);
+      return;
+    }
+
+    if (job->op == AG_STD_NUM_MIN) {
+      k->min(data, n, &raw);
+    } else {
+      k->max(data, n, &raw);
+    }
+    ag_std_typed_vector_num(tv, &raw, acc);
+    return;
+  }
+
+  struct ag_std_par_reduce_chunk rc = { job, c };
+  ag_std_par_walk(&job->pr, c, ag_std_par_reduce_visit, &rc);
+}
+
+/* Sum, min or max of a range of numbers, like ag_std_range_sum / _min /
+ * _max, and -1 in the same cases. Each chunk is folded on its own and the
+ * chunks are folded together in order, so a sum of doubles can differ
+ * from ag_std_range_sum in the last bits, but never from another run.
+ */
+int ag_std_par_reduce(void *rng, enum ag_std_num_op op, struct ag_std_num *out) {
+  struct ag_std_par_reduce_job job;
+  ag_std_par_range_of(rng, &job.pr);
+  job.op = op;
+
+  out->is_float = 0;
+  out->i = 0;
+  out->d = 0.0;
+
+  size_t chunks = job.pr.chunks;
+  job.accs = malloc((chunks + 1) * sizeof(struct ag_std_num));
+  job.counts = malloc((chunks + 1) * sizeof(size_t));
+  job.failed = malloc((chunks + 1) * sizeof(int));
+
+  int res = -1;
+  if (job.accs != NULL && job.counts != NULL && job.failed != NULL) {
+    ag_std_par_run(ag_std_par_reduce_chunk, &job, chunks);
+
+    size_t n = 0;
+    res = 0;
+    for (size_t c = 0; c < chunks && res == 0; ++c) {
+      if (job.failed[c]) {
+        res = -1;
+      } else if (job.counts[c] > 0) {
+        if (n == 0 && op != AG_STD_NUM_SUM) {
+          *out = job.accs[c];
+        } else {
+          ag_std_num_fold(out, &job.accs[c], op);
+        }
+        n += job.counts[c];
+      }
+    }
+
+    if (n == 0 && op != AG_STD_NUM_SUM) {
+      res = -1;
+    }
+  }
+
+  free(job.accs);
+  free(job.counts);
+  free(job.failed);
+
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tasks - fork / join on work stealing workers
+///////////////////////////////////////////////////////////////////////////////
+
+/* For parallel work that splits itself up as it goes (sorts, trees,
+ * ranges of ranges), where ag_std_par_run's flat chunks don't fit:
+ *
+ *   void sum_task(void *arg) {
+ *     struct job *j = arg;
+ *     if (small enough) { ...; return; }
+ *
+ *     struct job left = ..., right = ...;
+ *     struct ag_std_task_group g = AG_STD_TASK_GROUP_INIT;
+ *     struct ag_std_task t;
+ *     ag_std_spawn(&g, &t, sum_task, &left);
+ *     sum_task(&right);
+ *     ag_std_sync(&g);
+ *   }
+ *
+ *   ag_std_task_run(sum_task, &root);
+ *
+ * The task and what it captures (arg may be, or point to, any ag_std
+ * objects) belong to the spawner, and must outlive ag_std_sync; nothing is
+ * allocated per task. ag_std_task_run hands the first task to the workers
+ * and waits. spawn outside of a task just runs it.
+ *
+ * Every worker has a Chase-Lev deque: the worker pushes and takes at the
+ * bottom without locks, others steal from the top with one CAS. A worker
+ * with nothing to do, or one waiting in ag_std_sync, steals from the
+ * others (in ag_std_sync it never blocks). Only a worker that has found
+ * nothing for a while goes to sleep, until the next spawn.
+ */
+struct ag_std_task_group {
+  size_t pending;
+
+  // Whether a thread outside is waiting on it, in ag_std_task_run.
+  int outside;
+};
+
+#define AG_STD_TASK_GROUP_INIT { 0, 0 }
+
+struct ag_std_task {
+  ag_std_void_fn fn;
+  void *arg;
+  struct ag_std_task_group *group;
+
+  // For the queue ag_std_task_run puts first tasks on.
+  struct ag_std_task *next;
+};
+
+// A deque's array. The old ones are kept until the deque goes away, since
+// a thief may still be reading one.
+struct ag_std_deque_array {
+  struct ag_std_deque_array *older;
+  size_t mask;
+  struct ag_std_task *tasks[];
+};
+
+struct ag_std_deque {
+  int64_t top;
+  int64_t bottom;
+  struct ag_std_deque_array *array;
+};
+
+struct ag_std_deque_array *ag_std_deque_array_new(size_t size, struct ag_std_deque_array *older) {
+  struct ag_std_deque_array *a =
+    malloc(sizeof(struct ag_std_deque_array) + size * sizeof(struct ag_std_task *));
+  if (a != NULL) {
+    a->older = older;
+    a->mask = size - 1;
+  }
+  return a;
+}
+
+void ag_std_deque_init(struct ag_std_deque *d) {
+  d->top = 0;
+  d->bottom = 0;
+  d->array = ag_std_deque_array_new(256, NULL);
+}
+
+void ag_std_deque_free(struct ag_std_deque *d) {
+  struct ag_std_deque_array *a = d->array;
+  while (a != NULL) {
+    struct ag_std_deque_array *older = a->older;
+    free(a);
+    a = older;
+  }
+  d->array = NULL;
+}
+
+// The owner only. Returns -1 if the deque is full and can't grow.
+int ag_std_deque_push(struct ag_std_deque *d, struct ag_std_task *t) {
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  struct ag_std_deque_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+  if ((size_t)(b - top) > a->mask) {
+    struct ag_std_deque_array *bigger = ag_std_deque_array_new(2 * (a->mask + 1), a);
+    if (bigger == NULL) {
+      return -1;
+    }
+    for (int64_t i = top; i < b; ++i) {
+      bigger->tasks[i & bigger->mask] =
+        __atomic_load_n(&a->tasks[i & a->mask], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&d->array, bigger, __ATOMIC_RELEASE);
+    a = bigger;
+  }
+
+  // Release, so a thief that sees the new bottom sees the task too.
+  __atomic_store_n(&a->tasks[b & a->mask], t, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// The owner only, the last task pushed.
+struct ag_std_task *ag_std_deque_take(struct ag_std_deque *d) {
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  struct ag_std_deque_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+  if (top > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  struct ag_std_task *t = __atomic_load_n(&a->tasks[b & a->mask], __ATOMIC_RELAXED);
+  if (top == b) {
+    // The last one: a thief may be after it too.
+    if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0,
+          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      t = NULL;
+    }
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+
+  return t;
+}
+
+// Anyone, the first task pushed. NULL if it is empty or another thief won.
+struct ag_std_task *ag_std_deque_steal(struct ag_std_deque *d) {
+  int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= b) {
+    return NULL;
+  }
+
+  struct ag_std_deque_array *a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+  struct ag_std_task *t = __atomic_load_n(&a->tasks[top & a->mask], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+
+  return t;
+}
+
+/* Per worker numbers, for tuning: how many tasks it ran, how many of
+ * those it stole, how often it looked for one to steal and found none,
+ * and how long it spent with nothing to run.
+ */
+struct ag_std_sched_stats {
+  size_t tasks;
+  size_t steals;
+  size_t failed_steals;
+  double idle_seconds;
+};
+
+struct ag_std_worker {
+  struct ag_std_deque deque;
+  pthread_t thread;
+  size_t id;
+  uint64_t rand;
+
+  // Written by the worker, read by anyone, with atomics.
+  size_t tasks;
+  size_t steals;
+  size_t failed_steals;
+  uint64_t idle_ns;
+};
+
+struct ag_std_sched {
+  struct ag_std_worker *workers;
+  size_t n_workers;
+
+  // Tasks from outside, waiting for a worker.
+  struct ag_std_task *injected;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  size_t sleepers;
+  unsigned long spawns;
+  int stop;
+};
+
+struct ag_std_sched ag_std_sched = {
+  NULL, 0, NULL,
+  PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+  0, 0, 0
+};
+
+pthread_once_t ag_std_sched_once = PTHREAD_ONCE_INIT;
+
+// The worker this thread is, if it is one.
+__thread struct ag_std_worker *ag_std_sched_self = NULL;
+
+uint64_t ag_std_sched_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Internal function, run a task and tell its group. The task is the
+// spawner's, so it can't be touched once the group hears about it.
+void ag_std_sched_run_task(struct ag_std_task *t) {
+  struct ag_std_task_group *g = t->group;
+  int outside = g->outside;
+  t->fn(t->arg);
+
+  if (ag_std_sched_self != NULL) {
+    __atomic_fetch_add(&ag_std_sched_self->tasks, 1, __ATOMIC_RELAXED);
+  }
+
+  if (__atomic_sub_fetch(&g->pending, 1, __ATOMIC_ACQ_REL) == 0 && outside) {
+    pthread_mutex_lock(&ag_std_sched.lock);
+    pthread_cond_broadcast(&ag_std_sched.done);
+    pthread_mutex_unlock(&ag_std_sched.lock);
+  }
+}
+
+// Internal function, a task from the outside queue or another worker.
+struct ag_std_task *ag_std_sched_find(struct ag_std_worker *w) {
+  struct ag_std_sched *s = &ag_std_sched;
+
+  if (__atomic_load_n(&s->injected, __ATOMIC_ACQUIRE) != NULL) {
+    pthread_mutex_lock(&s->lock);
+    struct ag_std_task *t = s->injected;
+    if (t != NULL) {
+      __atomic_store_n(&s->injected, t->next, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (t != NULL) {
+      return t;
+    }
+  }
+
+  // Start at a random victim and go round once.
+  w->rand ^= w->rand << 13;
+  w->rand ^= w->rand >> 7;
+  w->rand ^= w->rand << 17;
+  size_t start = (size_t)(w->rand % s->n_workers);
+
+  for (size_t k = 0; k < s->n_workers; ++k) {
+    struct ag_std_worker *victim = &s->workers[(start + k) % s->n_workers];
+    if (victim == w) {
+      continue;
+    }
+
+    struct ag_std_task *t = ag_std_deque_steal(&victim->deque);
+    if (t != NULL) {
+      __atomic_fetch_add(&w->steals, 1, __ATOMIC_RELAXED);
+      return t;
+    }
+  }
+
+  __atomic_fetch_add(&w->failed_steals, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+// Rounds of stealing (with a yield between) before a worker sleeps.
+#define AG_STD_SCHED_SPINS 64
+
+void *ag_std_sched_worker(void *arg) {
+  struct ag_std_worker *w = arg;
+  struct ag_std_sched *s = &ag_std_sched;
+  ag_std_sched_self = w;
+
+  int misses = 0;
+  uint64_t idle_from = 0;
+
+  while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+    // A spawn after this is seen by a worker about to sleep.
+    unsigned long seen = __atomic_load_n(&s->spawns, __ATOMIC_SEQ_CST);
+
+    struct ag_std_task *t = ag_std_deque_take(&w->deque);
+    if (t == NULL) {
+      t = ag_std_sched_find(w);
+    }
+
+    if (t != NULL) {
+      if (idle_from != 0) {
+        __atomic_fetch_add(&w->idle_ns, ag_std_sched_now_ns() - idle_from, __ATOMIC_RELAXED);
+        idle_from = 0;
+      }
+      misses = 0;
+      ag_std_sched_run_task(t);
+      continue;
+    }
+
+    if (idle_from == 0) {
+      idle_from = ag_std_sched_now_ns();
+    }
+
+    if (++misses < AG_STD_SCHED_SPINS) {
+      sched_yield();
+      continue;
+    }
+
+    // Nothing for a while: sleep until something is spawned.
+    pthread_mutex_lock(&s->lock);
+    __atomic_fetch_add(&s->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&s->spawns, __ATOMIC_SEQ_CST) == seen
+        && s->injected == NULL && !s->stop) {
+      pthread_cond_wait(&s->wake, &s->lock);
+    }
+    __atomic_fetch_sub(&s->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&s->lock);
+    misses = 0;
+  }
+
+  if (idle_from != 0) {
+    __atomic_fetch_add(&w->idle_ns, ag_std_sched_now_ns() - idle_from, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+// Internal function, wake the sleeping workers, if there are any.
+void ag_std_sched_wake(void) {
+  struct ag_std_sched *s = &ag_std_sched;
+
+  __atomic_fetch_add(&s->spawns, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&s->sleepers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+// Stop and join the workers. Not while a task is running.
+void ag_std_sched_stop(void) {
+  struct ag_std_sched *s = &ag_std_sched;
+
+  pthread_mutex_lock(&s->lock);
+  __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  for (size_t i = 0; i < s->n_workers; ++i) {
+    pthread_join(s->workers[i].thread, NULL);
+    ag_std_deque_free(&s->workers[i].deque);
+  }
+
+  free(s->workers);
+  s->workers = NULL;
+  s->n_workers = 0;
+  s->stop = 0;
+}
+
+// (Re)start with n workers, which also clears the stats.
+void ag_std_sched_start(size_t n) {
+  struct ag_std_sched *s = &ag_std_sched;
+
+  ag_std_sched_stop();
+  if (n == 0) {
+    n = 1;
+  }
+
+  s->workers = calloc(n, sizeof(struct ag_std_worker));
+  if (s->workers == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    struct ag_std_worker *w = &s->workers[i];
+    ag_std_deque_init(&w->deque);
+    w->id = i;
+    w->rand = 0x9e3779b97f4a7c15ULL * (i + 1);
+  }
+
+  // Every worker is in place before any of them goes looking at the others.
+  s->n_workers = n;
+  for (size_t i = 0; i < n; ++i) {
+    if (pthread_create(&s->workers[i].thread, NULL, ag_std_sched_worker, &s->workers[i]) != 0) {
+      // Tell the ones running to stop, and forget the rest.
+      s->n_workers = i;
+      ag_std_sched_stop();
+      return;
+    }
+  }
+}
+
+// Internal function, one worker per CPU, unless ag_std_sched_start came
+// first.
+void ag_std_sched_init(void) {
+  if (ag_std_sched.workers == NULL) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ag_std_sched_start(cpus > 1 ? (size_t)cpus : 1);
+  }
+}
+
+size_t ag_std_sched_workers(void) {
+  pthread_once(&ag_std_sched_once, ag_std_sched_init);
+  return ag_std_sched.n_workers;
+}
+
+// The numbers of one worker; all 0 for one that isn't there (or before
+// the workers have started).
+void ag_std_sched_stats(size_t worker, struct ag_std_sched_stats *out) {
+  if (ag_std_sched.workers == NULL || worker >= ag_std_sched.n_workers) {
+    *out = (struct ag_std_sched_stats) { 0, 0, 0, 0.0 };
+    return;
+  }
+
+  struct ag_std_worker *w = &ag_std_sched.workers[worker];
+  out->tasks = __atomic_load_n(&w->tasks, __ATOMIC_RELAXED);
+  out->steals = __atomic_load_n(&w->steals, __ATOMIC_RELAXED);
+  out->failed_steals = __atomic_load_n(&w->failed_steals, __ATOMIC_RELAXED);
+  out->idle_seconds = (double)__atomic_load_n(&w->idle_ns, __ATOMIC_RELAXED) * 1e-9;
+}
+
+void ag_std_sched_print_stats(void) {
+  for (size_t i = 0; i < ag_std_sched.n_workers; ++i) {
+    struct ag_std_sched_stats stats;
+    ag_std_sched_stats(i, &stats);
+    printf("sched: worker %zu: %zu tasks, %zu stolen, %zu failed steals, %.3f s idle\n",
+        i, stats.tasks, stats.steals, stats.failed_steals, stats.idle_seconds);
+  }
+}
+
+/* Let fn(arg) run on a worker, some time before ag_std_sync(g). t is
+ * filled in here, and is the spawner's to keep until then.
+ */
+void ag_std_spawn(
+    struct ag_std_task_group *g,
+    struct ag_std_task *t,
+    ag_std_void_fn fn,
+    void *arg)
+{
+  struct ag_std_worker *w = ag_std_sched_self;
+
+  // Not on a worker, or no room: just run it.
+  if (w == NULL) {
+    fn(arg);
+    return;
+  }
+
+  t->fn = fn;
+  t->arg = arg;
+  t->group = g;
+  t->next = NULL;
+
+  __atomic_fetch_add(&g->pending, 1, __ATOMIC_RELAXED);
+  if (ag_std_deque_push(&w->deque, t) != 0) {
+    __atomic_fetch_sub(&g->pending, 1, __ATOMIC_RELAXED);
+    fn(arg);
+    return;
+  }
+
+  ag_std_sched_wake();
+}
+
+// Wait for everything spawned into g, running tasks (ours, or stolen)
+// meanwhile.
+void ag_std_sync(struct ag_std_task_group *g) {
+  struct ag_std_worker *w = ag_std_sched_self;
+
+  while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE) > 0) {
+    struct ag_std_task *t = ag_std_deque_take(&w->deque);
+    if (t == NULL) {
+      t = ag_std_sched_find(w);
+    }
+
+    if (t != NULL) {
+      ag_std_sched_run_task(t);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+// Run fn(arg) as a task on the workers, and wait until it (and all it
+// spawned) is done. On a worker, it is just called.
+void ag_std_task_run(ag_std_void_fn fn, void *arg) {
+  struct ag_std_sched *s = &ag_std_sched;
+
+  if (ag_std_sched_self != NULL) {
+    fn(arg);
+    return;
+  }
+
+  pthread_once(&ag_std_sched_once, ag_std_sched_init);
+  if (s->n_workers == 0) {
+    fn(arg);
+    return;
+  }
+
+  struct ag_std_task_group g = { 1, 1 };
+  struct ag_std_task t = { fn, arg, &g, NULL };
+
+  pthread_mutex_lock(&s->lock);
+  struct ag_std_task **tail = &s->injected;
+  while (*tail != NULL) {
+    tail = &(*tail)->next;
+  }
+  __atomic_store_n(tail, &t, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&s->lock);
+  ag_std_sched_wake();
+
+  pthread_mutex_lock(&s->lock);
+  while (__atomic_load_n(&g.pending, __ATOMIC_ACQUIRE) > 0) {
+    pthread_cond_wait(&s->done, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sorting - vectors, by ag_std_cmp or by radix
+///////////////////////////////////////////////////////////////////////////////
+
+/* ag_std_sort and ag_std_stable_sort sort a vector, or a typed vector, in
+ * place. A vector is sorted by ag_std_cmp, with pattern-defeating quicksort
+ * (or a merge sort, to keep equal elements in order). If all its elements
+ * are integers, or all are floatings, and for a typed vector always, the
+ * numbers themselves are radix sorted instead, with no calls at all. A big
+ * vector of anything else is cut into one piece per thread, the pieces
+ * sorted side by side, and then merged, pair by pair, also side by side.
+ */
+
+// Below this, insertion sort.
+#define AG_STD_SORT_INSERTION 24
+
+// Above this, the pivot is a median of three medians of three.
+#define AG_STD_SORT_NINTHER 128
+
+// How much moving around the partial insertion sort does, before it gives up.
+#define AG_STD_SORT_PARTIAL_LIMIT 8
+
+// Radix sorting fewer than this is not worth its histograms.
+#define AG_STD_SORT_RADIX_MIN 256
+
+// Below this, a vector is sorted on this thread only.
+#define AG_STD_SORT_PAR_MIN (1 << 16)
+
+// Internal function, swap two elements.
+void ag_std_sort_swap(void **a, void **b) {
+  void *tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+/* Internal function, insertion sort [begin, end). Unless leftmost, there
+ * is an element at begin[-1] no bigger than any in the range, so the inner
+ * loop needn't look for begin.
+ */
+void ag_std_sort_insertion(void **begin, void **end, int leftmost) {
+  if (begin == end) {
+    return;
+  }
+
+  for (void **cur = begin + 1; cur != end; ++cur) {
+    void **sift = cur;
+    void **sift_1 = cur - 1;
+
+    if (ag_std_cmp(*sift, *sift_1) < 0) {
+      void *tmp = *sift;
+      do {
+        *sift-- = *sift_1;
+      } while ((!leftmost || sift != begin) && ag_std_cmp(tmp, *--sift_1) < 0);
+      *sift = tmp;
+    }
+  }
+}
+
+// Internal function, insertion sort [begin, end), but give up (returning 0)
+// once too much has had to move: the range was not nearly sorted after all.
+int ag_std_sort_partial_insertion(void **begin, void **end) {
+  if (begin == end) {
+    return 1;
+  }
+
+  size_t moved = 0;
+  for (void **cur = begin + 1; cur != end; ++cur) {
+    void **sift = cur;
+    void **sift_1 = cur - 1;
+
+    if (ag_std_cmp(*sift, *sift_1) < 0) {
+      void *tmp = *sift;
+      do {
+        *sift-- = *sift_1;
+      } while (sift != begin && ag_std_cmp(tmp, *--sift_1) < 0);
+      *sift = tmp;
+
+      moved += (size_t)(cur - sift);
+      if (moved > AG_STD_SORT_PARTIAL_LIMIT) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+// Internal function, put *a, *b (and *c) in order.
+void ag_std_sort2(void **a, void **b) {
+  if (ag_std_cmp(*b, *a) < 0) {
+    ag_std_sort_swap(a, b);
+  }
+}
+
+void ag_std_sort3(void **a, void **b, void **c) {
+  ag_std_sort2(a, b);
+  ag_std_sort2(b, c);
+  ag_std_sort2(a, b);
+}
+
+// Internal function, heap sort [begin, end): for when the partitions keep
+// coming out lopsided.
+void ag_std_sort_sift_down(void **a, size_t i, size_t n) {
+  void *x = a[i];
+  while (2 * i + 1 < n) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < n && ag_std_cmp(a[child], a[child + 1]) < 0) {
+      ++child;
+    }
+    if (ag_std_cmp(x, a[child]) >= 0) {
+      break;
+    }
+    a[i] = a[child];
+    i = child;
+  }
+  a[i] = x;
+}
+
+void ag_std_sort_heap(void **begin, void **end) {
+  size_t n = (size_t)(end - begin);
+  for (size_t i = n / 2; i > 0; --i) {
+    ag_std_sort_sift_down(begin, i - 1, n);
+  }
+  for (size_t i = n - 1; i > 0; --i) {
+    ag_std_sort_swap(&begin[0], &begin[i]);
+    ag_std_sort_sift_down(begin, 0, i);
+  }
+}
+
+/* Internal function, partition [begin, end) around the pivot at *begin:
+ * the smaller elements go left of it, the others right. Returns where the
+ * pivot ends up, and whether nothing had to be swapped.
+ */
+void **ag_std_sort_partition_right(void **begin, void **end, int *already_partitioned) {
+  void *pivot = *begin;
+  void **first = begin;
+  void **last = end;
+
+  // The median of three left a big enough element at the end, and one no
+  // bigger than the pivot at begin[-1] (or, leftmost, the pivot is it).
+  while (ag_std_cmp(*++first, pivot) < 0) {
+  }
+  if (first - 1 == begin) {
+    while (first < last && ag_std_cmp(*--last, pivot) >= 0) {
+    }
+  } else {
+    while (ag_std_cmp(*--last, pivot) >= 0) {
+    }
+  }
+
+  *already_partitioned = first >= last;
+
+  while (first < last) {
+    ag_std_sort_swap(first, last);
+    while (ag_std_cmp(*++first, pivot) < 0) {
+    }
+    while (ag_std_cmp(*--last, pivot) >= 0) {
+    }
+  }
+
+  void **pivot_pos = first - 1;
+  *begin = *pivot_pos;
+  *pivot_pos = pivot;
+
+  return pivot_pos;
+}
+
+/* Internal function, the same, but the elements equal to the pivot go left
+ * of it. It is used when the pivot equals begin[-1], the pivot of a range
+ * further left: all of them are then in place, and are skipped over, so
+ * many equal elements cost linear time.
+ */
+void **ag_std_sort_partition_left(void **begin, void **end) {
+  void *pivot = *begin;
+  void **first = begin;
+  void **last = end;
+
+  while (ag_std_cmp(pivot, *--last) < 0) {
+  }
+  if (last + 1 == end) {
+    while (first < last && ag_std_cmp(pivot, *++first) >= 0) {
+    }
+  } else {
+    while (ag_std_cmp(pivot, *++first) >= 0) {
+    }
+  }
+
+  while (first < last) {
+    ag_std_sort_swap(first, last);
+    while (ag_std_cmp(pivot, *--last) < 0) {
+    }
+    while (ag_std_cmp(pivot, *++first) >= 0) {
+    }
+  }
+
+  void **pivot_pos = last;
+  *begin = *pivot_pos;
+  *pivot_pos = pivot;
+
+  return pivot_pos;
+}
+
+/* Internal function, pattern-defeating quicksort of [begin, end). After
+ * bad_allowed lopsided partitions it goes over to heap sort. It recurses on
+ * the left part and loops on the right.
+ */
+void ag_std_pdqsort(void **begin, void **end, int bad_allowed, int leftmost) {
+  while (1) {
+    size_t size = (size_t)(end - begin);
+
+    if (size < AG_STD_SORT_INSERTION) {
+      ag_std_sort_insertion(begin, end, leftmost);
+      return;
+    }
+
+    // The pivot goes to *begin.
+    size_t s2 = size / 2;
+    if (size > AG_STD_SORT_NINTHER) {
+      ag_std_sort3(begin, begin + s2, end - 1);
+      ag_std_sort3(begin + 1, begin + (s2 - 1), end - 2);
+      ag_std_sort3(begin + 2, begin + (s2 + 1), end - 3);
+      ag_std_sort3(begin + (s2 - 1), begin + s2, begin + (s2 + 1));
+      ag_std_sort_swap(begin, begin + s2);
+    } else {
+      ag_std_sort3(begin + s2, begin, end - 1);
+    }
+
+    // Equal to the pivot of the range to the left: nothing can be smaller,
+    // so take the equal ones off and go on with the rest.
+    if (!leftmost && ag_std_cmp(*(begin - 1), *begin) >= 0) {
+      begin = ag_std_sort_partition_left(begin, end) + 1;
+      continue;
+    }
+
+    int already_partitioned;
+    void **pivot_pos = ag_std_sort_partition_right(begin, end, &already_partitioned);
+
+    size_t l_size = (size_t)(pivot_pos - begin);
+    size_t r_size = (size_t)(end - (pivot_pos + 1));
+
+    if (l_size < size / 8 || r_size < size / 8) {
+      if (--bad_allowed == 0) {
+        ag_std_sort_heap(begin, end);
+        return;
+      }
+
+      // Shuffle some elements around, to break up whatever pattern it was.
+      if (l_size >= AG_STD_SORT_INSERTION) {
+        ag_std_sort_swap(begin, begin + l_size / 4);
+        ag_std_sort_swap(pivot_pos - 1, pivot_pos - l_size / 4);
+        if (l_size > AG_STD_SORT_NINTHER) {
+          ag_std_sort_swap(begin + 1, begin + (l_size / 4 + 1));
+          ag_std_sort_swap(begin + 2, begin + (l_size / 4 + 2));
+          ag_std_sort_swap(pivot_pos - 2, pivot_pos - (l_size / 4 + 1));
+          ag_std_sort_swap(pivot_pos - 3, pivot_pos - (l_size / 4 + 2));
+        }
+      }
+      if (r_size >= AG_STD_SORT_INSERTION) {
+        ag_std_sort_swap(pivot_pos + 1, pivot_pos + (1 + r_size / 4));
+        ag_std_sort_swap(end - 1, end - r_size / 4);
+        if (r_size > AG_STD_SORT_NINTHER) {
+          ag_std_sort_swap(pivot_pos + 2, pivot_pos + (2 + r_size / 4));
+          ag_std_sort_swap(pivot_pos + 3, pivot_pos + (3 + r_size / 4));
+          ag_std_sort_swap(end - 2, end - (1 + r_size / 4));
+          ag_std_sort_swap(end - 3, end - (2 + r_size / 4));
+        }
+      }
+    } else if (already_partitioned
+        && ag_std_sort_partial_insertion(begin, pivot_pos)
+        && ag_std_sort_partial_insertion(pivot_pos + 1, end)) {
+      // It was (nearly) sorted already.
+      return;
+    }
+
+    ag_std_pdqsort(begin, pivot_pos, bad_allowed, leftmost);
+    begin = pivot_pos + 1;
+    leftmost = 0;
+  }
+}
+
+// Internal function, sort n elements with pdqsort.
+void ag_std_sort_unstable(void **arr, size_t n) {
+  int log2 = 0;
+  for (size_t m = n; m > 1; m >>= 1) {
+    ++log2;
+  }
+
+  ag_std_pdqsort(arr, arr + n, log2 + 1, 1);
+}
+
+// Internal function, merge a[0..na) and b[0..nb) into out; on a tie the
+// element from a comes first.
+void ag_std_sort_merge_into(void **a, size_t na, void **b, size_t nb, void **out) {
+  size_t i = 0;
+  size_t j = 0;
+  while (i < na && j < nb) {
+    *out++ = ag_std_cmp(b[j], a[i]) < 0 ? b[j++] : a[i++];
+  }
+  memcpy(out, a + i, sizeof(void *) * (na - i));
+
+  // When merging in place, what is left of b may already be where it goes.
+  memmove(out + (na - i), b + j, sizeof(void *) * (nb - j));
+}
+
+/* Internal function, merge sort n elements, stably. buf has room for n / 2
+ * of them. Halves that are in order already are not merged.
+ */
+void ag_std_sort_stable(void **arr, size_t n, void **buf) {
+  if (n < AG_STD_SORT_INSERTION) {
+    ag_std_sort_insertion(arr, arr + n, 1);
+    return;
+  }
+
+  size_t mid = n / 2;
+  ag_std_sort_stable(arr, mid, buf);
+  ag_std_sort_stable(arr + mid, n - mid, buf);
+  if (ag_std_cmp(arr[mid], arr[mid - 1]) >= 0) {
+    return;
+  }
+
+  // The right half moves left no faster than the left half is taken out
+  // of buf, so it can be merged into arr itself.
+  memcpy(buf, arr, sizeof(void *) * mid);
+  ag_std_sort_merge_into(buf, mid, arr + mid, n - mid, arr);
+}
+
+/* Internal function, LSD radix sort n 64 bit keys, a byte at a time, and
+ * vals (if not NULL) with them. ktmp and vtmp are room for n more. Bytes
+ * that are the same in every key are skipped, so 32 bit keys take 4 passes.
+ * Returns -1 (having done nothing) if there is no memory for the counts.
+ */
+int ag_std_sort_radix(uint64_t *keys, void **vals, size_t n, uint64_t *ktmp, void **vtmp) {
+  size_t (*counts)[256] = calloc(8, sizeof(*counts));
+  if (counts == NULL) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t k = keys[i];
+    for (int b = 0; b < 8; ++b) {
+      counts[b][(k >> (8 * b)) & 0xff]++;
+    }
+  }
+
+  uint64_t *k_in = keys;
+  uint64_t *k_out = ktmp;
+  void **v_in = vals;
+  void **v_out = vtmp;
+
+  for (int b = 0; b < 8; ++b) {
+    size_t *count = counts[b];
+    if (count[(keys[0] >> (8 * b)) & 0xff] == n) {
+      continue;
+    }
+
+    size_t sum = 0;
+    for (int d = 0; d < 256; ++d) {
+      size_t c = count[d];
+      count[d] = sum;
+      sum += c;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      size_t at = count[(k_in[i] >> (8 * b)) & 0xff]++;
+      k_out[at] = k_in[i];
+      if (vals != NULL) {
+        v_out[at] = v_in[i];
+      }
+    }
+
+    uint64_t *k_swap = k_in;
+    k_in = k_out;
+    k_out = k_swap;
+    void **v_swap = v_in;
+    v_in = v_out;
+    v_out = v_swap;
+  }
+
+  if (k_in != keys) {
+    memcpy(keys, k_in, sizeof(uint64_t) * n);
+    if (vals != NULL) {
+      memcpy(vals, v_in, sizeof(void *) * n);
+    }
+  }
+
+  free(counts);
+  return 0;
+}
+
+// Internal function, for qsort, when there is no memory to radix sort keys.
+int ag_std_sort_key_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Internal functions, numbers as keys that sort (as unsigned) in the same
+ * order. For a float the sign bit is flipped, and if it was set, all the
+ * other bits too.
+ */
+uint64_t ag_std_sort_float_key(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+uint64_t ag_std_sort_double_key(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return bits & 0x8000000000000000u ? ~bits : bits | 0x8000000000000000u;
+}
+
+double ag_std_sort_double_of_key(uint64_t key) {
+  uint64_t bits = key & 0x8000000000000000u ? key ^ 0x8000000000000000u : ~key;
+  double x;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+/* Internal function, radix sort a vector whose elements are all integers,
+ * or all floatings. Returns 0 if they are not (or there are too few, or no
+ * memory to do it), and arr is left for the other sorts.
+ */
+int ag_std_sort_radix_boxed(void **arr, size_t n) {
+  if (n < AG_STD_SORT_RADIX_MIN) {
+    return 0;
+  }
+
+  void *cls = ag_std_class_of(arr[0]);
+  if (cls != integer && cls != floating) {
+    return 0;
+  }
+  for (size_t i = 1; i < n; ++i) {
+    if (ag_std_class_of(arr[i]) != cls) {
+      return 0;
+    }
+  }
+
+  uint64_t *keys = malloc(sizeof(uint64_t) * 2 * n);
+  void **vtmp = malloc(sizeof(void *) * n);
+  if (keys == NULL || vtmp == NULL) {
+    free(keys);
+    free(vtmp);
+    return 0;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    if (cls == integer) {
+      keys[i] = (uint32_t)ag_std_int_value(arr[i]) ^ 0x80000000u;
+    } else {
+      // -0 and 0 compare equal, so they must get the same key.
+      float x = ag_std_float_value(arr[i]);
+      keys[i] = ag_std_sort_float_key(x == 0 ? 0.0f : x);
+    }
+  }
+
+  int res = ag_std_sort_radix(keys, arr, n, keys + n, vtmp);
+
+  free(keys);
+  free(vtmp);
+  return res == 0;
+}
+
+/* Internal function, sort a typed vector: its numbers are made into keys,
+ * and back. The order is a total one: -0 comes before 0, and NaNs go to
+ * the ends. Returns -1 (having done nothing) if there is no memory for
+ * the keys.
+ */
+int ag_std_sort_typed(struct ag_std_typed_vector *v) {
+  size_t n = v->size;
+  if (n < 2) {
+    return 0;
+  }
+
+  uint64_t *keys = malloc(sizeof(uint64_t) * 2 * n);
+  if (keys == NULL) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    unsigned char *at = v->data + i * v->elem_size;
+    switch (v->kind) {
+      case AG_STD_INT32: {
+        int32_t x;
+        memcpy(&x, at, sizeof(x));
+        keys[i] = (uint32_t)x ^ 0x80000000u;
+        break;
+      }
+      case AG_STD_INT64: {
+        int64_t x;
+        memcpy(&x, at, sizeof(x));
+        keys[i] = (uint64_t)x ^ 0x8000000000000000u;
+        break;
+      }
+      case AG_STD_FLOAT: {
+        float x;
+        memcpy(&x, at, sizeof(x));
+        keys[i] = ag_std_sort_float_key(x);
+        break;
+      }
+      case AG_STD_DOUBLE: {
+        double x;
+        memcpy(&x, at, sizeof(x));
+        keys[i] = ag_std_sort_double_key(x);
+        break;
+      }
+    }
+  }
+
+  if (n < AG_STD_SORT_RADIX_MIN) {
+    for (size_t i = 1; i < n; ++i) {
+      uint64_t k = keys[i];
+      size_t j = i;
+      while (j > 0 && k < keys[j - 1]) {
+        keys[j] = keys[j - 1];
+        --j;
+      }
+      keys[j] = k;
+    }
+  } else if (ag_std_sort_radix(keys, NULL, n, keys + n, NULL) != 0) {
+    qsort(keys, n, sizeof(uint64_t), ag_std_sort_key_cmp);
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    unsigned char *at = v->data + i * v->elem_size;
+    switch (v->kind) {
+      case AG_STD_INT32: {
+        int32_t x = (int32_t)(uint32_t)(keys[i] ^ 0x80000000u);
+        memcpy(at, &x, sizeof(x));
+        break;
+      }
+      case AG_STD_INT64: {
+        int64_t x = (int64_t)(keys[i] ^ 0x8000000000000000u);
+        memcpy(at, &x, sizeof(x));
+        break;
+      }
+      case AG_STD_FLOAT: {
+        uint32_t bits = (uint32_t)keys[i];
+        bits = bits & 0x80000000u ? bits ^ 0x80000000u : ~bits;
+        memcpy(at, &bits, sizeof(bits));
+        break;
+      }
+      case AG_STD_DOUBLE: {
+        double x = ag_std_sort_double_of_key(keys[i]);
+        memcpy(at, &x, sizeof(x));
+        break;
+      }
+    }
+  }
+
+  free(keys);
+  return 0;
+}
+
+/* The parallel sort. First every run of `run` elements is sorted, one per
+ * chunk; then runs are merged two by two, from src into dst, until there is
+ * one. So that the last merges keep all threads busy too, each merge is cut
+ * into `pieces` pieces of the output.
+ */
+struct ag_std_sort_job {
+  void **arr;
+  void **buf;
+  size_t n;
+  int stable;
+
+  size_t run;
+  size_t pieces;
+  void **src;
+  void **dst;
+};
+
+// Internal function, sort chunk c's run.
+void ag_std_sort_run_chunk(void *job_arg, size_t c) {
+  struct ag_std_sort_job *job = job_arg;
+  size_t lo = c * job->run;
+  if (lo >= job->n) {
+    return;
+  }
+  size_t n = job->n - lo < job->run ? job->n - lo : job->run;
+
+  if (job->stable) {
+    ag_std_sort_stable(job->arr + lo, n, job->buf + lo);
+  } else {
+    ag_std_sort_unstable(job->arr + lo, n);
+  }
+}
+
+/* Internal function, how many of the first d elements of the merge of
+ * a[0..na) and b[0..nb) come from a (ties going to a).
+ */
+size_t ag_std_sort_corank(size_t d, void **a, size_t na, void **b, size_t nb) {
+  size_t lo = d > nb ? d - nb : 0;
+  size_t hi = d < na ? d : na;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ag_std_cmp(a[mid], b[d - mid - 1]) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Internal function, merge chunk c's piece of its pair of runs.
+void ag_std_sort_merge_chunk(void *job_arg, size_t c) {
+  struct ag_std_sort_job *job = job_arg;
+  size_t lo = c / job->pieces * 2 * job->run;
+  size_t piece = c % job->pieces;
+  if (lo >= job->n) {
+    return;
+  }
+
+  size_t mid = job->n - lo < job->run ? job->n : lo + job->run;
+  size_t hi = job->n - mid < job->run ? job->n : mid + job->run;
+  void **a = job->src + lo;
+  void **b = job->src + mid;
+  size_t na = mid - lo;
+  size_t nb = hi - mid;
+
+  size_t d0 = (na + nb) * piece / job->pieces;
+  size_t d1 = (na + nb) * (piece + 1) / job->pieces;
+  size_t i0 = ag_std_sort_corank(d0, a, na, b, nb);
+  size_t i1 = ag_std_sort_corank(d1, a, na, b, nb);
+
+  ag_std_sort_merge_into(a + i0, i1 - i0, b + (d0 - i0), (d1 - i1) - (d0 - i0),
+      job->dst + lo + d0);
+}
+
+// Internal function, sort arr on all the threads. Returns -1 (having done
+// nothing) if there is no memory for it.
+int ag_std_sort_par(void **arr, size_t n, int stable) {
+  size_t threads = ag_std_par_threads();
+  void **buf = malloc(sizeof(void *) * n);
+  if (buf == NULL) {
+    return -1;
+  }
+
+  struct ag_std_sort_job job = { arr, buf, n, stable, (n + threads - 1) / threads, 1, arr, buf };
+  ag_std_par_run(ag_std_sort_run_chunk, &job, threads);
+
+  while (job.run < n) {
+    size_t pairs = (n + 2 * job.run - 1) / (2 * job.run);
+    job.pieces = (threads + pairs - 1) / pairs;
+    ag_std_par_run(ag_std_sort_merge_chunk, &job, pairs * job.pieces);
+
+    void **tmp = job.src;
+    job.src = job.dst;
+    job.dst = tmp;
+    job.run *= 2;
+  }
+
+  if (job.src != arr) {
+    memcpy(arr, job.src, sizeof(void *) * n);
+  }
+
+  free(buf);
+  return 0;
+}
+
+// Internal function, the common part of ag_std_sort and ag_std_stable_sort.
+int ag_std_sort_range(void *rng, int stable) {
+  struct ag_std_typed_vector *tv = ag_std_typed_vector_of(rng);
+  if (tv != NULL) {
+    return ag_std_sort_typed(tv);
+  }
+
+  if (ag_std_class_of(rng) != vector) {
+    return -1;
+  }
+
+  struct ag_std_vector *v = rng;
+  size_t n = v->size;
+  if (n < 2 || ag_std_sort_radix_boxed(v->arr, n)) {
+    return 0;
+  }
+
+  if (n >= AG_STD_SORT_PAR_MIN && ag_std_par_threads() > 1
+      && ag_std_sort_par(v->arr, n, stable) == 0) {
+    return 0;
+  }
+
+  if (stable) {
+    void **buf = malloc(sizeof(void *) * (n / 2));
+    if (buf == NULL) {
+      return -1;
+    }
+    ag_std_sort_stable(v->arr, n, buf);
+    free(buf);
+  } else {
+    ag_std_sort_unstable(v->arr, n);
+  }
+
+  return 0;
+}
+
+// Sort rng (a vector or a typed vector) in place, by ag_std_cmp. Returns -1
+// for any other range, or if there is no memory to sort it; either way it
+// is left alone.
+int ag_std_sort(void *rng) {
+  return ag_std_sort_range(rng, 0);
+}
+
+// The same, but equal elements stay in the order they were in.
+int ag_std_stable_sort(void *rng) {
+  return ag_std_sort_range(rng, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Epochs - freeing what lock-free readers may still be looking at
+///////////////////////////////////////////////////////////////////////////////
+
+/* A reader that takes no lock can be halfway along a node when a writer
+ * unlinks it, so the writer can't free the node yet. Readers put their
+ * reads between ag_std_epoch_enter and ag_std_epoch_exit, and writers give
+ * what they unlinked to ag_std_epoch_retire, which frees it (with the
+ * function given) once no reader can still have it.
+ *
+ * There is a global epoch. A reader inside notes the epoch it came in at,
+ * and the epoch only moves on when all the readers inside have seen the
+ * current one. So whatever was retired in epoch e is out of every reader's
+ * hands by epoch e + 2. A thread keeps what it retires in three bags, by
+ * epoch mod 3, and frees a bag when its turn comes round again. Entering
+ * and leaving are a store each; only retire looks at the other threads,
+ * once every AG_STD_EPOCH_BATCH calls.
+ *
+ * A thread that exits waits for its bags to be safe and frees them.
+ * ag_std_epoch_synchronize does the same for a thread that goes on (it
+ * must not be inside an epoch itself).
+ */
+#define AG_STD_EPOCH_BATCH 64
+
+struct ag_std_epoch_item {
+  void *ptr;
+  ag_std_void_fn fn;
+};
+
+struct ag_std_epoch_bag {
+  size_t epoch;
+  struct ag_std_epoch_item *items;
+  size_t n;
+  size_t capacity;
+};
+
+struct ag_std_epoch_thread {
+  // The epoch it came in at, times two, plus one; 0 when it isn't inside.
+  size_t state;
+  size_t depth;
+  size_t retired;
+  struct ag_std_epoch_bag bags[3];
+
+  int registered;
+  struct ag_std_epoch_thread *next;
+  struct ag_std_epoch_thread *prev;
+};
+
+size_t ag_std_epoch;
+__thread struct ag_std_epoch_thread ag_std_epoch_self;
+
+struct ag_std_epoch_thread *ag_std_epoch_threads;
+pthread_mutex_t ag_std_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+pthread_key_t ag_std_epoch_key;
+pthread_once_t ag_std_epoch_once = PTHREAD_ONCE_INIT;
+
+// Internal function, free what is in a bag.
+void ag_std_epoch_bag_free(struct ag_std_epoch_bag *bag) {
+  // A fn can retire more, into this same bag, so take the items out first.
+  struct ag_std_epoch_item *items = bag->items;
+  size_t n = bag->n;
+  bag->items = NULL;
+  bag->n = 0;
+  bag->capacity = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    items[i].fn(items[i].ptr);
+  }
+
+  if (bag->items == NULL) {
+    bag->items = items;
+    bag->capacity = n;
+  } else {
+    free(items);
+  }
+}
+
+// Internal function, move the epoch on if every reader inside is in the
+// current one.
+int ag_std_epoch_try_advance(void) {
+  size_t e = __atomic_load_n(&ag_std_epoch, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock(&ag_std_epoch_lock);
+  for (struct ag_std_epoch_thread *t = ag_std_epoch_threads; t != NULL; t = t->next) {
+    size_t state = __atomic_load_n(&t->state, __ATOMIC_SEQ_CST);
+    if (state != 0 && state >> 1 != e) {
+      pthread_mutex_unlock(&ag_std_epoch_lock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&ag_std_epoch_lock);
+
+  __atomic_compare_exchange_n(&ag_std_epoch, &e, e + 1, 0,
+      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+// Wait until all that this thread retired is freed.
+void ag_std_epoch_synchronize(void) {
+  struct ag_std_epoch_thread *self = &ag_std_epoch_self;
+
+  size_t e = __atomic_load_n(&ag_std_epoch, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&ag_std_epoch, __ATOMIC_SEQ_CST) < e + 2) {
+    if (!ag_std_epoch_try_advance()) {
+      sched_yield();
+    }
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    ag_std_epoch_bag_free(&self->bags[i]);
+  }
+}
+
+// Internal function, the thread is exiting.
+void ag_std_epoch_thread_dtor(void *arg) {
+  struct ag_std_epoch_thread *self = arg;
+
+  ag_std_epoch_synchronize();
+  for (int i = 0; i < 3; ++i) {
+    free(self->bags[i].items);
+    self->bags[i].items = NULL;
+    self->bags[i].capacity = 0;
+  }
+
+  pthread_mutex_lock(&ag_std_epoch_lock);
+  if (self->prev != NULL) {
+    self->prev->next = self->next;
+  } else {
+    ag_std_epoch_threads = self->next;
+  }
+  if (self->next != NULL) {
+    self->next->prev = self->prev;
+  }
+  pthread_mutex_unlock(&ag_std_epoch_lock);
+
+  self->registered = 0;
+}
+
+void ag_std_epoch_init(void) {
+  pthread_key_create(&ag_std_epoch_key, ag_std_epoch_thread_dtor);
+}
+
+// Internal function, the first time a thread uses the epochs.
+void ag_std_epoch_register(struct ag_std_epoch_thread *self) {
+  pthread_once(&ag_std_epoch_once, ag_std_epoch_init);
+
+  pthread_mutex_lock(&ag_std_epoch_lock);
+  self->prev = NULL;
+  self->next = ag_std_epoch_threads;
+  if (self->next != NULL) {
+    self->next->prev = self;
+  }
+  ag_std_epoch_threads = self;
+  pthread_mutex_unlock(&ag_std_epoch_lock);
+
+  pthread_setspecific(ag_std_epoch_key, self);
+  self->registered = 1;
+}
+
+// Enter and exit nest, only the outermost pair counts.
+void ag_std_epoch_enter(void) {
+  struct ag_std_epoch_thread *self = &ag_std_epoch_self;
+  if (self->depth++ > 0) {
+    return;
+  }
+
+  if (!self->registered) {
+    ag_std_epoch_register(self);
+  }
+
+  // Seen by the others before anything this thread reads next.
+  size_t e = __atomic_load_n(&ag_std_epoch, __ATOMIC_RELAXED);
+  __atomic_store_n(&self->state, e * 2 + 1, __ATOMIC_SEQ_CST);
+}
+
+void ag_std_epoch_exit(void) {
+  struct ag_std_epoch_thread *self = &ag_std_epoch_self;
+  if (--self->depth == 0) {
+    __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+  }
+}
+
+// Call fn(ptr) once no reader can have ptr any more.
+void ag_std_epoch_retire(void *ptr, ag_std_void_fn fn) {
+  struct ag_std_epoch_thread *self = &ag_std_epoch_self;
+  if (!self->registered) {
+    ag_std_epoch_register(self);
+  }
+
+  // The bag for this epoch last held epoch e - 3, which is safe by now.
+  size_t e = __atomic_load_n(&ag_std_epoch, __ATOMIC_SEQ_CST);
+  struct ag_std_epoch_bag *bag = &self->bags[e % 3];
+  if (bag->epoch != e) {
+    ag_std_epoch_bag_free(bag);
+    bag->epoch = e;
+  }
+
+  if (bag->n == bag->capacity) {
+    size_t capacity = bag->capacity == 0 ? AG_STD_EPOCH_BATCH : bag->capacity * 2;
+    struct ag_std_epoch_item *items = realloc(bag->items, sizeof(*items) * capacity);
+    if (items == NULL) {
+      // Better to keep it than to free it too soon.
+      return;
+    }
+    bag->items = items;
+    bag->capacity = capacity;
+  }
+
+  struct ag_std_epoch_item item = { ptr, fn };
+  bag->items[bag->n++] = item;
+
+  if (++self->retired == AG_STD_EPOCH_BATCH) {
+    self->retired = 0;
+    ag_std_epoch_try_advance();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_cmap (derived from object) - a hash map for many threads
+///////////////////////////////////////////////////////////////////////////////
+
+/* A hash map of (key, value) pairs that any number of threads can use at
+ * once. Keys are found with hash and compared with cmp, like ag_std_map,
+ * and inserting a key that is already there leaves the map as it is.
+ *
+ * Lookups take no lock and write nothing shared: they walk the bins'
+ * chains inside an epoch. Writers lock one of AG_STD_CMAP_STRIPES locks,
+ * picked by the bin, link or unlink a node, and retire what they unlinked.
+ * The pairs (and their keys and values) are shared when they go in, and
+ * ag_std_cmap_at retains the value it finds, so the caller has its own
+ * reference, to release when done with it.
+ *
+ * The table doubles when a stripe has more pairs than bins, a few bins at
+ * a time: the writer that sees it is too full makes the new table, and
+ * from then on every write moves AG_STD_CMAP_MOVE more bins across. A bin
+ * that has moved points to a marker node, and whoever lands on it goes on
+ * to the new table. When the last one has moved the new table takes over.
+ * The stripe of a bin is its index mod AG_STD_CMAP_STRIPES, and a table
+ * has at least that many bins, so a bin and the two it moves to are under
+ * the same lock.
+ */
+#define AG_STD_CMAP_STRIPES 64
+#define AG_STD_CMAP_MOVE 16
+
+struct ag_std_cmap_node {
+  struct ag_std_cmap_node *next;
+  size_t hash;
+  void *pair;
+};
+
+struct ag_std_cmap_table {
+  size_t mask;
+
+  // While growing: the new table, the bins handed out to move, and the
+  // ones moved. Once a bin has failed to move for want of memory, failed is
+  // set, and helpers look for the bins left behind.
+  struct ag_std_cmap_table *next;
+  size_t claimed;
+  size_t moved;
+  int failed;
+
+  struct ag_std_cmap_node *bins[];
+};
+
+// A lock and its numbers, on a cache line of their own.
+union ag_std_cmap_stripe {
+  struct {
+    pthread_mutex_t lock;
+    size_t count; // Pairs in its bins.
+    size_t writes; // Times locked, to write or to move a bin.
+    size_t contended; // Of those, the times it had to wait.
+  } s;
+  char line[2 * AG_STD_BTREE_CACHE_LINE];
+};
+
+struct ag_std_cmap {
+  struct object obj;
+
+  struct ag_std_cmap_table *table;
+  pthread_mutex_t grow_lock;
+  size_t grows;
+
+  union ag_std_cmap_stripe stripes[AG_STD_CMAP_STRIPES];
+};
+
+struct ag_std_cmap_stats {
+  size_t writes;
+  size_t contended;
+  size_t grows;
+};
+
+// Where a bin that has moved points.
+struct ag_std_cmap_node ag_std_cmap_moved;
+
+// Internal function, a table with no pairs in it.
+struct ag_std_cmap_table *ag_std_cmap_table_ctor(size_t n_bins) {
+  struct ag_std_cmap_table *t =
+    calloc(1, sizeof(struct ag_std_cmap_table) + n_bins * sizeof(void *));
+  if (t != NULL) {
+    t->mask = n_bins - 1;
+  }
+
+  return t;
+}
+
+void ag_std_cmap_node_free(void *node) {
+  ag_std_pool_free(node, sizeof(struct ag_std_cmap_node));
+}
+
+void *ag_std_cmap_ctor(void *obj, va_list *app) {
+  (void)app;
+
+  if (DEBUG_MSG) {
+    printf("[ag_std_cmap][ctor]\n");
+  }
+
+  struct ag_std_cmap *m = obj;
+  m->table = ag_std_cmap_table_ctor(AG_STD_CMAP_STRIPES);
+  if (m->table == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&m->grow_lock, NULL);
+  for (size_t i = 0; i < AG_STD_CMAP_STRIPES; ++i) {
+    pthread_mutex_init(&m->stripes[i].s.lock, NULL);
+  }
+
+  return obj;
+}
+
+// Internal function, free the pairs and nodes of a table that are still in
+// it (not moved on).
+void ag_std_cmap_table_dtor(struct ag_std_cmap_table *t) {
+  for (size_t i = 0; i <= t->mask; ++i) {
+    struct ag_std_cmap_node *node = t->bins[i];
+    if (node == &ag_std_cmap_moved) {
+      continue;
+    }
+
+    while (node != NULL) {
+      struct ag_std_cmap_node *next = node->next;
+      ag_std_release(node->pair);
+      ag_std_cmap_node_free(node);
+      node = next;
+    }
+  }
+
+  free(t);
+}
+
+// No other thread may be using the map any more.
+void ag_std_cmap_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_cmap][dtor]\n");
+  }
+
+  struct ag_std_cmap *m = obj;
+  struct ag_std_cmap_table *t = m->table;
+  while (t != NULL) {
+    struct ag_std_cmap_table *next = t->next;
+    ag_std_cmap_table_dtor(t);
+    t = next;
+  }
+  m->table = NULL;
+
+  pthread_mutex_destroy(&m->grow_lock);
+  for (size_t i = 0; i < AG_STD_CMAP_STRIPES; ++i) {
+    pthread_mutex_destroy(&m->stripes[i].s.lock);
+  }
+}
+
+// Internal function, lock the stripe of bin, and count it.
+union ag_std_cmap_stripe *ag_std_cmap_lock(struct ag_std_cmap *m, size_t bin) {
+  union ag_std_cmap_stripe *stripe = &m->stripes[bin % AG_STD_CMAP_STRIPES];
+  if (pthread_mutex_trylock(&stripe->s.lock) != 0) {
+    pthread_mutex_lock(&stripe->s.lock);
+    __atomic_fetch_add(&stripe->s.contended, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&stripe->s.writes, 1, __ATOMIC_RELAXED);
+
+  return stripe;
+}
+
+// Internal function, lock the bin of hash h, in the newest table it has
+// moved to. The caller is inside an epoch.
+struct ag_std_cmap_table *ag_std_cmap_lock_bin(struct ag_std_cmap *m, size_t h,
+    union ag_std_cmap_stripe **stripe) {
+  struct ag_std_cmap_table *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+
+  for (;;) {
+    size_t bin = h & t->mask;
+    *stripe = ag_std_cmap_lock(m, bin);
+    if (t->bins[bin] != &ag_std_cmap_moved) {
+      return t;
+    }
+
+    pthread_mutex_unlock(&(*stripe)->s.lock);
+    t = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+  }
+}
+
+/* Internal function, move bin i of t to the new table. The stripe is
+ * locked. Readers may be on the old nodes, so the new table gets copies;
+ * they are all made first, so if there is no memory for them, nothing has
+ * changed (and it returns -1).
+ */
+int ag_std_cmap_move_bin(struct ag_std_cmap_table *t, size_t i) {
+  struct ag_std_cmap_table *next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+  struct ag_std_cmap_node *low = NULL;
+  struct ag_std_cmap_node *high = NULL;
+
+  for (struct ag_std_cmap_node *node = t->bins[i]; node != NULL; node = node->next) {
+    struct ag_std_cmap_node *copy = ag_std_pool_alloc(sizeof(struct ag_std_cmap_node));
+    if (copy == NULL) {
+      struct ag_std_cmap_node *lists[2] = { low, high };
+      for (int k = 0; k < 2; ++k) {
+        while (lists[k] != NULL) {
+          struct ag_std_cmap_node *rest = lists[k]->next;
+          ag_std_cmap_node_free(lists[k]);
+          lists[k] = rest;
+        }
+      }
+      return -1;
+    }
+
+    copy->hash = node->hash;
+    copy->pair = node->pair;
+    if (node->hash & (t->mask + 1)) {
+      copy->next = high;
+      high = copy;
+    } else {
+      copy->next = low;
+      low = copy;
+    }
+  }
+
+  struct ag_std_cmap_node *node = t->bins[i];
+  while (node != NULL) {
+    struct ag_std_cmap_node *old = node;
+    node = node->next;
+    ag_std_epoch_retire(old, ag_std_cmap_node_free);
+  }
+
+  __atomic_store_n(&next->bins[i], low, __ATOMIC_RELEASE);
+  __atomic_store_n(&next->bins[i + t->mask + 1], high, __ATOMIC_RELEASE);
+  __atomic_store_n(&t->bins[i], &ag_std_cmap_moved, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+// Internal function, move bin i of t, under its lock, unless someone has
+// already. Returns 1 if it was the last one across, and the new table has
+// taken over.
+int ag_std_cmap_move_one(struct ag_std_cmap *m, struct ag_std_cmap_table *t, size_t i) {
+  union ag_std_cmap_stripe *stripe = ag_std_cmap_lock(m, i);
+  int res = t->bins[i] == &ag_std_cmap_moved ? 1 : ag_std_cmap_move_bin(t, i);
+  pthread_mutex_unlock(&stripe->s.lock);
+
+  if (res == 1) {
+    return 0;
+  }
+  if (res != 0) {
+    __atomic_store_n(&t->failed, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  if (__atomic_add_fetch(&t->moved, 1, __ATOMIC_ACQ_REL) == t->mask + 1) {
+    __atomic_store_n(&m->table, __atomic_load_n(&t->next, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    ag_std_epoch_retire(t, free);
+    return 1;
+  }
+
+  return 0;
+}
+
+// Internal function, if the table is growing, move some bins. The caller
+// is inside an epoch.
+void ag_std_cmap_help(struct ag_std_cmap *m) {
+  struct ag_std_cmap_table *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&t->next, __ATOMIC_ACQUIRE) == NULL) {
+    return;
+  }
+
+  for (size_t k = 0; k < AG_STD_CMAP_MOVE; ++k) {
+    size_t i = __atomic_fetch_add(&t->claimed, 1, __ATOMIC_RELAXED);
+    if (i > t->mask) {
+      break;
+    }
+
+    if (ag_std_cmap_move_one(m, t, i)) {
+      return;
+    }
+  }
+
+  // Bins that failed to move were handed out already, so nobody else will
+  // get them: once all have been, look for them. Only a real move is
+  // counted, so it doesn't matter if the bin's claimer is still at it.
+  if (__atomic_load_n(&t->claimed, __ATOMIC_RELAXED) <= t->mask
+      || !__atomic_load_n(&t->failed, __ATOMIC_RELAXED)) {
+    return;
+  }
+  size_t tries = 0;
+  for (size_t i = 0; i <= t->mask && tries < AG_STD_CMAP_MOVE; ++i) {
+    if (__atomic_load_n(&t->bins[i], __ATOMIC_ACQUIRE) == &ag_std_cmap_moved) {
+      continue;
+    }
+
+    ++tries;
+    if (ag_std_cmap_move_one(m, t, i)) {
+      return;
+    }
+  }
+}
+
+// Internal function, start growing, unless it already has.
+void ag_std_cmap_grow(struct ag_std_cmap *m) {
+  pthread_mutex_lock(&m->grow_lock);
+
+  struct ag_std_cmap_table *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&t->next, __ATOMIC_ACQUIRE) == NULL) {
+    struct ag_std_cmap_table *next = ag_std_cmap_table_ctor(2 * (t->mask + 1));
+    if (next != NULL) {
+      __atomic_store_n(&t->next, next, __ATOMIC_RELEASE);
+      m->grows++;
+    }
+  }
+
+  pthread_mutex_unlock(&m->grow_lock);
+}
+
+// Put pair in, unless its key is there already. Returns -1 if there was no
+// memory for it.
+int ag_std_cmap_insert(void *map_arg, void *pair) {
+  struct ag_std_cmap *m = map_arg;
+  void *key = ag_std_pair_first(pair);
+  size_t h = ag_std_hash(key);
+
+  // Allocated before anything is locked, or changed.
+  struct ag_std_cmap_node *node = ag_std_pool_alloc(sizeof(struct ag_std_cmap_node));
+  if (node == NULL) {
+    return -1;
+  }
+
+  ag_std_epoch_enter();
+  ag_std_cmap_help(m);
+
+  union ag_std_cmap_stripe *stripe;
+  struct ag_std_cmap_table *t = ag_std_cmap_lock_bin(m, h, &stripe);
+  struct ag_std_cmap_node **bin = &t->bins[h & t->mask];
+
+  for (struct ag_std_cmap_node *other = *bin; other != NULL; other = other->next) {
+    if (other->hash == h && ag_std_cmp(ag_std_pair_first(other->pair), key) == 0) {
+      pthread_mutex_unlock(&stripe->s.lock);
+      ag_std_epoch_exit();
+      ag_std_cmap_node_free(node);
+      return 0;
+    }
+  }
+
+  // Other threads will count references to them.
+  ag_std_share(pair);
+  ag_std_share(key);
+  ag_std_share(ag_std_pair_second(pair));
+
+  node->hash = h;
+  node->pair = ag_std_retain(pair);
+  node->next = *bin;
+  __atomic_store_n(bin, node, __ATOMIC_RELEASE);
+
+  // Roughly, more pairs than bins.
+  size_t count = __atomic_add_fetch(&stripe->s.count, 1, __ATOMIC_RELAXED);
+  int full = count > (t->mask + 1) / AG_STD_CMAP_STRIPES
+    && __atomic_load_n(&t->next, __ATOMIC_ACQUIRE) == NULL;
+  pthread_mutex_unlock(&stripe->s.lock);
+
+  if (full) {
+    ag_std_cmap_grow(m);
+  }
+  ag_std_epoch_exit();
+
+  return 0;
+}
+
+// Take key (and its value) out, and say if it was there.
+int ag_std_cmap_erase(void *map_arg, void *key) {
+  struct ag_std_cmap *m = map_arg;
+  size_t h = ag_std_hash(key);
+
+  ag_std_epoch_enter();
+  ag_std_cmap_help(m);
+
+  union ag_std_cmap_stripe *stripe;
+  struct ag_std_cmap_table *t = ag_std_cmap_lock_bin(m, h, &stripe);
+
+  struct ag_std_cmap_node **link = &t->bins[h & t->mask];
+  struct ag_std_cmap_node *node = *link;
+  while (node != NULL
+      && !(node->hash == h && ag_std_cmp(ag_std_pair_first(node->pair), key) == 0)) {
+    link = &node->next;
+    node = node->next;
+  }
+
+  if (node != NULL) {
+    __atomic_store_n(link, node->next, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&stripe->s.count, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&stripe->s.lock);
+
+  if (node != NULL) {
+    ag_std_epoch_retire(node->pair, ag_std_release);
+    ag_std_epoch_retire(node, ag_std_cmap_node_free);
+  }
+  ag_std_epoch_exit();
+
+  return node != NULL;
+}
+
+// The value of key, retained (release it when done), or NULL.
+void *ag_std_cmap_at(void *map_arg, void *key) {
+  struct ag_std_cmap *m = map_arg;
+  size_t h = ag_std_hash(key);
+  void *value = NULL;
+
+  ag_std_epoch_enter();
+  struct ag_std_cmap_table *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+  struct ag_std_cmap_node *node = __atomic_load_n(&t->bins[h & t->mask], __ATOMIC_ACQUIRE);
+  while (node == &ag_std_cmap_moved) {
+    t = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+    node = __atomic_load_n(&t->bins[h & t->mask], __ATOMIC_ACQUIRE);
+  }
+
+  while (node != NULL) {
+    if (node->hash == h && ag_std_cmp(ag_std_pair_first(node->pair), key) == 0) {
+      value = ag_std_retain(ag_std_pair_second(node->pair));
+      break;
+    }
+    node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  }
+  ag_std_epoch_exit();
+
+  return value;
+}
+
+// Internal function, fn of every pair in bin i of t, or where it moved to.
+void ag_std_cmap_walk_bin(struct ag_std_cmap_table *t, size_t i, ag_std_void_fn fn) {
+  struct ag_std_cmap_node *node = __atomic_load_n(&t->bins[i], __ATOMIC_ACQUIRE);
+  if (node == &ag_std_cmap_moved) {
+    struct ag_std_cmap_table *next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+    ag_std_cmap_walk_bin(next, i, fn);
+    ag_std_cmap_walk_bin(next, i + t->mask + 1, fn);
+    return;
+  }
+
+  while (node != NULL) {
+    fn(node->pair);
+    node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  }
+}
+
+/* Call fn on every pair. With other threads writing, a pair that goes in
+ * or out meanwhile may or may not be seen, but none is seen twice. fn runs
+ * inside an epoch, so it mustn't wait for one (ag_std_epoch_synchronize).
+ */
+void ag_std_cmap_for_each(void *map_arg, ag_std_void_fn fn) {
+  struct ag_std_cmap *m = map_arg;
+
+  ag_std_epoch_enter();
+  struct ag_std_cmap_table *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+  for (size_t i = 0; i <= t->mask; ++i) {
+    ag_std_cmap_walk_bin(t, i, fn);
+  }
+  ag_std_epoch_exit();
+}
+
+size_t ag_std_cmap_size(void *obj) {
+  struct ag_std_cmap *m = obj;
+
+  // Only exact when no one is writing.
+  size_t size = 0;
+  for (size_t i = 0; i < AG_STD_CMAP_STRIPES; ++i) {
+    size += __atomic_load_n(&m->stripes[i].s.count, __ATOMIC_RELAXED);
+  }
+
+  return size;
+}
+
+void ag_std_cmap_stats(void *map_arg, struct ag_std_cmap_stats *stats) {
+  struct ag_std_cmap *m = map_arg;
+
+  stats->writes = 0;
+  stats->contended = 0;
+  for (size_t i = 0; i < AG_STD_CMAP_STRIPES; ++i) {
+    stats->writes += __atomic_load_n(&m->stripes[i].s.writes, __ATOMIC_RELAXED);
+    stats->contended += __atomic_load_n(&m->stripes[i].s.contended, __ATOMIC_RELAXED);
+  }
+  stats->grows = __atomic_load_n(&m->grows, __ATOMIC_RELAXED);
+}
+
+// Internal function, for ag_std_cmap_print.
+__thread int ag_std_cmap_print_first;
+
+void ag_std_cmap_print_pair(void *pair) {
+  if (!ag_std_cmap_print_first) {
+    printf(", ");
+  }
+  ag_std_cmap_print_first = 0;
+  ag_std_print(pair);
+}
+
+void ag_std_cmap_print(void *obj) {
+  printf("ag_std_cmap([");
+  ag_std_cmap_print_first = 1;
+  ag_std_cmap_for_each(obj, ag_std_cmap_print_pair);
+  printf("])");
+}
+
+// The class is out here too, so that the benchmarks can make one.
+void *ag_std_cmap;
+
+///////////////////////////////////////////////////////////////////////////////
+// ag_std_queue (derived from object) - a bounded queue for many threads
+///////////////////////////////////////////////////////////////////////////////
+
+/* A first in, first out queue of a fixed capacity (a power of two), for
+ * handing objects from some threads to others. Any number of threads can
+ * push and pop at once, with no lock: each cell of the ring has a sequence
+ * number that says whose turn it is (a pusher's at position pos when it is
+ * pos, a popper's when it is pos + 1), and a pusher or popper claims its
+ * cells by moving the shared position on with a compare and swap. This is
+ * Dmitry Vyukov's bounded MPMC queue. push_n and pop_n claim as many cells
+ * as are ready in one go.
+ *
+ * The queue keeps a reference to what is in it. Pushing shares and
+ * retains the object; popping hands the queue's reference to the caller,
+ * who releases it when done.
+ *
+ *   ag_std_new(ag_std_queue, capacity, blocking)
+ *
+ * capacity must be from 1 to AG_STD_QUEUE_MAX; otherwise, or if there is
+ * no memory for the cells, ag_std_new gives NULL.
+ *
+ * With blocking set, ag_std_queue_push and ag_std_queue_pop sleep on a
+ * futex while the queue is full (or empty) and are woken by the other
+ * side. That costs every push and pop a fence, so without it they spin,
+ * yielding the CPU, instead. The try_ calls and the _n calls never wait.
+ */
+
+#define AG_STD_QUEUE_SPINS 4
+#define AG_STD_QUEUE_MAX (1 << 30)
+
+struct ag_std_queue_cell {
+  size_t seq;
+  void *obj;
+};
+
+// The two positions, and the futex words, each on a cache line of their own.
+union ag_std_queue_pos {
+  size_t pos;
+  char line[2 * AG_STD_BTREE_CACHE_LINE];
+};
+
+union ag_std_queue_wait {
+  struct {
+    uint32_t word; // Goes up when there is something to wake for.
+    int sleeping; // Someone may be waiting on word.
+  } s;
+  char line[2 * AG_STD_BTREE_CACHE_LINE];
+};
+
+struct ag_std_queue {
+  struct object obj;
+
+  struct ag_std_queue_cell *cells;
+  size_t mask;
+  int blocking;
+
+  union ag_std_queue_pos push_pos;
+  union ag_std_queue_pos pop_pos;
+  union ag_std_queue_wait pushed; // Where poppers wait.
+  union ag_std_queue_wait popped; // Where pushers wait.
+};
+
+void *ag_std_queue_ctor(void *obj, va_list *app) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_queue][ctor]\n");
+  }
+
+  struct ag_std_queue *q = obj;
+  int capacity = va_arg(*app, int);
+  q->blocking = va_arg(*app, int);
+  if (capacity <= 0 || capacity > AG_STD_QUEUE_MAX) {
+    return NULL;
+  }
+
+  size_t n = 2;
+  while (n < (size_t)capacity) {
+    n *= 2;
+  }
+  q->mask = n - 1;
+
+  q->cells = malloc(sizeof(struct ag_std_queue_cell) * n);
+  if (q->cells == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    q->cells[i].seq = i;
+    q->cells[i].obj = NULL;
+  }
+
+  q->push_pos.pos = 0;
+  q->pop_pos.pos = 0;
+  q->pushed.s.word = 0;
+  q->pushed.s.sleeping = 0;
+  q->popped.s.word = 0;
+  q->popped.s.sleeping = 0;
+
+  return obj;
+}
+
+// No other thread may be using the queue any more.
+void ag_std_queue_dtor(void *obj) {
+  if (DEBUG_MSG) {
+    printf("[ag_std_queue][dtor]\n");
+  }
+
+  struct ag_std_queue *q = obj;
+  for (size_t pos = q->pop_pos.pos; pos != q->push_pos.pos; ++pos) {
+    ag_std_release(q->cells[pos & q->mask].obj);
+  }
+
+  free(q->cells);
+  q->cells = NULL;
+}
+
+// Internal function, wake whoever waits on w, after the cells are written.
+void ag_std_queue_wake(union ag_std_queue_wait *w) {
+  // Either the waiter sees the cells, or this sees the waiter.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&w->s.sleeping, __ATOMIC_RELAXED)
+      && __atomic_exchange_n(&w->s.sleeping, 0, __ATOMIC_SEQ_CST)) {
+    // All of them: the ones that find nothing go back to sleep. Until one
+    // does, there is no one to wake, and no more system calls.
+    __atomic_fetch_add(&w->s.word, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &w->s.word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+// Push as many of objs (from the first) as there is room for, and say how
+// many that was.
+size_t ag_std_queue_push_n(void *q_arg, void **objs, size_t n) {
+  struct ag_std_queue *q = q_arg;
+  size_t pos = __atomic_load_n(&q->push_pos.pos, __ATOMIC_RELAXED);
+  size_t k;
+
+  for (;;) {
+    // The cells from pos on that are free for their position.
+    for (k = 0; k < n; ++k) {
+      size_t seq = __atomic_load_n(&q->cells[(pos + k) & q->mask].seq, __ATOMIC_ACQUIRE);
+      if (seq != pos + k) {
+        break;
+      }
+    }
+
+    if (k == 0) {
+      size_t seq = __atomic_load_n(&q->cells[pos & q->mask].seq, __ATOMIC_ACQUIRE);
+      if ((ptrdiff_t)(seq - pos) < 0) {
+        return 0; // Full.
+      }
+      // Another pusher took it.
+      pos = __atomic_load_n(&q->push_pos.pos, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if (__atomic_compare_exchange_n(&q->push_pos.pos, &pos, pos + k, 1,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < k; ++i) {
+    struct ag_std_queue_cell *cell = &q->cells[(pos + i) & q->mask];
+    ag_std_share(objs[i]);
+    cell->obj = ag_std_retain(objs[i]);
+    __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+  }
+
+  if (q->blocking) {
+    ag_std_queue_wake(&q->pushed);
+  }
+
+  return k;
+}
+
+// Pop up to n objects into objs, and say how many there were.
+size_t ag_std_queue_pop_n(void *q_arg, void **objs, size_t n) {
+  struct ag_std_queue *q = q_arg;
+  size_t pos = __atomic_load_n(&q->pop_pos.pos, __ATOMIC_RELAXED);
+  size_t k;
+
+  for (;;) {
+    for (k = 0; k < n; ++k) {
+      size_t seq = __atomic_load_n(&q->cells[(pos + k) & q->mask].seq, __ATOMIC_ACQUIRE);
+      if (seq != pos + k + 1) {
+        break;
+      }
+    }
+
+    if (k == 0) {
+      size_t seq = __atomic_load_n(&q->cells[pos & q->mask].seq, __ATOMIC_ACQUIRE);
+      if ((ptrdiff_t)(seq - (pos + 1)) < 0) {
+        return 0; // Empty.
+      }
+      pos = __atomic_load_n(&q->pop_pos.pos, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if (__atomic_compare_exchange_n(&q->pop_pos.pos, &pos, pos + k, 1,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < k; ++i) {
+    struct ag_std_queue_cell *cell = &q->cells[(pos + i) & q->mask];
+    objs[i] = cell->obj;
+    __atomic_store_n(&cell->seq, pos + i + q->mask + 1, __ATOMIC_RELEASE);
+  }
+
+  if (q->blocking) {
+    ag_std_queue_wake(&q->popped);
+  }
+
+  return k;
+}
+
+int ag_std_queue_try_push(void *q_arg, void *obj) {
+  return ag_std_queue_push_n(q_arg, &obj, 1) == 1;
+}
+
+// Pop into *obj, or say the queue was empty.
+int ag_std_queue_try_pop(void *q_arg, void **obj) {
+  return ag_std_queue_pop_n(q_arg, obj, 1) == 1;
+}
+
+// Internal function, wait on w until try(q, obj) does it. It yields a few
+// times first, since the other side is often just about to get there.
+void ag_std_queue_wait(struct ag_std_queue *q, union ag_std_queue_wait *w,
+    size_t (*try)(void *, void **, size_t), void **obj) {
+  for (size_t spins = 0; try(q, obj, 1) == 0; ++spins) {
+    if (!q->blocking || spins < AG_STD_QUEUE_SPINS) {
+      sched_yield();
+      continue;
+    }
+
+    __atomic_store_n(&w->s.sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t word = __atomic_load_n(&w->s.word, __ATOMIC_SEQ_CST);
+
+    // What it waits for may have come before it said it was sleeping.
+    if (try(q, obj, 1) == 1) {
+      return;
+    }
+    syscall(SYS_futex, &w->s.word, FUTEX_WAIT_PRIVATE, word, NULL, NULL, 0);
+  }
+}
+
+// Push obj, waiting while the queue is full.
+void ag_std_queue_push(void *q_arg, void *obj) {
+  struct ag_std_queue *q = q_arg;
+  ag_std_queue_wait(q, &q->popped, ag_std_queue_push_n, &obj);
+}
+
+// Pop an object, waiting while the queue is empty.
+void *ag_std_queue_pop(void *q_arg) {
+  struct ag_std_queue *q = q_arg;
+  void *obj;
+  ag_std_queue_wait(q, &q->pushed, ag_std_queue_pop_n, &obj);
+  return obj;
+}
+
+size_t ag_std_queue_capacity(void *q_arg) {
+  struct ag_std_queue *q = q_arg;
+  return q->mask + 1;
+}
+
+size_t ag_std_queue_size(void *obj) {
+  struct ag_std_queue *q = obj;
+
+  // Only exact when no one is pushing or popping.
+  size_t pop = __atomic_load_n(&q->pop_pos.pos, __ATOMIC_RELAXED);
+  size_t push = __atomic_load_n(&q->push_pos.pos, __ATOMIC_RELAXED);
+  return (ptrdiff_t)(push - pop) > 0 ? push - pop : 0;
+}
+
+void ag_std_queue_print(void *obj) {
+  printf("ag_std_queue(%zu of %zu)", ag_std_queue_size(obj), ag_std_queue_capacity(obj));
+}
+
+// The class is out here too, so that the benchmarks can make one.
+void *ag_std_queue;
+
+///////////////////////////////////////////////////////////////////////////////
+// benchmarks (run with: ./ch_06_main.out bench)
+///////////////////////////////////////////////////////////////////////////////
+
+#define AG_STD_BENCH_BATCH 1024
+
+// A predicate and a function for the view tests and benchmarks.
+int ag_std_bench_is_even(void *x) {
+  return ag_std_int_value(x) % 2 == 0;
+}
+
+// Wraps around in 32 bits, instead of overflowing, for big ranges.
+void *ag_std_bench_square(void *x) {
+  unsigned i = (unsigned)ag_std_int_value(x);
+  return ag_std_int((int)(i * i));
+}
+
+// And for the parallel ones.
+int ag_std_bench_target = 0;
+size_t ag_std_bench_touched = 0;
+
+int ag_std_bench_is_target(void *x) {
+  return ag_std_int_value(x) == ag_std_bench_target;
+}
+
+void ag_std_bench_touch(void *x) {
+  __atomic_fetch_add(&ag_std_bench_touched, (size_t)ag_std_int_value(x), __ATOMIC_RELAXED);
+}
+
+// And for the tasks: fib, the usual way to see what a spawn costs.
+struct ag_std_bench_fib {
+  int n;
+  long result;
+};
+
+void ag_std_bench_fib_task(void *arg) {
+  struct ag_std_bench_fib *f = arg;
+  if (f->n < 2) {
+    f->result = f->n;
+    return;
+  }
+
+  struct ag_std_bench_fib a = { f->n - 1, 0 };
+  struct ag_std_bench_fib b = { f->n - 2, 0 };
+  struct ag_std_task_group g = AG_STD_TASK_GROUP_INIT;
+  struct ag_std_task t;
+
+  ag_std_spawn(&g, &t, ag_std_bench_fib_task, &a);
+  ag_std_bench_fib_task(&b);
+  ag_std_sync(&g);
+
+  f->result = a.result + b.result;
+}
+
+long ag_std_bench_fib_serial(int n) {
+  return n < 2 ? n : ag_std_bench_fib_serial(n - 1) + ag_std_bench_fib_serial(n - 2);
+}
+
+// A sum that splits a vector in halves, down to 1024 elements.
+struct ag_std_bench_sum {
+  void *v;
+  size_t lo;
+  size_t hi;
+  int64_t sum;
+};
+
+void ag_std_bench_sum_task(void *arg) {
+  struct ag_std_bench_sum *job = arg;
+  struct ag_std_vector *v = job->v;
+
+  if (job->hi - job->lo <= 1024) {
+    job->sum = 0;
+    for (size_t i = job->lo; i < job->hi; ++i) {
+      job->sum += ag_std_int_value(v->arr[i]);
+    }
+    return;
+  }
+
+  size_t mid = job->lo + (job->hi - job->lo) / 2;
+  struct ag_std_bench_sum left = { job->v, job->lo, mid, 0 };
+  struct ag_std_bench_sum right = { job->v, mid, job->hi, 0 };
+  struct ag_std_task_group g = AG_STD_TASK_GROUP_INIT;
+  struct ag_std_task t;
+
+  ag_std_spawn(&g, &t, ag_std_bench_sum_task, &left);
+  ag_std_bench_sum_task(&right);
+  ag_std_sync(&g);
+
+  job->sum = left.sum + right.sum;
+}
+
+// And for the reference counts: take a reference and give it back.
+void ag_std_bench_retain_release(void *x) {
+  ag_std_release(ag_std_retain(x));
+}
+
+// And for the pool: objects made on one thread and deleted on another.
+struct ag_std_bench_objs {
+  void **objs;
+  size_t n;
+  size_t per_chunk;
+};
+
+void ag_std_bench_new_chunk(void *job_arg, size_t c) {
+  struct ag_std_bench_objs *job = job_arg;
+  for (size_t i = c * job->per_chunk; i < (c + 1) * job->per_chunk && i < job->n; ++i) {
+    job->objs[i] = ag_std_new(integer, (int)i);
+  }
+}
+
+void ag_std_bench_delete_chunk(void *job_arg, size_t c) {
+  struct ag_std_bench_objs *job = job_arg;
+  for (size_t i = c * job->per_chunk; i < (c + 1) * job->per_chunk && i < job->n; ++i) {
+    ag_std_delete(job->objs[i]);
+  }
+}
+
+// For the arena test: delete an object on a thread of its own.
+void *ag_std_bench_delete_on_thread(void *obj) {
+  ag_std_delete(obj);
+  return NULL;
+}
+
+void *ag_std_bench_new_thread(void *arg) {
+  struct ag_std_bench_objs *job = arg;
+  ag_std_bench_new_chunk(job, 0);
+  return NULL;
+}
+
+double ag_std_bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void ag_std_bench_report(const char *name, size_t n, double secs) {
+  printf("%-44s %11zu ops %8.3f s %9.1f Mops/s\n",
+      name, n, secs, (double)n / secs / 1e6);
+}
+
+void ag_std_bench_pool(void) {
+  const size_t rounds = 10000;
+  const size_t n = rounds * AG_STD_BENCH_BATCH;
+  const struct ag_std_vtable *vt = integer;
+  void *objs[AG_STD_BENCH_BATCH];
+
+  // What ag_std_new used to do (plus the free that never happened).
+  double t = ag_std_bench_now();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      objs[i] = malloc(vt->size);
+      memset(objs[i], 0, vt->size);
+    }
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      free(objs[i]);
+    }
+  }
+  ag_std_bench_report("pool: malloc/free (integer size)", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      objs[i] = ag_std_pool_alloc(vt->size);
+      memset(objs[i], 0, vt->size);
+    }
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      ag_std_pool_free(objs[i], vt->size);
+    }
+  }
+  ag_std_bench_report("pool: pool alloc/free (integer size)", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      objs[i] = ag_std_new(integer, (int)i);
+    }
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      ag_std_delete(objs[i]);
+    }
+  }
+  ag_std_bench_report("pool: ag_std_new/ag_std_delete(integer)", n, ag_std_bench_now() - t);
+}
+
+// Each chunk makes and deletes its own batches, as a thread of a server would.
+void ag_std_bench_churn_chunk(void *job_arg, size_t c) {
+  (void)c;
+  const size_t *rounds = job_arg;
+  void *objs[AG_STD_BENCH_BATCH];
+
+  for (size_t r = 0; r < *rounds; ++r) {
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      objs[i] = ag_std_new(integer, (int)i);
+    }
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      ag_std_delete(objs[i]);
+    }
+  }
+}
+
+void ag_std_bench_malloc_chunk(void *job_arg, size_t c) {
+  (void)c;
+  const size_t *rounds = job_arg;
+  void *objs[AG_STD_BENCH_BATCH];
+
+  for (size_t r = 0; r < *rounds; ++r) {
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      objs[i] = malloc(sizeof(struct integer));
+      memset(objs[i], 0, sizeof(struct integer));
+    }
+    for (size_t i = 0; i < AG_STD_BENCH_BATCH; ++i) {
+      free(objs[i]);
+    }
+  }
+}
+
+void ag_std_bench_pool_threads(void) {
+  const size_t rounds = 2000;
+  size_t threads = ag_std_par_threads();
+  char name[64];
+
+  // Each thread does the same work, so ops/s should grow with the threads
+  // (as far as there are CPUs for them).
+  const size_t counts[] = { 1, 2, 4, 8, 16, 32 };
+  for (size_t k = 0; k < sizeof(counts) / sizeof(counts[0]); ++k) {
+    size_t n = counts[k] * rounds * AG_STD_BENCH_BATCH;
+    ag_std_par_set_threads(counts[k]);
+
+    double t = ag_std_bench_now();
+    ag_std_par_run(ag_std_bench_malloc_chunk, (void *)&rounds, counts[k]);
+    snprintf(name, sizeof(name), "pool: malloc/free, %zu threads", counts[k]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t);
+
+    t = ag_std_bench_now();
+    ag_std_par_run(ag_std_bench_churn_chunk, (void *)&rounds, counts[k]);
+    snprintf(name, sizeof(name), "pool: new/delete, %zu threads", counts[k]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t);
+  }
+
+  // Made on one thread and deleted on the others, the worst case for the
+  // magazines: every block has to go through the depot.
+  const size_t size = 1000000;
+  void **objs = malloc(size * sizeof(void *));
+  struct ag_std_bench_objs all = { objs, size, size };
+  struct ag_std_bench_objs job = { objs, size, size / 32 };
+  ag_std_par_set_threads(4);
+
+  double t = ag_std_bench_now();
+  ag_std_bench_new_chunk(&all, 0);
+  ag_std_par_run(ag_std_bench_delete_chunk, &job, 32);
+  ag_std_bench_report("pool: new here, delete there, 4 threads", size, ag_std_bench_now() - t);
+
+  free(objs);
+  ag_std_par_set_threads(threads);
+}
+
+void ag_std_bench_arena(void) {
+  const size_t requests = 10000;
+  const size_t per_request = 1000;
+  const size_t n = requests * per_request;
+  void **objs = malloc(sizeof(void *) * per_request);
+
+  double t = ag_std_bench_now();
+  for (size_t r = 0; r < requests; ++r) {
+    for (size_t i = 0; i < per_request; ++i) {
+      objs[i] = ag_std_new(ag_std_pair, NULL, NULL);
+    }
+    for (size_t i = 0; i < per_request; ++i) {
+      ag_std_delete(objs[i]);
+    }
+  }
+  ag_std_bench_report("arena: pool new + delete each (pair)", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t r = 0; r < requests; ++r) {
+    ag_std_arena_begin();
+    for (size_t i = 0; i < per_request; ++i) {
+      objs[i] = ag_std_new(ag_std_pair, NULL, NULL);
+    }
+    ag_std_arena_end(1);
+  }
+  ag_std_bench_report("arena: scope new + end(1) (pair)", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t r = 0; r < requests; ++r) {
+    ag_std_arena_begin();
+    for (size_t i = 0; i < per_request; ++i) {
+      objs[i] = ag_std_new(ag_std_pair, NULL, NULL);
+    }
+    ag_std_arena_end(0);
+  }
+  ag_std_bench_report("arena: scope new + end(0) (pair)", n, ag_std_bench_now() - t);
+
+  free(objs);
+}
+
+// The old way: heap iterators from ag_std_begin and ag_std_end.
+int ag_std_bench_find_heap(void *rng, void *val) {
+  void *it = ag_std_begin(rng);
+  void *end = ag_std_end(rng);
+  int found = 0;
+
+  while (ag_std_iter_not_equal(it, end)) {
+    if (ag_std_cmp(ag_std_iter_deref(it), val) == 0) {
+      found = 1;
+      break;
+    }
+    ag_std_iter_increment(it);
+  }
+
+  ag_std_delete(it);
+  ag_std_delete(end);
+  return found;
+}
+
+// Internal function, a vector of n integers 0 .. n - 1.
+void *ag_std_bench_int_vector(size_t n) {
+  void *v = ag_std_new(vector);
+
+  ag_std_vector_reserve(v, n);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_vector_push_back(v, ag_std_new(integer, (int)i));
+  }
+
+  return v;
+}
+
+void ag_std_bench_iter(void) {
+  const size_t big = 10000000;
+  void *v = ag_std_bench_int_vector(big);
+  void *missing = ag_std_new(integer, -1);
+
+  double t = ag_std_bench_now();
+  int found = ag_std_bench_find_heap(v, missing);
+  ag_std_bench_report("iter: heap iterators, find in 10M vector", big, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  found += ag_std_range_find(v, missing);
+  ag_std_bench_report("iter: stack iterators, find in 10M vector", big, ag_std_bench_now() - t);
+
+  // Lots of short traversals, where the two iterator allocations show.
+  const size_t calls = 2000000;
+  void *small = ag_std_bench_int_vector(4);
+
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < calls; ++i) {
+    found += ag_std_bench_find_heap(small, missing);
+  }
+  ag_std_bench_report("iter: heap iterators, 2M finds in 4 elems", calls, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < calls; ++i) {
+    found += ag_std_range_find(small, missing);
+  }
+  ag_std_bench_report("iter: stack iterators, 2M finds in 4 elems", calls, ag_std_bench_now() - t);
+
+  assert(found == 0);
+}
+
+void ag_std_bench_vector(void) {
+  void *x = ag_std_new(integer, 1);
+  const size_t sizes[] = { 1000000, 100000000 };
+  char name[64];
+
+  for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+    size_t n = sizes[k];
+
+    void *v = ag_std_new(vector);
+    double t = ag_std_bench_now();
+    for (size_t i = 0; i < n; ++i) {
+      ag_std_vector_push_back(v, x);
+    }
+    snprintf(name, sizeof(name), "vector: push_back x %zu", n);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t);
+
+    void *w = ag_std_new(vector);
+    t = ag_std_bench_now();
+    ag_std_vector_extend_from_range(w, v);
+    snprintf(name, sizeof(name), "vector: extend_from_range x %zu", n);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t);
+
+    ag_std_delete(w);
+    ag_std_delete(v);
+  }
+
+  ag_std_delete(x);
+}
+
+// The old ag_std_map_at, a linear scan calling cmp on every pair.
+void *ag_std_bench_map_linear_at(void *map_arg, void *key) {
+  struct ag_std_map *m = map_arg;
+
+  for (size_t i = 0; i < m->size; ++i) {
+    void *first = ag_std_pair_first(m->arr[i]);
+    if (ag_std_cmp(first, key) == 0) {
+      return ag_std_pair_second(m->arr[i]);
+    }
+  }
+
+  return NULL;
+}
+
+void ag_std_bench_map(void) {
+  const size_t sizes[] = { 1000, 100000, 1000000, 10000000 };
+  const size_t lookups = 1000000;
+  char name[64];
+  size_t hits = 0;
+
+  for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+    size_t n = sizes[k];
+    void *m = ag_std_new(ag_std_map);
+
+    ag_std_arena_begin();
+    for (size_t i = 0; i < n; ++i) {
+      void *key = ag_std_new(integer, (int)i);
+      ag_std_map_insert(m, ag_std_new(ag_std_pair, key, key));
+    }
+
+    void *probe = ag_std_new(integer, 0);
+    struct integer *pi = probe;
+
+    // Scattered keys, so the index is not walked in order.
+    double t = ag_std_bench_now();
+    for (size_t i = 0; i < lookups; ++i) {
+      pi->x = (int)((i * 2654435761u) % n);
+      hits += ag_std_map_at(m, probe) != NULL;
+    }
+    snprintf(name, sizeof(name), "map: hash at, %zu keys", n);
+    ag_std_bench_report(name, lookups, ag_std_bench_now() - t);
+
+    if (n <= 100000) {
+      size_t scans = n <= 1000 ? lookups : 1000;
+      t = ag_std_bench_now();
+      for (size_t i = 0; i < scans; ++i) {
+        pi->x = (int)((i * 2654435761u) % n);
+        hits += ag_std_bench_map_linear_at(m, probe) != NULL;
+      }
+      snprintf(name, sizeof(name), "map: linear at, %zu keys", n);
+      ag_std_bench_report(name, scans, ag_std_bench_now() - t);
+    }
+
+    ag_std_delete(m);
+    ag_std_arena_end(0);
+  }
+
+  assert(hits > 0);
+}
+
+void ag_std_bench_btree(void) {
+  const size_t sizes[] = { 1000, 100000, 1000000 };
+  const size_t queries = 100000;
+  const int width = 100;
+  char name[64];
+  size_t seen = 0;
+
+  for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+    size_t n = sizes[k];
+    void *t = ag_std_new(ag_std_btree);
+    void *m = ag_std_new(ag_std_map);
+
+    ag_std_arena_begin();
+    for (size_t i = 0; i < n; ++i) {
+      void *key = ag_std_new(integer, (int)((i * 2654435761u) % n));
+      void *p = ag_std_new(ag_std_pair, key, key);
+      ag_std_btree_insert(t, p);
+      ag_std_map_insert(m, p);
+    }
+
+    void *lo = ag_std_new(integer, 0);
+    void *hi = ag_std_new(integer, 0);
+    struct integer *lo_i = lo;
+    struct integer *hi_i = hi;
+    void *rng = ag_std_new(ag_std_btree_range, t, lo, hi);
+
+    union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(rng)];
+    union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+
+    double secs = ag_std_bench_now();
+    for (size_t q = 0; q < queries; ++q) {
+      lo_i->x = (int)((q * 40503u) % n);
+      hi_i->x = lo_i->x + width - 1;
+
+      void *it = ag_std_begin_into(rng, it_buf);
+      void *end = ag_std_end_into(rng, end_buf);
+      while (ag_std_iter_not_equal(it, end)) {
+        seen++;
+        ag_std_iter_increment(it);
+      }
+    }
+    snprintf(name, sizeof(name), "btree: range of %d, %zu keys", width, n);
+    ag_std_bench_report(name, queries, ag_std_bench_now() - secs);
+
+    // The same query by scanning the array-of-pairs map.
+    size_t scans = n <= 1000 ? queries : 100;
+    struct ag_std_map *mp = m;
+    secs = ag_std_bench_now();
+    for (size_t q = 0; q < scans; ++q) {
+      lo_i->x = (int)((q * 40503u) % n);
+      hi_i->x = lo_i->x + width - 1;
+
+      for (size_t i = 0; i < mp->size; ++i) {
+        void *key = ag_std_pair_first(mp->arr[i]);
+        if (ag_std_cmp(key, lo) >= 0 && ag_std_cmp(key, hi) <= 0) {
+          seen++;
+        }
+      }
+    }
+    snprintf(name, sizeof(name), "btree: linear scan range, %zu keys", n);
+    ag_std_bench_report(name, scans, ag_std_bench_now() - secs);
+
+    secs = ag_std_bench_now();
+    for (size_t q = 0; q < queries; ++q) {
+      lo_i->x = (int)((q * 40503u) % n);
+      seen += ag_std_btree_at(t, lo) != NULL;
+    }
+    snprintf(name, sizeof(name), "btree: at, %zu keys", n);
+    ag_std_bench_report(name, queries, ag_std_bench_now() - secs);
+
+    secs = ag_std_bench_now();
+    for (size_t q = 0; q < scans; ++q) {
+      lo_i->x = (int)((q * 40503u) % n);
+      seen += ag_std_bench_map_linear_at(m, lo) != NULL;
+    }
+    snprintf(name, sizeof(name), "btree: linear at, %zu keys", n);
+    ag_std_bench_report(name, scans, ag_std_bench_now() - secs);
+
+    ag_std_delete(t);
+    ag_std_delete(m);
+    ag_std_arena_end(0);
+  }
+
+  assert(seen > 0);
+}
+
+#define AG_STD_BENCH_WORDS 4096
+
+struct ag_std_bench_intern_arg {
+  char (*words)[32];
+  size_t n;
+};
+
+void *ag_std_bench_intern_worker(void *arg) {
+  struct ag_std_bench_intern_arg *a = arg;
+  for (size_t i = 0; i < a->n; ++i) {
+    ag_std_intern(a->words[(i * 2654435761u) % AG_STD_BENCH_WORDS]);
+  }
+
+  return NULL;
+}
+
+void ag_std_bench_intern(void) {
+  static char words[AG_STD_BENCH_WORDS][32];
+  for (size_t i = 0; i < AG_STD_BENCH_WORDS; ++i) {
+    snprintf(words[i], sizeof(words[i]), "word-%zu", i);
+  }
+
+  const size_t n = 4000000;
+  struct ag_std_bench_intern_arg arg = { words, n };
+
+  double t = ag_std_bench_now();
+  ag_std_bench_intern_worker(&arg);
+  ag_std_bench_report("intern: 1 thread, 4096 distinct words", n, ag_std_bench_now() - t);
+
+  enum { threads = 4 };
+  pthread_t tids[threads];
+  arg.n = n / threads;
+
+  t = ag_std_bench_now();
+  for (int i = 0; i < threads; ++i) {
+    pthread_create(&tids[i], NULL, ag_std_bench_intern_worker, &arg);
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+  ag_std_bench_report("intern: 4 threads, 4096 distinct words", n, ag_std_bench_now() - t);
+
+  ag_std_intern_print_stats();
+}
+
+void ag_std_bench_typed_vector(void) {
+  const size_t n = 10000000;
+
+  void *boxed = ag_std_bench_int_vector(n);
+  void *typed = ag_std_new(ag_std_int32_vector);
+  ag_std_typed_vector_reserve(typed, n);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_int32_vector_push_back(typed, (int32_t)i);
+  }
+
+  size_t boxed_bytes = n * (sizeof(void *) + ag_std_iter_round(sizeof(struct integer)));
+  size_t typed_bytes = n * sizeof(int32_t);
+  printf("typed: 10M ints take %zu MB boxed, %zu MB typed (%.1fx)\n",
+      boxed_bytes >> 20, typed_bytes >> 20, (double)boxed_bytes / (double)typed_bytes);
+
+  // Sum through each kind of access.
+  struct ag_std_vector *bv = boxed;
+  int64_t sum_boxed = 0;
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < bv->size; ++i) {
+    sum_boxed += ((struct integer *)bv->arr[i])->x;
+  }
+  ag_std_bench_report("typed: sum boxed vector", n, ag_std_bench_now() - t);
+
+  int64_t sum_span = 0;
+  const int32_t *span = ag_std_typed_vector_data(typed);
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    sum_span += span[i];
+  }
+  ag_std_bench_report("typed: sum int32 span", n, ag_std_bench_now() - t);
+
+  int64_t sum_iter = 0;
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(typed)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(typed)];
+  void *it = ag_std_begin_into(typed, it_buf);
+  void *end = ag_std_end_into(typed, end_buf);
+  t = ag_std_bench_now();
+  while (ag_std_iter_not_equal(it, end)) {
+    sum_iter += ((struct integer *)ag_std_iter_deref(it))->x;
+    ag_std_iter_increment(it);
+  }
+  ag_std_bench_report("typed: sum int32 via iterators", n, ag_std_bench_now() - t);
+
+  assert(sum_boxed == sum_span && sum_span == sum_iter);
+  ag_std_delete(typed);
+}
+
+void ag_std_bench_simd(void) {
+  const size_t n = 10000000;
+  const int reps = 10;
+
+  void *boxed = ag_std_bench_int_vector(n);
+  void *typed = ag_std_new(ag_std_int32_vector);
+  void *doubles = ag_std_new(ag_std_double_vector);
+  ag_std_typed_vector_reserve(typed, n);
+  ag_std_typed_vector_reserve(doubles, n);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_int32_vector_push_back(typed, (int32_t)i);
+    ag_std_double_vector_push_back(doubles, (double)i);
+  }
+
+  // Not in the ranges, so find has to look at every element.
+  void *missing = ag_std_new(integer, -1);
+  void *missing_d = ag_std_new(floating64, -1.0);
+  struct ag_std_num r;
+  size_t c = 0;
+
+  // The old way: three vtable calls per element.
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(boxed)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(boxed)];
+  double t = ag_std_bench_now();
+  for (int k = 0; k < reps; ++k) {
+    void *it = ag_std_begin_into(boxed, it_buf);
+    void *end = ag_std_end_into(boxed, end_buf);
+    while (ag_std_iter_not_equal(it, end)) {
+      c += ag_std_cmp(ag_std_iter_deref(it), missing) == 0;
+      ag_std_iter_increment(it);
+    }
+  }
+  ag_std_bench_report("simd: count via iterators", n * reps, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (int k = 0; k < reps; ++k) {
+    c += ag_std_range_count(boxed, missing);
+  }
+  ag_std_bench_report("simd: count boxed vector", n * reps, ag_std_bench_now() - t);
+
+  const char *names[] = { "scalar", "sse2", "avx2" };
+  char name[64];
+  enum ag_std_simd_level best = ag_std_simd_supported();
+  for (int level = AG_STD_SIMD_SCALAR; level <= (int)best; ++level) {
+    ag_std_simd_use(level);
+
+    t = ag_std_bench_now();
+    for (int k = 0; k < reps; ++k) {
+      c += (size_t)ag_std_range_find(typed, missing);
+    }
+    snprintf(name, sizeof(name), "simd: find int32 (%s)", names[level]);
+    ag_std_bench_report(name, n * reps, ag_std_bench_now() - t);
+
+    t = ag_std_bench_now();
+    for (int k = 0; k < reps; ++k) {
+      c += ag_std_range_count(doubles, missing_d);
+    }
+    snprintf(name, sizeof(name), "simd: count double (%s)", names[level]);
+    ag_std_bench_report(name, n * reps, ag_std_bench_now() - t);
+
+    t = ag_std_bench_now();
+    for (int k = 0; k < reps; ++k) {
+      ag_std_range_sum(typed, &r);
+      c += (size_t)r.i;
+    }
+    snprintf(name, sizeof(name), "simd: sum int32 (%s)", names[level]);
+    ag_std_bench_report(name, n * reps, ag_std_bench_now() - t);
+
+    t = ag_std_bench_now();
+    for (int k = 0; k < reps; ++k) {
+      ag_std_range_max(typed, &r);
+      c += (size_t)r.i;
+    }
+    snprintf(name, sizeof(name), "simd: max int32 (%s)", names[level]);
+    ag_std_bench_report(name, n * reps, ag_std_bench_now() - t);
+  }
+  ag_std_simd_use(best);
+
+  // Keep the compiler from throwing the loops away.
+  if (c == 1) {
+    printf("\n");
+  }
+
+  ag_std_delete(typed);
+  ag_std_delete(doubles);
+}
+
+void ag_std_bench_batch(void) {
+  // Small enough to stay in cache, so this measures the calls, not misses.
+  const size_t n = 10000;
+  const int reps = 1000;
+
+  void *lst = ag_std_new(ag_std_list);
+  void *t = ag_std_new(ag_std_btree);
+  for (size_t i = 0; i < n; ++i) {
+    void *x = ag_std_new(integer, (int)i);
+    ag_std_list_push_back(lst, x);
+    ag_std_btree_insert(t, ag_std_new(ag_std_pair, x, x));
+  }
+
+  void *ranges[] = { lst, t };
+  const char *names[] = { "list", "btree" };
+  char name[64];
+  size_t c = 0;
+
+  for (int r = 0; r < 2; ++r) {
+    union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(ranges[r])];
+    union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(ranges[r])];
+    void *end = ag_std_end_into(ranges[r], end_buf);
+
+    // Three indirect calls per element.
+    double t0 = ag_std_bench_now();
+    for (int k = 0; k < reps; ++k) {
+      void *it = ag_std_begin_into(ranges[r], it_buf);
+      while (ag_std_iter_not_equal(it, end)) {
+        c += ag_std_iter_deref(it) != NULL;
+        ag_std_iter_increment(it);
+      }
+    }
+    snprintf(name, sizeof(name), "batch: %s walk, per element", names[r]);
+    ag_std_bench_report(name, n * reps, ag_std_bench_now() - t0);
+
+    // One indirect call per AG_STD_ITER_BATCH elements.
+    void *batch[AG_STD_ITER_BATCH];
+    t0 = ag_std_bench_now();
+    for (int k = 0; k < reps; ++k) {
+      void *it = ag_std_begin_into(ranges[r], it_buf);
+      size_t got;
+      while ((got = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+        for (size_t i = 0; i < got; ++i) {
+          c += batch[i] != NULL;
+        }
+      }
+    }
+    snprintf(name, sizeof(name), "batch: %s walk, batched", names[r]);
+    ag_std_bench_report(name, n * reps, ag_std_bench_now() - t0);
+  }
+
+  // Keep the compiler from throwing the loops away.
+  if (c == 1) {
+    printf("\n");
+  }
+
+  ag_std_delete(t);
+}
+
+void ag_std_bench_dispatch(void) {
+  const size_t n = 100000000;
+  void *a = ag_std_new(integer, 1);
+  void *b = ag_std_new(integer, 2);
+  void *v = ag_std_new(vector);
+
+  // A built in selector and one added at run time cost the same.
+  size_t c = 0;
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    c += (size_t)ag_std_cmp(i & 1 ? a : b, a);
+  }
+  ag_std_bench_report("dispatch: ag_std_cmp (built in)", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    c += ag_std_size(v);
+  }
+  ag_std_bench_report("dispatch: ag_std_size (added)", n, ag_std_bench_now() - t);
+
+  if (c == 1) {
+    printf("\n");
+  }
+
+  ag_std_delete(v);
+}
+
+void ag_std_bench_is_a(void) {
+  const size_t n = 100000000;
+  void *objs[4] = {
+    ag_std_new(integer, 1),
+    ag_std_new(string, "one"),
+    ag_std_new(floating64, 1.0),
+    ag_std_new(vector)
+  };
+
+  // What a type check had to do before: walk up from the class.
+  size_t c = 0;
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    const struct ag_std_vtable *vt = ag_std_class_of(objs[i & 3]);
+    while (vt != NULL && vt != number) {
+      vt = vt->super;
+    }
+    c += vt != NULL;
+  }
+  ag_std_bench_report("is_a: walk the super chain", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    c += (size_t)ag_std_is_a(objs[i & 3], number);
+  }
+  ag_std_bench_report("is_a: display", n, ag_std_bench_now() - t);
+
+  if (c == 1) {
+    printf("\n");
+  }
+}
+
+void ag_std_bench_immediate(void) {
+  const size_t n = 10000000;
+  void *five = ag_std_new(integer, 5);
+
+  // A number that lives on the heap: allocate, compare, free.
+  int c = 0;
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    void *x = ag_std_new(integer, (int)(i & 7));
+    c += ag_std_cmp(x, five) == 0;
+    ag_std_delete(x);
+  }
+  ag_std_bench_report("immediate: boxed integer new/cmp/delete", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    void *x = ag_std_int((int)(i & 7));
+    c += ag_std_cmp(x, five) == 0;
+    ag_std_delete(x);
+  }
+  ag_std_bench_report("immediate: tagged integer new/cmp/delete", n, ag_std_bench_now() - t);
+
+  // The iota view used to box every element it handed out.
+  void *iota = ag_std_new(ag_std_iota_view, (int)n);
+  size_t live = ag_std_pool_live(sizeof(struct integer));
+  struct ag_std_num total;
+  t = ag_std_bench_now();
+  ag_std_range_sum(iota, &total);
+  ag_std_bench_report("immediate: range_sum over iota_view", n, ag_std_bench_now() - t);
+  assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+  if (c == 1 || total.i == 1) {
+    printf("\n");
+  }
+  ag_std_delete(iota);
+  ag_std_delete(five);
+}
+
+void ag_std_bench_zip(void) {
+  const size_t n = 1000000;
+
+  void *v = ag_std_new(vector);
+  void *w = ag_std_new(vector);
+  void *lst = ag_std_new(ag_std_list);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_vector_push_back(v, ag_std_int((int)i));
+    ag_std_vector_push_back(w, ag_std_int((int)(n - i)));
+    ag_std_list_push_back(lst, ag_std_int((int)i));
+  }
+
+  void *zv = ag_std_new(ag_std_zip_view, v, w);
+  size_t live = ag_std_pool_live(sizeof(struct ag_std_pair));
+  size_t c = 0;
+
+  // Heap iterators, one pair at a time. This used to make a pair per element.
+  double t = ag_std_bench_now();
+  void *it = ag_std_begin(zv);
+  void *end = ag_std_end(zv);
+  while (ag_std_iter_not_equal(it, end)) {
+    c += ag_std_pair_first(ag_std_iter_deref(it)) != NULL;
+    ag_std_iter_increment(it);
+  }
+  ag_std_delete(it);
+  ag_std_delete(end);
+  ag_std_bench_report("zip: walk 2 vectors, per element", n, ag_std_bench_now() - t);
+
+  void *items[2] = { ag_std_int(1), ag_std_int(1) };
+  void *want = ag_std_new(ag_std_pair, items[0], items[1]);
+  t = ag_std_bench_now();
+  c += ag_std_range_count(zv, want);
+  ag_std_bench_report("zip: range_count over 2 vectors", n, ag_std_bench_now() - t);
+
+  void *rngs[4] = { v, w, lst, v };
+  void *z4 = ag_std_new(ag_std_zip_n_view, 4, rngs);
+  void *want4 = ag_std_new(ag_std_tuple, 2, items);
+  t = ag_std_bench_now();
+  c += ag_std_range_count(z4, want4);
+  ag_std_bench_report("zip: range_count over 4 ranges", n, ag_std_bench_now() - t);
+
+  assert(ag_std_pool_live(sizeof(struct ag_std_pair)) == live + 1);
+
+  if (c == 1) {
+    printf("\n");
+  }
+  ag_std_delete(v);
+  ag_std_delete(w);
+  ag_std_delete(lst);
+}
+
+void ag_std_bench_view(void) {
+  const size_t n = 1000000;
+
+  void *v = ag_std_new(vector);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_vector_push_back(v, ag_std_int((int)(i & 0x7fff)));
+  }
+
+  // Squares of the even ones, the way it had to be done: a vector per stage.
+  double t = ag_std_bench_now();
+  void *evens = ag_std_new(vector);
+  struct ag_std_vector *src = v;
+  for (size_t i = 0; i < src->size; ++i) {
+    if (ag_std_bench_is_even(src->arr[i])) {
+      ag_std_vector_push_back(evens, src->arr[i]);
+    }
+  }
+  void *squares = ag_std_new(vector);
+  struct ag_std_vector *ev = evens;
+  for (size_t i = 0; i < ev->size; ++i) {
+    ag_std_vector_push_back(squares, ag_std_bench_square(ev->arr[i]));
+  }
+  struct ag_std_num total;
+  ag_std_range_sum(squares, &total);
+  ag_std_bench_report("view: filter + transform via vectors", n, ag_std_bench_now() - t);
+  int64_t want = total.i;
+
+  // The same as views, in one pass with nothing in between.
+  void *fv = ag_std_new(ag_std_filter_view, v, ag_std_bench_is_even);
+  void *tv = ag_std_new(ag_std_transform_view, fv, ag_std_bench_square);
+  t = ag_std_bench_now();
+  ag_std_range_sum(tv, &total);
+  ag_std_bench_report("view: filter + transform views", n, ag_std_bench_now() - t);
+  assert(total.i == want);
+
+  // And one element at a time, for what batches save.
+  t = ag_std_bench_now();
+  union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(tv)];
+  union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(tv)];
+  void *end = ag_std_end_into(tv, end_buf);
+  int64_t sum = 0;
+  for (void *it = ag_std_begin_into(tv, it_buf);
+      ag_std_iter_not_equal(it, end);
+      ag_std_iter_increment(it)) {
+    sum += ag_std_int_value(ag_std_iter_deref(it));
+  }
+  ag_std_bench_report("view: filter + transform views, per element", n, ag_std_bench_now() - t);
+  assert(sum == want);
+
+  ag_std_delete(v);
+  ag_std_delete(evens);
+  ag_std_delete(squares);
+}
+
+void ag_std_bench_par(void) {
+  const size_t n = 4000000;
+
+  void *v = ag_std_new(vector);
+  void *tv = ag_std_new(ag_std_int32_vector);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_vector_push_back(v, ag_std_int((int)(i & 0xffff)));
+    ag_std_typed_vector_append_n(tv, &(int32_t){ (int32_t)(i & 0xffff) }, 1);
+  }
+
+  // How it scales. With fewer cores than threads it can't, of course.
+  size_t threads[] = { 1, 2, 4, 8, 16, 32 };
+  char name[64];
+  size_t c = 0;
+  int64_t want = -1;
+
+  for (int t = 0; t < 6; ++t) {
+    ag_std_par_set_threads(threads[t]);
+
+    double t0 = ag_std_bench_now();
+    c += ag_std_par_count_if(v, ag_std_bench_is_even);
+    snprintf(name, sizeof(name), "par: count_if vector, %zu threads", threads[t]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t0);
+
+    struct ag_std_num total;
+    t0 = ag_std_bench_now();
+    ag_std_par_reduce(v, AG_STD_NUM_SUM, &total);
+    snprintf(name, sizeof(name), "par: reduce vector, %zu threads", threads[t]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t0);
+    assert(want == -1 || total.i == want);
+    want = total.i;
+
+    t0 = ag_std_bench_now();
+    ag_std_par_reduce(tv, AG_STD_NUM_SUM, &total);
+    snprintf(name, sizeof(name), "par: reduce int32 vector, %zu threads", threads[t]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t0);
+    assert(total.i == want);
+  }
+
+  if (c == 1) {
+    printf("\n");
+  }
+  ag_std_delete(v);
+  ag_std_delete(tv);
+}
+
+void ag_std_bench_sched(void) {
+  const int n = 30;
+  char name[64];
+
+  double t = ag_std_bench_now();
+  long want = ag_std_bench_fib_serial(n);
+  ag_std_bench_report("sched: fib(30), plain calls", (size_t)want, ag_std_bench_now() - t);
+
+  // One spawn per call, so this is about as bad as it gets.
+  size_t workers[] = { 1, 2, 4 };
+  for (int w = 0; w < 3; ++w) {
+    ag_std_sched_start(workers[w]);
+
+    struct ag_std_bench_fib f = { n, 0 };
+    t = ag_std_bench_now();
+    ag_std_task_run(ag_std_bench_fib_task, &f);
+    snprintf(name, sizeof(name), "sched: fib(30), spawns, %zu workers", workers[w]);
+    ag_std_bench_report(name, (size_t)want, ag_std_bench_now() - t);
+    assert(f.result == want);
+  }
+  ag_std_sched_print_stats();
+
+  const size_t size = 4000000;
+  void *v = ag_std_new(vector);
+  for (size_t i = 0; i < size; ++i) {
+    ag_std_vector_push_back(v, ag_std_int((int)(i & 0xffff)));
+  }
+
+  struct ag_std_bench_sum job = { v, 0, size, 0 };
+  t = ag_std_bench_now();
+  ag_std_task_run(ag_std_bench_sum_task, &job);
+  ag_std_bench_report("sched: split sum of a vector, 4 workers", size, ag_std_bench_now() - t);
+
+  ag_std_delete(v);
+}
+
+// Internal function, a vector of n boxed integers that only it refers to.
+void *ag_std_bench_boxed_vector(size_t n) {
+  void *v = ag_std_new(vector);
+  for (size_t i = 0; i < n; ++i) {
+    void *x = ag_std_new(integer, (int)i);
+    ag_std_vector_push_back(v, x);
+    ag_std_release(x);
+  }
+
+  return v;
+}
+
+void ag_std_bench_refcount(void) {
+  const size_t n = 20000000;
+
+  // Start with nothing left over from the benchmarks before.
+  ag_std_release_flush();
+
+  void *x = ag_std_new(integer, 1);
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_bench_retain_release(x);
+  }
+  ag_std_bench_report("refcount: retain + release, one thread", n, ag_std_bench_now() - t);
+
+  ag_std_share(x);
+  t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_bench_retain_release(x);
+  }
+  ag_std_bench_report("refcount: retain + release, shared", n, ag_std_bench_now() - t);
+  ag_std_release(x);
+
+  // Deleting a big container: all at once, or a step at a time.
+  const size_t size = 1000000;
+  void *v = ag_std_bench_boxed_vector(size);
+  t = ag_std_bench_now();
+  ag_std_delete(v);
+  ag_std_release_flush();
+  double all = ag_std_bench_now() - t;
+  ag_std_bench_report("refcount: delete 1M boxed, all at once", size, all);
+
+  v = ag_std_bench_boxed_vector(size);
+  t = ag_std_bench_now();
+  ag_std_delete(v);
+  double pause = ag_std_bench_now() - t;
+
+  double longest = 0;
+  size_t left = ag_std_release_pending();
+  while (left > 0) {
+    double s = ag_std_bench_now();
+    left = ag_std_release_drain(AG_STD_RELEASE_STEP);
+    if (ag_std_bench_now() - s > longest) {
+      longest = ag_std_bench_now() - s;
+    }
+  }
+  ag_std_bench_report("refcount: delete 1M boxed, deferred", size, ag_std_bench_now() - t);
+  printf("%-44s %9.1f us delete, %.1f us longest step (vs %.1f us)\n",
+      "refcount: pauses", pause * 1e6, longest * 1e6, all * 1e6);
+}
+
+// A shared lookup table: 95% lookups, 5% inserts of new keys.
+struct ag_std_bench_cmap_job {
+  void *m;
+  size_t keys;
+  size_t ops;
+  size_t hits;
+};
+
+pthread_mutex_t ag_std_bench_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Internal function, the key a chunk writes on its i-th op.
+void *ag_std_bench_cmap_pair(struct ag_std_bench_cmap_job *job, size_t c, size_t i) {
+  void *key = ag_std_new(integer, (int)(job->keys + c * job->ops + i));
+  void *pair = ag_std_new(ag_std_pair, key, key);
+  ag_std_release(key);
+  return pair;
+}
+
+void ag_std_bench_cmap_chunk(void *job_arg, size_t c) {
+  struct ag_std_bench_cmap_job *job = job_arg;
+  void *probe = ag_std_new(integer, 0);
+  struct integer *pi = probe;
+  size_t hits = 0;
+
+  for (size_t i = 0; i < job->ops; ++i) {
+    if (i % 20 == 0) {
+      void *pair = ag_std_bench_cmap_pair(job, c, i);
+      ag_std_cmap_insert(job->m, pair);
+      ag_std_release(pair);
+    } else {
+      pi->x = (int)(((c + 1) * i * 2654435761u) % job->keys);
+      void *value = ag_std_cmap_at(job->m, probe);
+      hits += value != NULL;
+      ag_std_release(value);
+    }
+  }
+
+  ag_std_delete(probe);
+  __atomic_fetch_add(&job->hits, hits, __ATOMIC_RELAXED);
+}
+
+// The same on ag_std_map, behind one lock.
+void ag_std_bench_locked_map_chunk(void *job_arg, size_t c) {
+  struct ag_std_bench_cmap_job *job = job_arg;
+  void *probe = ag_std_new(integer, 0);
+  struct integer *pi = probe;
+  size_t hits = 0;
+
+  for (size_t i = 0; i < job->ops; ++i) {
+    if (i % 20 == 0) {
+      void *pair = ag_std_bench_cmap_pair(job, c, i);
+      pthread_mutex_lock(&ag_std_bench_map_lock);
+      ag_std_map_insert(job->m, pair);
+      pthread_mutex_unlock(&ag_std_bench_map_lock);
+      ag_std_release(pair);
+    } else {
+      pi->x = (int)(((c + 1) * i * 2654435761u) % job->keys);
+      pthread_mutex_lock(&ag_std_bench_map_lock);
+      hits += ag_std_map_at(job->m, probe) != NULL;
+      pthread_mutex_unlock(&ag_std_bench_map_lock);
+    }
+  }
+
+  ag_std_delete(probe);
+  __atomic_fetch_add(&job->hits, hits, __ATOMIC_RELAXED);
+}
+
+void ag_std_bench_cmap(void) {
+  const size_t keys = 100000;
+  const size_t ops = 200000;
+  size_t threads = ag_std_par_threads();
+  char name[64];
+
+  const size_t counts[] = { 1, 2, 4, 8, 16, 32 };
+  for (size_t k = 0; k < sizeof(counts) / sizeof(counts[0]); ++k) {
+    size_t n = counts[k] * ops;
+    ag_std_par_set_threads(counts[k]);
+
+    void *locked = ag_std_new(ag_std_map);
+    void *m = ag_std_new(ag_std_cmap);
+    for (size_t i = 0; i < keys; ++i) {
+      void *key = ag_std_new(integer, (int)i);
+      void *pair = ag_std_new(ag_std_pair, key, key);
+      ag_std_map_insert(locked, pair);
+      ag_std_cmap_insert(m, pair);
+      ag_std_release(pair);
+      ag_std_release(key);
+    }
+
+    struct ag_std_bench_cmap_job job = { locked, keys, ops, 0 };
+    double t = ag_std_bench_now();
+    ag_std_par_run(ag_std_bench_locked_map_chunk, &job, counts[k]);
+    snprintf(name, sizeof(name), "cmap: locked map 95/5, %zu threads", counts[k]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t);
+
+    job.m = m;
+    t = ag_std_bench_now();
+    ag_std_par_run(ag_std_bench_cmap_chunk, &job, counts[k]);
+    snprintf(name, sizeof(name), "cmap: cmap 95/5, %zu threads", counts[k]);
+    ag_std_bench_report(name, n, ag_std_bench_now() - t);
+
+    struct ag_std_cmap_stats stats;
+    ag_std_cmap_stats(m, &stats);
+    printf("%-44s %9zu writes, %zu waited, %zu grows\n",
+        "cmap: stripes", stats.writes, stats.contended, stats.grows);
+
+    ag_std_delete(m);
+    ag_std_delete(locked);
+    ag_std_release_flush();
+  }
+
+  ag_std_par_set_threads(threads);
+}
+
+// Producers and consumers on their own threads (a producer waiting on a
+// full queue must not be holding up the consumer it waits for).
+struct ag_std_bench_queue_job {
+  void *q;
+  size_t n; // Each producer pushes n, each consumer pops n.
+  size_t batch;
+  int *latency; // Of each pop, in ns, for a consumer.
+  long long sum;
+};
+
+// Internal function, now in ns, cut to fit in an immediate.
+int ag_std_bench_stamp(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int)(((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec) & 0x3fffffff);
+}
+
+void *ag_std_bench_producer(void *arg) {
+  struct ag_std_bench_queue_job *job = arg;
+  void *objs[AG_STD_BENCH_BATCH];
+
+  for (size_t i = 0; i < job->n; ) {
+    size_t k = job->n - i < job->batch ? job->n - i : job->batch;
+    for (size_t j = 0; j < k; ++j) {
+      objs[j] = ag_std_int(ag_std_bench_stamp());
+    }
+
+    size_t done = k == 1 ? 0 : ag_std_queue_push_n(job->q, objs, k);
+    if (done == 0) {
+      ag_std_queue_push(job->q, objs[0]);
+      done = 1;
+    }
+    i += done;
+  }
+
+  return NULL;
+}
+
+void *ag_std_bench_consumer(void *arg) {
+  struct ag_std_bench_queue_job *job = arg;
+  void *objs[AG_STD_BENCH_BATCH];
+
+  for (size_t i = 0; i < job->n; ) {
+    size_t k = job->n - i < job->batch ? job->n - i : job->batch;
+    size_t done = k == 1 ? 0 : ag_std_queue_pop_n(job->q, objs, k);
+    if (done == 0) {
+      objs[0] = ag_std_queue_pop(job->q);
+      done = 1;
+    }
+
+    int now = ag_std_bench_stamp();
+    for (size_t j = 0; j < done; ++j, ++i) {
+      int stamp = ag_std_int_value(objs[j]);
+      job->latency[i] = (now - stamp) & 0x3fffffff;
+      job->sum += stamp;
+    }
+  }
+
+  return NULL;
+}
+
+// The way it was done before: a ring behind a mutex and two conditions.
+struct ag_std_bench_locked_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  void *items[1024];
+  size_t head;
+  size_t size;
+};
+
+void *ag_std_bench_locked_producer(void *arg) {
+  struct ag_std_bench_queue_job *job = arg;
+  struct ag_std_bench_locked_queue *q = job->q;
+  const size_t capacity = sizeof(q->items) / sizeof(q->items[0]);
+
+  for (size_t i = 0; i < job->n; ++i) {
+    void *obj = ag_std_int(ag_std_bench_stamp());
+    pthread_mutex_lock(&q->lock);
+    while (q->size == capacity) {
+      pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->items[(q->head + q->size++) % capacity] = obj;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  return NULL;
+}
+
+void *ag_std_bench_locked_consumer(void *arg) {
+  struct ag_std_bench_queue_job *job = arg;
+  struct ag_std_bench_locked_queue *q = job->q;
+  const size_t capacity = sizeof(q->items) / sizeof(q->items[0]);
+
+  for (size_t i = 0; i < job->n; ++i) {
+    pthread_mutex_lock(&q->lock);
+    while (q->size == 0) {
+      pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    void *obj = q->items[q->head];
+    q->head = (q->head + 1) % capacity;
+    q->size--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+
+    int stamp = ag_std_int_value(obj);
+    job->latency[i] = (ag_std_bench_stamp() - stamp) & 0x3fffffff;
+  }
+
+  return NULL;
+}
+
+int ag_std_bench_int_cmp(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+// Internal function, run pairs producers and pairs consumers on q, and
+// report how fast it went and how long items waited in the queue.
+void ag_std_bench_queue_run(const char *name, void *q, size_t pairs, size_t n,
+    size_t batch, void *(*producer)(void *), void *(*consumer)(void *)) {
+  pthread_t threads[64];
+  struct ag_std_bench_queue_job jobs[64];
+  int *latency = malloc(sizeof(int) * pairs * n);
+
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < 2 * pairs; ++i) {
+    struct ag_std_bench_queue_job job = { q, n, batch, latency + (i / 2) * n, 0 };
+    jobs[i] = job;
+    pthread_create(&threads[i], NULL, i % 2 ? consumer : producer, &jobs[i]);
+  }
+  for (size_t i = 0; i < 2 * pairs; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  double secs = ag_std_bench_now() - t;
+
+  char label[64];
+  snprintf(label, sizeof(label), "queue: %s, %zu+%zu threads", name, pairs, pairs);
+  ag_std_bench_report(label, pairs * n, secs);
+
+  size_t total = pairs * n;
+  qsort(latency, total, sizeof(int), ag_std_bench_int_cmp);
+  printf("%-44s %9.1f us p50, %.1f us p99, %.1f us p99.9\n", "queue: in the queue",
+      latency[total / 2] * 1e-3, latency[total / 100 * 99] * 1e-3,
+      latency[total / 1000 * 999] * 1e-3);
+
+  free(latency);
+}
+
+void ag_std_bench_queue(void) {
+  const size_t n = 200000;
+
+  const size_t pairs[] = { 1, 2, 4, 8, 16 };
+  for (size_t k = 0; k < sizeof(pairs) / sizeof(pairs[0]); ++k) {
+    struct ag_std_bench_locked_queue locked;
+    pthread_mutex_init(&locked.lock, NULL);
+    pthread_cond_init(&locked.not_empty, NULL);
+    pthread_cond_init(&locked.not_full, NULL);
+    locked.head = 0;
+    locked.size = 0;
+    ag_std_bench_queue_run("mutex + conds", &locked, pairs[k], n, 1,
+        ag_std_bench_locked_producer, ag_std_bench_locked_consumer);
+    pthread_mutex_destroy(&locked.lock);
+    pthread_cond_destroy(&locked.not_empty);
+    pthread_cond_destroy(&locked.not_full);
+
+    void *q = ag_std_new(ag_std_queue, 1024, 1);
+    ag_std_bench_queue_run("futex waits", q, pairs[k], n, 1,
+        ag_std_bench_producer, ag_std_bench_consumer);
+    ag_std_bench_queue_run("futex, batches of 64", q, pairs[k], n, 64,
+        ag_std_bench_producer, ag_std_bench_consumer);
+    ag_std_delete(q);
+
+    q = ag_std_new(ag_std_queue, 1024, 0);
+    ag_std_bench_queue_run("yield waits", q, pairs[k], n, 1,
+        ag_std_bench_producer, ag_std_bench_consumer);
+    ag_std_delete(q);
+  }
+}
+
+// Two lists built at the same time, so their nodes are interleaved in
+// memory, as they are in a program that does other things too.
+void ag_std_bench_list_kind(const char *name, void *cls, size_t n) {
+  char label[64];
+  void *a = ag_std_new(cls);
+  void *b = ag_std_new(cls);
+
+  double t = ag_std_bench_now();
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_list_push_back(a, ag_std_int((int)(2 * i)));
+    ag_std_list_push_back(b, ag_std_int((int)(2 * i + 1)));
+  }
+  snprintf(label, sizeof(label), "list: %s push_back", name);
+  ag_std_bench_report(label, 2 * n, ag_std_bench_now() - t);
+
+  struct ag_std_num r;
+  t = ag_std_bench_now();
+  for (int k = 0; k < 10; ++k) {
+    ag_std_range_sum(a, &r);
+  }
+  snprintf(label, sizeof(label), "list: %s range_sum", name);
+  ag_std_bench_report(label, 10 * n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  ag_std_list_merge(a, b);
+  snprintf(label, sizeof(label), "list: %s merge", name);
+  ag_std_bench_report(label, 2 * n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  ag_std_list_splice(b, NULL, a);
+  snprintf(label, sizeof(label), "list: %s splice", name);
+  ag_std_bench_report(label, 1, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  ag_std_delete(a);
+  ag_std_delete(b);
+  snprintf(label, sizeof(label), "list: %s delete", name);
+  ag_std_bench_report(label, 2 * n, ag_std_bench_now() - t);
+}
+
+void ag_std_bench_list(void) {
+  const size_t n = 2000000;
+  ag_std_bench_list_kind("1 a node,", ag_std_list, n);
+  ag_std_bench_list_kind("unrolled,", ag_std_unrolled_list, n);
+
+  void *v = ag_std_bench_int_vector(n);
+  struct ag_std_num r;
+  double t = ag_std_bench_now();
+  for (int k = 0; k < 10; ++k) {
+    ag_std_range_sum(v, &r);
+  }
+  ag_std_bench_report("list: (vector range_sum)", 10 * n, ag_std_bench_now() - t);
+  ag_std_delete(v);
+}
+
+int ag_std_bench_qsort_cmp(const void *a, const void *b) {
+  return ag_std_cmp(*(void *const *)a, *(void *const *)b);
+}
+
+// Sorting a big list in place, against copying it out to sort.
+void ag_std_bench_list_sort(void) {
+  const size_t n = 2000000;
+  char label[64];
+
+  void *classes[] = { ag_std_list, ag_std_unrolled_list };
+  const char *names[] = { "1 a node,", "unrolled," };
+  for (size_t k = 0; k < 2; ++k) {
+    void *lst = ag_std_new(classes[k]);
+    unsigned x = 1;
+    for (size_t i = 0; i < n; ++i) {
+      x = x * 1103515245u + 12345u;
+      ag_std_list_push_back(lst, ag_std_int((int)(x >> 1)));
+    }
+
+    if (k == 0) {
+      double t = ag_std_bench_now();
+      void **arr = malloc(sizeof(void *) * n);
+      void *it = ag_std_list_begin(lst);
+      void *end = ag_std_list_end(lst);
+      size_t m = ag_std_iter_next_batch(it, end, arr, n);
+      qsort(arr, m, sizeof(void *), ag_std_bench_qsort_cmp);
+      ag_std_bench_report("list: copy out + qsort", n, ag_std_bench_now() - t);
+      ag_std_delete(it);
+      ag_std_delete(end);
+      free(arr);
+    }
+
+    double t = ag_std_bench_now();
+    ag_std_list_sort(lst);
+    snprintf(label, sizeof(label), "list: %s sort", names[k]);
+    ag_std_bench_report(label, n, ag_std_bench_now() - t);
+
+    t = ag_std_bench_now();
+    ag_std_list_sort(lst);
+    snprintf(label, sizeof(label), "list: %s sort, sorted", names[k]);
+    ag_std_bench_report(label, n, ag_std_bench_now() - t);
+
+    ag_std_delete(lst);
+  }
+}
+
+/* For the sort test: is out sorted, and are equal elements in the order
+ * they had in orig? An element's place in orig is found by its address.
+ */
+struct ag_std_bench_place {
+  void *obj;
+  size_t i;
+};
+
+int ag_std_bench_place_cmp(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)((const struct ag_std_bench_place *)a)->obj;
+  uintptr_t y = (uintptr_t)((const struct ag_std_bench_place *)b)->obj;
+  return (x > y) - (x < y);
+}
+
+int ag_std_bench_sorted_stably(void **out, void **orig, size_t n) {
+  struct ag_std_bench_place *places = malloc(sizeof(*places) * (n + 1));
+  for (size_t i = 0; i < n; ++i) {
+    places[i].obj = orig[i];
+    places[i].i = i;
+  }
+  qsort(places, n, sizeof(*places), ag_std_bench_place_cmp);
+
+  int ok = 1;
+  size_t last = 0;
+  for (size_t i = 0; i < n && ok; ++i) {
+    struct ag_std_bench_place key = { out[i], 0 };
+    struct ag_std_bench_place *at =
+      bsearch(&key, places, n, sizeof(*places), ag_std_bench_place_cmp);
+    if (at == NULL) {
+      ok = 0;
+    } else if (i > 0) {
+      int res = ag_std_cmp(out[i - 1], out[i]);
+      ok = res < 0 || (res == 0 && last < at->i);
+    }
+    if (at != NULL) {
+      last = at->i;
+    }
+  }
+
+  free(places);
+  return ok;
+}
+
+// Sorting a big vector, every way there is, against qsort through ag_std_cmp.
+void ag_std_bench_sort(void) {
+  const size_t n = 2000000;
+  char label[64];
+
+  void **keys = malloc(sizeof(void *) * n);
+  unsigned x = 1;
+  for (size_t i = 0; i < n; ++i) {
+    x = x * 1103515245u + 12345u;
+    keys[i] = ag_std_int((int)(x >> 1));
+  }
+
+  void *v = ag_std_new(vector);
+  ag_std_vector_append_n(v, keys, n);
+  struct ag_std_vector *vec = v;
+
+  double t = ag_std_bench_now();
+  qsort(vec->arr, n, sizeof(void *), ag_std_bench_qsort_cmp);
+  ag_std_bench_report("sort: qsort, integers", n, ag_std_bench_now() - t);
+
+  memcpy(vec->arr, keys, sizeof(void *) * n);
+  t = ag_std_bench_now();
+  ag_std_sort(v);
+  ag_std_bench_report("sort: radix, integers", n, ag_std_bench_now() - t);
+
+  t = ag_std_bench_now();
+  ag_std_sort(v);
+  ag_std_bench_report("sort: radix, integers, sorted", n, ag_std_bench_now() - t);
+
+  // The same keys as strings, so everything goes through ag_std_cmp.
+  void **strs = malloc(sizeof(void *) * n);
+  for (size_t i = 0; i < n; ++i) {
+    char text[16];
+    snprintf(text, sizeof(text), "%010d", ag_std_int_value(keys[i]));
+    strs[i] = ag_std_new(string, text);
+  }
+
+  memcpy(vec->arr, strs, sizeof(void *) * n);
+  t = ag_std_bench_now();
+  qsort(vec->arr, n, sizeof(void *), ag_std_bench_qsort_cmp);
+  ag_std_bench_report("sort: qsort, strings", n, ag_std_bench_now() - t);
+
+  size_t threads = ag_std_par_threads();
+  size_t counts[2] = { 1, threads > 1 ? threads : 4 };
+  for (size_t k = 0; k < 2; ++k) {
+    ag_std_par_set_threads(counts[k]);
+
+    for (int stable = 0; stable < 2; ++stable) {
+      memcpy(vec->arr, strs, sizeof(void *) * n);
+      t = ag_std_bench_now();
+      stable ? ag_std_stable_sort(v) : ag_std_sort(v);
+      snprintf(label, sizeof(label), "sort: %s, strings, %zu threads",
+          stable ? "stable" : "pdq", counts[k]);
+      ag_std_bench_report(label, n, ag_std_bench_now() - t);
+
+      t = ag_std_bench_now();
+      stable ? ag_std_stable_sort(v) : ag_std_sort(v);
+      snprintf(label, sizeof(label), "sort: %s, strings, %zu threads, sorted",
+          stable ? "stable" : "pdq", counts[k]);
+      ag_std_bench_report(label, n, ag_std_bench_now() - t);
+    }
+  }
+  ag_std_par_set_threads(threads);
+
+  void *tv = ag_std_new(ag_std_int32_vector);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_typed_vector_append_n(tv, &(int32_t){ ag_std_int_value(keys[i]) }, 1);
+  }
+  t = ag_std_bench_now();
+  ag_std_sort(tv);
+  ag_std_bench_report("sort: radix, int32 vector", n, ag_std_bench_now() - t);
+
+  ag_std_delete(tv);
+  ag_std_delete(v);
+  for (size_t i = 0; i < n; ++i) {
+    ag_std_delete(strs[i]);
+  }
+  free(strs);
+  free(keys);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+
+  struct ag_std_vtable vtable_vt = {
     // parent_obj, // ??
     "vtable",
     (struct ag_std_vtable *)object, // vtable of the parent.
     sizeof(struct ag_std_vtable),
-    vtable_ctor,
-    vtable_dtor,
-    vtable_print,
-    vtable_cmp
+    1,
+    { object, &vtable_vt },
+    {
+      [AG_STD_SEL_CTOR] = vtable_ctor,
+      [AG_STD_SEL_DTOR] = vtable_dtor,
+      [AG_STD_SEL_PRINT] = vtable_print,
+      [AG_STD_SEL_CMP] = vtable_cmp,
+      [AG_STD_SEL_HASH] = object_hash
+    }
   };
 
-  const struct ag_std_vtable *vtable = &vtable_vt;
+  const struct ag_std_vtable *vtable = &vtable_vt;
+
+  // Selectors have to exist before the classes that override them.
+  ag_std_size_sel = ag_std_selector(ag_std_size);
+
+  void *container_vtable = ag_std_new(
+      vtable,               // The type of the object.
+      "container_vtable",   // The name of the object.
+      vtable,               // The superclass.
+      sizeof(struct container_vtable),  // The size of the structure...
+      ag_std_new, container_vtable_ctor,
+      0);
+
+  ag_std_list = ag_std_new(
+      container_vtable,     // The type of the object.
+      "list",               // The name of the object.
+      object,               // The superclass.
+      sizeof(struct ag_std_list), // The size of the objects.
+      ag_std_new, ag_std_list_ctor,
+      ag_std_delete, ag_std_list_dtor,
+      ag_std_begin, ag_std_list_begin,
+      ag_std_end, ag_std_list_end,
+      ag_std_begin_into, ag_std_list_begin_into,
+      ag_std_end_into, ag_std_list_end_into,
+      ag_std_iter_size, ag_std_list_iter_size,
+      ag_std_print, ag_std_list_print,
+      ag_std_cmp, ag_std_list_cmp,
+      ag_std_size, ag_std_list_size,
+      0);
+
+  // Everything but the ctor is the same as for list.
+  ag_std_unrolled_list = ag_std_new(
+      container_vtable,
+      "ag_std_unrolled_list",
+      ag_std_list,
+      sizeof(struct ag_std_list),
+      ag_std_new, ag_std_unrolled_list_ctor,
+      0);
+
+  vector = ag_std_new(
+      container_vtable,
+      "vector",
+      object,
+      sizeof(struct ag_std_vector),
+      ag_std_new, ag_std_vector_ctor,
+      ag_std_delete, ag_std_vector_dtor,
+      ag_std_begin, ag_std_vector_begin,
+      ag_std_end, ag_std_vector_end,
+      ag_std_begin_into, ag_std_vector_begin_into,
+      ag_std_end_into, ag_std_vector_end_into,
+      ag_std_iter_size, ag_std_vector_iter_size,
+      ag_std_print, ag_std_vector_print,
+      ag_std_size, ag_std_vector_size,
+      0);
+
+  ag_std_map = ag_std_new(
+      container_vtable,
+      "ag_std_map",
+      object,
+      sizeof(struct ag_std_map),
+      ag_std_new, ag_std_map_ctor,
+      ag_std_delete, ag_std_map_dtor,
+      ag_std_begin, ag_std_map_begin,
+      ag_std_end, ag_std_map_end,
+      ag_std_begin_into, ag_std_map_begin_into,
+      ag_std_end_into, ag_std_map_end_into,
+      ag_std_iter_size, ag_std_map_iter_size,
+      ag_std_print, ag_std_map_print,
+      ag_std_size, ag_std_map_size,
+      0);
+
+  ag_std_cmap = ag_std_new(
+      container_vtable,
+      "ag_std_cmap",
+      object,
+      sizeof(struct ag_std_cmap),
+      ag_std_new, ag_std_cmap_ctor,
+      ag_std_delete, ag_std_cmap_dtor,
+      ag_std_print, ag_std_cmap_print,
+      ag_std_size, ag_std_cmap_size,
+      0);
+
+  ag_std_queue = ag_std_new(
+      container_vtable,
+      "ag_std_queue",
+      object,
+      sizeof(struct ag_std_queue),
+      ag_std_new, ag_std_queue_ctor,
+      ag_std_delete, ag_std_queue_dtor,
+      ag_std_print, ag_std_queue_print,
+      ag_std_size, ag_std_queue_size,
+      0);
+
+  ag_std_btree = ag_std_new(
+      container_vtable,
+      "ag_std_btree",
+      object,
+      sizeof(struct ag_std_btree),
+      ag_std_new, ag_std_btree_ctor,
+      ag_std_delete, ag_std_btree_dtor,
+      ag_std_begin, ag_std_btree_begin,
+      ag_std_end, ag_std_btree_end,
+      ag_std_begin_into, ag_std_btree_begin_into,
+      ag_std_end_into, ag_std_btree_end_into,
+      ag_std_iter_size, ag_std_btree_iter_size,
+      ag_std_print, ag_std_btree_print,
+      ag_std_size, ag_std_btree_size,
+      0);
+
+  ag_std_btree_range = ag_std_new(
+      container_vtable,
+      "ag_std_btree_range",
+      object,
+      sizeof(struct ag_std_btree_range),
+      ag_std_new, ag_std_btree_range_ctor,
+      ag_std_begin, ag_std_btree_range_begin,
+      ag_std_end, ag_std_btree_range_end,
+      ag_std_begin_into, ag_std_btree_range_begin_into,
+      ag_std_end_into, ag_std_btree_range_end_into,
+      ag_std_iter_size, ag_std_btree_iter_size,
+      ag_std_print, ag_std_btree_range_print,
+      0);
+
+  ag_std_iota_view = ag_std_new(
+      container_vtable,
+      "ag_std_iota_view",
+      object,
+      sizeof(struct ag_std_iota_view),
+      ag_std_new, ag_std_iota_view_ctor,
+      ag_std_begin, ag_std_iota_view_begin,
+      ag_std_end, ag_std_iota_view_end,
+      ag_std_begin_into, ag_std_iota_view_begin_into,
+      ag_std_end_into, ag_std_iota_view_end_into,
+      ag_std_iter_size, ag_std_iota_view_iter_size,
+      ag_std_print, ag_std_iota_view_print,
+      ag_std_size, ag_std_iota_view_size,
+      0);
+
+  ag_std_zip_view = ag_std_new(
+      container_vtable,
+      "ag_std_zip_view",
+      object,
+      sizeof(struct ag_std_zip_view),
+      ag_std_new, ag_std_zip_view_ctor,
+      ag_std_begin, ag_std_zip_view_begin,
+      ag_std_end, ag_std_zip_view_end,
+      ag_std_begin_into, ag_std_zip_view_begin_into,
+      ag_std_end_into, ag_std_zip_view_end_into,
+      ag_std_iter_size, ag_std_zip_view_iter_size,
+      ag_std_print, ag_std_zip_view_print,
+      0);
+
+  // Everything but the ctor is the same as for two.
+  ag_std_zip_n_view = ag_std_new(
+      container_vtable,
+      "ag_std_zip_n_view",
+      ag_std_zip_view,
+      sizeof(struct ag_std_zip_view),
+      ag_std_new, ag_std_zip_n_view_ctor,
+      0);
+
+  ag_std_filter_view = ag_std_new(
+      container_vtable,
+      "ag_std_filter_view",
+      object,
+      sizeof(struct ag_std_view),
+      ag_std_new, ag_std_filter_view_ctor,
+      ag_std_begin, ag_std_view_begin,
+      ag_std_end, ag_std_view_end,
+      ag_std_begin_into, ag_std_view_begin_into,
+      ag_std_end_into, ag_std_view_end_into,
+      ag_std_iter_size, ag_std_view_iter_size,
+      ag_std_print, ag_std_view_print,
+      0);
+
+  ag_std_transform_view = ag_std_new(
+      container_vtable,
+      "ag_std_transform_view",
+      object,
+      sizeof(struct ag_std_view),
+      ag_std_new, ag_std_transform_view_ctor,
+      ag_std_begin, ag_std_view_begin,
+      ag_std_end, ag_std_view_end,
+      ag_std_begin_into, ag_std_view_begin_into,
+      ag_std_end_into, ag_std_view_end_into,
+      ag_std_iter_size, ag_std_view_iter_size,
+      ag_std_print, ag_std_view_print,
+      0);
+
+  ag_std_take_view = ag_std_new(
+      container_vtable,
+      "ag_std_take_view",
+      object,
+      sizeof(struct ag_std_view),
+      ag_std_new, ag_std_take_view_ctor,
+      ag_std_begin, ag_std_view_begin,
+      ag_std_end, ag_std_view_end,
+      ag_std_begin_into, ag_std_view_begin_into,
+      ag_std_end_into, ag_std_view_end_into,
+      ag_std_iter_size, ag_std_view_iter_size,
+      ag_std_print, ag_std_view_print,
+      0);
+
+  ag_std_enumerate_view = ag_std_new(
+      container_vtable,
+      "ag_std_enumerate_view",
+      object,
+      sizeof(struct ag_std_view),
+      ag_std_new, ag_std_enumerate_view_ctor,
+      ag_std_begin, ag_std_view_begin,
+      ag_std_end, ag_std_view_end,
+      ag_std_begin_into, ag_std_view_begin_into,
+      ag_std_end_into, ag_std_view_end_into,
+      ag_std_iter_size, ag_std_view_iter_size,
+      ag_std_print, ag_std_view_print,
+      0);
+
+  // A drop hands out the iterators of the range under it.
+  ag_std_drop_view = ag_std_new(
+      container_vtable,
+      "ag_std_drop_view",
+      object,
+      sizeof(struct ag_std_view),
+      ag_std_new, ag_std_drop_view_ctor,
+      ag_std_begin, ag_std_drop_view_begin,
+      ag_std_end, ag_std_drop_view_end,
+      ag_std_begin_into, ag_std_drop_view_begin_into,
+      ag_std_end_into, ag_std_drop_view_end_into,
+      ag_std_iter_size, ag_std_drop_view_iter_size,
+      ag_std_print, ag_std_view_print,
+      0);
+
+  void *iterator_vtable = ag_std_new(
+      vtable,               // The type of the object.
+      "iterator_vtable",   // The name of the object.
+      vtable,               // The superclass.
+      sizeof(struct iterator_vtable),  // The size of the structure...
+      ag_std_new, iterator_vtable_ctor,
+      0);
+
+  // The ag_std_list_iter symbol must exist outside of the main function, because
+  // the ag_std_list_begin and ag_std_list_end functions create iterators.
+  ag_std_list_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_list_iter",
+      object,
+      sizeof(struct ag_std_list_iter),
+      ag_std_new, ag_std_list_iter_ctor,
+      ag_std_iter_increment, ag_std_list_iter_increment,
+      ag_std_iter_deref, ag_std_list_iter_deref,
+      ag_std_iter_not_equal, ag_std_list_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_list_iter_next_batch,
+      0);
+
+  // The vec iter symbol must also exist outside of the main fn,
+  // becuase vec_begin and vec_end functions create iterators.
+  ag_std_vector_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_vector_iter",
+      object,
+      sizeof(struct ag_std_vector_iter),
+      ag_std_new, ag_std_vector_iter_ctor,
+      ag_std_iter_increment, ag_std_vector_iter_increment,
+      ag_std_iter_deref, ag_std_vector_iter_deref,
+      ag_std_iter_not_equal, ag_std_vector_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_vector_iter_next_batch,
+      0);
+
+  // The ag_std_iota_view_iter symbol must also exist outside of the main fn,
+  // becuase vec_begin and vec_end functions create iterators.
+  ag_std_iota_view_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_iota_view_iter",
+      object,
+      sizeof(struct ag_std_iota_view_iter),
+      ag_std_new, ag_std_iota_view_iter_ctor,
+      ag_std_iter_increment, ag_std_iota_view_iter_increment,
+      ag_std_iter_deref, ag_std_iota_view_iter_deref,
+      ag_std_iter_not_equal, ag_std_iota_view_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_iota_view_iter_next_batch,
+      0);
+
+  // The btree iterator symbol must also exist outside of the main fn,
+  // becuase the btree functions create iterators.
+  ag_std_btree_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_btree_iter",
+      object,
+      sizeof(struct ag_std_btree_iter),
+      ag_std_new, ag_std_btree_iter_ctor,
+      ag_std_iter_increment, ag_std_btree_iter_increment,
+      ag_std_iter_deref, ag_std_btree_iter_deref,
+      ag_std_iter_not_equal, ag_std_btree_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_btree_iter_next_batch,
+      0);
+
+  // The map keeps its pairs in an array just like the vector, so its
+  // iterator walks the array the same way.
+  ag_std_map_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_map_iter",
+      object,
+      sizeof(struct ag_std_vector_iter),
+      ag_std_new, ag_std_vector_iter_ctor,
+      ag_std_iter_increment, ag_std_vector_iter_increment,
+      ag_std_iter_deref, ag_std_vector_iter_deref,
+      ag_std_iter_not_equal, ag_std_vector_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_vector_iter_next_batch,
+      0);
+
+  // The ag_std_zip_view_iter symbol must also exist outside of the main fn,
+  // becuase zip_begin and zip_end functions create iterators.
+  ag_std_zip_view_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_zip_view_iter",
+      object,
+      sizeof(struct ag_std_zip_view_iter),
+      ag_std_new, ag_std_zip_view_iter_ctor,
+      ag_std_delete, ag_std_zip_view_iter_dtor,
+      ag_std_iter_increment, ag_std_zip_view_iter_increment,
+      ag_std_iter_deref, ag_std_zip_view_iter_deref,
+      ag_std_iter_not_equal, ag_std_zip_view_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_zip_view_iter_next_batch,
+      0);
+
+  // The view iterators share a struct, a ctor and a dtor.
+  ag_std_filter_view_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_filter_view_iter",
+      object,
+      sizeof(struct ag_std_view_iter),
+      ag_std_new, ag_std_view_iter_ctor,
+      ag_std_delete, ag_std_view_iter_dtor,
+      ag_std_iter_increment, ag_std_filter_view_iter_increment,
+      ag_std_iter_deref, ag_std_view_iter_deref,
+      ag_std_iter_not_equal, ag_std_view_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_filter_view_iter_next_batch,
+      0);
+
+  ag_std_transform_view_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_transform_view_iter",
+      object,
+      sizeof(struct ag_std_view_iter),
+      ag_std_new, ag_std_view_iter_ctor,
+      ag_std_delete, ag_std_view_iter_dtor,
+      ag_std_iter_increment, ag_std_view_iter_increment,
+      ag_std_iter_deref, ag_std_transform_view_iter_deref,
+      ag_std_iter_not_equal, ag_std_view_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_transform_view_iter_next_batch,
+      0);
+
+  ag_std_take_view_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_take_view_iter",
+      object,
+      sizeof(struct ag_std_view_iter),
+      ag_std_new, ag_std_view_iter_ctor,
+      ag_std_delete, ag_std_view_iter_dtor,
+      ag_std_iter_increment, ag_std_view_iter_increment,
+      ag_std_iter_deref, ag_std_view_iter_deref,
+      ag_std_iter_not_equal, ag_std_take_view_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_take_view_iter_next_batch,
+      0);
+
+  ag_std_enumerate_view_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_enumerate_view_iter",
+      object,
+      sizeof(struct ag_std_view_iter),
+      ag_std_new, ag_std_view_iter_ctor,
+      ag_std_delete, ag_std_view_iter_dtor,
+      ag_std_iter_increment, ag_std_view_iter_increment,
+      ag_std_iter_deref, ag_std_enumerate_view_iter_deref,
+      ag_std_iter_not_equal, ag_std_view_iter_not_equal,
+      ag_std_iter_next_batch, ag_std_enumerate_view_iter_next_batch,
+      0);
+
+  // This pointer must be declared outside so that zip can use it.
+  ag_std_pair = ag_std_new(
+      vtable,
+      "pair",
+      object,
+      sizeof(struct ag_std_pair),
+      ag_std_new, ag_std_pair_ctor,
+      ag_std_delete, ag_std_pair_dtor,
+      ag_std_print, ag_std_pair_print,
+      ag_std_cmp, ag_std_pair_cmp,
+      ag_std_hash, ag_std_pair_hash,
+      0);
+
+  // Zips of more than two make these.
+  ag_std_tuple = ag_std_new(
+      vtable,
+      "tuple",
+      object,
+      sizeof(struct ag_std_tuple),
+      ag_std_new, ag_std_tuple_ctor,
+      ag_std_delete, ag_std_tuple_dtor,
+      ag_std_print, ag_std_tuple_print,
+      ag_std_cmp, ag_std_tuple_cmp,
+      ag_std_hash, ag_std_tuple_hash,
+      0);
+
+  // This is not created in the main function, since some functions
+  // return an integer object.
+  number = ag_std_new(
+      vtable,
+      "number",
+      object,
+      sizeof(struct object),
+      0);
+
+  integer = ag_std_new(
+      vtable,     // The type of object we are creating.
+      "integer",  // The name of the object. (integer type)
+      number,     // The superclass.
+      sizeof(struct integer),       // The size of the integer structure.
+      ag_std_print, integer_print,  // The method of obj that we override.
+      ag_std_new, integer_ctor,
+      ag_std_delete, integer_dtor,
+      ag_std_cmp, integer_cmp,
+      ag_std_hash, integer_hash,
+      0);
+
+  floating = ag_std_new(
+      vtable,     // The type of the object we're creating.
+      "floating", // The name of the object. (floating type)
+      number,     // The superclass.
+      sizeof(struct floating),      // The size of the floating struct
+      ag_std_print, floating_print,
+      ag_std_delete, floating_dtor,
+      ag_std_new, floating_ctor,
+      ag_std_cmp, floating_cmp,
+      ag_std_hash, floating_hash,
+      0);
+
+  string = ag_std_new(
+      vtable,
+      "string",
+      object,
+      sizeof(struct string),
+      ag_std_print, string_print,
+      ag_std_delete, string_dtor,
+      ag_std_new, string_ctor,
+      ag_std_cmp, string_cmp,
+      ag_std_hash, string_hash,
+      0);
+
+  integer64 = ag_std_new(
+      vtable,
+      "integer64",
+      number,
+      sizeof(struct integer64),
+      ag_std_new, integer64_ctor,
+      ag_std_print, integer64_print,
+      ag_std_cmp, integer64_cmp,
+      ag_std_hash, integer64_hash,
+      0);
+
+  floating64 = ag_std_new(
+      vtable,
+      "floating64",
+      number,
+      sizeof(struct floating64),
+      ag_std_new, floating64_ctor,
+      ag_std_print, floating64_print,
+      ag_std_cmp, floating64_cmp,
+      ag_std_hash, floating64_hash,
+      0);
+
+  ag_std_typed_vector_iter = ag_std_new(
+      iterator_vtable,
+      "ag_std_typed_vector_iter",
+      object,
+      sizeof(struct ag_std_typed_vector_iter),
+      ag_std_new, ag_std_typed_vector_iter_ctor,
+      ag_std_iter_increment, ag_std_typed_vector_iter_increment,
+      ag_std_iter_deref, ag_std_typed_vector_iter_deref,
+      ag_std_iter_not_equal, ag_std_typed_vector_iter_not_equal,
+      0);
+
+  // The four typed vectors share everything except their ctor.
+  ag_std_int32_vector = ag_std_new(
+      container_vtable,
+      "ag_std_int32_vector",
+      object,
+      sizeof(struct ag_std_typed_vector),
+      ag_std_new, ag_std_int32_vector_ctor,
+      ag_std_delete, ag_std_typed_vector_dtor,
+      ag_std_begin, ag_std_typed_vector_begin,
+      ag_std_end, ag_std_typed_vector_end,
+      ag_std_begin_into, ag_std_typed_vector_begin_into,
+      ag_std_end_into, ag_std_typed_vector_end_into,
+      ag_std_iter_size, ag_std_typed_vector_iter_size,
+      ag_std_print, ag_std_typed_vector_print,
+      ag_std_size, ag_std_typed_vector_size,
+      0);
+
+  ag_std_int64_vector = ag_std_new(
+      container_vtable,
+      "ag_std_int64_vector",
+      object,
+      sizeof(struct ag_std_typed_vector),
+      ag_std_new, ag_std_int64_vector_ctor,
+      ag_std_delete, ag_std_typed_vector_dtor,
+      ag_std_begin, ag_std_typed_vector_begin,
+      ag_std_end, ag_std_typed_vector_end,
+      ag_std_begin_into, ag_std_typed_vector_begin_into,
+      ag_std_end_into, ag_std_typed_vector_end_into,
+      ag_std_iter_size, ag_std_typed_vector_iter_size,
+      ag_std_print, ag_std_typed_vector_print,
+      ag_std_size, ag_std_typed_vector_size,
+      0);
+
+  ag_std_float_vector = ag_std_new(
+      container_vtable,
+      "ag_std_float_vector",
+      object,
+      sizeof(struct ag_std_typed_vector),
+      ag_std_new, ag_std_float_vector_ctor,
+      ag_std_delete, ag_std_typed_vector_dtor,
+      ag_std_begin, ag_std_typed_vector_begin,
+      ag_std_end, ag_std_typed_vector_end,
+      ag_std_begin_into, ag_std_typed_vector_begin_into,
+      ag_std_end_into, ag_std_typed_vector_end_into,
+      ag_std_iter_size, ag_std_typed_vector_iter_size,
+      ag_std_print, ag_std_typed_vector_print,
+      ag_std_size, ag_std_typed_vector_size,
+      0);
+
+  ag_std_double_vector = ag_std_new(
+      container_vtable,
+      "ag_std_double_vector",
+      object,
+      sizeof(struct ag_std_typed_vector),
+      ag_std_new, ag_std_double_vector_ctor,
+      ag_std_delete, ag_std_typed_vector_dtor,
+      ag_std_begin, ag_std_typed_vector_begin,
+      ag_std_end, ag_std_typed_vector_end,
+      ag_std_begin_into, ag_std_typed_vector_begin_into,
+      ag_std_end_into, ag_std_typed_vector_end_into,
+      ag_std_iter_size, ag_std_typed_vector_iter_size,
+      ag_std_print, ag_std_typed_vector_print,
+      ag_std_size, ag_std_typed_vector_size,
+      0);
+
+  if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+    ag_std_bench_pool();
+    ag_std_bench_pool_threads();
+    ag_std_bench_arena();
+    ag_std_bench_iter();
+    ag_std_bench_vector();
+    ag_std_bench_map();
+    ag_std_bench_btree();
+    ag_std_bench_intern();
+    ag_std_bench_typed_vector();
+    ag_std_bench_simd();
+    ag_std_bench_batch();
+    ag_std_bench_dispatch();
+    ag_std_bench_is_a();
+    ag_std_bench_immediate();
+    ag_std_bench_zip();
+    ag_std_bench_view();
+    ag_std_bench_par();
+    ag_std_bench_sched();
+    ag_std_bench_refcount();
+    ag_std_bench_cmap();
+    ag_std_bench_queue();
+    ag_std_bench_list();
+    ag_std_bench_list_sort();
+    ag_std_bench_sort();
+    return 0;
+  }
+
+  void *lst = ag_std_new(ag_std_list);
+
+  ag_std_print(lst);
+  printf("\n");
+  assert(ag_std_class_of(lst) == ag_std_list);
+
+  void *v = ag_std_new(vector);
+  ag_std_print(v);
+  printf("\n");
+  assert(ag_std_class_of(v) == vector);
+
+  void *s1 = ag_std_new(string, "Dumbledore");
+
+  void *i = ag_std_new(integer, 4);
+  void *i2 = ag_std_new(integer, 7);
+  void *i3 = ag_std_new(integer, 1);
+  void *i4 = ag_std_new(integer, -3);
+
+  void *p1 = ag_std_new(ag_std_pair, i2, i3);
+  printf("Printing the pair: ");
+  ag_std_print(p1);
+  printf("\n");
+  {
+    void *first = ag_std_pair_first(p1);
+    void *second = ag_std_pair_second(p1);
+    ag_std_print(first);
+    printf("\n");
+    ag_std_print(second);
+    printf("\n");
+  }
+
+  ag_std_list_push_back(lst, i);
+  ag_std_list_push_back(lst, i2);
+  ag_std_list_push_back(lst, s1);
+  ag_std_list_push_back(lst, i3);
+  ag_std_list_push_back(lst, i4);
+  ag_std_list_push_back(lst, ag_std_new(floating, 5.3));
+
+  {
+    printf("Printing this with a ag_std_list iterator: ");
+    printf("{ ");
+    void *it = ag_std_list_begin(lst);
+    void *lst_end = ag_std_list_end(lst);
+    (void)lst_end;
+
+    while (ag_std_iter_not_equal(it, lst_end)) {
+      ag_std_print(ag_std_iter_deref(it));
+      printf(" ");
+      ag_std_iter_increment(it);
+    }
+
+    printf("}\n");
+
+    ag_std_range_print(lst);
+  }
+
+  ag_std_print(lst);
+  printf("\n");
+
+  ag_std_print(i);
+  printf("\n");
+  {
+    void *ai = ag_std_new(integer, 10);
+    void *as = ag_std_new(string, "ten");
+
+    void *bi = ag_std_new(integer, 20);
+    void *bs = ag_std_new(string, "twenty");
+
+    void *ci = ag_std_new(integer, 30);
+    void *cs = ag_std_new(string, "thirty");
+
+    void *lst_a = ag_std_new(ag_std_list);
+    ag_std_list_push_back(lst_a, ai);
+    ag_std_list_push_back(lst_a, as);
+
+    void *lst_b = ag_std_new(ag_std_list);
+    ag_std_list_push_back(lst_b, bi);
+    ag_std_list_push_back(lst_b, bs);
+
+    void *lst_c = ag_std_new(ag_std_list);
+    ag_std_list_push_back(lst_c, ci);
+    ag_std_list_push_back(lst_c, cs);
+
+    void *lst_final = ag_std_new(ag_std_list);
+    ag_std_list_push_back(lst_final, lst_a);
+
+    ag_std_print(lst_final);
+    printf("\n");
+
+    ag_std_list_push_back(lst_final, lst_b);
+    ag_std_list_push_back(lst_final, lst_c);
+
+    ag_std_print(lst_final);
+    printf("\n");
+  }
+
+  {
+    void *ai = ag_std_new(integer, 10);
+    void *bi = ag_std_new(integer, 20);
+    void *ci = ag_std_new(integer, 30);
+
+    void *v = ag_std_new(vector);
+    ag_std_print(v);
+    printf("\n");
+
+    ag_std_vector_push_back(v, ai);
+    ag_std_vector_push_back(v, bi);
+    ag_std_vector_push_back(v, ci);
+    ag_std_vector_push_back(v, ci);
+    ag_std_vector_pop_back(v);
+
+    ag_std_print(v);
+    printf("\n");
+
+    {
+      printf("Printing this with a vec iterator: ");
+      printf("{ ");
+      void *it = ag_std_vector_begin(v);
+      void *vec_end = ag_std_vector_end(v);
+
+      while (ag_std_iter_not_equal(it, vec_end)) {
+        ag_std_print(ag_std_iter_deref(it));
+        printf(" ");
+        ag_std_iter_increment(it);
+      }
+
+      printf("}\n");
+
+      ag_std_range_print(v);
+
+      // An integer is in the same size class as the iterators, so make it
+      // first.
+      void *z = ag_std_new(integer, 0);
+
+      // The iterators live on the stack, nothing comes out of the pool.
+      size_t live = ag_std_pool_live(sizeof(struct ag_std_vector_iter));
+
+      int found = ag_std_range_find(v, bi);
+      assert(found == 1);
+
+      found = ag_std_range_find(v, z);
+      assert(found == 0);
+
+      assert(ag_std_pool_live(sizeof(struct ag_std_vector_iter)) == live);
+    }
+  }
+
+  void *class_of_i = ag_std_class_of(i);
+  assert(class_of_i == integer);
+
+  {
+    printf("Iota view test: ");
+    void *v_10 = ag_std_new(ag_std_iota_view, 10);
+
+    void *it = ag_std_begin(v_10);
+    void *end = ag_std_end(v_10);
+
+    while (ag_std_iter_not_equal(it, end)) {
+      void *x = ag_std_iter_deref(it);
+      ag_std_print(x);
+      printf(" ");
+      ag_std_iter_increment(it);
+    }
+
+    printf("\n");
+  }
+
+  {
+    printf("Zip view test: ");
+
+    void *v = ag_std_new(vector);
+
+    ag_std_vector_push_back(v, ag_std_new(string, "Harry"));
+    ag_std_vector_push_back(v, ag_std_new(string, "Ron"));
+    ag_std_vector_push_back(v, ag_std_new(string, "Hermione"));
+
+    void *iv = ag_std_new(ag_std_iota_view, 2);
+
+    void *zv = ag_std_new(ag_std_zip_view, v, iv);
+
+    void *it = ag_std_begin(zv);
+    void *end = ag_std_end(zv);
+
+    while (ag_std_iter_not_equal(it, end)) {
+      // The pair.
+      void *p = ag_std_iter_deref(it);
+      ag_std_print(p);
+      printf(" ");
+      ag_std_iter_increment(it);
+    }
+
+    printf("\n");
+  }
+
+  {
+    printf("Zip view test v2: ");
+
+    void *v = ag_std_new(vector);
+
+    ag_std_vector_push_back(v, ag_std_new(string, "Harry"));
+    ag_std_vector_push_back(v, ag_std_new(string, "Ron"));
+    ag_std_vector_push_back(v, ag_std_new(string, "Hermione"));
+
+    void *iv = ag_std_new(ag_std_iota_view, 2);
+
+    void *zv = ag_std_new(ag_std_zip_view, v, iv);
+
+    // void *it = ag_std_begin(zv);
+    void *end = ag_std_end(zv);
+
+    for (
+        void *it = ag_std_begin(zv);
+        ag_std_iter_not_equal(it, end);
+        ag_std_iter_increment(it))
+    {
+      // The pair.
+      void *p = ag_std_iter_deref(it);
+      ag_std_print(p);
+      printf(" ");
+    }
+
+    printf("\n");
+  }
+
+  {
+    printf("Zip view test v3: ");
+
+    void *v = ag_std_new(vector);
+
+    ag_std_vector_push_back(v, ag_std_new(string, "Harry"));
+    ag_std_vector_push_back(v, ag_std_new(string, "Ron"));
+    ag_std_vector_push_back(v, ag_std_new(string, "Hermione"));
+
+    void *iv = ag_std_new(ag_std_iota_view, 2);
+
+    void *zv = ag_std_new(ag_std_zip_view, v, iv);
+
+    ag_std_range_print(zv);
+  }
+
+  {
+    printf("Map test.. (using asserts)\n");
+
+    void *m = ag_std_new(ag_std_map);
+
+    void *k1 = ag_std_new(integer, 3);
+    void *v1 = ag_std_new(string, "three");
+    void *p1 = ag_std_new(ag_std_pair, k1, v1);
+
+    ag_std_map_insert(m, p1);
+
+    void *k2 = ag_std_new(integer, 4);
+    void *v2 = ag_std_new(string, "four");
+    void *p2 = ag_std_new(ag_std_pair, k2, v2);
+
+    ag_std_map_insert(m, p2);
+
+    // This key will not be in the map.
+    void *k3 = ag_std_new(integer, 5);
+
+    // Now check the find.
+    void *find_01 = ag_std_map_at(m, k1);
+    assert(find_01 == v1);
+
+    void *find_02 = ag_std_map_at(m, k2);
+    assert(find_02 == v2);
+
+    void *find_03 = ag_std_map_at(m, k3);
+    assert(find_03 == NULL);
+
+    assert(ag_std_range_find(m, p2) == 1);
+    ag_std_range_print(m);
+
+    // A key that is already there doesn't replace the value.
+    ag_std_map_insert(m, ag_std_new(ag_std_pair, ag_std_new(integer, 3), v2));
+    assert(ag_std_map_at(m, k1) == v1);
+    assert(((struct ag_std_map *)m)->size == 2);
+
+    // Enough keys to grow past the first group a few times.
+    void *keys[10000];
+    for (int i = 0; i < 10000; ++i) {
+      keys[i] = ag_std_new(integer, i * 7 + 100);
+      ag_std_map_insert(m, ag_std_new(ag_std_pair, keys[i], keys[i]));
+    }
+
+    for (int i = 0; i < 10000; ++i) {
+      void *k = ag_std_new(integer, i * 7 + 100);
+      assert(ag_std_map_at(m, k) == keys[i]);
+      ag_std_delete(k);
+    }
 
-  void *container_vtable = ag_std_new(
-      vtable,               // The type of the object.
-      "container_vtable",   // The name of the object.
-      vtable,               // The superclass.
-      sizeof(struct container_vtable),  // The size of the structure...
-      ag_std_new, container_vtable_ctor,
-      0);
+    // Equal values of other classes find their own entries.
+    void *sk = ag_std_new(string, "three");
+    void *fk = ag_std_new(floating, 3.0);
+    void *pk = ag_std_new(ag_std_pair, k1, v1);
+    assert(ag_std_map_at(m, sk) == NULL);
+    ag_std_map_insert(m, ag_std_new(ag_std_pair, sk, v1));
+    ag_std_map_insert(m, ag_std_new(ag_std_pair, fk, v2));
+    ag_std_map_insert(m, ag_std_new(ag_std_pair, pk, k3));
+    assert(ag_std_map_at(m, ag_std_new(string, "three")) == v1);
+    assert(ag_std_map_at(m, ag_std_new(floating, 3.0)) == v2);
+    assert(ag_std_map_at(m, ag_std_new(ag_std_pair, k1, v1)) == k3);
+    assert(ag_std_map_at(m, k1) == v1);
+
+    ag_std_delete(m);
+  }
 
-  void *ag_std_list = ag_std_new(
-      container_vtable,     // The type of the object.
-      "list",               // The name of the object.
-      object,               // The superclass.
-      sizeof(struct ag_std_list), // The size of the objects.
-      ag_std_new, ag_std_list_ctor,
-      ag_std_begin, ag_std_list_begin,
-      ag_std_end, ag_std_list_end,
-      ag_std_print, ag_std_list_print,
-      ag_std_cmp, ag_std_list_cmp,
-      0);
+  {
+    printf("Btree test.. (using asserts)\n");
 
-  void *vector = ag_std_new(
-      container_vtable,
-      "vector",
-      object,
-      sizeof(struct ag_std_vector),
-      ag_std_new, ag_std_vector_ctor,
-      ag_std_begin, ag_std_vector_begin,
-      ag_std_end, ag_std_vector_end,
-      ag_std_print, ag_std_vector_print,
-      0);
+    void *t = ag_std_new(ag_std_btree);
+    struct ag_std_btree *bt = t;
 
-  void *ag_std_map = ag_std_new(
-      container_vtable,
-      "ag_std_map",
-      object,
-      sizeof(struct ag_std_map),
-      ag_std_new, ag_std_map_ctor,
-      ag_std_begin, ag_std_map_begin,
-      ag_std_end, ag_std_map_end,
-      ag_std_print, ag_std_map_print,
-      0);
+    // 5000 keys in a scrambled order (7919 is prime, so this hits them all).
+    void *keys[5000];
+    for (int i = 0; i < 5000; ++i) {
+      keys[i] = ag_std_new(integer, i * 2);
+    }
+    for (int i = 0; i < 5000; ++i) {
+      int j = (i * 7919) % 5000;
+      assert(ag_std_btree_insert(t, ag_std_new(ag_std_pair, keys[j], keys[j])) == 0);
+    }
 
-  void *ag_std_iota_view = ag_std_new(
-      container_vtable,
-      "ag_std_iota_view",
-      object,
-      sizeof(struct ag_std_iota_view),
-      ag_std_new, ag_std_iota_view_ctor,
-      ag_std_begin, ag_std_iota_view_begin,
-      ag_std_end, ag_std_iota_view_end,
-      ag_std_print, ag_std_iota_view_print,
-      0);
+    // Again, and nothing changes.
+    assert(ag_std_btree_insert(t, ag_std_new(ag_std_pair, keys[10], keys[11])) == 0);
+    assert(bt->size == 5000);
+    assert(bt->height > 0);
 
-  void *ag_std_zip_view = ag_std_new(
-      container_vtable,
-      "ag_std_zip_view",
-      object,
-      sizeof(struct ag_std_zip_view),
-      ag_std_new, ag_std_zip_view_ctor,
-      ag_std_begin, ag_std_zip_view_begin,
-      ag_std_end, ag_std_zip_view_end,
-      ag_std_print, ag_std_zip_view_print,
-      0);
+    // The walk comes out sorted.
+    int n = 0;
+    void *it = ag_std_begin(t);
+    void *end = ag_std_end(t);
+    while (ag_std_iter_not_equal(it, end)) {
+      assert(ag_std_pair_first(ag_std_iter_deref(it)) == keys[n]);
+      n++;
+      ag_std_iter_increment(it);
+    }
+    assert(n == 5000);
+    ag_std_delete(it);
+    ag_std_delete(end);
+
+    void *odd = ag_std_new(integer, 101);
+    assert(ag_std_btree_at(t, keys[50]) == keys[50]);
+    assert(ag_std_btree_at(t, odd) == NULL);
+
+    // Bounds on a key that isn't there, and one that is.
+    union ag_std_iter_slot buf[AG_STD_ITER_SLOTS(t)];
+    it = ag_std_btree_lower_bound_into(t, odd, buf);
+    assert(ag_std_pair_first(ag_std_iter_deref(it)) == keys[51]);
+    it = ag_std_btree_upper_bound_into(t, keys[51], buf);
+    assert(ag_std_pair_first(ag_std_iter_deref(it)) == keys[52]);
+
+    // Everything from 101 to 300 is 51 .. 150.
+    void *hi = ag_std_new(integer, 300);
+    void *rng = ag_std_new(ag_std_btree_range, t, odd, hi);
+    void *lo_key = ag_std_new(integer, 9990);
+    void *tail = ag_std_new(ag_std_btree_range, t, lo_key, NULL);
+
+    n = 0;
+    union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(rng)];
+    end = ag_std_end_into(rng, end_buf);
+    for (it = ag_std_begin_into(rng, buf);
+        ag_std_iter_not_equal(it, end);
+        ag_std_iter_increment(it))
+    {
+      assert(ag_std_pair_first(ag_std_iter_deref(it)) == keys[51 + n]);
+      n++;
+    }
+    assert(n == 100);
+
+    ag_std_range_print(tail);
+
+    // lo > hi is an empty range, whichever way it is walked.
+    void *inverted = ag_std_new(ag_std_btree_range, t, hi, odd);
+    void *batch[8];
+    it = ag_std_begin_into(inverted, buf);
+    end = ag_std_end_into(inverted, end_buf);
+    assert(!ag_std_iter_not_equal(it, end));
+    assert(ag_std_iter_next_batch(it, end, batch, 8) == 0);
+    it = ag_std_begin(inverted);
+    end = ag_std_end(inverted);
+    assert(!ag_std_iter_not_equal(it, end));
+    ag_std_delete(it);
+    ag_std_delete(end);
+    ag_std_range_print(inverted);
+
+    // So is any range of an empty tree.
+    void *empty = ag_std_new(ag_std_btree);
+    void *none = ag_std_new(ag_std_btree_range, empty, odd, hi);
+    it = ag_std_begin_into(none, buf);
+    end = ag_std_end_into(none, end_buf);
+    assert(!ag_std_iter_not_equal(it, end));
+    assert(ag_std_iter_next_batch(it, end, batch, 8) == 0);
+    ag_std_range_print(none);
+
+    ag_std_delete(inverted);
+    ag_std_delete(none);
+    ag_std_delete(empty);
+    ag_std_delete(t);
+  }
 
-  void *iterator_vtable = ag_std_new(
-      vtable,               // The type of the object.
-      "iterator_vtable",   // The name of the object.
-      vtable,               // The superclass.
-      sizeof(struct iterator_vtable),  // The size of the structure...
-      ag_std_new, iterator_vtable_ctor,
-      0);
+  {
+    printf("String test.. (using asserts)\n");
+
+    void *a = ag_std_new(string, "Harry");
+    void *b = ag_std_new(string, "Harry Potter and the Philosopher's Stone");
+    void *c = ag_std_new(string, "Harry");
+    void *d = ag_std_new(string, "Harry Potter and the Chamber of Secrets");
+
+    assert(ag_std_string_len(a) == 5);
+    assert(ag_std_string_len(b) == 40);
+    assert(strcmp(ag_std_string_cstr(b), "Harry Potter and the Philosopher's Stone") == 0);
+
+    // Short ones stay in the object, long ones don't.
+    assert(ag_std_string_cstr(a) == ((struct string *)a)->data.buf);
+    assert(ag_std_string_cstr(b) != ((struct string *)b)->data.buf);
+
+    assert(ag_std_cmp(a, c) == 0);
+    assert(ag_std_hash(a) == ag_std_hash(c));
+    assert(ag_std_cmp(a, b) < 0);
+    assert(ag_std_cmp(b, a) > 0);
+    assert(ag_std_cmp(d, b) < 0);
+
+    ag_std_delete(a);
+    ag_std_delete(b);
+    ag_std_delete(c);
+    ag_std_delete(d);
+  }
 
-  // The ag_std_list_iter symbol must exist outside of the main function, because
-  // the ag_std_list_begin and ag_std_list_end functions create iterators.
-  ag_std_list_iter = ag_std_new(
-      iterator_vtable,
-      "ag_std_list_iter",
-      object,
-      sizeof(struct ag_std_list_iter),
-      ag_std_new, ag_std_list_iter_ctor,
-      ag_std_iter_increment, ag_std_list_iter_increment,
-      ag_std_iter_deref, ag_std_list_iter_deref,
-      ag_std_iter_not_equal, ag_std_list_iter_not_equal,
-      0);
+  {
+    printf("Intern test.. (using asserts)\n");
+
+    struct ag_std_intern_stats before;
+    ag_std_intern_stats(&before);
+
+    void *a = ag_std_intern("Gryffindor");
+    void *b = ag_std_intern("Gryffindor");
+    void *c = ag_std_intern("Slytherin");
+
+    // One object per content, and it's a plain string.
+    assert(a == b);
+    assert(a != c);
+    assert(ag_std_class_of(a) == string);
+    assert(ag_std_cmp(a, b) == 0);
+
+    void *s = ag_std_new(string, "Gryffindor");
+    assert(ag_std_cmp(a, s) == 0);
+    assert(ag_std_hash(a) == ag_std_hash(s));
+    ag_std_delete(s);
+
+    // Interned strings outlive arena scopes.
+    ag_std_arena_begin();
+    void *d = ag_std_intern("Hufflepuff, a house with a rather long name");
+    ag_std_arena_end(1);
+    assert(ag_std_intern("Hufflepuff, a house with a rather long name") == d);
+
+    struct ag_std_intern_stats after;
+    ag_std_intern_stats(&after);
+    assert(after.lookups == before.lookups + 5);
+    assert(after.hits == before.hits + 2);
+    assert(after.strings == before.strings + 3);
+  }
 
-  // The vec iter symbol must also exist outside of the main fn,
-  // becuase vec_begin and vec_end functions create iterators.
-  ag_std_vector_iter = ag_std_new(
-      iterator_vtable,
-      "ag_std_vector_iter",
-      object,
-      sizeof(struct ag_std_vector_iter),
-      ag_std_new, ag_std_vector_iter_ctor,
-      ag_std_iter_increment, ag_std_vector_iter_increment,
-      ag_std_iter_deref, ag_std_vector_iter_deref,
-      ag_std_iter_not_equal, ag_std_vector_iter_not_equal,
-      0);
+  {
+    printf("Typed vector test.. (using asserts)\n");
 
-  // The ag_std_iota_view_iter symbol must also exist outside of the main fn,
-  // becuase vec_begin and vec_end functions create iterators.
-  ag_std_iota_view_iter = ag_std_new(
-      iterator_vtable,
-      "ag_std_iota_view_iter",
-      object,
-      sizeof(struct ag_std_iota_view_iter),
-      ag_std_new, ag_std_iota_view_iter_ctor,
-      ag_std_iter_increment, ag_std_iota_view_iter_increment,
-      ag_std_iter_deref, ag_std_iota_view_iter_deref,
-      ag_std_iter_not_equal, ag_std_iota_view_iter_not_equal,
-      0);
+    // No kernel has run yet: a level forced now must stick.
+    assert(ag_std_simd_use(AG_STD_SIMD_SCALAR) == AG_STD_SIMD_SCALAR);
+    assert(ag_std_simd_get(AG_STD_INT32)->find == ag_std_scalar_find_i32);
+    assert(ag_std_simd_current == AG_STD_SIMD_SCALAR);
+    ag_std_simd_use(ag_std_simd_supported());
 
-  // The ag_std_zip_view_iter symbol must also exist outside of the main fn,
-  // becuase zip_begin and zip_end functions create iterators.
-  ag_std_zip_view_iter = ag_std_new(
-      iterator_vtable,
-      "ag_std_zip_view_iter",
-      object,
-      sizeof(struct ag_std_zip_view_iter),
-      ag_std_new, ag_std_zip_view_iter_ctor,
-      ag_std_iter_increment, ag_std_zip_view_iter_increment,
-      ag_std_iter_deref, ag_std_zip_view_iter_deref,
-      ag_std_iter_not_equal, ag_std_zip_view_iter_not_equal,
-      0);
+    void *iv = ag_std_new(ag_std_int32_vector);
+    for (int i = 0; i < 100; ++i) {
+      ag_std_int32_vector_push_back(iv, i * i);
+    }
 
-  // This pointer must be declared outside so that zip can use it.
-  ag_std_pair = ag_std_new(
-      vtable,
-      "pair",
-      object,
-      sizeof(struct ag_std_pair),
-      ag_std_new, ag_std_pair_ctor,
-      ag_std_delete, ag_std_pair_dtor,
-      ag_std_print, ag_std_pair_print,
-      ag_std_cmp, ag_std_pair_cmp,
-      0);
+    assert(ag_std_typed_vector_size(iv) == 100);
+    int32_t *span = ag_std_typed_vector_data(iv);
+    assert(span[9] == 81);
 
-  // This is not created in the main function, since some functions
-  // return an integer object.
-  integer = ag_std_new(
-      vtable,     // The type of object we are creating.
-      "integer",  // The name of the object. (integer type)
-      object,     // The superclass.
-      sizeof(struct integer),       // The size of the integer structure.
-      ag_std_print, integer_print,  // The method of obj that we override.
-      ag_std_new, integer_ctor,
-      ag_std_delete, integer_dtor,
-      ag_std_cmp, integer_cmp,
-      0);
+    // The range algorithms see integer objects.
+    void *x = ag_std_new(integer, 81);
+    assert(ag_std_range_find(iv, x) == 1);
+    ((struct integer *)x)->x = 82;
+    assert(ag_std_range_find(iv, x) == 0);
 
-  void *floating = ag_std_new(
-      vtable,     // The type of the object we're creating.
-      "floating", // The name of the object. (floating type)
-      object,     // The superclass.
-      sizeof(struct floating),      // The size of the floating struct
-      ag_std_print, floating_print,
-      ag_std_delete, floating_dtor,
-      ag_std_new, floating_ctor,
-      ag_std_cmp, floating_cmp,
-      0);
+    void *dv = ag_std_new(ag_std_double_vector);
+    double vals[] = { 0.5, 1.5, 2.5 };
+    ag_std_typed_vector_append_n(dv, vals, 3);
+    ag_std_double_vector_push_back(dv, 1e10);
+    ag_std_range_print(dv);
 
-  void *string = ag_std_new(
-      vtable,
-      "string",
-      object,
-      sizeof(struct string),
-      ag_std_print, string_print,
-      ag_std_delete, string_dtor,
-      ag_std_new, string_ctor,
-      ag_std_cmp, string_cmp,
-      0);
+    void *d = ag_std_new(floating64, 1e10);
+    assert(ag_std_range_find(dv, d) == 1);
 
-  void *lst = ag_std_new(ag_std_list);
+    void *lv = ag_std_new(ag_std_int64_vector);
+    ag_std_int64_vector_push_back(lv, INT64_C(1) << 40);
+    assert(ag_std_range_find(lv, ag_std_new(integer64, INT64_C(1) << 40)) == 1);
 
-  ag_std_print(lst);
-  printf("\n");
-  assert(ag_std_class_of(lst) == ag_std_list);
+    void *fv = ag_std_new(ag_std_float_vector);
+    ag_std_float_vector_push_back(fv, 2.5f);
+    ag_std_print(fv);
+    printf("\n");
 
-  void *v = ag_std_new(vector);
-  ag_std_print(v);
-  printf("\n");
-  assert(ag_std_class_of(v) == vector);
+    // A vector made from a typed one holds the values, not the box.
+    void *small = ag_std_new(ag_std_int32_vector);
+    int32_t sevens[] = { 7, 8, 9 };
+    ag_std_typed_vector_append_n(small, sevens, 3);
+    void *boxed = ag_std_new(vector);
+    assert(ag_std_vector_extend_from_range(boxed, small) == 0);
+    assert(ag_std_vector_extend_from_range(boxed, dv) == 0);
+    assert(ag_std_vector_extend_from_range(boxed, lv) == 0);
+    struct ag_std_vector *bv = boxed;
+    assert(bv->size == 8);
+    for (int i = 0; i < 3; ++i) {
+      assert(ag_std_int_value(bv->arr[i]) == 7 + i);
+    }
+    assert(((struct floating64 *)bv->arr[3])->x == 0.5);
+    assert(((struct floating64 *)bv->arr[6])->x == 1e10);
+    assert(((struct integer64 *)bv->arr[7])->x == INT64_C(1) << 40);
+
+    // A zip's tuples can't be held; the vector stays as it was.
+    void *zv = ag_std_new(ag_std_zip_view, small, small);
+    assert(ag_std_vector_extend_from_range(boxed, zv) == -1);
+    assert(bv->size == 8);
+
+    ag_std_delete(zv);
+    ag_std_delete(boxed);
+    ag_std_delete(small);
+    ag_std_delete(iv);
+    ag_std_delete(dv);
+    ag_std_delete(lv);
+    ag_std_delete(fv);
+  }
 
-  void *s1 = ag_std_new(string, "Dumbledore");
+  {
+    printf("SIMD kernels test.. (using asserts)\n");
+
+    // 1003 so that every kernel has a tail to deal with.
+    const int n = 1003;
+    void *iv = ag_std_new(ag_std_int32_vector);
+    void *lv = ag_std_new(ag_std_int64_vector);
+    void *fv = ag_std_new(ag_std_float_vector);
+    void *dv = ag_std_new(ag_std_double_vector);
+    void *bv = ag_std_new(vector);
+    void *lst = ag_std_new(ag_std_list);
+
+    int64_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+      int x = (i * 37) % 101 - 50;
+      ag_std_int32_vector_push_back(iv, x);
+      ag_std_int64_vector_push_back(lv, x);
+      ag_std_float_vector_push_back(fv, (float)x);
+      ag_std_double_vector_push_back(dv, x);
+      ag_std_vector_push_back(bv, ag_std_new(integer, x));
+      ag_std_list_push_back(lst, ag_std_new(integer, x));
+      sum += x;
+    }
 
-  void *i = ag_std_new(integer, 4);
-  void *i2 = ag_std_new(integer, 7);
-  void *i3 = ag_std_new(integer, 1);
-  void *i4 = ag_std_new(integer, -3);
+    // The last element is the only 77, and is the largest.
+    ag_std_int32_vector_push_back(iv, 77);
+    ag_std_int64_vector_push_back(lv, 77);
+    ag_std_float_vector_push_back(fv, 77.0f);
+    ag_std_double_vector_push_back(dv, 77.0);
+    ag_std_vector_push_back(bv, ag_std_new(integer, 77));
+    ag_std_list_push_back(lst, ag_std_new(integer, 77));
+    sum += 77;
+
+    void *i_7 = ag_std_new(integer, -7);
+    void *i_77 = ag_std_new(integer, 77);
+    void *i_99 = ag_std_new(integer, 99);
+    void *l_7 = ag_std_new(integer64, (int64_t)-7);
+    void *f_7 = ag_std_new(floating, -7.0);
+    void *d_7 = ag_std_new(floating64, -7.0);
+    void *d_77 = ag_std_new(floating64, 77.0);
+
+    size_t sevens = ag_std_range_count(lst, i_7);
+    assert(sevens > 0);
+    assert(ag_std_range_count(bv, i_7) == sevens);
+
+    struct ag_std_num r;
+    assert(ag_std_range_sum(lst, &r) == 0 && !r.is_float && r.i == sum);
+    assert(ag_std_range_sum(bv, &r) == 0 && !r.is_float && r.i == sum);
+    assert(ag_std_range_min(bv, &r) == 0 && r.i == -50);
+    assert(ag_std_range_max(lst, &r) == 0 && r.i == 77);
+    assert(ag_std_range_find(bv, i_77) == 1);
+    assert(ag_std_range_find(bv, i_99) == 0);
+
+    enum ag_std_simd_level best = ag_std_simd_supported();
+    for (int level = AG_STD_SIMD_SCALAR; level <= (int)best; ++level) {
+      assert(ag_std_simd_use(level) == (enum ag_std_simd_level)level);
+
+      assert(ag_std_range_find(iv, i_77) == 1);
+      assert(ag_std_range_find(iv, i_99) == 0);
+      assert(ag_std_range_find(dv, d_77) == 1);
+      assert(ag_std_range_count(iv, i_7) == sevens);
+      assert(ag_std_range_count(lv, l_7) == sevens);
+      assert(ag_std_range_count(fv, f_7) == sevens);
+      assert(ag_std_range_count(dv, d_7) == sevens);
+
+      assert(ag_std_range_sum(iv, &r) == 0 && !r.is_float && r.i == sum);
+      assert(ag_std_range_sum(lv, &r) == 0 && !r.is_float && r.i == sum);
+      assert(ag_std_range_sum(fv, &r) == 0 && r.is_float && r.d == (double)sum);
+      assert(ag_std_range_sum(dv, &r) == 0 && r.is_float && r.d == (double)sum);
+
+      assert(ag_std_range_min(iv, &r) == 0 && r.i == -50);
+      assert(ag_std_range_min(lv, &r) == 0 && r.i == -50);
+      assert(ag_std_range_min(fv, &r) == 0 && r.d == -50.0);
+      assert(ag_std_range_min(dv, &r) == 0 && r.d == -50.0);
+      assert(ag_std_range_max(iv, &r) == 0 && r.i == 77);
+      assert(ag_std_range_max(lv, &r) == 0 && r.i == 77);
+      assert(ag_std_range_max(fv, &r) == 0 && r.d == 77.0);
+      assert(ag_std_range_max(dv, &r) == 0 && r.d == 77.0);
+
+      assert(ag_std_range_equal(iv, iv));
+      assert(ag_std_range_equal(fv, fv));
+      assert(ag_std_range_equal(dv, dv));
+    }
+    ag_std_simd_use(best);
+
+    // Typed against boxed goes through the iterators, and still agrees.
+    assert(ag_std_range_equal(iv, bv));
+    assert(ag_std_range_equal(bv, lst));
+
+    void *dv2 = ag_std_new(ag_std_double_vector);
+    ag_std_typed_vector_append_n(dv2, ag_std_typed_vector_data(dv), n);
+    assert(!ag_std_range_equal(dv, dv2));
+    ag_std_double_vector_push_back(dv2, 77.0);
+    assert(ag_std_range_equal(dv, dv2));
+    ((double *)ag_std_typed_vector_data(dv2))[0] += 1.0;
+    assert(!ag_std_range_equal(dv, dv2));
+
+    // Min and max have nothing to give for an empty range.
+    void *empty = ag_std_new(ag_std_int32_vector);
+    assert(ag_std_range_min(empty, &r) == -1);
+    assert(ag_std_range_sum(empty, &r) == 0 && r.i == 0);
+
+    ag_std_delete(iv);
+    ag_std_delete(lv);
+    ag_std_delete(fv);
+    ag_std_delete(dv);
+    ag_std_delete(dv2);
+    ag_std_delete(empty);
+  }
 
-  void *p1 = ag_std_new(ag_std_pair, i2, i3);
-  printf("Printing the pair: ");
-  ag_std_print(p1);
-  printf("\n");
   {
-    void *first = ag_std_pair_first(p1);
-    void *second = ag_std_pair_second(p1);
-    ag_std_print(first);
-    printf("\n");
-    ag_std_print(second);
-    printf("\n");
+    printf("Batch iterator test.. (using asserts)\n");
+
+    void *lst = ag_std_new(ag_std_list);
+    void *v = ag_std_new(vector);
+    void *t = ag_std_new(ag_std_btree);
+    void *iv = ag_std_new(ag_std_int32_vector);
+    void *objs[200];
+    for (int i = 0; i < 200; ++i) {
+      objs[i] = ag_std_new(integer, i);
+      ag_std_list_push_back(lst, objs[i]);
+      ag_std_vector_push_back(v, objs[i]);
+      ag_std_btree_insert(t, ag_std_new(ag_std_pair, objs[i], objs[i]));
+      ag_std_int32_vector_push_back(iv, i);
+    }
+
+    // 200 in batches of 64 is 64, 64, 64, 8 and then nothing.
+    void *ranges[] = { lst, v, t };
+    void *batch[AG_STD_ITER_BATCH];
+    for (int r = 0; r < 3; ++r) {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(ranges[r])];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(ranges[r])];
+      void *it = ag_std_begin_into(ranges[r], it_buf);
+      void *end = ag_std_end_into(ranges[r], end_buf);
+
+      size_t seen = 0;
+      size_t k;
+      while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+        assert(k == (seen < 192 ? 64u : 8u));
+        for (size_t i = 0; i < k; ++i) {
+          void *x = r == 2 ? ag_std_pair_first(batch[i]) : batch[i];
+          assert(x == objs[seen + i]);
+        }
+        seen += k;
+      }
+      assert(seen == 200);
+      assert(!ag_std_iter_not_equal(it, end));
+    }
+
+    // A btree range that starts and stops part way through a leaf.
+    void *lo = ag_std_new(integer, 17);
+    void *hi = ag_std_new(integer, 150);
+    void *part = ag_std_new(ag_std_btree_range, t, lo, hi);
+    struct ag_std_num total;
+    void *firsts = ag_std_new(vector);
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(part)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(part)];
+      void *it = ag_std_begin_into(part, it_buf);
+      void *end = ag_std_end_into(part, end_buf);
+
+      size_t k;
+      while ((k = ag_std_iter_next_batch(it, end, batch, 5)) > 0) {
+        assert(k <= 5);
+        for (size_t i = 0; i < k; ++i) {
+          ag_std_vector_push_back(firsts, ag_std_pair_first(batch[i]));
+        }
+      }
+    }
+    assert(((struct ag_std_vector *)firsts)->size == 134);
+    assert(ag_std_range_sum(firsts, &total) == 0 && total.i == (17 + 150) * 134 / 2);
+
+    // Zips batch when both sides do, and pair the right elements up. The
+    // pairs are the zip's own, so they are only good until the next batch.
+    void *zv = ag_std_new(ag_std_zip_view, lst, v);
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(zv)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(zv)];
+      void *it = ag_std_begin_into(zv, it_buf);
+      void *end = ag_std_end_into(zv, end_buf);
+      assert(!ag_std_iter_batches(it));
+
+      size_t seen = 0;
+      size_t k;
+      while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+        assert(k == AG_STD_ITER_BATCH || seen + k == 200);
+        for (size_t i = 0; i < k; ++i) {
+          assert(ag_std_pair_first(batch[i]) == objs[seen + i]);
+          assert(ag_std_pair_second(batch[i]) == objs[seen + i]);
+        }
+        seen += k;
+      }
+      assert(seen == 200);
+    }
+
+    // A typed vector refills one box, so a zip over it goes one at a time.
+    void *short_v = ag_std_new(vector);
+    ag_std_vector_append_n(short_v, objs, 10);
+    void *zt = ag_std_new(ag_std_zip_view, iv, short_v);
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(zt)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(zt)];
+      void *it = ag_std_begin_into(zt, it_buf);
+      void *end = ag_std_end_into(zt, end_buf);
+      assert(!ag_std_iter_batches(it));
+
+      int seen = 0;
+      while (ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH) == 1) {
+        assert(ag_std_cmp(ag_std_pair_first(batch[0]), objs[seen]) == 0);
+        seen++;
+      }
+      assert(seen == 10);
+    }
+
+    // The algorithms give the same answers through batches.
+    assert(ag_std_range_equal(lst, v));
+    assert(ag_std_range_equal(iv, lst));
+    assert(ag_std_range_equal(lst, iv));
+    assert(ag_std_range_count(lst, objs[7]) == 1);
+    assert(ag_std_range_find(t, ag_std_new(ag_std_pair, objs[7], objs[7])) == 1);
+
+    void *copy = ag_std_new(vector);
+    ag_std_vector_extend_from_range(copy, t);
+    assert(((struct ag_std_vector *)copy)->size == 200);
+
+    ag_std_list_push_back(lst, objs[0]);
+    assert(!ag_std_range_equal(lst, v));
+    assert(!ag_std_range_equal(v, lst));
+
+    ag_std_delete(iv);
+    ag_std_delete(t);
   }
 
-  ag_std_list_push_back(lst, i);
-  ag_std_list_push_back(lst, i2);
-  ag_std_list_push_back(lst, s1);
-  ag_std_list_push_back(lst, i3);
-  ag_std_list_push_back(lst, i4);
-  ag_std_list_push_back(lst, ag_std_new(floating, 5.3));
+  {
+    printf("Selector test.. (using asserts)\n");
+
+    // The built in generic functions keep their ids.
+    assert(ag_std_selector(ag_std_print) == AG_STD_SEL_PRINT);
+    assert(ag_std_selector(ag_std_iter_next_batch) == AG_STD_SEL_NEXT_BATCH);
+
+    // ag_std_size was added at run time, and asking again changes nothing.
+    assert(ag_std_size_sel >= AG_STD_SEL_BUILTIN);
+    assert(ag_std_selector(ag_std_size) == ag_std_size_sel);
+    assert(ag_std_selector_find(ag_std_range_print) == -1);
+
+    void *v = ag_std_new(vector);
+    void *lst = ag_std_new(ag_std_list);
+    void *iv = ag_std_new(ag_std_int32_vector);
+    void *x = ag_std_new(integer, 3);
+    for (int i = 0; i < 3; ++i) {
+      ag_std_vector_push_back(v, x);
+      ag_std_list_push_back(lst, x);
+      ag_std_int32_vector_push_back(iv, i);
+    }
+    assert(ag_std_size(v) == 3);
+    assert(ag_std_size(lst) == 3);
+    assert(ag_std_size(iv) == 3);
+
+    assert(ag_std_responds_to(v, ag_std_size_sel));
+    assert(!ag_std_responds_to(x, ag_std_size_sel));
+    assert(!ag_std_responds_to(x, AG_STD_SEL_BEGIN));
+    assert(ag_std_method(x, AG_STD_SEL_PRINT) == (void *)integer_print);
+
+    // A subclass starts with all of its super's methods, and overrides some.
+    void *stack = ag_std_new(
+        container_vtable,
+        "stack",
+        vector,
+        sizeof(struct ag_std_vector),
+        ag_std_print, object_print,
+        0);
+
+    void *st = ag_std_new(stack);
+    ag_std_vector_push_back(st, x);
+    assert(ag_std_class_of(st) == stack);
+    assert(ag_std_size(st) == 1);
+    assert(ag_std_range_find(st, x) == 1);
+    assert(ag_std_method(st, AG_STD_SEL_PRINT) == (void *)object_print);
+    assert(ag_std_method(st, AG_STD_SEL_BEGIN) == (void *)ag_std_vector_begin);
+
+    ag_std_delete(st);
+    ag_std_delete(v);
+    ag_std_delete(iv);
+  }
 
   {
-    printf("Printing this with a ag_std_list iterator: ");
-    printf("{ ");
-    void *it = ag_std_list_begin(lst);
-    void *lst_end = ag_std_list_end(lst);
-    (void)lst_end;
+    printf("Class test.. (using asserts)\n");
 
-    while (ag_std_iter_not_equal(it, lst_end)) {
-      ag_std_print(ag_std_iter_deref(it));
-      printf(" ");
-      ag_std_iter_increment(it);
+    void *n = ag_std_new(integer, 1);
+    void *f = ag_std_new(floating, 1.5);
+    void *s = ag_std_new(string, "one");
+    void *v = ag_std_new(vector);
+
+    assert(ag_std_is_a(n, integer));
+    assert(ag_std_is_a(n, number));
+    assert(ag_std_is_a(n, object));
+    assert(!ag_std_is_a(n, floating));
+    assert(!ag_std_is_a(s, number));
+    assert(ag_std_is_a(v, object));
+    assert(ag_std_is_subclass(integer64, number));
+    assert(!ag_std_is_subclass(number, integer64));
+
+    // The metaclasses line up the same way.
+    assert(ag_std_is_subclass(container_vtable, vtable));
+    assert(!ag_std_is_subclass(vtable, iterator_vtable));
+
+    assert(ag_std_cast(f, number) == f);
+    assert(ag_std_cast(s, number) == NULL);
+
+    // Sorting out a mixed list takes one check per element.
+    void *mixed = ag_std_new(ag_std_list);
+    ag_std_list_push_back(mixed, n);
+    ag_std_list_push_back(mixed, s);
+    ag_std_list_push_back(mixed, f);
+    ag_std_list_push_back(mixed, v);
+
+    int numbers = 0;
+    union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(mixed)];
+    union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(mixed)];
+    void *end = ag_std_end_into(mixed, end_buf);
+    for (void *it = ag_std_begin_into(mixed, it_buf);
+        ag_std_iter_not_equal(it, end);
+        ag_std_iter_increment(it))
+    {
+      numbers += ag_std_is_a(ag_std_iter_deref(it), number);
     }
+    assert(numbers == 2);
 
-    printf("}\n");
+    struct ag_std_num total;
+    assert(ag_std_range_sum(mixed, &total) == -1);
+
+    // A chain deeper than the display still answers right.
+    void *chain[AG_STD_CLASS_DEPTH + 4];
+    void *super = number;
+    for (int d = 0; d < AG_STD_CLASS_DEPTH + 4; ++d) {
+      chain[d] = ag_std_new(vtable, "deep", super, sizeof(struct object), 0);
+      super = chain[d];
+    }
+
+    void *deep = ag_std_new(chain[AG_STD_CLASS_DEPTH + 3]);
+    assert(((struct ag_std_vtable *)chain[AG_STD_CLASS_DEPTH + 3])->depth
+        == AG_STD_CLASS_DEPTH + 5);
+    assert(ag_std_is_a(deep, number));
+    assert(!ag_std_is_a(deep, integer));
+    assert(ag_std_is_a(deep, chain[AG_STD_CLASS_DEPTH]));
+    assert(ag_std_is_a(deep, chain[AG_STD_CLASS_DEPTH + 3]));
+    assert(!ag_std_is_a(n, chain[AG_STD_CLASS_DEPTH]));
+    assert(!ag_std_is_subclass(chain[AG_STD_CLASS_DEPTH], chain[AG_STD_CLASS_DEPTH + 1]));
+
+    ag_std_delete(v);
+  }
+
+  {
+    printf("Immediate test.. (using asserts)\n");
+
+    void *a = ag_std_int(5);
+    void *b = ag_std_new(integer, 5);
+    assert(ag_std_is_immediate(a));
+    assert(!ag_std_is_immediate(b));
+    assert(ag_std_class_of(a) == integer);
+    assert(ag_std_is_a(a, number));
+    assert(ag_std_cmp(a, b) == 0 && ag_std_cmp(b, a) == 0);
+    assert(ag_std_hash(a) == ag_std_hash(b));
+    assert(ag_std_cmp(ag_std_int(-7), a) < 0);
+
+    int edges[] = { 0, -1, 1, INT32_MIN, INT32_MAX };
+    for (int i = 0; i < 5; ++i) {
+      assert(ag_std_int_value(ag_std_int(edges[i])) == edges[i]);
+    }
+
+    void *f = ag_std_float(2.5f);
+    assert(ag_std_class_of(f) == floating);
+    assert(ag_std_float_value(f) == 2.5f);
+    assert(ag_std_cmp(f, ag_std_new(floating, 2.5)) == 0);
+    assert(ag_std_hash(ag_std_float(-0.0f)) == ag_std_hash(ag_std_float(0.0f)));
 
-    ag_std_range_print(lst);
-  }
+    // Nothing to delete.
+    ag_std_delete(a);
+    ag_std_delete(f);
+    assert(ag_std_int_value(a) == 5);
 
-  ag_std_print(lst);
-  printf("\n");
+    // Immediates and boxes find each other in containers.
+    void *m = ag_std_new(ag_std_map);
+    ag_std_map_insert(m, ag_std_new(ag_std_pair, ag_std_int(3), b));
+    assert(ag_std_map_at(m, ag_std_new(integer, 3)) == b);
 
-  ag_std_print(i);
-  printf("\n");
-  {
-    void *ai = ag_std_new(integer, 10);
-    void *as = ag_std_new(string, "ten");
+    void *v = ag_std_new(vector);
+    ag_std_vector_push_back(v, ag_std_int(1));
+    ag_std_vector_push_back(v, b);
+    ag_std_vector_push_back(v, ag_std_float(0.5f));
+    assert(ag_std_range_find(v, ag_std_int(5)) == 1);
+    assert(ag_std_range_count(v, ag_std_new(integer, 1)) == 1);
+
+    struct ag_std_num total;
+    assert(ag_std_range_sum(v, &total) == 0 && total.is_float && total.d == 6.5);
+    ag_std_print(v);
+    printf("\n");
 
-    void *bi = ag_std_new(integer, 20);
-    void *bs = ag_std_new(string, "twenty");
+    // Walking an iota_view makes no objects at all.
+    void *iota = ag_std_new(ag_std_iota_view, 100000);
+    size_t live = ag_std_pool_live(sizeof(struct integer));
+    assert(ag_std_range_sum(iota, &total) == 0);
+    assert(total.i == (int64_t)99999 * 100000 / 2);
+    assert(ag_std_range_find(iota, ag_std_int(99999)) == 1);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
 
-    void *ci = ag_std_new(integer, 30);
-    void *cs = ag_std_new(string, "thirty");
+    ag_std_delete(m);
+    ag_std_delete(v);
+  }
 
-    void *lst_a = ag_std_new(ag_std_list);
-    ag_std_list_push_back(lst_a, ai);
-    ag_std_list_push_back(lst_a, as);
+  {
+    printf("Zip test.. (using asserts)\n");
 
-    void *lst_b = ag_std_new(ag_std_list);
-    ag_std_list_push_back(lst_b, bi);
-    ag_std_list_push_back(lst_b, bs);
+    void *v = ag_std_new(vector);
+    void *lst = ag_std_new(ag_std_list);
+    for (int i = 0; i < 300; ++i) {
+      ag_std_vector_push_back(v, ag_std_int(i * 2));
+      ag_std_list_push_back(lst, ag_std_int(-i));
+    }
+    void *iota = ag_std_new(ag_std_iota_view, 200);
 
-    void *lst_c = ag_std_new(ag_std_list);
-    ag_std_list_push_back(lst_c, ci);
-    ag_std_list_push_back(lst_c, cs);
+    // Three ranges, as long as the shortest.
+    void *rngs[3] = { v, iota, lst };
+    void *z3 = ag_std_new(ag_std_zip_n_view, 3, rngs);
+    assert(ag_std_is_a(z3, ag_std_zip_view));
 
-    void *lst_final = ag_std_new(ag_std_list);
-    ag_std_list_push_back(lst_final, lst_a);
+    // More ranges than a tuple holds, or fewer than none: no zip at all.
+    void *many[AG_STD_ZIP_MAX + 1];
+    for (int i = 0; i <= AG_STD_ZIP_MAX; ++i) {
+      many[i] = v;
+    }
+    assert(ag_std_new(ag_std_zip_n_view, AG_STD_ZIP_MAX + 1, many) == NULL);
+    assert(ag_std_new(ag_std_zip_n_view, -1, many) == NULL);
 
-    ag_std_print(lst_final);
+    size_t live_pairs = ag_std_pool_live(sizeof(struct ag_std_pair));
+    size_t live_tuples = ag_std_pool_live(sizeof(struct ag_std_tuple));
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(z3)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(z3)];
+      void *it = ag_std_begin_into(z3, it_buf);
+      void *end = ag_std_end_into(z3, end_buf);
+
+      // Every element comes in the same tuple.
+      void *first = ag_std_iter_deref(it);
+      int n = 0;
+      for (; ag_std_iter_not_equal(it, end); ag_std_iter_increment(it)) {
+        void *t = ag_std_iter_deref(it);
+        assert(t == first);
+        assert(ag_std_tuple_size(t) == 3);
+        assert(ag_std_int_value(ag_std_tuple_at(t, 0)) == n * 2);
+        assert(ag_std_int_value(ag_std_tuple_at(t, 1)) == n);
+        assert(ag_std_int_value(ag_std_tuple_at(t, 2)) == -n);
+        n++;
+      }
+      assert(n == 200);
+    }
+    assert(ag_std_pool_live(sizeof(struct ag_std_pair)) == live_pairs);
+    assert(ag_std_pool_live(sizeof(struct ag_std_tuple)) == live_tuples);
+
+    // The algorithms see the same thing, a batch at a time.
+    void *items[3] = { ag_std_int(20), ag_std_int(10), ag_std_int(-10) };
+    void *want = ag_std_new(ag_std_tuple, 3, items);
+    assert(ag_std_range_find(z3, want) == 1);
+    assert(ag_std_range_count(z3, want) == 1);
+    ag_std_print(want);
     printf("\n");
 
-    ag_std_list_push_back(lst_final, lst_b);
-    ag_std_list_push_back(lst_final, lst_c);
+    // A zip of a zip doesn't know its size, so it has to ask each end.
+    void *z2 = ag_std_new(ag_std_zip_view, iota, v);
+    void *zz = ag_std_new(ag_std_zip_view, z2, lst);
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(zz)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(zz)];
+      void *it = ag_std_begin_into(zz, it_buf);
+      void *end = ag_std_end_into(zz, end_buf);
+      assert(!((struct ag_std_zip_view_iter *)it)->sized);
+
+      void *batch[AG_STD_ITER_BATCH];
+      size_t seen = 0;
+      size_t k;
+      while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+        for (size_t i = 0; i < k; ++i) {
+          void *inner = ag_std_pair_first(batch[i]);
+          assert(ag_std_int_value(ag_std_pair_first(inner)) == (int)(seen + i));
+          assert(ag_std_int_value(ag_std_pair_second(batch[i])) == -(int)(seen + i));
+        }
+        seen += k;
+      }
+      assert(seen == 200);
+    }
 
-    ag_std_print(lst_final);
-    printf("\n");
+    // Heap iterators free what they hold.
+    void *it = ag_std_begin(z3);
+    void *end = ag_std_end(z3);
+    assert(ag_std_iter_not_equal(it, end));
+    ag_std_delete(it);
+    ag_std_delete(end);
+
+    ag_std_delete(v);
+    ag_std_delete(lst);
   }
 
   {
-    void *ai = ag_std_new(integer, 10);
-    void *bi = ag_std_new(integer, 20);
-    void *ci = ag_std_new(integer, 30);
+    printf("View test.. (using asserts)\n");
 
     void *v = ag_std_new(vector);
-    ag_std_print(v);
-    printf("\n");
+    for (int i = 0; i < 100; ++i) {
+      ag_std_vector_push_back(v, ag_std_int(i));
+    }
 
-    ag_std_vector_push_back(v, ai);
-    ag_std_vector_push_back(v, bi);
-    ag_std_vector_push_back(v, ci);
-    ag_std_vector_push_back(v, ci);
-    ag_std_vector_pop_back(v);
+    // Squares of the first five even numbers, in one pass.
+    void *evens = ag_std_new(ag_std_filter_view, v, ag_std_bench_is_even);
+    void *squares = ag_std_new(ag_std_transform_view, evens, ag_std_bench_square);
+    void *first = ag_std_new(ag_std_take_view, squares, 5);
 
-    ag_std_print(v);
-    printf("\n");
+    void *out = ag_std_new(vector);
+    ag_std_vector_extend_from_range(out, first);
+    assert(((struct ag_std_vector *)out)->size == 5);
+    for (int i = 0; i < 5; ++i) {
+      assert(ag_std_int_value(((struct ag_std_vector *)out)->arr[i]) == 4 * i * i);
+    }
+    ag_std_range_print(first);
 
+    // One element at a time gives the same thing.
     {
-      printf("Printing this with a vec iterator: ");
-      printf("{ ");
-      void *it = ag_std_vector_begin(v);
-      void *vec_end = ag_std_vector_end(v);
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(first)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(first)];
+      void *it = ag_std_begin_into(first, it_buf);
+      void *end = ag_std_end_into(first, end_buf);
+      assert(ag_std_iter_batches(it));
+
+      int n = 0;
+      for (; ag_std_iter_not_equal(it, end); ag_std_iter_increment(it)) {
+        assert(ag_std_int_value(ag_std_iter_deref(it)) == 4 * n * n);
+        n++;
+      }
+      assert(n == 5);
+    }
 
-      while (ag_std_iter_not_equal(it, vec_end)) {
-        ag_std_print(ag_std_iter_deref(it));
-        printf(" ");
-        ag_std_iter_increment(it);
+    struct ag_std_num total;
+    assert(ag_std_range_sum(squares, &total) == 0);
+    assert(total.i == 4 * (49 * 50 * 99 / 6));
+    assert(ag_std_range_count(evens, ag_std_int(3)) == 0);
+    assert(ag_std_range_find(squares, ag_std_int(9604)) == 1);
+
+    // Take and drop past the end.
+    assert(ag_std_range_sum(ag_std_new(ag_std_take_view, v, 1000), &total) == 0);
+    assert(total.i == 99 * 100 / 2);
+    assert(ag_std_range_sum(ag_std_new(ag_std_drop_view, v, 95), &total) == 0);
+    assert(total.i == 95 + 96 + 97 + 98 + 99);
+    assert(ag_std_range_count(ag_std_new(ag_std_drop_view, v, 1000), ag_std_int(0)) == 0);
+    assert(ag_std_range_equal(
+        ag_std_new(ag_std_drop_view, ag_std_new(ag_std_take_view, v, 10), 5),
+        ag_std_new(ag_std_take_view, ag_std_new(ag_std_drop_view, v, 5), 5)));
+
+    // Enumerate counts with immediates.
+    void *lst = ag_std_new(ag_std_list);
+    ag_std_list_push_back(lst, ag_std_new(string, "a"));
+    ag_std_list_push_back(lst, ag_std_new(string, "b"));
+    ag_std_list_push_back(lst, ag_std_new(string, "c"));
+    void *en = ag_std_new(ag_std_enumerate_view, lst);
+    ag_std_range_print(en);
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(en)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(en)];
+      void *it = ag_std_begin_into(en, it_buf);
+      void *end = ag_std_end_into(en, end_buf);
+      assert(!ag_std_iter_batches(it));
+
+      int n = 0;
+      for (; ag_std_iter_not_equal(it, end); ag_std_iter_increment(it)) {
+        void *idx = ag_std_pair_first(ag_std_iter_deref(it));
+        assert(ag_std_is_immediate(idx) && ag_std_int_value(idx) == n);
+        n++;
       }
+      assert(n == 3);
+    }
 
-      printf("}\n");
+    void *en_v = ag_std_new(ag_std_enumerate_view, ag_std_new(ag_std_drop_view, v, 30));
+    void *batch[AG_STD_ITER_BATCH];
+    size_t live = ag_std_pool_live(sizeof(struct integer));
+    size_t live_pairs = ag_std_pool_live(sizeof(struct ag_std_pair));
+    {
+      union ag_std_iter_slot it_buf[AG_STD_ITER_SLOTS(en_v)];
+      union ag_std_iter_slot end_buf[AG_STD_ITER_SLOTS(en_v)];
+      void *it = ag_std_begin_into(en_v, it_buf);
+      void *end = ag_std_end_into(en_v, end_buf);
+
+      int seen = 0;
+      size_t k;
+      while ((k = ag_std_iter_next_batch(it, end, batch, AG_STD_ITER_BATCH)) > 0) {
+        for (size_t i = 0; i < k; ++i) {
+          assert(ag_std_int_value(ag_std_pair_first(batch[i])) == seen);
+          assert(ag_std_int_value(ag_std_pair_second(batch[i])) == seen + 30);
+          seen++;
+        }
+      }
+      assert(seen == 70);
+    }
 
-      ag_std_range_print(v);
+    // None of that made a number or a pair.
+    assert(ag_std_range_sum(first, &total) == 0 && total.i == 4 * 30);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+    assert(ag_std_pool_live(sizeof(struct ag_std_pair)) == live_pairs);
+
+    // Heap iterators work too.
+    void *it = ag_std_begin(first);
+    void *end = ag_std_end(first);
+    int n = 0;
+    for (; ag_std_iter_not_equal(it, end); ag_std_iter_increment(it)) {
+      n++;
+    }
+    assert(n == 5);
+    ag_std_delete(it);
+    ag_std_delete(end);
 
-      int found = ag_std_range_find(v, bi);
-      assert(found == 1);
+    ag_std_print(ag_std_new(ag_std_take_view, ag_std_new(ag_std_drop_view, lst, 1), 1));
+    printf("\n");
 
-      void *z = ag_std_new(integer, 0);
+    ag_std_delete(out);
+    ag_std_delete(v);
+  }
 
-      found = ag_std_range_find(v, z);
-      assert(found == 0);
+  {
+    printf("Parallel test.. (using asserts)\n");
+
+    // A setting made before first use is kept by the first use, even 1.
+    ag_std_par_set_threads(1);
+    ag_std_par_init();
+    assert(ag_std_par_threads() == 1);
+
+    ag_std_par_set_threads(4);
+    assert(ag_std_par_threads() == 4);
+
+    const int n = 100000;
+    void *v = ag_std_new(vector);
+    void *tv = ag_std_new(ag_std_int32_vector);
+    void *dv = ag_std_new(ag_std_double_vector);
+    for (int i = 0; i < n; ++i) {
+      ag_std_vector_push_back(v, ag_std_int(i));
+      ag_std_typed_vector_append_n(tv, &(int32_t){ i }, 1);
+      ag_std_typed_vector_append_n(dv, &(double){ 1.0 / (i + 1) }, 1);
+    }
+    void *iota = ag_std_new(ag_std_iota_view, n);
+
+    // Same answers as the one thread versions, from every kind of range.
+    void *rngs[3] = { v, tv, iota };
+    for (int r = 0; r < 3; ++r) {
+      struct ag_std_num want, got;
+      assert(ag_std_range_sum(rngs[r], &want) == 0);
+      assert(ag_std_par_reduce(rngs[r], AG_STD_NUM_SUM, &got) == 0);
+      assert(!got.is_float && got.i == want.i);
+      assert(ag_std_par_reduce(rngs[r], AG_STD_NUM_MAX, &got) == 0 && got.i == n - 1);
+      assert(ag_std_par_reduce(rngs[r], AG_STD_NUM_MIN, &got) == 0 && got.i == 0);
+
+      assert(ag_std_par_count_if(rngs[r], ag_std_bench_is_even) == (size_t)n / 2);
+
+      size_t at = 0;
+      ag_std_bench_target = 77777;
+      assert(ag_std_par_find_any(rngs[r], ag_std_bench_is_target, &at) && at == 77777);
+      ag_std_bench_target = -1;
+      assert(!ag_std_par_find_any(rngs[r], ag_std_bench_is_target, NULL));
+
+      ag_std_bench_touched = 0;
+      ag_std_par_for_each(rngs[r], ag_std_bench_touch);
+      assert(ag_std_bench_touched == (size_t)want.i);
     }
-  }
 
-  void *class_of_i = ag_std_class_of(i);
-  assert(class_of_i == integer);
+    // A sum of doubles comes out the same on any number of threads.
+    struct ag_std_num sums[4];
+    size_t threads[4] = { 1, 2, 3, 4 };
+    for (int t = 0; t < 4; ++t) {
+      ag_std_par_set_threads(threads[t]);
+      assert(ag_std_par_reduce(dv, AG_STD_NUM_SUM, &sums[t]) == 0 && sums[t].is_float);
+      assert(memcmp(&sums[t].d, &sums[0].d, sizeof(double)) == 0);
+    }
+
+    // Transform keeps the order.
+    void *out = ag_std_new(vector);
+    ag_std_vector_push_back(out, ag_std_int(-1));
+    ag_std_par_transform(iota, out, ag_std_bench_square);
+    struct ag_std_vector *o = out;
+    assert(o->size == (size_t)n + 1);
+    for (int i = 0; i < n; ++i) {
+      assert(ag_std_int_value(o->arr[i + 1]) == (int)((unsigned)i * (unsigned)i));
+    }
+
+    // Ranges that can't be cut up run on this thread, and empty ones work.
+    void *lst = ag_std_new(ag_std_list);
+    for (int i = 0; i < 10; ++i) {
+      ag_std_list_push_back(lst, ag_std_int(i));
+    }
+    assert(ag_std_par_count_if(lst, ag_std_bench_is_even) == 5);
+    ag_std_par_transform(lst, out, ag_std_bench_square);
+    assert(o->size == (size_t)n + 11 && ag_std_int_value(o->arr[n + 10]) == 81);
+
+    struct ag_std_num got;
+    void *empty = ag_std_new(vector);
+    assert(ag_std_par_reduce(empty, AG_STD_NUM_SUM, &got) == 0 && got.i == 0);
+    assert(ag_std_par_reduce(empty, AG_STD_NUM_MIN, &got) == -1);
+    ag_std_vector_push_back(v, ag_std_new(string, "not a number"));
+    assert(ag_std_par_reduce(v, AG_STD_NUM_SUM, &got) == -1);
+
+    ag_std_delete(v);
+    ag_std_delete(tv);
+    ag_std_delete(dv);
+    ag_std_delete(out);
+    ag_std_delete(empty);
+  }
 
   {
-    printf("Iota view test: ");
-    void *v_10 = ag_std_new(ag_std_iota_view, 10);
+    printf("Task test.. (using asserts)\n");
 
-    void *it = ag_std_begin(v_10);
-    void *end = ag_std_end(v_10);
+    ag_std_sched_start(4);
+    assert(ag_std_sched_workers() == 4);
 
-    while (ag_std_iter_not_equal(it, end)) {
-      void *x = ag_std_iter_deref(it);
-      ag_std_print(x);
-      printf(" ");
-      ag_std_iter_increment(it);
+    struct ag_std_bench_fib f = { 20, 0 };
+    ag_std_task_run(ag_std_bench_fib_task, &f);
+    assert(f.result == 6765);
+
+    // Every call with n >= 2 spawned one, and the first was one too.
+    size_t spawned[21] = { 0 };
+    for (int i = 2; i <= 20; ++i) {
+      spawned[i] = spawned[i - 1] + spawned[i - 2] + 1;
+    }
+    size_t tasks = 0;
+    size_t steals = 0;
+    for (size_t i = 0; i < ag_std_sched_workers(); ++i) {
+      struct ag_std_sched_stats stats;
+      ag_std_sched_stats(i, &stats);
+      tasks += stats.tasks;
+      steals += stats.steals;
     }
+    assert(tasks == spawned[20] + 1);
+    assert(steals <= tasks);
 
-    printf("\n");
+    // Tasks that hold on to objects.
+    void *v = ag_std_new(vector);
+    for (int i = 0; i < 100000; ++i) {
+      ag_std_vector_push_back(v, ag_std_int(i));
+    }
+    struct ag_std_bench_sum job = { v, 0, 100000, 0 };
+    ag_std_task_run(ag_std_bench_sum_task, &job);
+    assert(job.sum == (int64_t)99999 * 100000 / 2);
+
+    // Outside of a task, a spawn just runs it.
+    struct ag_std_bench_fib small = { 10, 0 };
+    struct ag_std_task_group g = AG_STD_TASK_GROUP_INIT;
+    struct ag_std_task t;
+    ag_std_spawn(&g, &t, ag_std_bench_fib_task, &small);
+    ag_std_sync(&g);
+    assert(small.result == 55);
+
+    // A restart clears the numbers.
+    ag_std_sched_start(2);
+    struct ag_std_sched_stats stats;
+    ag_std_sched_stats(1, &stats);
+    assert(stats.tasks == 0 && stats.steals == 0);
+
+    // And there is no worker 2.
+    stats.tasks = 1;
+    ag_std_sched_stats(2, &stats);
+    assert(stats.tasks == 0 && stats.failed_steals == 0 && stats.idle_seconds == 0.0);
+    ag_std_task_run(ag_std_bench_fib_task, &f);
+    assert(f.result == 6765);
+
+    ag_std_delete(v);
   }
 
   {
-    printf("Zip view test: ");
+    printf("Refcount test.. (using asserts)\n");
+
+    // The tests before left big containers on the release queue.
+    ag_std_release_flush();
+
+    size_t live = ag_std_pool_live(sizeof(struct integer));
+    size_t live_pairs = ag_std_pool_live(sizeof(struct ag_std_pair));
 
+    // Only objects from the pool are counted.
+    assert(ag_std_refs(ag_std_int(3)) == 0);
+    struct integer placed;
+    assert(ag_std_refs(ag_std_new_at(&placed, integer, 3)) == 0);
+
+    // The vector's reference keeps a alive after the caller lets go.
+    void *a = ag_std_new(integer, 7);
+    assert(ag_std_refs(a) == 1);
     void *v = ag_std_new(vector);
+    ag_std_vector_push_back(v, a);
+    ag_std_vector_push_back(v, ag_std_int(8));
+    assert(ag_std_refs(a) == 2);
+    ag_std_delete(a);
+    assert(ag_std_refs(a) == 1);
+    assert(ag_std_int_value(a) == 7);
+
+    // And it goes when it's popped.
+    ag_std_vector_pop_back(v);
+    ag_std_vector_pop_back(v);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
 
-    ag_std_vector_push_back(v, ag_std_new(string, "Harry"));
-    ag_std_vector_push_back(v, ag_std_new(string, "Ron"));
-    ag_std_vector_push_back(v, ag_std_new(string, "Hermione"));
+    // Pairs hold their items, the map and the tree hold their pairs.
+    void *k = ag_std_new(integer, 1);
+    void *p = ag_std_new(ag_std_pair, k, ag_std_int(10));
+    ag_std_delete(k);
+    void *m = ag_std_new(ag_std_map);
+    void *t = ag_std_new(ag_std_btree);
+    void *lst = ag_std_new(ag_std_list);
+    ag_std_map_insert(m, p);
+    ag_std_btree_insert(t, p);
+    ag_std_list_push_back(lst, p);
+    ag_std_vector_push_back(v, p);
+    ag_std_delete(p);
+    assert(ag_std_refs(p) == 4);
+
+    // The same key again isn't kept.
+    void *p2 = ag_std_new(ag_std_pair, ag_std_int(1), ag_std_int(11));
+    ag_std_btree_insert(t, p2);
+    assert(ag_std_refs(p2) == 1);
+    ag_std_delete(p2);
+
+    ag_std_delete(m);
+    ag_std_delete(t);
+    ag_std_delete(lst);
+    assert(ag_std_refs(p) == 1);
+    ag_std_delete(v);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+    assert(ag_std_pool_live(sizeof(struct ag_std_pair)) == live_pairs);
+
+    // A shared object can be retained and released from any thread.
+    void *s = ag_std_new(integer, 5);
+    ag_std_share(s);
+    void *w = ag_std_new(vector);
+    for (int i = 0; i < 100000; ++i) {
+      ag_std_vector_push_back(w, s);
+    }
+    ag_std_par_for_each(w, ag_std_bench_retain_release);
+    assert(ag_std_refs(s) == 100001);
+    ag_std_delete(s);
+
+    // A big container is released a step at a time.
+    ag_std_delete(w);
+    assert(ag_std_release_pending() == 100000);
+    assert(ag_std_refs(s) == 100000);
+    assert(ag_std_release_drain(AG_STD_RELEASE_STEP) == 100000 - AG_STD_RELEASE_STEP);
+    ag_std_release_flush();
+    assert(ag_std_release_pending() == 0);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+    void *u = ag_std_new(ag_std_list);
+    for (int i = 0; i < 5000; ++i) {
+      void *x = ag_std_new(integer, i);
+      ag_std_list_push_back(u, x);
+      ag_std_release(x);
+    }
+    ag_std_delete(u);
+    assert(ag_std_release_pending() == 5000);
+    ag_std_release_flush();
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+  }
 
-    void *iv = ag_std_new(ag_std_iota_view, 2);
+  {
+    printf("Pool cache test.. (using asserts)\n");
+
+    size_t live = ag_std_pool_live(sizeof(struct integer));
+    size_t threads = ag_std_par_threads();
+    ag_std_par_set_threads(4);
+
+    // Made here, deleted on the other threads, and the other way around.
+    void *objs[10000];
+    const size_t n = sizeof(objs) / sizeof(objs[0]);
+    struct ag_std_bench_objs all = { objs, n, n };
+    struct ag_std_bench_objs job = { objs, n, n / 8 };
+
+    ag_std_bench_new_chunk(&all, 0);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live + n);
+    ag_std_par_run(ag_std_bench_delete_chunk, &job, 8);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+    ag_std_par_run(ag_std_bench_new_chunk, &job, 8);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live + n);
+    for (size_t i = 0; i < n; ++i) {
+      assert(ag_std_int_value(objs[i]) == (int)i);
+    }
+    ag_std_bench_delete_chunk(&all, 0);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+    // A thread that exits leaves its objects counted, and its free blocks
+    // in the depot.
+    struct ag_std_bench_objs one = { objs, 1000, 1000 };
+    pthread_t t;
+    pthread_create(&t, NULL, ag_std_bench_new_thread, &one);
+    pthread_join(t, NULL);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live + 1000);
+    ag_std_bench_delete_chunk(&one, 0);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+    // Stopping the workers gives their blocks back too.
+    ag_std_par_set_threads(threads);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+    struct ag_std_pool *pool = &ag_std_pools[ag_std_pool_class(sizeof(struct integer))];
+    assert(pool->n_full > 0);
+  }
 
-    void *zv = ag_std_new(ag_std_zip_view, v, iv);
+  {
+    printf("Concurrent map test.. (using asserts)\n");
+
+    size_t live = ag_std_pool_live(sizeof(struct integer));
+    void *m = ag_std_new(ag_std_cmap);
+
+    // On one thread it is a map, and grows as it fills.
+    void *key = ag_std_new(integer, 3);
+    void *value = ag_std_new(integer, 30);
+    void *pair = ag_std_new(ag_std_pair, key, value);
+    assert(ag_std_cmap_insert(m, pair) == 0);
+    ag_std_release(pair);
+    ag_std_release(value);
+    assert(ag_std_size(m) == 1);
+
+    value = ag_std_cmap_at(m, key);
+    assert(ag_std_int_value(value) == 30);
+    ag_std_release(value);
+
+    // The first insert of a key wins.
+    pair = ag_std_new(ag_std_pair, key, key);
+    assert(ag_std_cmap_insert(m, pair) == 0);
+    ag_std_release(pair);
+    value = ag_std_cmap_at(m, key);
+    assert(ag_std_int_value(value) == 30);
+    ag_std_release(value);
+
+    assert(ag_std_cmap_erase(m, key));
+    assert(!ag_std_cmap_erase(m, key));
+    assert(ag_std_cmap_at(m, key) == NULL);
+    assert(ag_std_size(m) == 0);
+    ag_std_release(key);
+
+    // Keys 10000 and on, every 20th; the lookups (below 10000) all miss.
+    struct ag_std_bench_cmap_job job = { m, 10000, 10000, 0 };
+    ag_std_bench_cmap_chunk(&job, 0);
+    assert(ag_std_size(m) == 500);
+    assert(job.hits == 0);
+
+    struct ag_std_cmap_stats stats;
+    ag_std_cmap_stats(m, &stats);
+    assert(stats.grows > 0);
+    assert(stats.contended == 0);
+
+    void *probe = ag_std_new(integer, 0);
+    struct integer *pi = probe;
+    for (size_t i = 0; i < 10000; ++i) {
+      pi->x = (int)(10000 + i);
+      value = ag_std_cmap_at(m, probe);
+      assert((value != NULL) == (i % 20 == 0));
+      if (value != NULL) {
+        assert(ag_std_int_value(value) == pi->x);
+      }
+      ag_std_release(value);
+    }
 
-    void *it = ag_std_begin(zv);
-    void *end = ag_std_end(zv);
+    // Many threads at once, reading the keys there and adding their own.
+    size_t threads = ag_std_par_threads();
+    ag_std_par_set_threads(4);
+    job.keys = 20000;
+    ag_std_par_run(ag_std_bench_cmap_chunk, &job, 8);
+    assert(ag_std_size(m) == 500 + 8 * 500);
+    assert(job.hits > 0);
+
+    for (size_t i = 0; i < 10000; i += 20) {
+      pi->x = (int)(10000 + i);
+      assert(ag_std_cmap_erase(m, probe));
+    }
+    assert(ag_std_size(m) == 8 * 500);
+    for (size_t c = 0; c < 8; ++c) {
+      pi->x = (int)(20000 + c * 10000 + 20);
+      value = ag_std_cmap_at(m, probe);
+      assert(ag_std_int_value(value) == pi->x);
+      ag_std_release(value);
+    }
 
-    while (ag_std_iter_not_equal(it, end)) {
-      // The pair.
-      void *p = ag_std_iter_deref(it);
-      ag_std_print(p);
-      printf(" ");
-      ag_std_iter_increment(it);
+    ag_std_cmap_stats(m, &stats);
+    assert(stats.writes >= 500 + 8 * 500);
+
+    // What was erased is freed once no thread can be reading it.
+    ag_std_delete(probe);
+    ag_std_delete(m);
+    ag_std_par_set_threads(threads);
+    ag_std_epoch_synchronize();
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+  }
+
+  {
+    printf("Queue test.. (using asserts)\n");
+
+    // A capacity it can't have gives no queue.
+    assert(ag_std_new(ag_std_queue, 0, 0) == NULL);
+    assert(ag_std_new(ag_std_queue, -1, 0) == NULL);
+    assert(ag_std_new(ag_std_queue, AG_STD_QUEUE_MAX + 1, 0) == NULL);
+
+    void *q = ag_std_new(ag_std_queue, 3, 0);
+    assert(ag_std_queue_capacity(q) == 4);
+
+    // First in, first out, and no more than it holds.
+    for (int i = 0; i < 4; ++i) {
+      assert(ag_std_queue_try_push(q, ag_std_int(i)));
+    }
+    assert(!ag_std_queue_try_push(q, ag_std_int(4)));
+    assert(ag_std_size(q) == 4);
+
+    void *obj;
+    assert(ag_std_queue_try_pop(q, &obj));
+    assert(ag_std_int_value(obj) == 0);
+    assert(ag_std_queue_try_push(q, ag_std_int(4)));
+
+    void *objs[8];
+    assert(ag_std_queue_pop_n(q, objs, 8) == 4);
+    for (int i = 0; i < 4; ++i) {
+      assert(ag_std_int_value(objs[i]) == i + 1);
     }
+    assert(!ag_std_queue_try_pop(q, &obj));
+
+    // Round the ring a few times, in batches.
+    int pushed = 0;
+    int popped = 0;
+    for (int r = 0; r < 10; ++r) {
+      for (int i = 0; i < 8; ++i) {
+        objs[i] = ag_std_int(pushed + i);
+      }
+      size_t k = ag_std_queue_push_n(q, objs, 8);
+      assert(k == (r == 0 ? 4 : 2));
+      pushed += (int)k;
+
+      assert(ag_std_queue_pop_n(q, objs, 2) == 2);
+      assert(ag_std_int_value(objs[0]) == popped);
+      assert(ag_std_int_value(objs[1]) == popped + 1);
+      popped += 2;
+    }
+    assert(ag_std_size(q) == 2);
+
+    // It holds a reference to what is in it, and gives it to the popper.
+    void *x = ag_std_new(integer, 7);
+    ag_std_queue_push(q, x);
+    assert(ag_std_refs(x) == 2);
+    ag_std_delete(q);
+    assert(ag_std_refs(x) == 1);
+
+    q = ag_std_new(ag_std_queue, 16, 1);
+    ag_std_queue_push(q, x);
+    assert(ag_std_queue_pop(q) == x);
+    assert(ag_std_refs(x) == 2);
+    ag_std_release(x);
+    ag_std_release(x);
+
+    // Four producers and four consumers, through a small queue so that
+    // both sides wait. All of it comes out.
+    struct ag_std_bench_queue_job jobs[8];
+    pthread_t threads[8];
+    int *latency = malloc(sizeof(int) * 4 * 10000);
+    for (size_t i = 0; i < 8; ++i) {
+      struct ag_std_bench_queue_job job = { q, 10000, i < 4 ? 1 : 16, latency + (i / 2) * 10000, 0 };
+      jobs[i] = job;
+      pthread_create(&threads[i], NULL, i % 2 ? ag_std_bench_consumer : ag_std_bench_producer,
+          &jobs[i]);
+    }
+    for (size_t i = 0; i < 8; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+    assert(ag_std_size(q) == 0);
+    free(latency);
 
-    printf("\n");
+    ag_std_delete(q);
   }
 
   {
-    printf("Zip view test v2: ");
+    printf("List test.. (using asserts)\n");
+
+    size_t live = ag_std_pool_live(ag_std_list_node_size(1));
+    size_t live_unrolled = ag_std_pool_live(ag_std_list_node_size(AG_STD_LIST_UNROLL));
+
+    // An empty list has no nodes.
+    void *a = ag_std_new(ag_std_list);
+    void *b = ag_std_new(ag_std_unrolled_list);
+    assert(ag_std_is_a(b, ag_std_list));
+    assert(ag_std_pool_live(ag_std_list_node_size(1)) == live);
 
     void *v = ag_std_new(vector);
+    for (int i = 0; i < 100; ++i) {
+      ag_std_vector_push_back(v, ag_std_int(i));
+    }
+    for (int i = 0; i < 50; ++i) {
+      ag_std_list_push_front(a, ag_std_int(49 - i));
+      ag_std_list_push_front(b, ag_std_int(49 - i));
+    }
+    for (int i = 50; i < 100; ++i) {
+      ag_std_list_push_back(a, ag_std_int(i));
+      ag_std_list_push_back(b, ag_std_int(i));
+    }
+    assert(ag_std_range_equal(a, v));
+    assert(ag_std_range_equal(b, v));
+    assert(ag_std_range_equal(b, a));
+    assert(ag_std_pool_live(ag_std_list_node_size(1)) == live + 100);
+    assert(ag_std_pool_live(ag_std_list_node_size(AG_STD_LIST_UNROLL)) ==
+        live_unrolled + 4 + 4);
+
+    struct ag_std_num r;
+    assert(ag_std_range_sum(b, &r) == 0 && r.i == 99 * 100 / 2);
+
+    // Splicing moves the nodes, into the middle of a node if need be.
+    void *c = ag_std_new(ag_std_list);
+    ag_std_list_push_back(c, ag_std_int(-1));
+    ag_std_list_push_back(c, ag_std_int(-2));
+    void *it = ag_std_list_begin(b);
+    for (int i = 0; i < 5; ++i) {
+      ag_std_iter_increment(it);
+    }
+    ag_std_list_splice(b, it, c);
+    assert(ag_std_size(c) == 0 && ag_std_size(b) == 102);
+    assert(ag_std_int_value(ag_std_iter_deref(it)) == 5);
+    ag_std_delete(it);
+
+    it = ag_std_list_begin(b);
+    for (int i = 0; i < 8; ++i) {
+      int want = i < 5 ? i : i < 7 ? 4 - i : i - 2;
+      assert(ag_std_int_value(ag_std_iter_deref(it)) == want);
+      ag_std_iter_increment(it);
+    }
+    ag_std_delete(it);
+
+    ag_std_list_push_back(c, ag_std_int(100));
+    ag_std_list_splice(a, NULL, c);
+    ag_std_list_push_back(c, ag_std_int(-1));
+    ag_std_list_splice(c, NULL, a);
+    assert(ag_std_size(a) == 0 && ag_std_size(c) == 102);
+    assert(ag_std_int_value(((struct ag_std_list *)c)->head.next->objs[0]) == -1);
+    assert(ag_std_int_value(((struct ag_std_list *)c)->head.prev->objs[0]) == 100);
+
+    // Merging keeps the order, and of equal elements the first list's
+    // come first.
+    void *odd = ag_std_new(ag_std_list);
+    void *even = ag_std_new(ag_std_unrolled_list);
+    void *twins[2];
+    for (int i = 0; i < 200; ++i) {
+      void *x = ag_std_new(integer, i / 2);
+      ag_std_list_push_back(i % 2 ? odd : even, x);
+      ag_std_release(x);
+      if (i == 100 || i == 101) {
+        twins[i % 2] = x;
+      }
+    }
+    assert(ag_std_list_merge(even, odd) == 0);
+    assert(ag_std_size(odd) == 0 && ag_std_size(even) == 200);
 
-    ag_std_vector_push_back(v, ag_std_new(string, "Harry"));
-    ag_std_vector_push_back(v, ag_std_new(string, "Ron"));
-    ag_std_vector_push_back(v, ag_std_new(string, "Hermione"));
+    it = ag_std_list_begin(even);
+    for (int i = 0; i < 200; ++i) {
+      void *x = ag_std_iter_deref(it);
+      assert(ag_std_int_value(x) == i / 2);
+      if (i == 100 || i == 101) {
+        assert(x == twins[i % 2]);
+      }
+      ag_std_iter_increment(it);
+    }
+    ag_std_delete(it);
 
-    void *iv = ag_std_new(ag_std_iota_view, 2);
+    // The other way round, into a list of one node a piece; what it has
+    // left over goes on the end.
+    for (int i = 0; i < 10; ++i) {
+      ag_std_list_push_back(odd, ag_std_new(integer, 2 * i));
+      ag_std_release(((struct ag_std_list *)odd)->head.prev->objs[0]);
+    }
+    assert(ag_std_list_merge(odd, even) == 0);
+    assert(ag_std_size(odd) == 210);
+    it = ag_std_list_begin(odd);
+    int last = -1;
+    for (int i = 0; i < 210; ++i) {
+      int x = ag_std_int_value(ag_std_iter_deref(it));
+      assert(x >= last);
+      last = x;
+      ag_std_iter_increment(it);
+    }
+    assert(last == 99);
+    ag_std_delete(it);
+
+    ag_std_delete(odd);
+    ag_std_delete(even);
+    ag_std_delete(a);
+    ag_std_delete(b);
+    ag_std_delete(c);
+    ag_std_delete(v);
+    assert(ag_std_pool_live(ag_std_list_node_size(1)) == live);
+    assert(ag_std_pool_live(ag_std_list_node_size(AG_STD_LIST_UNROLL)) == live_unrolled);
+  }
 
-    void *zv = ag_std_new(ag_std_zip_view, v, iv);
+  {
+    printf("List sort test.. (using asserts)\n");
+
+    void *classes[] = { ag_std_list, ag_std_unrolled_list };
+    for (size_t k = 0; k < 2; ++k) {
+      // Equal keys keep their order: objs[i] has key i % 10, so sorted
+      // they come key by key, and within a key in the order of i.
+      void *lst = ag_std_new(classes[k]);
+      void *objs[1000];
+      unsigned x = 12345;
+      for (int i = 0; i < 1000; ++i) {
+        x = x * 1103515245u + 12345u;
+        objs[i] = ag_std_new(integer, (int)(x >> 16) % 10);
+        ag_std_list_push_back(lst, objs[i]);
+        ag_std_release(objs[i]);
+      }
 
-    // void *it = ag_std_begin(zv);
-    void *end = ag_std_end(zv);
+      size_t live = ag_std_pool_live(ag_std_list_node_size(1));
+      assert(ag_std_list_sort(lst) == 0);
+      assert(ag_std_size(lst) == 1000);
+      if (k == 0) {
+        assert(ag_std_pool_live(ag_std_list_node_size(1)) == live);
+      }
 
-    for (
-        void *it = ag_std_begin(zv);
-        ag_std_iter_not_equal(it, end);
-        ag_std_iter_increment(it))
-    {
-      // The pair.
-      void *p = ag_std_iter_deref(it);
-      ag_std_print(p);
-      printf(" ");
-    }
+      void *it = ag_std_list_begin(lst);
+      for (int key = 0; key < 10; ++key) {
+        for (int i = 0; i < 1000; ++i) {
+          if (ag_std_int_value(objs[i]) == key) {
+            assert(ag_std_iter_deref(it) == objs[i]);
+            ag_std_iter_increment(it);
+          }
+        }
+      }
+      ag_std_delete(it);
+
+      // Going backwards too, through the prevs.
+      struct ag_std_list_node *node = ((struct ag_std_list *)lst)->head.prev;
+      assert(ag_std_int_value(node->objs[node->n - 1]) == 9);
+      size_t n = 0;
+      for (; node != &((struct ag_std_list *)lst)->head; node = node->prev) {
+        n += node->n;
+      }
+      assert(n == 1000);
+
+      assert(ag_std_list_unique(lst) == 990);
+      void *digits = ag_std_new(ag_std_iota_view, 10);
+      assert(ag_std_range_equal(lst, digits));
+
+      // Erase and insert where an iterator is.
+      it = ag_std_list_begin(lst);
+      void *end = ag_std_list_end(lst);
+      while (ag_std_iter_not_equal(it, end)) {
+        if (ag_std_int_value(ag_std_iter_deref(it)) % 3 == 0) {
+          ag_std_list_erase(lst, it);
+        } else {
+          ag_std_list_insert(lst, it, ag_std_int(-1));
+          ag_std_iter_increment(it);
+        }
+      }
+      ag_std_list_insert(lst, it, ag_std_int(100));
+      ag_std_delete(it);
+      ag_std_delete(end);
+
+      int want[] = { -1, 1, -1, 2, -1, 4, -1, 5, -1, 7, -1, 8, 100 };
+      assert(ag_std_size(lst) == 13);
+      it = ag_std_list_begin(lst);
+      for (size_t i = 0; i < 13; ++i) {
+        assert(ag_std_int_value(ag_std_iter_deref(it)) == want[i]);
+        ag_std_iter_increment(it);
+      }
+      ag_std_delete(it);
 
-    printf("\n");
+      assert(ag_std_list_remove_if(lst, ag_std_bench_is_even) == 4);
+      assert(ag_std_size(lst) == 9);
+      assert(ag_std_list_unique(lst) == 2);
+      assert(ag_std_size(lst) == 7);
+
+      ag_std_delete(digits);
+      ag_std_delete(lst);
+    }
   }
 
   {
-    printf("Zip view test v3: ");
+    printf("Sort test.. (using asserts)\n");
+
+    // Strings go through ag_std_cmp: every shape of input, both sorts,
+    // against qsort.
+    const size_t sizes[] = { 0, 1, 2, 23, 24, 25, 129, 1000, 5000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+      size_t n = sizes[s];
+      for (int shape = 0; shape < 6; ++shape) {
+        void *v = ag_std_new(vector);
+        unsigned x = 777;
+        for (size_t i = 0; i < n; ++i) {
+          x = x * 1103515245u + 12345u;
+          size_t key = shape == 0 ? x >> 8
+            : shape == 1 ? i
+            : shape == 2 ? n - i
+            : shape == 3 ? 7
+            : shape == 4 ? (x >> 8) % 4
+            : (i < n / 2 ? i : n - i);
+          char text[16];
+          snprintf(text, sizeof(text), "%08zu", key);
+          void *str = ag_std_new(string, text);
+          ag_std_vector_push_back(v, str);
+          ag_std_release(str);
+        }
+
+        struct ag_std_vector *vec = v;
+        void **orig = malloc(sizeof(void *) * (n + 1));
+        void **want = malloc(sizeof(void *) * (n + 1));
+        memcpy(orig, vec->arr, sizeof(void *) * n);
+        memcpy(want, vec->arr, sizeof(void *) * n);
+        qsort(want, n, sizeof(void *), ag_std_bench_qsort_cmp);
+
+        assert(ag_std_sort(v) == 0);
+        for (size_t i = 0; i < n; ++i) {
+          assert(ag_std_cmp(vec->arr[i], want[i]) == 0);
+        }
+
+        memcpy(vec->arr, orig, sizeof(void *) * n);
+        assert(ag_std_stable_sort(v) == 0);
+        assert(ag_std_bench_sorted_stably(vec->arr, orig, n));
+
+        free(orig);
+        free(want);
+        ag_std_delete(v);
+      }
+    }
 
-    void *v = ag_std_new(vector);
+    // Integers and floatings are radix sorted; equal boxed ones still keep
+    // their order, and -0 and 0 are equal.
+    void *ints = ag_std_new(vector);
+    void *floats = ag_std_new(vector);
+    unsigned x = 99;
+    for (int i = 0; i < 3000; ++i) {
+      x = x * 1103515245u + 12345u;
+      void *boxed = ag_std_new(integer, (int)(x >> 20) - 2048);
+      ag_std_vector_push_back(ints, boxed);
+      ag_std_release(boxed);
+      ag_std_vector_push_back(floats, i % 7 == 0 ? ag_std_float(i % 2 ? -0.0f : 0.0f)
+          : ag_std_float(((float)(x >> 16) - 32768.0f) / 16.0f));
+    }
+    ag_std_vector_push_back(ints, ag_std_int(INT_MIN));
+    ag_std_vector_push_back(ints, ag_std_int(INT_MAX));
+
+    struct ag_std_vector *iv = ints;
+    struct ag_std_vector *fv = floats;
+    void **orig = malloc(sizeof(void *) * iv->size);
+    memcpy(orig, iv->arr, sizeof(void *) * iv->size);
+    assert(ag_std_sort(ints) == 0);
+    assert(ag_std_bench_sorted_stably(iv->arr, orig, iv->size));
+    assert(ag_std_int_value(iv->arr[0]) == INT_MIN);
+    assert(ag_std_int_value(iv->arr[iv->size - 1]) == INT_MAX);
+    free(orig);
+
+    // (Equal immediates are the same pointer, so only the order is seen.)
+    assert(ag_std_stable_sort(floats) == 0);
+    for (size_t i = 1; i < fv->size; ++i) {
+      assert(ag_std_cmp(fv->arr[i - 1], fv->arr[i]) <= 0);
+    }
 
-    ag_std_vector_push_back(v, ag_std_new(string, "Harry"));
-    ag_std_vector_push_back(v, ag_std_new(string, "Ron"));
-    ag_std_vector_push_back(v, ag_std_new(string, "Hermione"));
+    // An immediate and a boxed integer are both integers.
+    void *two = ag_std_new(vector);
+    for (int i = 300; i > 0; --i) {
+      ag_std_vector_push_back(two, i % 2 ? ag_std_int(i) : ag_std_new(integer, i));
+      if (i % 2 == 0) {
+        ag_std_release(((struct ag_std_vector *)two)->arr[300 - i]);
+      }
+    }
+    assert(ag_std_sort(two) == 0);
+    for (int i = 0; i < 300; ++i) {
+      assert(ag_std_int_value(((struct ag_std_vector *)two)->arr[i]) == i + 1);
+    }
 
-    void *iv = ag_std_new(ag_std_iota_view, 2);
+    // Typed vectors, of all four kinds, small and big.
+    void *tvs[4] = {
+      ag_std_new(ag_std_int32_vector), ag_std_new(ag_std_int64_vector),
+      ag_std_new(ag_std_float_vector), ag_std_new(ag_std_double_vector)
+    };
+    const size_t tv_sizes[2] = { 100, 5000 };
+    for (size_t s = 0; s < 2; ++s) {
+      for (size_t i = 0; i < tv_sizes[s]; ++i) {
+        x = x * 1103515245u + 12345u;
+        int32_t i32 = (int32_t)x;
+        int64_t i64 = (int64_t)x * -123456789;
+        float f = (float)i32 / 1024.0f;
+        double d = (double)i64 / 3.0;
+        ag_std_typed_vector_append_n(tvs[0], &i32, 1);
+        ag_std_typed_vector_append_n(tvs[1], &i64, 1);
+        ag_std_typed_vector_append_n(tvs[2], &f, 1);
+        ag_std_typed_vector_append_n(tvs[3], &d, 1);
+      }
 
-    void *zv = ag_std_new(ag_std_zip_view, v, iv);
+      for (int k = 0; k < 4; ++k) {
+        assert(ag_std_sort(tvs[k]) == 0);
+        struct ag_std_typed_vector *tv = tvs[k];
+        unsigned char *data = ag_std_typed_vector_data(tvs[k]);
+        for (size_t i = 1; i < tv->size; ++i) {
+          unsigned char *a = data + (i - 1) * tv->elem_size;
+          unsigned char *b = a + tv->elem_size;
+          switch (tv->kind) {
+            case AG_STD_INT32:
+              assert(*(int32_t *)a <= *(int32_t *)b);
+              break;
+            case AG_STD_INT64:
+              assert(*(int64_t *)a <= *(int64_t *)b);
+              break;
+            case AG_STD_FLOAT:
+              assert(*(float *)a <= *(float *)b);
+              break;
+            case AG_STD_DOUBLE:
+              assert(*(double *)a <= *(double *)b);
+              break;
+          }
+        }
+      }
+    }
 
-    ag_std_range_print(zv);
+    // Big enough to go parallel, on 4 threads, with many equal keys.
+    size_t threads = ag_std_par_threads();
+    ag_std_par_set_threads(4);
+
+    const size_t n = 100000;
+    void *big = ag_std_new(vector);
+    for (size_t i = 0; i < n; ++i) {
+      x = x * 1103515245u + 12345u;
+      char text[16];
+      snprintf(text, sizeof(text), "%05u", (x >> 8) % 3000);
+      void *str = ag_std_new(string, text);
+      ag_std_vector_push_back(big, str);
+      ag_std_release(str);
+    }
+    struct ag_std_vector *bv = big;
+    orig = malloc(sizeof(void *) * n);
+    memcpy(orig, bv->arr, sizeof(void *) * n);
+
+    assert(ag_std_stable_sort(big) == 0);
+    assert(ag_std_bench_sorted_stably(bv->arr, orig, n));
+
+    memcpy(bv->arr, orig, sizeof(void *) * n);
+    assert(ag_std_sort(big) == 0);
+    for (size_t i = 1; i < n; ++i) {
+      assert(ag_std_cmp(bv->arr[i - 1], bv->arr[i]) <= 0);
+    }
+    free(orig);
+
+    ag_std_par_set_threads(threads);
+
+    // Anything else is left alone.
+    void *lst = ag_std_new(ag_std_list);
+    ag_std_list_push_back(lst, ag_std_int(2));
+    ag_std_list_push_back(lst, ag_std_int(1));
+    assert(ag_std_sort(lst) == -1);
+    assert(ag_std_stable_sort(lst) == -1);
+
+    ag_std_delete(ints);
+    ag_std_delete(floats);
+    ag_std_delete(two);
+    for (int k = 0; k < 4; ++k) {
+      ag_std_delete(tvs[k]);
+    }
+    ag_std_delete(big);
+    ag_std_delete(lst);
   }
 
   {
-    printf("Map test.. (using asserts)\n");
+    printf("Vector growth test.. (using asserts)\n");
 
-    void *m = ag_std_new(ag_std_map);
+    void *v = ag_std_new(vector);
+    struct ag_std_vector *vec = v;
 
-    void *k1 = ag_std_new(integer, 3);
-    void *v1 = ag_std_new(string, "three");
-    void *p1 = ag_std_new(ag_std_pair, k1, v1);
+    void *objs[1000];
+    for (int i = 0; i < 1000; ++i) {
+      objs[i] = ag_std_new(integer, i);
+      ag_std_vector_push_back(v, objs[i]);
+    }
 
-    ag_std_map_insert(m, p1);
+    assert(vec->size == 1000);
+    assert(vec->capacity >= 1000);
+    assert(ag_std_cmp(vec->arr[999], objs[999]) == 0);
 
-    void *k2 = ag_std_new(integer, 4);
-    void *v2 = ag_std_new(string, "four");
-    void *p2 = ag_std_new(ag_std_pair, k2, v2);
+    ag_std_vector_append_n(v, objs, 1000);
+    assert(vec->size == 2000);
+    assert(vec->arr[1500] == objs[500]);
 
-    ag_std_map_insert(m, p2);
+    // Past AG_STD_VECTOR_MMAP_BYTES the array is mapped, and still grows.
+    ag_std_vector_reserve(v, 200000);
+    assert(ag_std_vector_is_mapped(vec->capacity));
+    while (vec->size < 300000) {
+      ag_std_vector_append_n(v, objs, 1000);
+    }
+    assert(vec->arr[299999] == objs[999]);
+
+    // And going back down goes back to the heap.
+    vec->size = 10;
+    ag_std_vector_shrink_to_fit(v);
+    assert(vec->capacity == 10);
+    assert(vec->arr[9] == objs[9]);
+
+    void *iv = ag_std_new(ag_std_iota_view, 5);
+    ag_std_vector_extend_from_range(v, iv);
+    assert(vec->size == 15);
+    assert(ag_std_cmp(vec->arr[14], objs[4]) == 0);
+
+    void *w = ag_std_new(vector);
+    ag_std_vector_extend_from_range(w, v);
+    assert(((struct ag_std_vector *)w)->size == 15);
+
+    // A vector extended with itself doubles, even when its array moves.
+    ag_std_vector_shrink_to_fit(v);
+    ag_std_vector_extend_from_range(v, v);
+    assert(vec->size == 30);
+    assert(vec->arr[15] == vec->arr[0] && vec->arr[29] == vec->arr[14]);
+
+    ag_std_delete(w);
+    ag_std_delete(v);
+  }
 
-    // This key will not be in the map.
-    void *k3 = ag_std_new(integer, 5);
+  {
+    printf("Pool test.. (using asserts)\n");
 
-    // Now check the find.
-    void *find_01 = ag_std_map_at(m, k1);
-    assert(find_01 == v1);
+    size_t live = ag_std_pool_live(sizeof(struct integer));
 
-    void *find_02 = ag_std_map_at(m, k2);
-    assert(find_02 == v2);
+    void *a = ag_std_new(integer, 1);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live + 1);
 
-    void *find_03 = ag_std_map_at(m, k3);
-    assert(find_03 == NULL);
+    ag_std_delete(a);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+    // The block we just gave back is the next one handed out.
+    void *b = ag_std_new(integer, 2);
+    assert(a == b);
+    ag_std_delete(b);
+  }
+
+  {
+    printf("Arena test.. (using asserts)\n");
+
+    size_t live = ag_std_pool_live(sizeof(struct integer));
+
+    ag_std_arena_begin();
+    void *a = ag_std_new(integer, 1);
+    void *b = ag_std_new(integer, 2);
+    assert(ag_std_arena_owns(a) && ag_std_arena_owns(b));
+
+    // Nothing came out of the pool.
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+
+    // A nested scope gets its own objects.
+    ag_std_arena_begin();
+    void *c = ag_std_new(integer, 3);
+    assert(ag_std_cmp(c, b) > 0);
+    ag_std_delete(c);
+    ag_std_arena_end(1);
+
+    // Deleting inside the scope is fine, the memory stays with the arena.
+    ag_std_delete(a);
+
+    // So is deleting on another thread, which has no scope open: the
+    // object says it is the arena's.
+    pthread_t other;
+    assert(pthread_create(&other, NULL, ag_std_bench_delete_on_thread, b) == 0);
+    pthread_join(other, NULL);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
+    ag_std_arena_end(1);
+
+    // Nothing else is the arena's.
+    void *pooled = ag_std_new(integer, 4);
+    struct integer placed;
+    assert(!ag_std_arena_owns(pooled) && !ag_std_arena_owns(ag_std_int(4)));
+    assert(!ag_std_arena_owns(ag_std_new_at(&placed, integer, 4)));
+    ag_std_delete(pooled);
+
+    assert(ag_std_arena_top == NULL);
+    assert(ag_std_pool_live(sizeof(struct integer)) == live);
   }
 
   return 0;
@@ -3,12 +3,102 @@
 #include <stdlib.h>
 #include <string.h>
 
-void *ag_std_new(const struct ag_std_vtable *vt) {
+/* Size-class free lists behind ag_std_new and ag_std_delete. An object's
+ * size is in its vtable, so blocks need no header: ag_std_delete reads
+ * vt->size before giving the block back. Sizes up to AG_STD_POOL_MAX_SIZE
+ * are rounded up to a multiple of AG_STD_POOL_ALIGN, and each class has a
+ * free list, refilled a slab at a time. Anything bigger goes to malloc.
+ */
+
+#define AG_STD_POOL_ALIGN 16
+#define AG_STD_POOL_MAX_SIZE 256
+#define AG_STD_POOL_CLASSES (AG_STD_POOL_MAX_SIZE / AG_STD_POOL_ALIGN)
+#define AG_STD_POOL_SLAB_SIZE (64 * 1024)
+
+struct ag_std_pool_block {
+  struct ag_std_pool_block *next;
+};
+
+struct ag_std_pool {
+  struct ag_std_pool_block *free_list;
+  size_t live;
+};
+
+static struct ag_std_pool ag_std_pools[AG_STD_POOL_CLASSES];
+
+static size_t ag_std_pool_class(size_t size) {
+  return (size + AG_STD_POOL_ALIGN - 1) / AG_STD_POOL_ALIGN - 1;
+}
+
+// Carve a new slab into blocks. Slabs are never given back to libc, their
+// blocks just get recycled.
+static void ag_std_pool_refill(struct ag_std_pool *pool, size_t block_size) {
+  char *slab = malloc(AG_STD_POOL_SLAB_SIZE);
+  if (slab == NULL) {
+    return;
+  }
+
+  // Linked back to front, so the blocks are handed out in address order.
+  for (size_t n = AG_STD_POOL_SLAB_SIZE / block_size; n > 0; --n) {
+    struct ag_std_pool_block *b = (struct ag_std_pool_block *)(slab + (n - 1) * block_size);
+    b->next = pool->free_list;
+    pool->free_list = b;
+  }
+}
+
+void *ag_std_pool_alloc(size_t size) {
+  if (size == 0 || size > AG_STD_POOL_MAX_SIZE) {
+    return malloc(size);
+  }
+
+  size_t cls = ag_std_pool_class(size);
+  struct ag_std_pool *pool = &ag_std_pools[cls];
+  if (pool->free_list == NULL) {
+    ag_std_pool_refill(pool, (cls + 1) * AG_STD_POOL_ALIGN);
+    if (pool->free_list == NULL) {
+      return NULL;
+    }
+  }
 
-  // a vt has a size.
-  void *obj = malloc(vt->size);
+  struct ag_std_pool_block *b = pool->free_list;
+  pool->free_list = b->next;
+  pool->live++;
 
-  // TODO: Check for null.
+  return b;
+}
+
+void ag_std_pool_free(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  if (size == 0 || size > AG_STD_POOL_MAX_SIZE) {
+    free(ptr);
+    return;
+  }
+
+  struct ag_std_pool *pool = &ag_std_pools[ag_std_pool_class(size)];
+  struct ag_std_pool_block *b = ptr;
+  b->next = pool->free_list;
+  pool->free_list = b;
+  pool->live--;
+}
+
+size_t ag_std_pool_live(size_t size) {
+  if (size == 0 || size > AG_STD_POOL_MAX_SIZE) {
+    return 0;
+  }
+
+  return ag_std_pools[ag_std_pool_class(size)].live;
+}
+
+void *ag_std_new(const struct ag_std_vtable *vt) {
+
+  // a vt has a size, and the pool hands out a block of that size class.
+  void *obj = ag_std_pool_alloc(vt->size);
+  if (obj == NULL) {
+    return NULL;
+  }
 
   // Zero out the obj.
   memset(obj, 0, vt->size);
@@ -27,4 +117,7 @@ void ag_std_delete(void *obj) {
 
   struct ag_std_vtable *vt = *(struct ag_std_vtable **)obj;
   vt->dtor(obj);
+
+  // The dtor is done with the object, give the memory back.
+  ag_std_pool_free(obj, vt->size);
 }